@@ -31,6 +31,19 @@ typedef uint64_t crypto_uint64;
 extern int crypto_auth_hmacsha512256(unsigned char *,const unsigned char *,crypto_uint16,const unsigned char *);
 extern int crypto_auth_hmacsha512256_verify(const unsigned char *,const unsigned char *,crypto_uint16,const unsigned char *);
 
+// Change compared to original avrnacl: HMAC with precomputed key state.
+// crypto_auth_hmacsha512256_beforenm() compresses the ipad and opad blocks of
+// a key once; the *_afternm() functions then start from these chaining values,
+// which saves two SHA-512 compressions per message.
+#define crypto_auth_hmacsha512256_STATEBYTES 128
+typedef struct {
+  unsigned char inner[64];
+  unsigned char outer[64];
+} crypto_auth_hmacsha512256_state;
+extern int crypto_auth_hmacsha512256_beforenm(crypto_auth_hmacsha512256_state *,const unsigned char *);
+extern int crypto_auth_hmacsha512256_afternm(unsigned char *,const unsigned char *,crypto_uint16,const crypto_auth_hmacsha512256_state *);
+extern int crypto_auth_hmacsha512256_verify_afternm(const unsigned char *,const unsigned char *,crypto_uint16,const crypto_auth_hmacsha512256_state *);
+
 // Change compared to original avrnacl: removed all unused functions and
 // definitions.
 /*
@@ -170,6 +183,8 @@ extern int crypto_stream_xsalsa20_xor(unsigned char *,const unsigned char *,cryp
 extern int crypto_stream_salsa20(unsigned char *,crypto_uint16,const unsigned char *,const unsigned char *);
 extern int crypto_stream_salsa20_xor(unsigned char *,const unsigned char *,crypto_uint16,const unsigned char *,const unsigned char *);
 
+*/
+
 #define crypto_verify_PRIMITIVE "16"
 #define crypto_verify crypto_verify_16
 #define crypto_verify_BYTES crypto_verify_16_BYTES
@@ -178,6 +193,5 @@ extern int crypto_verify_16(const unsigned char *,const unsigned char *);
 
 #define crypto_verify_32_BYTES 32
 extern int crypto_verify_32(const unsigned char *,const unsigned char *);
-*/
 
 #endif
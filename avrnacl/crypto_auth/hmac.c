@@ -19,10 +19,37 @@ typedef unsigned long long uint64;
 
 extern const unsigned char avrnacl_sha512_iv[64];
 
-int crypto_auth_hmacsha512256(
+/*
+ * Key-dependent part of HMAC-SHA512-256: the SHA-512 chaining values after
+ * compressing the ipad and opad blocks. These only depend on the key, so
+ * callers authenticating many messages under the same key can compute them
+ * once and save two of the (usually) four compressions per message.
+ */
+int crypto_auth_hmacsha512256_beforenm(
+    crypto_auth_hmacsha512256_state *st,
+    const unsigned char *k
+    )
+{
+  unsigned char padded[128];
+  unsigned int i;
+
+  for (i = 0;i < 64;++i) st->inner[i] = avrnacl_sha512_iv[i];
+  for (i = 0;i < 32;++i) padded[i] = k[i] ^ 0x36;
+  for (i = 32;i < 128;++i) padded[i] = 0x36;
+  blocks(st->inner,padded,128);
+
+  for (i = 0;i < 64;++i) st->outer[i] = avrnacl_sha512_iv[i];
+  for (i = 0;i < 32;++i) padded[i] = k[i] ^ 0x5c;
+  for (i = 32;i < 128;++i) padded[i] = 0x5c;
+  blocks(st->outer,padded,128);
+
+  return 0;
+}
+
+int crypto_auth_hmacsha512256_afternm(
     unsigned char *out,
     const unsigned char *in, crypto_uint16 inlen,
-    const unsigned char *k
+    const crypto_auth_hmacsha512256_state *st
     )
 {
   unsigned char h[64];
@@ -30,12 +57,8 @@ int crypto_auth_hmacsha512256(
   unsigned int i;
   unsigned int bytes = 128 + inlen;
 
-  for (i = 0;i < 64;++i) h[i] = avrnacl_sha512_iv[i];
-
-  for (i = 0;i < 32;++i) padded[i] = k[i] ^ 0x36;
-  for (i = 32;i < 128;++i) padded[i] = 0x36;
+  for (i = 0;i < 64;++i) h[i] = st->inner[i];
 
-  blocks(h,padded,128);
   blocks(h,in,inlen);
   in += inlen;
   inlen &= 127;
@@ -58,22 +81,43 @@ int crypto_auth_hmacsha512256(
     blocks(h,padded,256);
   }
 
-  for (i = 0;i < 32;++i) padded[i] = k[i] ^ 0x5c;
-  for (i = 32;i < 128;++i) padded[i] = 0x5c;
-
-  for (i = 0;i < 64;++i) padded[128 + i] = h[i];
-  for (i = 0;i < 64;++i) h[i] = avrnacl_sha512_iv[i];
+  // Outer hash: one block holding the 64 byte inner hash, padding, and the
+  // length of ipad block plus inner hash (192 bytes = 0x600 bits).
+  for (i = 0;i < 64;++i) padded[i] = h[i];
+  for (i = 0;i < 64;++i) h[i] = st->outer[i];
 
-  for (i = 64;i < 128;++i) padded[128 + i] = 0;
-  padded[128 + 64] = 0x80;
-  padded[128 + 126] = 6;
+  for (i = 64;i < 128;++i) padded[i] = 0;
+  padded[64] = 0x80;
+  padded[126] = 6;
 
-  blocks(h,padded,256);
+  blocks(h,padded,128);
   for (i = 0;i < 32;++i) out[i] = h[i];
 
   return 0;
 }
 
+int crypto_auth_hmacsha512256_verify_afternm(
+    const unsigned char *h,
+    const unsigned char *in,crypto_uint16 inlen,
+    const crypto_auth_hmacsha512256_state *st
+    )
+{
+  unsigned char correct[32];
+  crypto_auth_hmacsha512256_afternm(correct,in,inlen,st);
+  return crypto_verify_32(h,correct);
+}
+
+int crypto_auth_hmacsha512256(
+    unsigned char *out,
+    const unsigned char *in, crypto_uint16 inlen,
+    const unsigned char *k
+    )
+{
+  crypto_auth_hmacsha512256_state st;
+  crypto_auth_hmacsha512256_beforenm(&st,k);
+  return crypto_auth_hmacsha512256_afternm(out,in,inlen,&st);
+}
+
 
 int crypto_auth_hmacsha512256_verify(
     const unsigned char *h,
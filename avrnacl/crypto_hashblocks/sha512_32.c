@@ -0,0 +1,251 @@
+/*
+ * File:    crypto_hashblocks/sha512_32.c
+ * Version: 32-bit limb variant of avrnacl_8bitc/crypto_hashblocks/sha512.c
+ * Public Domain
+ */
+
+/*
+ * Same interface as crypto_hashblocks/sha512.c, but every 64-bit word is
+ * kept as two 32-bit halves instead of eight bytes. Additions propagate a
+ * single carry between the halves, and rotations are done with two shifts
+ * per half. This maps directly to the 32-bit registers of a Cortex-M0 (and
+ * any other 32-bit target) instead of going through the byte-serial
+ * bigint_add().
+ *
+ * Exactly one of crypto_hashblocks/sha512.c and crypto_hashblocks/sha512_32.c
+ * must be linked; both define crypto_hashblocks_sha512().
+ */
+
+#include "avrnacl.h"
+
+typedef struct{
+  crypto_uint32 l;
+  crypto_uint32 h;
+} myu64;
+
+static crypto_uint32 load32_bigendian(const unsigned char *x)
+{
+  return ((crypto_uint32)x[0] << 24) | ((crypto_uint32)x[1] << 16) |
+         ((crypto_uint32)x[2] << 8) | (crypto_uint32)x[3];
+}
+
+static void store32_bigendian(unsigned char *r, crypto_uint32 x)
+{
+  r[0] = x >> 24;
+  r[1] = x >> 16;
+  r[2] = x >> 8;
+  r[3] = x;
+}
+
+static void myu64_load_bigendian(myu64 *r, const unsigned char *x)
+{
+  r->h = load32_bigendian(x);
+  r->l = load32_bigendian(x + 4);
+}
+
+static void myu64_store_bigendian(unsigned char *r, const myu64 *x)
+{
+  store32_bigendian(r, x->h);
+  store32_bigendian(r + 4, x->l);
+}
+
+static inline void myu64_add(myu64 *r, const myu64 *x, const myu64 *y)
+{
+  crypto_uint32 l = x->l + y->l;
+  r->h = x->h + y->h + (l < x->l);
+  r->l = l;
+}
+
+// Rotation to the right by n bits, 0 < n < 32.
+#define ROTR_LO(x,n) (((x).l >> (n)) | ((x).h << (32-(n))))
+#define ROTR_HI(x,n) (((x).h >> (n)) | ((x).l << (32-(n))))
+
+// Rotation to the right by n bits, 32 < n < 64: swap halves, then rotate by
+// n-32.
+#define ROTR32_LO(x,n) (((x).h >> ((n)-32)) | ((x).l << (64-(n))))
+#define ROTR32_HI(x,n) (((x).l >> ((n)-32)) | ((x).h << (64-(n))))
+
+static inline void Sigma0(myu64 *r, const myu64 *x)
+{
+  // ROTR 28 ^ ROTR 34 ^ ROTR 39
+  r->l = ROTR_LO(*x,28) ^ ROTR32_LO(*x,34) ^ ROTR32_LO(*x,39);
+  r->h = ROTR_HI(*x,28) ^ ROTR32_HI(*x,34) ^ ROTR32_HI(*x,39);
+}
+
+static inline void Sigma1(myu64 *r, const myu64 *x)
+{
+  // ROTR 14 ^ ROTR 18 ^ ROTR 41
+  r->l = ROTR_LO(*x,14) ^ ROTR_LO(*x,18) ^ ROTR32_LO(*x,41);
+  r->h = ROTR_HI(*x,14) ^ ROTR_HI(*x,18) ^ ROTR32_HI(*x,41);
+}
+
+static inline void sigma0(myu64 *r, const myu64 *x)
+{
+  // ROTR 1 ^ ROTR 8 ^ SHR 7
+  r->l = ROTR_LO(*x,1) ^ ROTR_LO(*x,8) ^ ((x->l >> 7) | (x->h << 25));
+  r->h = ROTR_HI(*x,1) ^ ROTR_HI(*x,8) ^ (x->h >> 7);
+}
+
+static inline void sigma1(myu64 *r, const myu64 *x)
+{
+  // ROTR 19 ^ ROTR 61 ^ SHR 6
+  r->l = ROTR_LO(*x,19) ^ ROTR32_LO(*x,61) ^ ((x->l >> 6) | (x->h << 26));
+  r->h = ROTR_HI(*x,19) ^ ROTR32_HI(*x,61) ^ (x->h >> 6);
+}
+
+static const myu64 roundconstants[80] = {
+  {0xd728ae22, 0x428a2f98},
+  {0x23ef65cd, 0x71374491},
+  {0xec4d3b2f, 0xb5c0fbcf},
+  {0x8189dbbc, 0xe9b5dba5},
+  {0xf348b538, 0x3956c25b},
+  {0xb605d019, 0x59f111f1},
+  {0xaf194f9b, 0x923f82a4},
+  {0xda6d8118, 0xab1c5ed5},
+  {0xa3030242, 0xd807aa98},
+  {0x45706fbe, 0x12835b01},
+  {0x4ee4b28c, 0x243185be},
+  {0xd5ffb4e2, 0x550c7dc3},
+  {0xf27b896f, 0x72be5d74},
+  {0x3b1696b1, 0x80deb1fe},
+  {0x25c71235, 0x9bdc06a7},
+  {0xcf692694, 0xc19bf174},
+  {0x9ef14ad2, 0xe49b69c1},
+  {0x384f25e3, 0xefbe4786},
+  {0x8b8cd5b5, 0x0fc19dc6},
+  {0x77ac9c65, 0x240ca1cc},
+  {0x592b0275, 0x2de92c6f},
+  {0x6ea6e483, 0x4a7484aa},
+  {0xbd41fbd4, 0x5cb0a9dc},
+  {0x831153b5, 0x76f988da},
+  {0xee66dfab, 0x983e5152},
+  {0x2db43210, 0xa831c66d},
+  {0x98fb213f, 0xb00327c8},
+  {0xbeef0ee4, 0xbf597fc7},
+  {0x3da88fc2, 0xc6e00bf3},
+  {0x930aa725, 0xd5a79147},
+  {0xe003826f, 0x06ca6351},
+  {0x0a0e6e70, 0x14292967},
+  {0x46d22ffc, 0x27b70a85},
+  {0x5c26c926, 0x2e1b2138},
+  {0x5ac42aed, 0x4d2c6dfc},
+  {0x9d95b3df, 0x53380d13},
+  {0x8baf63de, 0x650a7354},
+  {0x3c77b2a8, 0x766a0abb},
+  {0x47edaee6, 0x81c2c92e},
+  {0x1482353b, 0x92722c85},
+  {0x4cf10364, 0xa2bfe8a1},
+  {0xbc423001, 0xa81a664b},
+  {0xd0f89791, 0xc24b8b70},
+  {0x0654be30, 0xc76c51a3},
+  {0xd6ef5218, 0xd192e819},
+  {0x5565a910, 0xd6990624},
+  {0x5771202a, 0xf40e3585},
+  {0x32bbd1b8, 0x106aa070},
+  {0xb8d2d0c8, 0x19a4c116},
+  {0x5141ab53, 0x1e376c08},
+  {0xdf8eeb99, 0x2748774c},
+  {0xe19b48a8, 0x34b0bcb5},
+  {0xc5c95a63, 0x391c0cb3},
+  {0xe3418acb, 0x4ed8aa4a},
+  {0x7763e373, 0x5b9cca4f},
+  {0xd6b2b8a3, 0x682e6ff3},
+  {0x5defb2fc, 0x748f82ee},
+  {0x43172f60, 0x78a5636f},
+  {0xa1f0ab72, 0x84c87814},
+  {0x1a6439ec, 0x8cc70208},
+  {0x23631e28, 0x90befffa},
+  {0xde82bde9, 0xa4506ceb},
+  {0xb2c67915, 0xbef9a3f7},
+  {0xe372532b, 0xc67178f2},
+  {0xea26619c, 0xca273ece},
+  {0x21c0c207, 0xd186b8c7},
+  {0xcde0eb1e, 0xeada7dd6},
+  {0xee6ed178, 0xf57d4f7f},
+  {0x72176fba, 0x06f067aa},
+  {0xa2c898a6, 0x0a637dc5},
+  {0xbef90dae, 0x113f9804},
+  {0x131c471b, 0x1b710b35},
+  {0x23047d84, 0x28db77f5},
+  {0x40c72493, 0x32caab7b},
+  {0x15c9bebc, 0x3c9ebe0a},
+  {0x9c100d4c, 0x431d67c4},
+  {0xcb3e42b6, 0x4cc5d4be},
+  {0xfc657e2a, 0x597f299c},
+  {0x3ad6faec, 0x5fcb6fab},
+  {0x4a475817, 0x6c44198c}
+};
+
+int crypto_hashblocks_sha512(
+    unsigned char *statebytes,
+    const unsigned char *in,crypto_uint16 inlen
+    )
+{
+  myu64 state[8];
+  // Working variables a..h are kept in v[0..7].
+  myu64 v[8];
+  myu64 w[16];
+  myu64 t1, t2, t;
+  unsigned char i;
+
+  for(i=0;i<8;i++)
+    myu64_load_bigendian(state+i, statebytes + 8*i);
+
+  while (inlen >= 128)
+  {
+    for(i=0;i<8;i++)
+      v[i] = state[i];
+
+    for(i=0;i<80;i++)
+    {
+      myu64 *wi = w + (i & 15);
+
+      if (i < 16)
+        myu64_load_bigendian(wi, in + 8*i);
+      else
+      {
+        // W[i] = sigma1(W[i-2]) + W[i-7] + sigma0(W[i-15]) + W[i-16]
+        sigma1(&t, w + ((i-2) & 15));
+        myu64_add(wi, wi, &t);
+        myu64_add(wi, wi, w + ((i-7) & 15));
+        sigma0(&t, w + ((i-15) & 15));
+        myu64_add(wi, wi, &t);
+      }
+
+      // t1 = h + Sigma1(e) + Ch(e,f,g) + K[i] + W[i]
+      Sigma1(&t1, v+4);
+      myu64_add(&t1, &t1, v+7);
+      t.l = (v[4].l & v[5].l) ^ (~v[4].l & v[6].l);
+      t.h = (v[4].h & v[5].h) ^ (~v[4].h & v[6].h);
+      myu64_add(&t1, &t1, &t);
+      myu64_add(&t1, &t1, roundconstants+i);
+      myu64_add(&t1, &t1, wi);
+
+      // t2 = Sigma0(a) + Maj(a,b,c)
+      Sigma0(&t2, v+0);
+      t.l = (v[0].l & v[1].l) ^ (v[0].l & v[2].l) ^ (v[1].l & v[2].l);
+      t.h = (v[0].h & v[1].h) ^ (v[0].h & v[2].h) ^ (v[1].h & v[2].h);
+      myu64_add(&t2, &t2, &t);
+
+      v[7] = v[6];
+      v[6] = v[5];
+      v[5] = v[4];
+      myu64_add(v+4, v+3, &t1);
+      v[3] = v[2];
+      v[2] = v[1];
+      v[1] = v[0];
+      myu64_add(v+0, &t1, &t2);
+    }
+
+    for(i=0;i<8;i++)
+      myu64_add(state+i, state+i, v+i);
+
+    in += 128;
+    inlen -= 128;
+  }
+
+  for(i=0;i<8;i++)
+    myu64_store_bigendian(statebytes + 8*i, state+i);
+
+  return inlen;
+}
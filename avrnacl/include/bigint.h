@@ -9,9 +9,9 @@
 #define bigint_mul32 avrnacl_bigint_mul32
 #define bigint_cmov avrnacl_bigint_cmov
 
-unsigned char bigint_add(unsigned char r[32], const unsigned char a[32], const unsigned char b[32], unsigned int len);
+unsigned char bigint_add(unsigned char *r, const unsigned char *a, const unsigned char *b, unsigned int len);
 
-unsigned char bigint_sub(unsigned char r[32], const unsigned char a[32], const unsigned char b[32], unsigned int len);
+unsigned char bigint_sub(unsigned char *r, const unsigned char *a, const unsigned char *b, unsigned int len);
 
 void bigint_mul(unsigned char *r, const unsigned char *a, const unsigned char *b, unsigned int len);
 
@@ -0,0 +1,17 @@
+#ifndef CPUCYCLES_H
+#define CPUCYCLES_H
+
+/*
+ * Cycle counter for the benchmarks.
+ *
+ * On the host (cpucycles_host.c) this is the time stamp counter on x86 and
+ * a nanosecond clock elsewhere. On the Cortex-M0 (cpucycles_m0.c) SysTick
+ * is run from the core clock, so the value is in core cycles; under QEMU
+ * with -icount it counts executed instructions.
+ */
+unsigned long long cpucycles(void);
+
+/* Name of the unit returned by cpucycles(). */
+extern const char cpucycles_unit[];
+
+#endif
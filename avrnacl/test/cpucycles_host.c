@@ -0,0 +1,27 @@
+#include "cpucycles.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <x86intrin.h>
+
+const char cpucycles_unit[] = "cycles";
+
+unsigned long long cpucycles(void)
+{
+  return __rdtsc();
+}
+
+#else
+
+#include <time.h>
+
+const char cpucycles_unit[] = "ns";
+
+unsigned long long cpucycles(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * SysTick based cycle counter for Cortex-M0 targets without a DWT cycle
+ * counter (nRF51, STM32F0). SysTick is a 24 bit down counter; wrap-arounds
+ * are counted in the SysTick interrupt.
+ */
+
+#include "cpucycles.h"
+
+#define SYST_CSR (*(volatile unsigned int *) 0xe000e010)
+#define SYST_RVR (*(volatile unsigned int *) 0xe000e014)
+#define SYST_CVR (*(volatile unsigned int *) 0xe000e018)
+
+#define SYST_RELOAD 0x00ffffff
+
+const char cpucycles_unit[] = "cycles";
+
+static volatile unsigned long long wraps = 0;
+static int running = 0;
+
+void SysTick_Handler(void)
+{
+  wraps += SYST_RELOAD + 1ULL;
+}
+
+unsigned long long cpucycles(void)
+{
+  unsigned long long w;
+  unsigned int v;
+
+  if (!running) {
+    SYST_RVR = SYST_RELOAD;
+    SYST_CVR = 0;
+    // Enable counter and interrupt, clock source = core clock.
+    SYST_CSR = 0x7;
+    running = 1;
+  }
+
+  // Re-read if the counter wrapped between reading wraps and the counter.
+  do {
+    w = wraps;
+    v = SYST_CVR;
+  } while (w != wraps);
+
+  return w + (SYST_RELOAD - v);
+}
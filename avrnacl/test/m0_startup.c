@@ -0,0 +1,60 @@
+/*
+ * Minimal startup code for running the avrnacl test and benchmark programs
+ * bare-metal on an nRF51 Cortex-M0 (e.g. QEMU's "microbit" machine).
+ * Output goes through ARM semihosting (newlib rdimon), so QEMU has to be
+ * started with "-semihosting".
+ */
+
+extern unsigned long __etext;
+extern unsigned long __data_start__;
+extern unsigned long __data_end__;
+extern unsigned long __bss_start__;
+extern unsigned long __bss_end__;
+extern unsigned long __StackTop;
+
+extern int main(void);
+extern void initialise_monitor_handles(void);
+extern void SysTick_Handler(void);
+
+void Reset_Handler(void);
+
+static void Default_Handler(void)
+{
+  while (1);
+}
+
+static void exit_semihosting(int status)
+{
+  // SYS_EXIT with ADP_Stopped_ApplicationExit (0x20026).
+  register int r0 __asm__("r0") = 0x18;
+  register int r1 __asm__("r1") = (status == 0) ? 0x20026 : 0x20024;
+  __asm__ volatile ("bkpt 0xab" : : "r"(r0), "r"(r1));
+}
+
+__attribute__((section(".vectors"), used))
+static void (* const vectors[16])(void) = {
+  (void (*)(void)) &__StackTop,
+  Reset_Handler,
+  Default_Handler, // NMI
+  Default_Handler, // HardFault
+  0, 0, 0, 0, 0, 0, 0,
+  Default_Handler, // SVC
+  0, 0,
+  Default_Handler, // PendSV
+  SysTick_Handler
+};
+
+void Reset_Handler(void)
+{
+  unsigned long *src = &__etext;
+  unsigned long *dst;
+
+  for (dst = &__data_start__; dst < &__data_end__; )
+    *dst++ = *src++;
+  for (dst = &__bss_start__; dst < &__bss_end__; )
+    *dst++ = 0;
+
+  initialise_monitor_handles();
+  exit_semihosting(main());
+  while (1);
+}
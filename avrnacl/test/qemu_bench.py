@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+#
+# Runs Cortex-M0 benchmark programs under QEMU and compares their results
+# with a baseline. Public domain.
+#
+#     qemu_bench.py [--qemu cmd] [--timeout s] [--tolerance percent]
+#                   [--baseline file] [--results file] [--update]
+#                   [--allow-new] elf ...
+#
+# Every program is run with the QEMU command (default: the "microbit"
+# machine with semihosting and -icount, so the numbers are deterministic).
+# Result lines of the programs have the form
+#
+#     <name>: [<bytes>] <value> <unit> [(median of <n>)]
+#
+# with unit "cycles" (cpucycles_m0.c) or "stack bytes" (stack
+# high-water mark). All results are written to the results file as tab
+# separated lines "program, name, unit, value", sorted, which is also the
+# format of the baseline. A result more than the tolerance above its
+# baseline value is a regression; a result missing from the output, a
+# program exiting with an error or printing "ERROR", or a timeout fails
+# as well. So does a result without a baseline value (reported as new),
+# unless --allow-new is given (for runs that only collect numbers). If 
+# the baseline has no value at all for one of the programs, nothing is 
+# run: the baseline has not been recorded yet. With --update, the 
+# baseline is replaced by the results.
+
+import argparse
+import os
+import re
+import shlex
+import subprocess
+import sys
+
+QEMU = ('qemu-system-arm -M microbit -nographic -semihosting '
+        '-icount shift=0')
+
+RESULT_RE = re.compile(r'^(?P<name>[^:]+): (?:\[\d+\] )?(?P<value>\d+) '
+                       r'(?P<unit>cycles|stack bytes)\b')
+
+
+def read_table(path):
+    table = {}
+    if not os.path.exists(path):
+        return table
+    with open(path) as f:
+        for line in f:
+            if line.startswith('#') or not line.strip():
+                continue
+            program, name, unit, value = line.rstrip('\n').split('\t')
+            table[(program, name, unit)] = int(value)
+    return table
+
+
+def read_comments(path):
+    if not os.path.exists(path):
+        return ''
+    with open(path) as f:
+        return ''.join(line for line in f if line.startswith('#'))
+
+
+def write_table(path, table, header):
+    with open(path, 'w') as f:
+        f.write(header)
+        for key in sorted(table):
+            f.write('%s\t%s\t%s\t%d\n' % (key + (table[key],)))
+
+
+def run(qemu, elf, timeout):
+    """Returns the results of one program and a list of errors."""
+    program = os.path.basename(elf)
+    results = {}
+    errors = []
+    try:
+        p = subprocess.run(shlex.split(qemu) + ['-kernel', elf],
+                           stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                           universal_newlines=True, timeout=timeout)
+    except subprocess.TimeoutExpired:
+        return results, ['%s: timeout after %d s' % (program, timeout)]
+    for line in p.stdout.splitlines():
+        line = line.strip()
+        m = RESULT_RE.match(line)
+        if m:
+            results[(program, m.group('name'), m.group('unit'))] = \
+                int(m.group('value'))
+        elif line.startswith('ERROR'):
+            errors.append('%s: %s' % (program, line))
+    if p.returncode != 0:
+        errors.append('%s: exit status %d' % (program, p.returncode))
+    if not results:
+        errors.append('%s: no results' % program)
+    return results, errors
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Run Cortex-M0 benchmarks under QEMU.')
+    parser.add_argument('--qemu', default=QEMU)
+    parser.add_argument('--timeout', type=int, default=600,
+                        help='timeout per program [s]')
+    parser.add_argument('--tolerance', type=float, default=0.0,
+                        help='allowed increase over the baseline [%%]')
+    parser.add_argument('--baseline', default='m0_baseline.tsv')
+    parser.add_argument('--results', default='m0_results.tsv')
+    parser.add_argument('--update', action='store_true',
+                        help='replace the baseline by the results')
+    parser.add_argument('--allow-new', action='store_true',
+                        help='do not fail on results without a baseline')
+    parser.add_argument('elf', nargs='+')
+    args = parser.parse_args()
+
+    baseline = read_table(args.baseline)
+    programs = {os.path.basename(elf) for elf in args.elf}
+    unrecorded = programs - {key[0] for key in baseline}
+    if unrecorded and not args.update and not args.allow_new:
+        print('FAIL no baseline recorded in %s for %s; record it with '
+              '"make bench-m0-baseline" (arm-none-eabi-gcc and QEMU)'
+              % (args.baseline, ', '.join(sorted(unrecorded))))
+        return 1
+
+    results = {}
+    errors = []
+    for elf in args.elf:
+        r, e = run(args.qemu, elf, args.timeout)
+        results.update(r)
+        errors.extend(e)
+
+    header = '# program\tname\tunit\tvalue (%s)\n' % args.qemu
+    write_table(args.results, results, header)
+
+    regressions = 0
+    new = 0
+    for key in sorted(set(results) | set(baseline)):
+        if key[0] not in programs:
+            continue
+        label = '%s %s (%s)' % key
+        if key not in results:
+            errors.append('%s: missing' % label)
+            continue
+        value = results[key]
+        if key not in baseline:
+            print('new         %-66s %10d' % (label, value))
+            new += 1
+            continue
+        base = baseline[key]
+        change = 100.0*(value - base)/base if base else 0.0
+        if value > base*(1 + args.tolerance/100.0):
+            status = 'REGRESSION'
+            regressions += 1
+        elif value < base:
+            status = 'improved'
+        else:
+            status = 'ok'
+        print('%-11s %-66s %10d %10d %+7.2f%%' % (status, label, value, base,
+                                                  change))
+
+    if args.update:
+        baseline = {k: v for k, v in baseline.items() if k[0] not in programs}
+        baseline.update(results)
+        write_table(args.baseline, baseline,
+                    read_comments(args.baseline) or header)
+        print('baseline %s updated' % args.baseline)
+
+    for error in errors:
+        print('FAIL %s' % error)
+    if regressions:
+        print('FAIL %d regression(s) against %s' % (regressions,
+                                                    args.baseline))
+    if new and not args.allow_new and not args.update:
+        print('FAIL %d result(s) without a baseline value in %s (record it '
+              'with --update)' % (new, args.baseline))
+    return 1 if errors or ((regressions or (new and not args.allow_new))
+                           and not args.update) else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,84 @@
+/*
+ * Cycle benchmark of crypto_verify_32 and the bigint_* functions of
+ * shared/bigint.c on 32 byte operands (the sizes used by the crypto code).
+ * Public domain.
+ */
+
+#include <stdio.h>
+#include "avrnacl.h"
+#include "bigint.h"
+#include "cpucycles.h"
+
+#ifndef NRUNS
+#define NRUNS 16
+#endif
+
+static unsigned char a[32];
+static unsigned char b[32];
+static unsigned char r[64];
+static volatile int result;
+
+static void report(const char *what, unsigned long long t[NRUNS+1])
+{
+  unsigned long long d[NRUNS];
+  unsigned int i, j;
+
+  for (i = 0; i < NRUNS; i++)
+    d[i] = t[i+1] - t[i];
+  // Insertion sort keeps the M0 build free of qsort().
+  for (i = 1; i < NRUNS; i++)
+    for (j = i; j > 0 && d[j-1] > d[j]; j--) {
+      unsigned long long x = d[j];
+      d[j] = d[j-1];
+      d[j-1] = x;
+    }
+  printf("%s: %llu %s (median of %u)\n", what, d[NRUNS/2], cpucycles_unit,
+         NRUNS);
+}
+
+int main(void)
+{
+  unsigned long long t[NRUNS+1];
+  unsigned int i;
+
+  for (i = 0; i < sizeof(a); i++) a[i] = 7*i + 1;
+  for (i = 0; i < sizeof(b); i++) b[i] = 3*i + 5;
+
+  for (i = 0; i <= NRUNS; i++) {
+    t[i] = cpucycles();
+    result = crypto_verify_32(a, b);
+  }
+  report("crypto_verify_32", t);
+
+  for (i = 0; i <= NRUNS; i++) {
+    t[i] = cpucycles();
+    result = bigint_add(r, a, b, 32);
+  }
+  report("bigint_add (32 bytes)", t);
+
+  for (i = 0; i <= NRUNS; i++) {
+    t[i] = cpucycles();
+    result = bigint_sub(r, a, b, 32);
+  }
+  report("bigint_sub (32 bytes)", t);
+
+  for (i = 0; i <= NRUNS; i++) {
+    t[i] = cpucycles();
+    bigint_mul(r, a, b, 32);
+  }
+  report("bigint_mul (32 bytes)", t);
+
+  for (i = 0; i <= NRUNS; i++) {
+    t[i] = cpucycles();
+    bigint_mul32(r, a, b);
+  }
+  report("bigint_mul32", t);
+
+  for (i = 0; i <= NRUNS; i++) {
+    t[i] = cpucycles();
+    bigint_cmov(r, a, i & 1, 32);
+  }
+  report("bigint_cmov (32 bytes)", t);
+
+  return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Cycle benchmark of crypto_hashblocks_sha512, crypto_hash_sha512, and
+ * crypto_auth_hmacsha512256 (with and without precomputed key state) for
+ * whichever crypto_hashblocks_sha512 backend is linked. Build once per
+ * backend (see avrnacl/Makefile) to compare them.
+ * Public domain.
+ */
+
+#include <stdio.h>
+#include "avrnacl.h"
+#include "cpucycles.h"
+
+#ifndef NRUNS
+#define NRUNS 16
+#endif
+
+#ifndef BACKEND
+#define BACKEND "unknown"
+#endif
+
+static unsigned char state[64];
+static unsigned char block[128];
+static unsigned char msg[32];
+static unsigned char out[64];
+static unsigned char key[32];
+static crypto_auth_hmacsha512256_state st;
+
+static int cmp(const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *) a;
+  unsigned long long y = *(const unsigned long long *) b;
+  return (x > y) - (x < y);
+}
+
+static void report(const char *what, unsigned long long t[NRUNS+1])
+{
+  unsigned long long d[NRUNS];
+  unsigned int i, j;
+
+  for (i = 0; i < NRUNS; i++)
+    d[i] = t[i+1] - t[i];
+  // Insertion sort keeps the M0 build free of qsort().
+  for (i = 1; i < NRUNS; i++)
+    for (j = i; j > 0 && cmp(d+j-1, d+j) > 0; j--) {
+      unsigned long long x = d[j];
+      d[j] = d[j-1];
+      d[j-1] = x;
+    }
+  printf("%s %s: %llu %s (median of %u)\n", BACKEND, what, d[NRUNS/2],
+         cpucycles_unit, NRUNS);
+}
+
+int main(void)
+{
+  unsigned long long t[NRUNS+1];
+  unsigned int i;
+
+  for (i = 0; i < sizeof(block); i++) block[i] = i;
+  for (i = 0; i < sizeof(msg); i++) msg[i] = 3*i;
+  for (i = 0; i < sizeof(key); i++) key[i] = 5*i;
+
+  for (i = 0; i <= NRUNS; i++) {
+    t[i] = cpucycles();
+    crypto_hashblocks_sha512(state, block, sizeof(block));
+  }
+  report("crypto_hashblocks_sha512 (1 block)", t);
+
+  for (i = 0; i <= NRUNS; i++) {
+    t[i] = cpucycles();
+    crypto_hash_sha512(out, msg, sizeof(msg));
+  }
+  report("crypto_hash_sha512 (32 bytes)", t);
+
+  for (i = 0; i <= NRUNS; i++) {
+    t[i] = cpucycles();
+    crypto_auth_hmacsha512256(out, msg, 16, key);
+  }
+  report("crypto_auth_hmacsha512256 (16 bytes)", t);
+
+  crypto_auth_hmacsha512256_beforenm(&st, key);
+  for (i = 0; i <= NRUNS; i++) {
+    t[i] = cpucycles();
+    crypto_auth_hmacsha512256_afternm(out, msg, 16, &st);
+  }
+  report("crypto_auth_hmacsha512256_afternm (16 bytes)", t);
+
+  return 0;
+}
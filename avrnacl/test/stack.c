@@ -0,0 +1,100 @@
+/*
+ * Stack high-water marks of the avrnacl primitives used by the firmware:
+ * the stack below main() is filled with a canary, the primitive is run,
+ * and the bytes overwritten are counted (as in curve25519-cortexm0's
+ * test/stack.c). Meant for the Cortex-M0; on the host the numbers depend
+ * on the compiler and ABI.
+ * Public domain.
+ */
+
+#include <stdio.h>
+#include "avrnacl.h"
+#include "bigint.h"
+
+#define MAXSTACK 4000
+
+static unsigned char canary = 42;
+static volatile unsigned char *p;
+// Address of the beginning of the stack, passed as an integer since the
+// canary is written outside of any object.
+static volatile unsigned long stack_top;
+
+static unsigned char msg[128];
+static unsigned char out[64];
+static unsigned char key[32];
+static unsigned char state[64];
+static unsigned char r[64];
+static crypto_auth_hmacsha512256_state st;
+
+#define TOP ((volatile unsigned char *) stack_top)
+#define WRITE_CANARY {p=TOP;while(p>= (TOP-MAXSTACK)) *(p--) = canary;}
+
+static unsigned int stack_count(void)
+{
+  volatile unsigned char *q = TOP-MAXSTACK;
+  unsigned int c = 0;
+  while (*q == canary && q < TOP) {
+    q++;
+    c++;
+  }
+  return MAXSTACK - c;
+}
+
+static void report(const char *primitive, unsigned int bytes,
+                   unsigned int stack)
+{
+  printf("%s: [%u] %u stack bytes\n", primitive, bytes, stack);
+}
+
+int main(void)
+{
+  volatile unsigned char a; /* Mark the beginning of the stack */
+
+  stack_top = (unsigned long) &a;
+
+  WRITE_CANARY;
+  crypto_hashblocks_sha512(state, msg, sizeof(msg));
+  report("crypto_hashblocks_sha512", sizeof(msg), stack_count());
+
+  WRITE_CANARY;
+  crypto_hash_sha512(out, msg, 32);
+  report("crypto_hash_sha512", 32, stack_count());
+
+  WRITE_CANARY;
+  crypto_auth_hmacsha512256(out, msg, 16, key);
+  report("crypto_auth_hmacsha512256", 16, stack_count());
+
+  WRITE_CANARY;
+  crypto_auth_hmacsha512256_beforenm(&st, key);
+  report("crypto_auth_hmacsha512256_beforenm", 32, stack_count());
+
+  WRITE_CANARY;
+  crypto_auth_hmacsha512256_afternm(out, msg, 16, &st);
+  report("crypto_auth_hmacsha512256_afternm", 16, stack_count());
+
+  WRITE_CANARY;
+  crypto_verify_32(out, key);
+  report("crypto_verify_32", 32, stack_count());
+
+  WRITE_CANARY;
+  bigint_add(r, out, key, 32);
+  report("bigint_add", 32, stack_count());
+
+  WRITE_CANARY;
+  bigint_sub(r, out, key, 32);
+  report("bigint_sub", 32, stack_count());
+
+  WRITE_CANARY;
+  bigint_mul(r, out, key, 32);
+  report("bigint_mul", 32, stack_count());
+
+  WRITE_CANARY;
+  bigint_mul32(r, out, key);
+  report("bigint_mul32", 32, stack_count());
+
+  WRITE_CANARY;
+  bigint_cmov(r, out, 1, 32);
+  report("bigint_cmov", 32, stack_count());
+
+  return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Known-answer test of crypto_auth_hmacsha512256 and of the precomputed-key
+ * variant (crypto_auth_hmacsha512256_beforenm/afternm).
+ *
+ * Vectors 0-3 are test cases 1-4 of RFC 4231 (HMAC-SHA-512), truncated to
+ * 256 bits. Their keys are shorter than 32 bytes; HMAC pads keys with zeros,
+ * so the zero-padded 32 byte key gives the same result. Vector 4 is a
+ * 120 byte message, which needs two blocks of inner padding.
+ * Public domain.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "avrnacl.h"
+
+struct testvector {
+  unsigned char key[32];
+  unsigned int keylen;
+  unsigned char msg[120];
+  unsigned int msglen;
+  const char *tag;
+};
+
+static struct testvector vectors[5];
+
+static void setup(void)
+{
+  unsigned int i;
+
+  vectors[0].keylen = 20;
+  memset(vectors[0].key, 0x0b, 20);
+  vectors[0].msglen = 8;
+  memcpy(vectors[0].msg, "Hi There", 8);
+  vectors[0].tag =
+    "87aa7cdea5ef619d4ff0b4241a1d6cb02379f4e2ce4ec2787ad0b30545e17cde";
+
+  vectors[1].keylen = 4;
+  memcpy(vectors[1].key, "Jefe", 4);
+  vectors[1].msglen = 28;
+  memcpy(vectors[1].msg, "what do ya want for nothing?", 28);
+  vectors[1].tag =
+    "164b7a7bfcf819e2e395fbe73b56e0a387bd64222e831fd610270cd7ea250554";
+
+  vectors[2].keylen = 20;
+  memset(vectors[2].key, 0xaa, 20);
+  vectors[2].msglen = 50;
+  memset(vectors[2].msg, 0xdd, 50);
+  vectors[2].tag =
+    "fa73b0089d56a284efb0f0756c890be9b1b5dbdd8ee81a3655f83e33b2279d39";
+
+  vectors[3].keylen = 25;
+  for (i = 0; i < 25; i++) vectors[3].key[i] = i + 1;
+  vectors[3].msglen = 50;
+  memset(vectors[3].msg, 0xcd, 50);
+  vectors[3].tag =
+    "b0ba465637458c6990e5a8c5f61d4af7e576d97ff94b872de76f8050361ee3db";
+
+  vectors[4].keylen = 32;
+  for (i = 0; i < 32; i++) vectors[4].key[i] = i;
+  vectors[4].msglen = 120;
+  for (i = 0; i < 120; i++) vectors[4].msg[i] = 7*i;
+  vectors[4].tag =
+    "1b8e3e0f23e9fa5eee00917a2eb54bd230dba61d0e480905dbfddcd885c52e04";
+}
+
+static int check(const char *name, unsigned int no, const unsigned char *tag,
+                 const char *expected)
+{
+  char str[2*crypto_auth_hmacsha512256_BYTES+1];
+  unsigned int i;
+
+  for (i = 0; i < crypto_auth_hmacsha512256_BYTES; i++)
+    sprintf(str + 2*i, "%02x", tag[i]);
+  if (strcmp(str, expected) != 0) {
+    printf("FAIL %s vector %u\n  got      %s\n  expected %s\n", name, no,
+           str, expected);
+    return 1;
+  }
+  printf("ok   %s vector %u\n", name, no);
+  return 0;
+}
+
+int main(void)
+{
+  unsigned char tag[crypto_auth_hmacsha512256_BYTES];
+  crypto_auth_hmacsha512256_state st;
+  int failed = 0;
+  unsigned int i;
+
+  setup();
+  for (i = 0; i < sizeof(vectors)/sizeof(vectors[0]); i++) {
+    struct testvector *v = &vectors[i];
+
+    crypto_auth_hmacsha512256(tag, v->msg, v->msglen, v->key);
+    failed |= check("hmacsha512256", i, tag, v->tag);
+
+    crypto_auth_hmacsha512256_beforenm(&st, v->key);
+    crypto_auth_hmacsha512256_afternm(tag, v->msg, v->msglen, &st);
+    failed |= check("hmacsha512256_afternm", i, tag, v->tag);
+
+    if (crypto_auth_hmacsha512256_verify_afternm(tag, v->msg, v->msglen,
+                                                 &st) != 0) {
+      printf("FAIL hmacsha512256_verify_afternm vector %u\n", i);
+      failed = 1;
+    }
+    tag[31] ^= 1;
+    if (crypto_auth_hmacsha512256_verify_afternm(tag, v->msg, v->msglen,
+                                                 &st) == 0) {
+      printf("FAIL hmacsha512256_verify_afternm accepts bad tag %u\n", i);
+      failed = 1;
+    }
+  }
+
+  return failed;
+}
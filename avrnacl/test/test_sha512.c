@@ -0,0 +1,106 @@
+/*
+ * Known-answer test of crypto_hash_sha512 (and thereby of whichever
+ * crypto_hashblocks_sha512 backend is linked) against the SHA-512 examples
+ * of NIST FIPS 180-2 / the NIST CSRC example values.
+ * Public domain.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "avrnacl.h"
+
+extern const unsigned char avrnacl_sha512_iv[64];
+
+struct testvector {
+  const char *msg;
+  const char *digest;
+};
+
+static const struct testvector vectors[] = {
+  {"abc",
+   "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+   "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f"},
+  {"",
+   "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
+   "47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e"},
+  {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+   "204a8fc6dda82f0a0ced7beb8e08a41657c16ef468b228a8279be331a703c335"
+   "96fd15c13b1b07f9aa1d3bea57789ca031ad85c7a71dd70354ec631238ca3445"},
+  {"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+   "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+   "8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018"
+   "501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909"}
+};
+
+// One million times 'a'.
+static const char *digest_million_a =
+  "e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973eb"
+  "de0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b";
+
+static void hex(char *str, const unsigned char *bin, unsigned int len)
+{
+  for (unsigned int i = 0; i < len; i++)
+    sprintf(str + 2*i, "%02x", bin[i]);
+}
+
+static int check(const char *name, const unsigned char *digest,
+        const char *expected)
+{
+  char str[2*crypto_hash_sha512_BYTES+1];
+
+  hex(str, digest, crypto_hash_sha512_BYTES);
+  if (strcmp(str, expected) != 0) {
+    printf("FAIL %s\n  got      %s\n  expected %s\n", name, str, 
+        expected);
+    return 1;
+  }
+  printf("ok   %s\n", name);
+  return 0;
+}
+
+/**
+ * crypto_hash_sha512() takes at most 65535 bytes, so the one-million-'a'
+ * message is fed to crypto_hashblocks_sha512() block by block and padded
+ * here.
+ */
+static void hash_million_a(unsigned char digest[crypto_hash_sha512_BYTES])
+{
+  const unsigned long long len = 1000000;
+  unsigned char block[128];
+  unsigned char h[64];
+  unsigned long long bits = len*8;
+  unsigned int i;
+
+  memcpy(h, avrnacl_sha512_iv, sizeof(h));
+  memset(block, 'a', sizeof(block));
+  for (i = 0; i < len/128; i++)
+    crypto_hashblocks_sha512(h, block, 128);
+
+  // 1000000 % 128 = 64 remaining bytes, 0x80, zeros, 128 bit length.
+  memset(block + len%128, 0, sizeof(block) - len%128);
+  block[len%128] = 0x80;
+  for (i = 0; i < 8; i++)
+    block[127-i] = bits >> (8*i);
+  crypto_hashblocks_sha512(h, block, 128);
+
+  memcpy(digest, h, sizeof(h));
+}
+
+int main(void)
+{
+  unsigned char digest[crypto_hash_sha512_BYTES];
+  int failed = 0;
+
+  for (unsigned int i = 0; i < sizeof(vectors)/sizeof(vectors[0]); i++) {
+    char name[32];
+    crypto_hash_sha512(digest, (const unsigned char *) vectors[i].msg,
+              strlen(vectors[i].msg));
+    sprintf(name, "sha512 vector %u", i);
+    failed |= check(name, digest, vectors[i].digest);
+  }
+
+  hash_million_a(digest);
+  failed |= check("sha512 million a", digest, digest_million_a);
+
+  return failed;
+}
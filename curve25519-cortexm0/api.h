@@ -0,0 +1,5 @@
+/* 
+ * SUPERCOP-style API header included by the programs in test/.
+ */
+
+#include "curve25519-cortexm0.h"
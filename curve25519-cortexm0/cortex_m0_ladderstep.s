@@ -0,0 +1,329 @@
+// The Montgomery ladder step of scalarmult.c (curve25519_ladderstep) with 
+// the additions and subtractions in assembly, and the conditional swap of
+// the point pointers. This is not a fused ladder step: the 
+// multiplications and squarings still call the kernels of mul.s, sqr.s, 
+// cortex_m0_reduce25519.s and cortex_m0_mpy121666.s, and all operands 
+// and the 512 bit product live on the stack. It has not been measured 
+// against the C ladder step, so it is only used if DH_LADDERSTEP_ASM is 
+// defined (CURVE25519_LADDERSTEP = asm in ../nrf51/Makefile).
+//
+// public domain.
+//
+// gnu assembler format.
+//
+//    extern void
+//    curve25519_ladderstep_asm (
+//        fe25519*       points[4],
+//        const fe25519* x0,
+//        uint32         swap
+//    );
+//
+// points holds the pointers to Xp, Zp, Xq and Zq. If swap is 1, the
+// pointers to p and q are exchanged (in constant time, by masking), and
+// written back to points; scalarmult.c only passes swap = 1 with 
+// DH_SWAP_BY_POINTERS, and swaps the data itself (passing 0) otherwise.
+// Then, the ladder step is done on the points as in the C version. The 
+// additions and subtractions have the same lazy reduction as fe25519_add
+// and fe25519_sub of scalarmult.c (results are below 2^256, not 
+// necessarily below 2^255 - 19): the upper bits of the most significant
+// word are folded into the least significant word by multiples of 19 
+// within a single pass, keeping the carries in registers.
+//
+// Stack frame of curve25519_ladderstep_asm (besides the saved registers):
+//
+//   sp + 0    product of the multiplications (64 bytes)
+//   sp + 64   temporary t1 (b5 of the C version)
+//   sp + 96   temporary t2 (b6 of the C version)
+//   sp + 128  pointers to x0, b5, b6, b1, b2, b3, b4
+
+	.cpu cortex-m0
+	.fpu softvfp
+	.eabi_attribute 20, 1
+	.eabi_attribute 21, 1
+	.eabi_attribute 23, 3
+	.eabi_attribute 24, 1
+	.eabi_attribute 25, 1
+	.eabi_attribute 26, 1
+	.eabi_attribute 30, 2
+	.eabi_attribute 34, 0
+	.eabi_attribute 18, 4
+	.code	16
+
+	.file	"cortex_m0_ladderstep.s"
+
+	.text
+	.align	2
+
+	.equ	T1, 64
+	.equ	T2, 96
+	.equ	X0, 128
+	.equ	B5, 132
+	.equ	B6, 136
+	.equ	B1, 140
+	.equ	B2, 144
+	.equ	B3, 148
+	.equ	B4, 152
+	.equ	FRAME, 164
+
+@ out = a + b, out = a - b: operands are pointers in the frame.
+	.macro fe_add out, a, b
+    ldr r0,[sp,#\out]
+    ldr r1,[sp,#\a]
+    ldr r2,[sp,#\b]
+    bl fe25519_add_lazy
+	.endm
+
+	.macro fe_sub out, a, b
+    ldr r0,[sp,#\out]
+    ldr r1,[sp,#\a]
+    ldr r2,[sp,#\b]
+    bl fe25519_sub_lazy
+	.endm
+
+	.macro fe_mul out, a, b
+    add r0,sp,#0
+    ldr r1,[sp,#\a]
+    ldr r2,[sp,#\b]
+    bl multiply256x256_asm
+    ldr r0,[sp,#\out]
+    add r1,sp,#0
+    bl fe25519_reduceTo256Bits_asm
+	.endm
+
+	.macro fe_square out, a
+    add r0,sp,#0
+    ldr r1,[sp,#\a]
+    bl square256_asm
+    ldr r0,[sp,#\out]
+    add r1,sp,#0
+    bl fe25519_reduceTo256Bits_asm
+	.endm
+
+	.global	curve25519_ladderstep_asm
+	.code	16
+	.thumb_func
+	.type	curve25519_ladderstep_asm, %function
+
+curve25519_ladderstep_asm:
+    push {r4,r5,r6,r7,r14}
+    mov r4,r8
+    mov r5,r9
+    push {r4,r5}
+    sub sp,#FRAME
+
+    @ Conditional swap of the pointers: mask = -swap.
+    neg r2,r2
+    ldm r0!,{r4,r5,r6,r7}
+    mov r3,r4
+    eor r3,r6
+    and r3,r2
+    eor r4,r3
+    eor r6,r3
+    mov r3,r5
+    eor r3,r7
+    and r3,r2
+    eor r5,r3
+    eor r7,r3
+    sub r0,#16
+    stm r0!,{r4,r5,r6,r7}
+    add r2,sp,#T1
+    add r3,sp,#T2
+    add r0,sp,#X0
+    stm r0!,{r1,r2,r3,r4,r5,r6,r7}
+
+    fe_add B5,B1,B2      @ A = X2+Z2
+    fe_sub B6,B1,B2      @ B = X2-Z2
+    fe_add B1,B3,B4      @ C = X3+Z3
+    fe_sub B2,B3,B4      @ D = X3-Z3
+    fe_mul B3,B2,B5      @ DA= D*A
+    fe_mul B2,B1,B6      @ CB= C*B
+    fe_add B1,B2,B3      @ T0= DA+CB
+    fe_sub B4,B3,B2      @ T2= DA-CB
+    fe_square B3,B1      @ X5==T1= T0^2
+    fe_square B1,B4      @ T3= t2^2
+    fe_mul B4,B1,X0      @ Z5=X1*t3
+    fe_square B1,B5      @ AA=A^2
+    fe_square B5,B6      @ BB=B^2
+    fe_sub B2,B1,B5      @ E=AA-BB
+    fe_mul B1,B5,B1      @ X4= AA*BB
+    ldr r0,[sp,#B6]      @ T4 = a24*E
+    ldr r1,[sp,#B2]
+    bl fe25519_mpyWith121666_asm
+    fe_add B6,B6,B5      @ T5 = BB + t4
+    fe_mul B2,B6,B2      @ Z4 = E*t5
+
+    add sp,#FRAME
+    pop {r4,r5}
+    mov r8,r4
+    mov r9,r5
+    pop {r4,r5,r6,r7,r15}
+
+	.size	curve25519_ladderstep_asm, .-curve25519_ladderstep_asm
+
+@ fe25519_add_lazy (r0 = out, r1 = a, r2 = b), same result as fe25519_add:
+@ the sum of the most significant words is reduced to 31 bits first,
+@ 19 times the bits above is added to the least significant word. out may
+@ be a or b. Clobbers r0-r9.
+
+	.code	16
+	.thumb_func
+	.type	fe25519_add_lazy, %function
+
+fe25519_add_lazy:
+    ldr r3,[r1,#28]
+    ldr r4,[r2,#28]
+    add r3,r4
+    mov r5,#0
+    adc r5,r5
+    lsl r3,r3,#1
+    adc r5,r5
+    lsr r3,r3,#1
+    mov r9,r3
+    mov r3,#19
+    mul r3,r5
+    mov r8,r0
+    @ Words 0 to 3: first add 19 * (bits 255 and 256), then b, and keep
+    @ both carries in r3.
+    ldm r1!,{r4,r5,r6,r7}
+    add r4,r3
+    mov r3,#0
+    adc r5,r3
+    adc r6,r3
+    adc r7,r3
+    adc r3,r3
+    ldr r0,[r2,#0]
+    add r4,r0
+    ldr r0,[r2,#4]
+    adc r5,r0
+    ldr r0,[r2,#8]
+    adc r6,r0
+    ldr r0,[r2,#12]
+    adc r7,r0
+    mov r0,#0
+    adc r3,r0
+    mov r0,r8
+    stm r0!,{r4,r5,r6,r7}
+    mov r8,r0
+    @ Words 4 to 7 with the reduced sum of the most significant words.
+    ldm r1!,{r4,r5,r6}
+    mov r7,r9
+    add r4,r3
+    mov r3,#0
+    adc r5,r3
+    adc r6,r3
+    adc r7,r3
+    ldr r0,[r2,#16]
+    add r4,r0
+    ldr r0,[r2,#20]
+    adc r5,r0
+    ldr r0,[r2,#24]
+    adc r6,r0
+    adc r7,r3
+    mov r0,r8
+    stm r0!,{r4,r5,r6,r7}
+    bx lr
+
+	.size	fe25519_add_lazy, .-fe25519_add_lazy
+
+@ fe25519_sub_lazy (r0 = out, r1 = a, r2 = b), same result as fe25519_sub:
+@ bit 255 of the result is always set, which is compensated, together
+@ with the bits above bit 255 of the difference of the most significant
+@ words, by subtracting a multiple of 19 (0 to 57) from the least
+@ significant word. out may be a or b. Clobbers r0-r9.
+
+	.code	16
+	.thumb_func
+	.type	fe25519_sub_lazy, %function
+
+fe25519_sub_lazy:
+    ldr r3,[r1,#28]
+    ldr r4,[r2,#28]
+    sub r3,r4
+    @ r5 = 2 * carry + bit 31 = (difference >> 31) + 2
+    mov r5,#0
+    adc r5,r5
+    lsl r3,r3,#1
+    adc r5,r5
+    @ Most significant word with bit 31 set.
+    add r3,#1
+    mov r4,#1
+    ror r3,r4
+    mov r9,r3
+    @ r3 = 19 * (1 - (difference >> 31))
+    mov r3,#3
+    sub r3,r5
+    mov r4,#19
+    mul r3,r4
+    mov r8,r0
+    @ Words 0 to 3: first subtract r3, then b, and keep both borrows
+    @ in r3 (0, -1 or -2).
+    ldm r1!,{r4,r5,r6,r7}
+    sub r4,r3
+    mov r3,#0
+    sbc r5,r3
+    sbc r6,r3
+    sbc r7,r3
+    sbc r3,r3
+    ldr r0,[r2,#0]
+    sub r4,r0
+    ldr r0,[r2,#4]
+    sbc r5,r0
+    ldr r0,[r2,#8]
+    sbc r6,r0
+    ldr r0,[r2,#12]
+    sbc r7,r0
+    mov r0,#0
+    sbc r3,r0
+    mov r0,r8
+    stm r0!,{r4,r5,r6,r7}
+    mov r8,r0
+    @ Words 4 to 7: add the (sign extended) borrows, subtract b.
+    ldm r1!,{r4,r5,r6}
+    mov r7,r9
+    asr r0,r3,#31
+    add r4,r3
+    adc r5,r0
+    adc r6,r0
+    adc r7,r0
+    ldr r0,[r2,#16]
+    sub r4,r0
+    ldr r0,[r2,#20]
+    sbc r5,r0
+    ldr r0,[r2,#24]
+    sbc r6,r0
+    mov r0,#0
+    sbc r7,r0
+    mov r0,r8
+    stm r0!,{r4,r5,r6,r7}
+    bx lr
+
+	.size	fe25519_sub_lazy, .-fe25519_sub_lazy
+
+@ fe25519_add_lazy and fe25519_sub_lazy with the calling convention of C
+@ (saving r4-r9), for the differential test in test/test_fe25519.c:
+@
+@    extern void
+@    fe25519_add_lazy_test (fe25519* out, const fe25519* a, const fe25519* b);
+
+	.macro test_wrapper name, function
+	.global	\name
+	.code	16
+	.thumb_func
+	.type	\name, %function
+
+\name:
+    push {r4,r5,r6,r7,r14}
+    mov r4,r8
+    mov r5,r9
+    push {r4,r5}
+    bl \function
+    pop {r4,r5}
+    mov r8,r4
+    mov r9,r5
+    pop {r4,r5,r6,r7,r15}
+
+	.size	\name, .-\name
+	.endm
+
+	test_wrapper fe25519_add_lazy_test, fe25519_add_lazy
+	test_wrapper fe25519_sub_lazy_test, fe25519_sub_lazy
@@ -1,6 +1,8 @@
 #ifndef CURVE2519_H
 #define CURVE2519_H
 
+#include <stdint.h>
+
 #define crypto_scalarmult crypto_scalarmult_curve25519
 #define crypto_scalarmult_base crypto_scalarmult_curve25519_base
 #define crypto_scalarmult_BYTES crypto_scalarmult_curve25519_BYTES
@@ -10,4 +12,28 @@
 extern int crypto_scalarmult_curve25519(unsigned char *,const unsigned char *,const unsigned char *);
 extern int crypto_scalarmult_curve25519_base(unsigned char *,const unsigned char *);
 
+/*
+ * Incremental version of crypto_scalarmult_curve25519 for splitting the 
+ * Montgomery ladder into slices, e.g., to process events in between:
+ *
+ * crypto_scalarmult_curve25519_init(&st, n, p);
+ * while (crypto_scalarmult_curve25519_step(&st, 8) > 0)
+ *   ...
+ * crypto_scalarmult_curve25519_finish(q, &st);
+ *
+ * _step processes up to the given number of scalar bits (one ladder step
+ * each) and returns the number of ladder steps left. Its running time only 
+ * depends on the number of bits processed, not on the scalar. _finish does
+ * the remaining ladder steps (if any) and the final inversion, writes the 
+ * result and clears the scalar from the state. The state is opaque and must
+ * not be moved between the calls.
+ */
+typedef struct {
+  uint64_t opaque[32];
+} crypto_scalarmult_curve25519_state;
+
+extern int crypto_scalarmult_curve25519_init(crypto_scalarmult_curve25519_state *,const unsigned char *,const unsigned char *);
+extern int crypto_scalarmult_curve25519_step(crypto_scalarmult_curve25519_state *,unsigned int);
+extern int crypto_scalarmult_curve25519_finish(unsigned char *,crypto_scalarmult_curve25519_state *);
+
 #endif
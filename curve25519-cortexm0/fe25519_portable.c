@@ -0,0 +1,197 @@
+/*                          =======================
+  ============================ C/C++ HEADER FILE =============================
+                            =======================
+
+    Portable C versions of the five assembly functions required by
+    scalarmult.c:
+
+    fe25519_reduceTo256Bits_asm, fe25519_mpyWith121666_asm,
+    multiply256x256_asm, square256_asm and fe25519_square_n_asm.
+
+    They keep the names and calling conventions of the assembly versions,
+    so scalarmult.c may be linked against either of them. The results
+    of the reductions are congruent modulo 2^255-19 and fit into 256 bits,
+    which is all scalarmult.c requires; they are not necessarily identical
+    to the (equally valid) results of the assembly versions.
+
+    Intended for building the Curve25519 code on other platforms than
+    the Cortex M0 (e.g., for host-side tests and simulations). All
+    functions run in constant time.
+
+    \file fe25519_portable.c
+
+    Distributed under the conditions of the
+    Creative Commons CC0 1.0 Universal public domain dedication
+  ============================================================================*/
+
+#include <inttypes.h>
+
+typedef uint8_t  uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+
+// Same layout as in scalarmult.c.
+typedef union UN_256bitValue_
+{
+    uint8          as_uint8[32];
+    uint16         as_uint16[16];
+    uint32         as_uint32[8];
+    uint64         as_uint64[4];
+} UN_256bitValue;
+
+typedef union UN_512bitValue_
+{
+    uint8          as_uint8[64];
+    uint16         as_uint16[32];
+    uint32         as_uint32[16];
+    uint64         as_uint64[8];
+    UN_256bitValue as_256_bitValue[2];
+} UN_512bitValue;
+
+typedef UN_256bitValue fe25519;
+
+/// Adds carry * 2^256 to the 256 bit value in words, reducing modulo
+/// 2^255-19 by means of 2^256 = 38. Two passes are always required
+/// (the first one may produce a carry of one), a potential carry of the
+/// second pass is zero. So we always do both passes (constant time).
+static void
+fe25519_foldCarry(
+    uint32 words[8],
+    uint64 carry
+)
+{
+    uint8  pass;
+    uint8  ctr;
+    uint64 accu;
+
+    for (pass = 0; pass < 2; pass++)
+    {
+        accu = carry * 38;
+        for (ctr = 0; ctr < 8; ctr++)
+        {
+            accu += words[ctr];
+            words[ctr] = (uint32)accu;
+            accu >>= 32;
+        }
+        carry = accu;
+    }
+}
+
+void
+fe25519_reduceTo256Bits_asm(
+    fe25519              *res,
+    const UN_512bitValue *in
+)
+{
+    uint32 tmp[8];
+    uint64 accu = 0;
+    uint8  ctr;
+
+    // 2^256 = 38 mod 2^255-19, so the upper half is multiplied by 38 and
+    // added to the lower half.
+    for (ctr = 0; ctr < 8; ctr++)
+    {
+        accu += in->as_uint32[ctr];
+        accu += (uint64)in->as_uint32[ctr + 8] * 38;
+        tmp[ctr] = (uint32)accu;
+        accu >>= 32;
+    }
+
+    fe25519_foldCarry(tmp, accu);
+
+    for (ctr = 0; ctr < 8; ctr++)
+    {
+        res->as_uint32[ctr] = tmp[ctr];
+    }
+}
+
+void
+fe25519_mpyWith121666_asm(
+    fe25519*       out,
+    const fe25519* in
+)
+{
+    uint32 tmp[8];
+    uint64 accu = 0;
+    uint8  ctr;
+
+    for (ctr = 0; ctr < 8; ctr++)
+    {
+        accu += (uint64)in->as_uint32[ctr] * 121666;
+        tmp[ctr] = (uint32)accu;
+        accu >>= 32;
+    }
+
+    fe25519_foldCarry(tmp, accu);
+
+    for (ctr = 0; ctr < 8; ctr++)
+    {
+        out->as_uint32[ctr] = tmp[ctr];
+    }
+}
+
+void
+multiply256x256_asm(
+    UN_512bitValue*       result,
+    const UN_256bitValue* x,
+    const UN_256bitValue* y
+)
+{
+    uint32 tmp[16];
+    uint64 accu;
+    uint8  i;
+    uint8  j;
+
+    for (i = 0; i < 16; i++)
+    {
+        tmp[i] = 0;
+    }
+
+    // Schoolbook multiplication. (2^32-1)^2 + 2*(2^32-1) = 2^64-1, so the
+    // accumulator cannot overflow.
+    for (i = 0; i < 8; i++)
+    {
+        accu = 0;
+        for (j = 0; j < 8; j++)
+        {
+            accu += (uint64)x->as_uint32[i] * y->as_uint32[j];
+            accu += tmp[i + j];
+            tmp[i + j] = (uint32)accu;
+            accu >>= 32;
+        }
+        tmp[i + 8] = (uint32)accu;
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        result->as_uint32[i] = tmp[i];
+    }
+}
+
+void
+square256_asm(
+    UN_512bitValue*       result,
+    const UN_256bitValue* x
+)
+{
+    multiply256x256_asm(result, x, x);
+}
+
+void
+fe25519_square_n_asm(
+    fe25519*       out,
+    const fe25519* in,
+    uint32         n
+)
+{
+    UN_512bitValue tmp;
+
+    square256_asm(&tmp, in);
+    fe25519_reduceTo256Bits_asm(out, &tmp);
+    while (--n > 0)
+    {
+        square256_asm(&tmp, out);
+        fe25519_reduceTo256Bits_asm(out, &tmp);
+    }
+}
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+#
+# Generates scalarmult_base_table.h, the precomputed table for the
+# fixed-base scalar multiplication in scalarmult.c:
+#
+#   python3 gen_base_table.py > scalarmult_base_table.h
+#
+# The table is computed on the twisted Edwards curve -x^2 + y^2 =
+# 1 + d x^2 y^2 (d = -121665/121666), which is birationally equivalent to
+# Curve25519. Its base point B (y = 4/5) corresponds to u = 9.
+#
+# Row i (0 <= i < 64) holds k * 16^i * B for k = 1..8 in affine
+# coordinates as (y+x, y-x, 2*d*x*y), each value reduced mod 2^255-19
+# and stored as 32 bytes (little endian). Each row is enclosed in an
+# #if, so scalarmult.c only compiles the rows required for the
+# configured DH_BASE_TABLE_SPACING.
+#
+# Distributed under the conditions of the
+# Creative Commons CC0 1.0 Universal public domain dedication
+
+P = 2**255 - 19
+D = -121665 * pow(121666, P - 2, P) % P
+I = pow(2, (P - 1) // 4, P)
+
+def inv(x):
+    return pow(x, P - 2, P)
+
+def recover_x(y):
+    xx = (y * y - 1) * inv(D * y * y + 1)
+    x = pow(xx, (P + 3) // 8, P)
+    if (x * x - xx) % P != 0:
+        x = x * I % P
+    if x % 2 != 0:
+        x = P - x
+    return x
+
+def add(p1, p2):
+    (x1, y1) = p1
+    (x2, y2) = p2
+    t = D * x1 * x2 * y1 * y2 % P
+    x3 = (x1 * y2 + x2 * y1) * inv(1 + t)
+    y3 = (y1 * y2 + x1 * x2) * inv(1 - t)
+    return (x3 % P, y3 % P)
+
+def fe(v):
+    return "{" + ",".join("0x%02x" % b for b in v.to_bytes(32, "little")) + "}"
+
+def main():
+    by = 4 * inv(5) % P
+    b = (recover_x(by), by)
+
+    print("// Generated by gen_base_table.py, do not edit.")
+    print("// Row i: k * 16^i * B for k = 1..8 as (y+x, y-x, 2*d*x*y).")
+    for i in range(64):
+        print("#if (%d %% DH_BASE_TABLE_SPACING) == 0" % i)
+        print("{")
+        p = b
+        for k in range(8):
+            (x, y) = p
+            print("    {")
+            print("        {%s}," % fe((y + x) % P))
+            print("        {%s}," % fe((y - x) % P))
+            print("        {%s}" % fe(2 * D * x * y % P))
+            print("    }%s" % ("," if k < 7 else ""))
+            p = add(p, b)
+        print("},")
+        print("#endif")
+        for k in range(4):
+            b = add(b, b)
+
+if __name__ == "__main__":
+    main()
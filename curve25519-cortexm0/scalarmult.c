@@ -22,7 +22,11 @@
         const unsigned char* p
     );
 
-    Requires inttypes.h header and the four external assembly functions
+    and to the incremental version of crypto_scalarmult_curve25519
+    (crypto_scalarmult_curve25519_init, _step and _finish, see
+    curve25519-cortexm0.h).
+
+    Requires inttypes.h header and the five external assembly functions
 
     extern void
     fe25519_reduceTo256Bits_asm (
@@ -49,6 +53,16 @@
         const UN_256bitValue* x
     );
 
+    extern void
+    fe25519_square_n_asm (
+        fe25519*       out,
+        const fe25519* in,
+        uint32         n
+    );
+
+    and, if DH_LADDERSTEP_ASM is defined, curve25519_ladderstep_asm
+    (cortex_m0_ladderstep.s).
+
     \file scalarmult.c
 
     \Author B. Haase, Endress + Hauser Conducta GmbH & Co. KG
@@ -58,12 +72,27 @@
   ============================================================================*/
 
 #include <inttypes.h>
-
-// comment out this line if implementing conditional swaps by data moves
-//#define DH_SWAP_BY_POINTERS
-
-// Define the symbol to 0 in order to only use ladder steps
-//#define DH_REPLACE_LAST_THREE_LADDERSTEPS_WITH_DOUBLINGS 1 
+#include "curve25519-cortexm0.h"
+
+// DH_SWAP_BY_POINTERS (conditional swaps by pointers or by data moves) and
+// DH_REPLACE_LAST_THREE_LADDERSTEPS_WITH_DOUBLINGS (doublings or ladder steps
+// for the last three bits), both 0 or 1, are set by scalarmult_config.h
+// unless defined otherwise (see gen_config.py).
+#include "scalarmult_config.h"
+
+// Define the symbol in order to use the ladder step of cortex_m0_ladderstep.s
+// (Cortex M0 only, not measured against it yet) instead of 
+// curve25519_ladderstep.
+//#define DH_LADDERSTEP_ASM
+
+// Row spacing of the precomputed table of crypto_scalarmult_curve25519_base
+// (1, 2, 4, 8, 16, 32 or 64). The table takes 64 / spacing * 768 bytes of
+// flash (48 kB for 1, 24 kB for 2, 12 kB for 4, ...); every spacing
+// above 1 costs 4 * (spacing - 1) point doublings.
+// Define the symbol to 0 in order to use the Montgomery ladder with u = 9.
+#ifndef DH_BASE_TABLE_SPACING
+#define DH_BASE_TABLE_SPACING 2
+#endif
 
 typedef uint8_t  uint8;
 typedef uint16_t uint16;
@@ -132,6 +161,25 @@ square256(
     const UN_256bitValue* x
 );
 
+// out = in^(2^n) for n >= 1, the same result as n times fe25519_square.
+extern void
+fe25519_square_n_asm(
+    fe25519*       out,
+    const fe25519* in,
+    uint32         n
+);
+
+#ifdef DH_LADDERSTEP_ASM
+// Conditional swap of the pointers to Xp, Zp, Xq, Zq in points[], followed
+// by the ladder step on the points (see curve25519_ladderstep).
+extern void
+curve25519_ladderstep_asm(
+    fe25519*       points[4],
+    const fe25519* x0,
+    uint32         swap
+);
+#endif
+
 // ****************************************************
 // C functions for fe25519 
 // ****************************************************
@@ -165,6 +213,8 @@ fe25519_unpack(
     out->as_uint8[31] &= 0x7f; // make sure that the last bit is cleared.
 }
 
+#if !defined(DH_LADDERSTEP_ASM) || DH_REPLACE_LAST_THREE_LADDERSTEPS_WITH_DOUBLINGS || \
+    DH_BASE_TABLE_SPACING
 static void
 fe25519_sub(
     fe25519*       out,
@@ -229,6 +279,7 @@ fe25519_add(
     accu += out->as_uint32[7];
     out->as_uint32[7] = (uint32)accu;
 }
+#endif
 
 static void
 fe25519_mul(
@@ -335,14 +386,13 @@ fe25519_invert_useProvidedScratchBuffers(
     fe25519 *z2_50_0 = t2;
     fe25519 *z2_100_0 = z2_10_0;
 
-    uint8   i;
-
+    // The runs of squarings are done by fe25519_square_n_asm, which only 
+    // saves the calls and register saves of every single squaring.
     {
          fe25519 *z2 = z2_50_0;
 
         /* 2 */ fe25519_square(z2, x);
-        /* 4 */ fe25519_square(t0, z2);
-        /* 8 */ fe25519_square(t0, t0);
+        /* 8 */ fe25519_square_n_asm(t0, z2, 2);
         /* 9 */ fe25519_mul(z2_10_0, t0, x);
         /* 11 */ fe25519_mul(z11, z2_10_0, z2);
         
@@ -352,63 +402,28 @@ fe25519_invert_useProvidedScratchBuffers(
     /* 22 */ fe25519_square(t0, z11);
     /* 2^5 - 2^0 = 31 */ fe25519_mul(z2_10_0, t0, z2_10_0);
 
-    /* 2^6 - 2^1 */ fe25519_square(t0, z2_10_0);
-    /* 2^7 - 2^2 */ fe25519_square(t0, t0);
-    /* 2^8 - 2^3 */ fe25519_square(t0, t0);
-    /* 2^9 - 2^4 */ fe25519_square(t0, t0);
-    /* 2^10 - 2^5 */ fe25519_square(t0, t0);
+    /* 2^10 - 2^5 */ fe25519_square_n_asm(t0, z2_10_0, 5);
     /* 2^10 - 2^0 */ fe25519_mul(z2_10_0, t0, z2_10_0);
 
-    /* 2^11 - 2^1 */ fe25519_square(t0, z2_10_0);
-
-    /* 2^20 - 2^10 */ for (i = 1; i < 10; i ++)
-    {
-        fe25519_square(t0, t0);
-    }
+    /* 2^20 - 2^10 */ fe25519_square_n_asm(t0, z2_10_0, 10);
     /* 2^20 - 2^0 */ fe25519_mul(z2_50_0, t0, z2_10_0);
 
-    /* 2^21 - 2^1 */ fe25519_square(t0, z2_50_0);
-
-    /* 2^40 - 2^20 */ for (i = 1; i < 20; i ++)
-    {
-        fe25519_square(t0, t0);
-    }
+    /* 2^40 - 2^20 */ fe25519_square_n_asm(t0, z2_50_0, 20);
     /* 2^40 - 2^0 */ fe25519_mul(t0, t0, z2_50_0);
 
-    /* 2^41 - 2^1 */ fe25519_square(t0, t0);
-
-    /* 2^50 - 2^10 */ for (i = 1; i < 10; i ++)
-    {
-        fe25519_square(t0, t0);
-    }
+    /* 2^50 - 2^10 */ fe25519_square_n_asm(t0, t0, 10);
     /* 2^50 - 2^0 */ fe25519_mul(z2_50_0, t0, z2_10_0);
 
-    /* 2^51 - 2^1 */ fe25519_square(t0, z2_50_0);
-
-    /* 2^100 - 2^50 */ for (i = 1; i < 50; i ++)
-    {
-        fe25519_square(t0, t0);
-    }
+    /* 2^100 - 2^50 */ fe25519_square_n_asm(t0, z2_50_0, 50);
     /* 2^100 - 2^0 */ fe25519_mul(z2_100_0, t0, z2_50_0);
 
-    /* 2^101 - 2^1 */ fe25519_square(t0, z2_100_0);
-
-    /* 2^200 - 2^100 */ for (i = 1; i < 100; i ++)
-    {
-        fe25519_square(t0, t0);
-    }
+    /* 2^200 - 2^100 */ fe25519_square_n_asm(t0, z2_100_0, 100);
     /* 2^200 - 2^0 */ fe25519_mul(t0, t0, z2_100_0);
 
-    /* 2^250 - 2^50 */ for (i = 0; i < 50; i ++)
-    {
-        fe25519_square(t0, t0);
-    }
+    /* 2^250 - 2^50 */ fe25519_square_n_asm(t0, t0, 50);
     /* 2^250 - 2^0 */ fe25519_mul(t0, t0, z2_50_0);
 
-    /* 2^255 - 2^5 */ for (i = 0; i < 5; i ++)
-    {
-         fe25519_square(t0, t0);
-    }
+    /* 2^255 - 2^5 */ fe25519_square_n_asm(t0, t0, 5);
     /* 2^255 - 21 */ fe25519_mul(r, t0, z11);
 }
 
@@ -440,7 +455,7 @@ fe25519_setone(
     }
 }
 
-/*
+#if DH_SWAP_BY_POINTERS
 static void
 swapPointersConditionally (void **p1, void **p2, uint8 condition)
 {
@@ -467,8 +482,9 @@ swapPointersConditionally (void **p1, void **p2, uint8 condition)
     *p1 = (void *) val1;
     *p2 = (void *) val2;
 }
-*/
+#endif
 
+#if !DH_SWAP_BY_POINTERS || DH_BASE_TABLE_SPACING
 static void
 fe25519_cswap(
     fe25519* in1,
@@ -495,6 +511,7 @@ fe25519_cswap(
     	in2->as_uint32[ctr] = val2;
     }
 }
+#endif
 
 // ****************************************************
 // Scalarmultiplication implementation.
@@ -516,15 +533,23 @@ typedef struct _ST_curve25519ladderstepWorkingState
     int nextScalarBitToProcess;
     uint8 previousProcessedBit;
 
-#ifdef DH_SWAP_BY_POINTERS
-    fe25519 *pXp;
-    fe25519 *pZp;
-    fe25519 *pXq;
-    fe25519 *pZq;
+#if DH_SWAP_BY_POINTERS
+    union
+    {
+        struct
+        {
+            fe25519 *pXp;
+            fe25519 *pZp;
+            fe25519 *pXq;
+            fe25519 *pZq;
+        };
+        fe25519 *pPoints[4]; // for curve25519_ladderstep_asm
+    };
 #endif
 
 } ST_curve25519ladderstepWorkingState;
 
+#ifndef DH_LADDERSTEP_ASM
 static void
 curve25519_ladderstep(
     ST_curve25519ladderstepWorkingState* pState
@@ -547,7 +572,7 @@ curve25519_ladderstep(
 
     fe25519 t1, t2;
 
-    #ifdef DH_SWAP_BY_POINTERS
+    #if DH_SWAP_BY_POINTERS
     fe25519 *b1=pState->pXp; fe25519 *b2=pState->pZp;
     fe25519 *b3=pState->pXq; fe25519 *b4=pState->pZq;
     #else
@@ -576,6 +601,7 @@ curve25519_ladderstep(
     fe25519_add(b6,b6,b5); // T5 = BB + t4
     fe25519_mul(b2,b6,b2); // Z4 = E*t5
 }
+#endif
 
 static void
 curve25519_cswap(
@@ -583,7 +609,7 @@ curve25519_cswap(
     uint8                                b
 )
 {
-    #ifdef DH_SWAP_BY_POINTERS
+    #if DH_SWAP_BY_POINTERS
     swapPointersConditionally ((void **) &state->pXp,(void **) &state->pXq,b);
     swapPointersConditionally ((void **) &state->pZp,(void **) &state->pZq,b);
     #else
@@ -592,6 +618,27 @@ curve25519_cswap(
     #endif
 }
 
+static void
+curve25519_cswapAndLadderstep(
+    ST_curve25519ladderstepWorkingState* pState,
+    uint8                                swap
+)
+{
+    // The pointer swap of curve25519_ladderstep_asm is only used with
+    // DH_SWAP_BY_POINTERS; otherwise the data is swapped here.
+#if defined(DH_LADDERSTEP_ASM) && DH_SWAP_BY_POINTERS
+    curve25519_ladderstep_asm (pState->pPoints, &pState->x0, swap);
+#elif defined(DH_LADDERSTEP_ASM)
+    fe25519 *points[4] = {&pState->xp, &pState->zp, &pState->xq, &pState->zq};
+
+    curve25519_cswap(pState, swap);
+    curve25519_ladderstep_asm (points, &pState->x0, 0);
+#else
+    curve25519_cswap(pState, swap);
+    curve25519_ladderstep(pState);
+#endif
+}
+
 #if DH_REPLACE_LAST_THREE_LADDERSTEPS_WITH_DOUBLINGS
 
 static void
@@ -615,7 +662,7 @@ curve25519_doublePointP (ST_curve25519ladderstepWorkingState* pState)
     // Double the point input in the state variable "P". Use the State variable "Q" as temporary
     // for storing A, AA and B, BB. Use the same temporary variable for A and AA respectively and
     // B, BB respectively.
-    #ifdef DH_SWAP_BY_POINTERS
+    #if DH_SWAP_BY_POINTERS
     fe25519 *pA = pState->pXq;
     fe25519 *pB = pState->pZq;
     fe25519 *pX = pState->pXp;
@@ -649,102 +696,412 @@ curve25519_doublePointP (ST_curve25519ladderstepWorkingState* pState)
 
 #endif // #ifdef DH_REPLACE_LAST_THREE_LADDERSTEPS_WITH_DOUBLINGS
 
+#if DH_REPLACE_LAST_THREE_LADDERSTEPS_WITH_DOUBLINGS
+// The last three bits are processed by explicit doublings in
+// crypto_scalarmult_curve25519_finish.
+#define DH_LAST_LADDERSTEP_BIT 3
+#else
+#define DH_LAST_LADDERSTEP_BIT 0
+#endif
+
+// The working state lives in caller-owned memory of type
+// crypto_scalarmult_curve25519_state, which must be large enough.
+typedef char ST_curve25519ladderstepWorkingState_fits[
+    (sizeof(ST_curve25519ladderstepWorkingState) <= 
+     sizeof(crypto_scalarmult_curve25519_state)) ? 1 : -1];
+
 int
-crypto_scalarmult_curve25519(
-    unsigned char*       r,
-    const unsigned char* s,
-    const unsigned char* p
+crypto_scalarmult_curve25519_init(
+    crypto_scalarmult_curve25519_state* st,
+    const unsigned char*                s,
+    const unsigned char*                p
 )
 {
-    ST_curve25519ladderstepWorkingState state;
+    ST_curve25519ladderstepWorkingState* pState = 
+        (ST_curve25519ladderstepWorkingState*) st;
     unsigned char i;
 
-
     // Prepare the scalar within the working state buffer.
     for (i = 0; i < 32; i++)
     {
-        state.s.as_uint8 [i] = s[i];
+        pState->s.as_uint8 [i] = s[i];
     }
 #if DH_REPLACE_LAST_THREE_LADDERSTEPS_WITH_DOUBLINGS    
     // Due to explicit final doubling for the last three bits instead of a full ladderstep, 
     // the following line is no longer necessary.
 #else
-    state.s.as_uint8 [0] &= 248; 
+    pState->s.as_uint8 [0] &= 248; 
 #endif
-    state.s.as_uint8 [31] &= 127;
-    state.s.as_uint8 [31] |= 64;
+    pState->s.as_uint8 [31] &= 127;
+    pState->s.as_uint8 [31] |= 64;
 
     // Copy the affine x-axis of the base point to the state.
-    fe25519_unpack (&state.x0, p);
+    fe25519_unpack (&pState->x0, p);
 
     // Prepare the working points within the working state struct.
 
-    fe25519_setone (&state.zq);
-    fe25519_cpy (&state.xq, &state.x0);
+    fe25519_setone (&pState->zq);
+    fe25519_cpy (&pState->xq, &pState->x0);
 
-    fe25519_setone(&state.xp);
-    fe25519_setzero(&state.zp);
+    fe25519_setone(&pState->xp);
+    fe25519_setzero(&pState->zp);
 
-    state.nextScalarBitToProcess = 254;
+    pState->nextScalarBitToProcess = 254;
 
-#ifdef DH_SWAP_BY_POINTERS
+#if DH_SWAP_BY_POINTERS
     // we need to initially assign the pointers correctly.
-    state.pXp = &state.xp;
-    state.pZp = &state.zp;
-    state.pXq = &state.xq;
-    state.pZq = &state.zq;
+    pState->pXp = &pState->xp;
+    pState->pZp = &pState->zp;
+    pState->pXq = &pState->xq;
+    pState->pZq = &pState->zq;
 #endif
 
-    state.previousProcessedBit = 0;
+    pState->previousProcessedBit = 0;
 
-#if DH_REPLACE_LAST_THREE_LADDERSTEPS_WITH_DOUBLINGS          
-    // Process all the bits except for the last three where we explicitly double the result.
-    while (state.nextScalarBitToProcess >= 3)
-#else
-    // Process all the bits except for the last three where we explicitly double the result.
-    while (state.nextScalarBitToProcess >= 0)
-#endif    
+    return 0;
+}
+
+int
+crypto_scalarmult_curve25519_step(
+    crypto_scalarmult_curve25519_state* st,
+    unsigned int                        bits
+)
+{
+    ST_curve25519ladderstepWorkingState* pState = 
+        (ST_curve25519ladderstepWorkingState*) st;
+
+    // The number of ladder steps only depends on bits and on the number of
+    // steps done before, not on the scalar.
+    while (bits > 0 && pState->nextScalarBitToProcess >= DH_LAST_LADDERSTEP_BIT)
     {
-    	uint8 byteNo = state.nextScalarBitToProcess >> 3;
-    	uint8 bitNo = state.nextScalarBitToProcess & 7;
+    	uint8 byteNo = pState->nextScalarBitToProcess >> 3;
+    	uint8 bitNo = pState->nextScalarBitToProcess & 7;
         uint8 bit;
         uint8 swap;
 
-        bit = 1 & (state.s.as_uint8 [byteNo] >> bitNo);
-        swap = bit ^ state.previousProcessedBit;
-        state.previousProcessedBit = bit;
-        curve25519_cswap(&state, swap);
-        curve25519_ladderstep(&state);
-        state.nextScalarBitToProcess --;
+        bit = 1 & (pState->s.as_uint8 [byteNo] >> bitNo);
+        swap = bit ^ pState->previousProcessedBit;
+        pState->previousProcessedBit = bit;
+        curve25519_cswapAndLadderstep(pState, swap);
+        pState->nextScalarBitToProcess --;
+        bits--;
     }
 
-    curve25519_cswap(&state,state.previousProcessedBit);
+    return pState->nextScalarBitToProcess - DH_LAST_LADDERSTEP_BIT + 1;
+}
+
+int
+crypto_scalarmult_curve25519_finish(
+    unsigned char*                      r,
+    crypto_scalarmult_curve25519_state* st
+)
+{
+    ST_curve25519ladderstepWorkingState* pState = 
+        (ST_curve25519ladderstepWorkingState*) st;
+    uint8 i;
+
+    // Process the remaining bits, if any.
+    crypto_scalarmult_curve25519_step(st, 255);
+
+    curve25519_cswap(pState, pState->previousProcessedBit);
 
 #if DH_REPLACE_LAST_THREE_LADDERSTEPS_WITH_DOUBLINGS        
-    curve25519_doublePointP (&state);
-    curve25519_doublePointP (&state);
-    curve25519_doublePointP (&state);
+    curve25519_doublePointP (pState);
+    curve25519_doublePointP (pState);
+    curve25519_doublePointP (pState);
 #endif
 
-#ifdef DH_SWAP_BY_POINTERS
+#if DH_SWAP_BY_POINTERS
     // optimize for stack usage.
-    fe25519_invert_useProvidedScratchBuffers (state.pZp, state.pZp, state.pXq,state.pZq,&state.x0);
-    fe25519_mul(state.pXp, state.pXp, state.pZp);
-    fe25519_reduceCompletely(state.pXp);
+    fe25519_invert_useProvidedScratchBuffers (pState->pZp, pState->pZp, pState->pXq, pState->pZq, &pState->x0);
+    fe25519_mul(pState->pXp, pState->pXp, pState->pZp);
+    fe25519_reduceCompletely(pState->pXp);
 
-    fe25519_pack (r, state.pXp);
+    fe25519_pack (r, pState->pXp);
 #else
     // optimize for stack usage.
-    fe25519_invert_useProvidedScratchBuffers (&state.zp, &state.zp, &state.xq, &state.zq, &state.x0);    
-    fe25519_mul(&state.xp, &state.xp, &state.zp);
-    fe25519_reduceCompletely(&state.xp);
+    fe25519_invert_useProvidedScratchBuffers (&pState->zp, &pState->zp, &pState->xq, &pState->zq, &pState->x0);    
+    fe25519_mul(&pState->xp, &pState->xp, &pState->zp);
+    fe25519_reduceCompletely(&pState->xp);
 
-    fe25519_pack (r, &state.xp);
+    fe25519_pack (r, &pState->xp);
 #endif
 
+    // Do not leave the scalar behind in caller-owned memory.
+    for (i = 0; i < 32; i++)
+    {
+        pState->s.as_uint8 [i] = 0;
+    }
+
+    return 0;
+}
+
+int
+crypto_scalarmult_curve25519(
+    unsigned char*       r,
+    const unsigned char* s,
+    const unsigned char* p
+)
+{
+    crypto_scalarmult_curve25519_state state;
+
+    crypto_scalarmult_curve25519_init(&state, s, p);
+    return crypto_scalarmult_curve25519_finish(r, &state);
+}
+
+// ****************************************************
+// Fixed-base scalar multiplication.
+// ****************************************************
+
+#if DH_BASE_TABLE_SPACING
+
+// The base point is multiplied on the twisted Edwards curve
+// -x^2 + y^2 = 1 + d x^2 y^2, which is birationally equivalent to
+// Curve25519 (same approach and point representations as in the ref10
+// implementation of Ed25519). The result is mapped back to the
+// Montgomery u coordinate by u = (1 + y) / (1 - y) = (Z + Y) / (Z - Y).
+//
+// The clamped scalar is written in radix 16 with signed digits
+// e[0..63] in [-8, 8], so that s*B = sum_i e[i] * 16^i * B. The table
+// (generated by gen_base_table.py) holds the multiples 1*P .. 8*P of
+// P = 16^i * B for every DH_BASE_TABLE_SPACING-th i. With spacing S, this
+// takes 64 additions of table entries and 4*(S-1) doublings:
+//
+// s*B = sum_{k=0}^{S-1} 16^k * sum_j e[S*j + k] * 16^(S*j) * B
+//
+// Table entries are selected without data dependent branches or memory
+// accesses.
+
+// Extended coordinates: x = X/Z, y = Y/Z, x*y = T/Z.
+typedef struct _ST_ge25519_p3
+{
+    fe25519 X;
+    fe25519 Y;
+    fe25519 Z;
+    fe25519 T;
+} ST_ge25519_p3;
+
+// Completed coordinates: x = X/Z, y = Y/T.
+typedef struct _ST_ge25519_p1p1
+{
+    fe25519 X;
+    fe25519 Y;
+    fe25519 Z;
+    fe25519 T;
+} ST_ge25519_p1p1;
+
+// Affine point (x, y) as (y+x, y-x, 2*d*x*y).
+typedef struct _ST_ge25519_precomp
+{
+    fe25519 yplusx;
+    fe25519 yminusx;
+    fe25519 xy2d;
+} ST_ge25519_precomp;
+
+static const ST_ge25519_precomp ge25519_base_table[64 / DH_BASE_TABLE_SPACING][8] =
+{
+#include "scalarmult_base_table.h"
+};
+
+static void
+fe25519_cmov(
+    fe25519*       out,
+    const fe25519* in,
+    uint8          condition
+)
+{
+    uint32 mask = -(uint32)condition;
+    uint8  ctr;
+
+    for (ctr = 0; ctr < 8; ctr++)
+    {
+        out->as_uint32[ctr] ^= mask & (out->as_uint32[ctr] ^ in->as_uint32[ctr]);
+    }
+}
+
+static void
+ge25519_p1p1_to_p2(
+    ST_ge25519_p3*         r,
+    const ST_ge25519_p1p1* p
+)
+{
+    // The T coordinate is not required for doublings.
+    fe25519_mul(&r->X, &p->X, &p->T);
+    fe25519_mul(&r->Y, &p->Y, &p->Z);
+    fe25519_mul(&r->Z, &p->Z, &p->T);
+}
+
+static void
+ge25519_p1p1_to_p3(
+    ST_ge25519_p3*         r,
+    const ST_ge25519_p1p1* p
+)
+{
+    ge25519_p1p1_to_p2(r, p);
+    fe25519_mul(&r->T, &p->X, &p->Y);
+}
+
+// r = 2*p (only uses X, Y, Z of p).
+static void
+ge25519_dbl(
+    ST_ge25519_p1p1*     r,
+    const ST_ge25519_p3* p
+)
+{
+    fe25519 t0;
+
+    fe25519_square(&r->X, &p->X);
+    fe25519_square(&r->Z, &p->Y);
+    fe25519_square(&r->T, &p->Z);
+    fe25519_add(&r->T, &r->T, &r->T);
+    fe25519_add(&r->Y, &p->X, &p->Y);
+    fe25519_square(&t0, &r->Y);
+    fe25519_add(&r->Y, &r->Z, &r->X);
+    fe25519_sub(&r->Z, &r->Z, &r->X);
+    fe25519_sub(&r->X, &t0, &r->Y);
+    fe25519_sub(&r->T, &r->T, &r->Z);
+}
+
+// r = p + q.
+static void
+ge25519_madd(
+    ST_ge25519_p1p1*          r,
+    const ST_ge25519_p3*      p,
+    const ST_ge25519_precomp* q
+)
+{
+    fe25519 t0;
+
+    fe25519_add(&r->X, &p->Y, &p->X);
+    fe25519_sub(&r->Y, &p->Y, &p->X);
+    fe25519_mul(&r->Z, &r->X, &q->yplusx);
+    fe25519_mul(&r->Y, &r->Y, &q->yminusx);
+    fe25519_mul(&r->T, &q->xy2d, &p->T);
+    fe25519_add(&t0, &p->Z, &p->Z);
+    fe25519_sub(&r->X, &r->Z, &r->Y);
+    fe25519_add(&r->Y, &r->Z, &r->Y);
+    fe25519_add(&r->Z, &t0, &r->T);
+    fe25519_sub(&r->T, &t0, &r->T);
+}
+
+// t = b * (table entry row), b in [-8, 8].
+static void
+ge25519_select(
+    ST_ge25519_precomp* t,
+    uint8               row,
+    int8                b
+)
+{
+    uint8 bnegative = ((uint8)b) >> 7;
+    uint8 babs = b - ((-bnegative & b) << 1);
+    fe25519 minusxy2d;
+    uint8 ctr;
+
+    fe25519_setone(&t->yplusx);
+    fe25519_setone(&t->yminusx);
+    fe25519_setzero(&t->xy2d);
+
+    for (ctr = 0; ctr < 8; ctr++)
+    {
+        // equal = (babs == ctr + 1) without branches.
+        uint8 equal = (uint8)(((uint32)(babs ^ (ctr + 1)) - 1) >> 31);
+
+        fe25519_cmov(&t->yplusx, &ge25519_base_table[row][ctr].yplusx, equal);
+        fe25519_cmov(&t->yminusx, &ge25519_base_table[row][ctr].yminusx, equal);
+        fe25519_cmov(&t->xy2d, &ge25519_base_table[row][ctr].xy2d, equal);
+    }
+
+    // -(x, y) = (-x, y): swap y+x and y-x, negate 2*d*x*y.
+    fe25519_cswap(&t->yplusx, &t->yminusx, bnegative);
+    fe25519_setzero(&minusxy2d);
+    fe25519_sub(&minusxy2d, &minusxy2d, &t->xy2d);
+    fe25519_cmov(&t->xy2d, &minusxy2d, bnegative);
+}
+
+int
+crypto_scalarmult_curve25519_base(
+    unsigned char*       q,
+    const unsigned char* n
+)
+{
+    int8 e[64];
+    int8 carry;
+    uint8 i;
+    uint8 k;
+    uint8 j;
+    ST_ge25519_p3 h;
+    ST_ge25519_p1p1 r;
+    ST_ge25519_precomp t;
+
+    for (i = 0; i < 32; i++)
+    {
+        uint8 b = n[i];
+
+        if (i == 0)
+        {
+            b &= 248;
+        }
+        if (i == 31)
+        {
+            b &= 127;
+            b |= 64;
+        }
+        e[2 * i] = b & 15;
+        e[2 * i + 1] = b >> 4;
+    }
+
+    // Signed digits: each e[i] in [-8, 7], e[63] in [0, 8] (bit 255 of the
+    // clamped scalar is cleared).
+    carry = 0;
+    for (i = 0; i < 63; i++)
+    {
+        e[i] += carry;
+        carry = (e[i] + 8) >> 4;
+        e[i] -= carry << 4;
+    }
+    e[63] += carry;
+
+    // Neutral element (0, 1).
+    fe25519_setzero(&h.X);
+    fe25519_setone(&h.Y);
+    fe25519_setone(&h.Z);
+    fe25519_setzero(&h.T);
+
+    for (k = DH_BASE_TABLE_SPACING; k-- > 0; )
+    {
+        if (k != DH_BASE_TABLE_SPACING - 1)
+        {
+            // h = 16*h
+            ge25519_dbl(&r, &h);
+            ge25519_p1p1_to_p2(&h, &r);
+            ge25519_dbl(&r, &h);
+            ge25519_p1p1_to_p2(&h, &r);
+            ge25519_dbl(&r, &h);
+            ge25519_p1p1_to_p2(&h, &r);
+            ge25519_dbl(&r, &h);
+            ge25519_p1p1_to_p3(&h, &r);
+        }
+
+        for (j = 0; j < 64 / DH_BASE_TABLE_SPACING; j++)
+        {
+            ge25519_select(&t, j, e[j * DH_BASE_TABLE_SPACING + k]);
+            ge25519_madd(&r, &h, &t);
+            ge25519_p1p1_to_p3(&h, &r);
+        }
+    }
+
+    // u = (Z + Y) / (Z - Y). X and T serve as scratch buffers.
+    fe25519_sub(&t.yminusx, &h.Z, &h.Y);
+    fe25519_add(&t.yplusx, &h.Z, &h.Y);
+    fe25519_invert_useProvidedScratchBuffers(&t.yminusx, &t.yminusx, &h.X, &h.T, &t.xy2d);
+    fe25519_mul(&t.yplusx, &t.yplusx, &t.yminusx);
+    fe25519_pack(q, &t.yplusx);
+
     return 0;
 }
 
+#else // #if DH_BASE_TABLE_SPACING
+
 int
 crypto_scalarmult_curve25519_base(
     unsigned char*       q,
@@ -759,3 +1116,5 @@ crypto_scalarmult_curve25519_base(
 
     return crypto_scalarmult_curve25519(q, n, base);
 }
+
+#endif // #if DH_BASE_TABLE_SPACING
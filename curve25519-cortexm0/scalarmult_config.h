@@ -0,0 +1,16 @@
+// Generated by gen_config.py, do not edit.
+// Not selected: no combination has been measured yet. Both options
+// are off as in the original scalarmult.c. Run
+// "make select-m0-config" to select them by measurement.
+
+// 1: conditional swaps of the working points by pointers,
+// 0: by data moves.
+#ifndef DH_SWAP_BY_POINTERS
+#define DH_SWAP_BY_POINTERS 0
+#endif
+
+// 1: the last three bits of the scalar are processed by doublings,
+// 0: only ladder steps are used.
+#ifndef DH_REPLACE_LAST_THREE_LADDERSTEPS_WITH_DOUBLINGS
+#define DH_REPLACE_LAST_THREE_LADDERSTEPS_WITH_DOUBLINGS 0
+#endif
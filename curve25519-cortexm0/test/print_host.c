@@ -0,0 +1,43 @@
+/*
+ * Host versions of the output functions of print.c: output goes to 
+ * stdout. Writing EOT (4), which ends the output of the test programs 
+ * on the board, ends the program. Also used for the nRF51 under QEMU,
+ * where stdout and exit() go through ARM semihosting.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "print.h"
+
+void write_byte(unsigned char c)
+{
+  if(c == 4)
+  {
+    fflush(stdout);
+    exit(0);
+  }
+  putchar(c);
+}
+
+void print(const char *s)
+{
+  fputs(s, stdout);
+}
+
+void bigint_print(const unsigned char *x, unsigned char xlen)
+{
+  int i;
+
+  printf("(");
+  for(i=xlen-1;i>0;i--)
+    printf("%u*2^(%d*8)+",x[i],i);
+  printf("%u*2^(%d*8))",x[0],i);
+}
+
+void print_stack(const char *primitive, const unsigned int bytes, unsigned int stack)
+{
+  printf("%s: ", primitive);
+  if(bytes != (unsigned int)-1)
+    printf("[%u] ", bytes);
+  printf("%u stack bytes\n", stack);
+}
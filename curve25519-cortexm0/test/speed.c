@@ -1,6 +1,6 @@
 #include <stdio.h>
-#include <stm32f0xx.h>
 #include "print.h"
+#include "cpucycles.h"
 #include "../api.h"
 
 int main(void)
@@ -20,17 +20,21 @@ int main(void)
                                             0x6f, 0x88, 0x2b, 0x4f };*/
 
   unsigned char sharedSecretCalculatedByAlice[32];
-  SysTick_Config(12000000);
-  SysTick->VAL = 0;
-  int ini, fin;
+  unsigned long long t;
 
-  ini= SysTick->VAL;
+  t = cpucycles();
   crypto_scalarmult_curve25519(sharedSecretCalculatedByAlice, secretKeyAlice, expectedPublicKeyBob);
-  fin= SysTick->VAL;
+  t = cpucycles() - t;
 
-  fin = ini-fin;
+  sprintf(out, "crypto_scalarmult_curve25519: %llu %s", t, cpucycles_unit);
+  print(out);
+  print("\n");
+
+  t = cpucycles();
+  crypto_scalarmult_curve25519_base(sharedSecretCalculatedByAlice, secretKeyAlice);
+  t = cpucycles() - t;
 
-  sprintf(out, "Cycles: %d.", fin);
+  sprintf(out, "crypto_scalarmult_curve25519_base: %llu %s", t, cpucycles_unit);
   print(out);
   print("\n");
   
@@ -38,8 +42,3 @@ int main(void)
 
   while(1);
 }
-
-void SysTick_Handler(void)
-{
-  ;
-}
@@ -0,0 +1,72 @@
+/*
+ * Cycles of the 254 squarings of the inversion in scalarmult.c, as single
+ * squarings (square256_asm and fe25519_reduceTo256Bits_asm) and with
+ * fe25519_square_n_asm.
+ * Public domain.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "print.h"
+#include "cpucycles.h"
+
+#define SQUARINGS 254
+
+typedef union {
+  uint8_t as_uint8[32];
+  uint32_t as_uint32[8];
+} UN_256bitValue;
+
+typedef union {
+  uint8_t as_uint8[64];
+  uint32_t as_uint32[16];
+} UN_512bitValue;
+
+extern void square256_asm(UN_512bitValue *result, const UN_256bitValue *x);
+extern void fe25519_reduceTo256Bits_asm(UN_256bitValue *res,
+                                        const UN_512bitValue *in);
+extern void fe25519_square_n_asm(UN_256bitValue *out,
+                                 const UN_256bitValue *in, uint32_t n);
+
+int main(void)
+{
+  char out[500];
+  UN_256bitValue x = { { 9 } }, y = { { 9 } };
+  UN_512bitValue tmp;
+  unsigned long long t;
+  unsigned int i;
+
+  t = cpucycles();
+  for (i = 0; i < SQUARINGS; i++)
+  {
+    square256_asm(&tmp, &x);
+    fe25519_reduceTo256Bits_asm(&x, &tmp);
+  }
+  t = cpucycles() - t;
+
+  sprintf(out, "fe25519_square: [%u] %llu %s", SQUARINGS, t, cpucycles_unit);
+  print(out);
+  print("\n");
+
+  t = cpucycles();
+  fe25519_square_n_asm(&y, &y, SQUARINGS);
+  t = cpucycles() - t;
+
+  sprintf(out, "fe25519_square_n_asm: [%u] %llu %s", SQUARINGS, t,
+          cpucycles_unit);
+  print(out);
+  print("\n");
+
+  for (i = 0; i < 8; i++)
+  {
+    if (x.as_uint32[i] != y.as_uint32[i])
+    {
+      print("ERROR: fe25519_square_n_asm differs from fe25519_square\n");
+      break;
+    }
+  }
+
+  write_byte(4);
+
+  while(1);
+}
@@ -0,0 +1,73 @@
+/*
+ * Host cycle benchmark of crypto_scalarmult_curve25519 (Montgomery ladder)
+ * and crypto_scalarmult_curve25519_base (precomputed table unless built
+ * with DH_BASE_TABLE_SPACING=0). Build once per table spacing (see
+ * ../Makefile) to compare them.
+ * Public domain.
+ */
+
+#include <stdio.h>
+#include "../api.h"
+#include "cpucycles.h"
+
+#ifndef NRUNS
+#define NRUNS 64
+#endif
+
+#ifndef DH_BASE_TABLE_SPACING
+#define DH_BASE_TABLE_SPACING 2
+#endif
+
+static unsigned char sk[32];
+static unsigned char pk[32];
+static unsigned char out[32];
+
+static int cmp(const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *) a;
+  unsigned long long y = *(const unsigned long long *) b;
+  return (x > y) - (x < y);
+}
+
+static void report(const char *what, unsigned long long t[NRUNS+1])
+{
+  unsigned long long d[NRUNS];
+  unsigned int i, j;
+
+  for (i = 0; i < NRUNS; i++)
+    d[i] = t[i+1] - t[i];
+  for (i = 1; i < NRUNS; i++)
+    for (j = i; j > 0 && cmp(d+j-1, d+j) > 0; j--) {
+      unsigned long long x = d[j];
+      d[j] = d[j-1];
+      d[j-1] = x;
+    }
+  printf("spacing %2d: %s: %llu %s (median of %u)\n", DH_BASE_TABLE_SPACING,
+         what, d[NRUNS/2], cpucycles_unit, NRUNS);
+}
+
+int main(void)
+{
+  unsigned long long t[NRUNS+1];
+  unsigned int i;
+
+  for (i = 0; i < sizeof(sk); i++) sk[i] = 7*i + 1;
+  pk[0] = 9;
+
+  for (i = 0; i <= NRUNS; i++) {
+    t[i] = cpucycles();
+    crypto_scalarmult_curve25519(out, sk, pk);
+  }
+  report("crypto_scalarmult_curve25519", t);
+
+  for (i = 0; i <= NRUNS; i++) {
+    t[i] = cpucycles();
+    crypto_scalarmult_curve25519_base(out, sk);
+  }
+  if (DH_BASE_TABLE_SPACING)
+    printf("spacing %2d: table: %d bytes\n", DH_BASE_TABLE_SPACING,
+           64 / (DH_BASE_TABLE_SPACING ? DH_BASE_TABLE_SPACING : 1) * 768);
+  report("crypto_scalarmult_curve25519_base", t);
+
+  return 0;
+}
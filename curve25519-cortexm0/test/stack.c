@@ -7,7 +7,9 @@
 #define nlen crypto_scalarmult_SCALARBYTES
 #define qlen crypto_scalarmult_BYTES
 
+#ifndef MAXSTACK
 #define MAXSTACK 1000
+#endif
 
 unsigned char i;
 unsigned char n[nlen];
@@ -44,6 +46,11 @@ int main(void)
   ctr = MAXSTACK - stack_count(canary,&a);
   print_stack("crypto_scalarmult",-1,ctr);
 
+  WRITE_CANARY(&a);
+  crypto_scalarmult_base(q,n);
+  ctr = MAXSTACK - stack_count(canary,&a);
+  print_stack("crypto_scalarmult_base",-1,ctr);
+
   write_byte(4);
   while(1);
 }
@@ -0,0 +1,412 @@
+/*
+ * Differential test of the field arithmetic kernels used by scalarmult.c
+ * (multiply256x256_asm, square256_asm, fe25519_reduceTo256Bits_asm,
+ * fe25519_mpyWith121666_asm and fe25519_square_n_asm) against a
+ * straightforward byte-wise reference implementation.
+ *
+ * Products have to match the reference exactly. The reductions only have
+ * to return a 256 bit value congruent modulo 2^255-19, so their results
+ * are compared after reducing both to the canonical representation.
+ * fe25519_square_n_asm has to match repeated square256_asm and
+ * fe25519_reduceTo256Bits_asm exactly.
+ *
+ * Inputs are edge cases (0, 1, p-1, p, 2p-1, 2^256-1, ...) and
+ * pseudo-random values. Linking this test against the assembly kernels
+ * instead of fe25519_portable.c checks the assembly.
+ *
+ * With TEST_LADDERSTEP_ASM (Cortex M0, "make check-m0"), the ladder step
+ * of cortex_m0_ladderstep.s is also compared with the C ladder step of
+ * scalarmult.c, which is included for that (and thus compiled without
+ * DH_LADDERSTEP_ASM): the whole step for both swap values, with the
+ * points updated in place, and its additions and subtractions with the
+ * output aliasing either operand. All results have to match exactly.
+ * Public domain.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef RANDOM_TESTS
+#define RANDOM_TESTS 100000
+#endif
+
+#ifdef TEST_LADDERSTEP_ASM
+#include "../scalarmult.c"
+
+extern void curve25519_ladderstep_asm(fe25519 *points[4], const fe25519 *x0,
+                                      uint32 swap);
+extern void fe25519_add_lazy_test(fe25519 *out, const fe25519 *a,
+                                  const fe25519 *b);
+extern void fe25519_sub_lazy_test(fe25519 *out, const fe25519 *a,
+                                  const fe25519 *b);
+#else
+typedef union {
+  uint8_t as_uint8[32];
+  uint32_t as_uint32[8];
+} UN_256bitValue;
+
+typedef union {
+  uint8_t as_uint8[64];
+  uint32_t as_uint32[16];
+} UN_512bitValue;
+#endif
+
+extern void multiply256x256_asm(UN_512bitValue *result,
+                                const UN_256bitValue *x,
+                                const UN_256bitValue *y);
+extern void square256_asm(UN_512bitValue *result, const UN_256bitValue *x);
+extern void fe25519_reduceTo256Bits_asm(UN_256bitValue *res,
+                                        const UN_512bitValue *in);
+extern void fe25519_mpyWith121666_asm(UN_256bitValue *out,
+                                      const UN_256bitValue *in);
+extern void fe25519_square_n_asm(UN_256bitValue *out,
+                                 const UN_256bitValue *in, uint32_t n);
+
+/* Little-endian multiplication of an xlen byte and a ylen byte number. */
+static void ref_mul(uint8_t *r, const uint8_t *x, unsigned int xlen,
+                    const uint8_t *y, unsigned int ylen)
+{
+  uint32_t t[96];
+  uint32_t carry = 0;
+  unsigned int i, j;
+
+  memset(t, 0, sizeof(t));
+  for (i = 0; i < xlen; i++)
+    for (j = 0; j < ylen; j++)
+      t[i + j] += (uint32_t)x[i] * y[j];
+  for (i = 0; i < xlen + ylen; i++) {
+    carry += t[i];
+    r[i] = carry & 0xff;
+    carry >>= 8;
+  }
+}
+
+/* Canonical representation (0 <= r < 2^255-19) of a 64 byte number. */
+static void ref_canonical(uint8_t r[32], const uint8_t in[64])
+{
+  uint8_t t[64];
+  uint8_t s[32];
+  uint32_t carry;
+  int borrow;
+  unsigned int i, pass;
+
+  memcpy(t, in, 64);
+
+  // 2^256 = 38 (mod p). Three passes shrink the number to 256 bits.
+  for (pass = 0; pass < 3; pass++) {
+    carry = 0;
+    for (i = 0; i < 32; i++) {
+      carry += t[i] + 38 * (uint32_t)t[i + 32];
+      t[i] = carry & 0xff;
+      carry >>= 8;
+    }
+    for (i = 32; i < 64; i++) {
+      t[i] = carry & 0xff;
+      carry >>= 8;
+    }
+  }
+
+  // 2^255 = 19 (mod p). Twice: the first pass may leave bit 255 set.
+  for (pass = 0; pass < 2; pass++) {
+    carry = 19 * (uint32_t)(t[31] >> 7);
+    t[31] &= 0x7f;
+    for (i = 0; i < 32; i++) {
+      carry += t[i];
+      t[i] = carry & 0xff;
+      carry >>= 8;
+    }
+  }
+
+  // Now t < 2^255 < 2p; subtract p once if t >= p.
+  borrow = 0;
+  for (i = 0; i < 32; i++) {
+    int d = t[i] - borrow - (i == 0 ? 0xed : (i == 31 ? 0x7f : 0xff));
+    borrow = d < 0;
+    s[i] = d & 0xff;
+  }
+  memcpy(r, borrow ? t : s, 32);
+}
+
+static void ref_canonical256(uint8_t r[32], const uint8_t in[32])
+{
+  uint8_t t[64];
+
+  memset(t, 0, 64);
+  memcpy(t, in, 32);
+  ref_canonical(r, t);
+}
+
+static uint32_t rnd_state = 0x12345678;
+
+static uint32_t rnd(void)
+{
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state;
+}
+
+static void random256(UN_256bitValue *x)
+{
+  unsigned int i;
+  uint32_t w;
+
+  // Mostly uniform words, but also words with all bits set or cleared to
+  // provoke long carry chains.
+  for (i = 0; i < 8; i++) {
+    w = rnd();
+    switch (w & 7) {
+    case 0: x->as_uint32[i] = 0; break;
+    case 1: x->as_uint32[i] = 0xffffffff; break;
+    default: x->as_uint32[i] = rnd();
+    }
+  }
+}
+
+static void set_hex(UN_256bitValue *x, const char *hex)
+{
+  unsigned int i;
+
+  // Big-endian hex string.
+  for (i = 0; i < 32; i++)
+    sscanf(hex + 2*i, "%2hhx", &x->as_uint8[31 - i]);
+}
+
+static const char *edge_cases[] = {
+  "0000000000000000000000000000000000000000000000000000000000000000",
+  "0000000000000000000000000000000000000000000000000000000000000001",
+  "0000000000000000000000000000000000000000000000000000000000000013",
+  "7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffec",
+  "7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffed",
+  "7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffee",
+  "7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff",
+  "8000000000000000000000000000000000000000000000000000000000000000",
+  "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffd9",
+  "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffda",
+  "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffdb",
+  "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff",
+  "00000000ffffffff00000000ffffffff00000000ffffffff00000000ffffffff",
+};
+
+#define EDGE_CASES (sizeof(edge_cases)/sizeof(edge_cases[0]))
+
+static int failed = 0;
+
+static void fail(const char *what, unsigned long n)
+{
+  printf("FAIL %s %lu\n", what, n);
+  failed = 1;
+}
+
+static void test_pair(const UN_256bitValue *x, const UN_256bitValue *y,
+                      unsigned long n)
+{
+  static const uint8_t c121666[3] = { 0x42, 0xdb, 0x01 };
+  UN_512bitValue prod, ref;
+  UN_256bitValue red, sq;
+  uint8_t t[64];
+  uint8_t a[32], b[32];
+  unsigned int i, squarings;
+
+  ref_mul(ref.as_uint8, x->as_uint8, 32, y->as_uint8, 32);
+  multiply256x256_asm(&prod, x, y);
+  if (memcmp(prod.as_uint8, ref.as_uint8, 64) != 0)
+    fail("multiply256x256", n);
+
+  // Reduce the product (an actual input of the reduction in scalarmult.c).
+  fe25519_reduceTo256Bits_asm(&red, &ref);
+  ref_canonical(a, ref.as_uint8);
+  ref_canonical256(b, red.as_uint8);
+  if (memcmp(a, b, 32) != 0)
+    fail("reduceTo256Bits product", n);
+
+  // Reduce an arbitrary 512 bit value.
+  memcpy(ref.as_uint8, x->as_uint8, 32);
+  memcpy(ref.as_uint8 + 32, y->as_uint8, 32);
+  fe25519_reduceTo256Bits_asm(&red, &ref);
+  ref_canonical(a, ref.as_uint8);
+  ref_canonical256(b, red.as_uint8);
+  if (memcmp(a, b, 32) != 0)
+    fail("reduceTo256Bits", n);
+
+  ref_mul(ref.as_uint8, x->as_uint8, 32, x->as_uint8, 32);
+  square256_asm(&prod, x);
+  if (memcmp(prod.as_uint8, ref.as_uint8, 64) != 0)
+    fail("square256", n);
+
+  memset(t, 0, 64);
+  ref_mul(t, x->as_uint8, 32, c121666, 3);
+  fe25519_mpyWith121666_asm(&red, x);
+  ref_canonical(a, t);
+  ref_canonical256(b, red.as_uint8);
+  if (memcmp(a, b, 32) != 0)
+    fail("mpyWith121666", n);
+
+  // Squarings 1 to 8 times, to another buffer and in place.
+  squarings = 1 + n % 8;
+  memcpy(red.as_uint8, x->as_uint8, 32);
+  memset(t, 0, 64);
+  memcpy(t, x->as_uint8, 32);
+  for (i = 0; i < squarings; i++) {
+    square256_asm(&prod, &red);
+    fe25519_reduceTo256Bits_asm(&red, &prod);
+    ref_canonical(a, t);
+    ref_mul(t, a, 32, a, 32);
+  }
+  ref_canonical(a, t);
+  ref_canonical256(b, red.as_uint8);
+  if (memcmp(a, b, 32) != 0)
+    fail("square_n reference", n);
+  fe25519_square_n_asm(&sq, x, squarings);
+  if (memcmp(sq.as_uint8, red.as_uint8, 32) != 0)
+    fail("square_n", n);
+  memcpy(sq.as_uint8, x->as_uint8, 32);
+  fe25519_square_n_asm(&sq, &sq, squarings);
+  if (memcmp(sq.as_uint8, red.as_uint8, 32) != 0)
+    fail("square_n in place", n);
+}
+
+#ifdef TEST_LADDERSTEP_ASM
+static void test_add_sub(const fe25519 *x, const fe25519 *y, unsigned long n)
+{
+  fe25519 ref, out;
+
+  fe25519_add(&ref, x, y);
+  fe25519_add_lazy_test(&out, x, y);
+  if (memcmp(out.as_uint8, ref.as_uint8, 32) != 0)
+    fail("add_lazy", n);
+  out = *x;
+  fe25519_add_lazy_test(&out, &out, y);
+  if (memcmp(out.as_uint8, ref.as_uint8, 32) != 0)
+    fail("add_lazy out == a", n);
+  out = *y;
+  fe25519_add_lazy_test(&out, x, &out);
+  if (memcmp(out.as_uint8, ref.as_uint8, 32) != 0)
+    fail("add_lazy out == b", n);
+
+  fe25519_sub(&ref, x, y);
+  fe25519_sub_lazy_test(&out, x, y);
+  if (memcmp(out.as_uint8, ref.as_uint8, 32) != 0)
+    fail("sub_lazy", n);
+  out = *x;
+  fe25519_sub_lazy_test(&out, &out, y);
+  if (memcmp(out.as_uint8, ref.as_uint8, 32) != 0)
+    fail("sub_lazy out == a", n);
+  out = *y;
+  fe25519_sub_lazy_test(&out, x, &out);
+  if (memcmp(out.as_uint8, ref.as_uint8, 32) != 0)
+    fail("sub_lazy out == b", n);
+}
+
+// v: x0, Xp, Zp, Xq, Zq.
+static void test_ladderstep(const fe25519 *v[5], uint32 swap, unsigned long n)
+{
+  ST_curve25519ladderstepWorkingState state;
+  fe25519 x0, p[4];
+  fe25519 *points[4] = { &p[0], &p[1], &p[2], &p[3] };
+  fe25519 *ref[4];
+  unsigned int i;
+
+  memset(&state, 0, sizeof(state));
+  state.x0 = *v[0];
+  state.xp = *v[1];
+  state.zp = *v[2];
+  state.xq = *v[3];
+  state.zq = *v[4];
+#if DH_SWAP_BY_POINTERS
+  state.pXp = &state.xp;
+  state.pZp = &state.zp;
+  state.pXq = &state.xq;
+  state.pZq = &state.zq;
+#endif
+  curve25519_cswapAndLadderstep(&state, swap);
+#if DH_SWAP_BY_POINTERS
+  ref[0] = state.pXp;
+  ref[1] = state.pZp;
+  ref[2] = state.pXq;
+  ref[3] = state.pZq;
+#else
+  ref[0] = &state.xp;
+  ref[1] = &state.zp;
+  ref[2] = &state.xq;
+  ref[3] = &state.zq;
+#endif
+
+  x0 = *v[0];
+  for (i = 0; i < 4; i++)
+    p[i] = *v[i + 1];
+  curve25519_ladderstep_asm(points, &x0, swap);
+
+  for (i = 0; i < 4; i++) {
+    if (points[i] != &p[swap ? (i + 2) % 4 : i])
+      fail("ladderstep swap", n);
+    if (memcmp(points[i]->as_uint8, ref[i]->as_uint8, 32) != 0)
+      fail("ladderstep", n);
+  }
+  if (memcmp(x0.as_uint8, v[0]->as_uint8, 32) != 0)
+    fail("ladderstep x0", n);
+}
+
+static void test_ladder(const fe25519 *v[5], unsigned long n)
+{
+  test_add_sub(v[1], v[2], n);
+  test_ladderstep(v, 0, n);
+  test_ladderstep(v, 1, n);
+}
+#endif
+
+int main(void)
+{
+  UN_256bitValue x, y;
+  unsigned long n = 0;
+  unsigned int i, j;
+
+  for (i = 0; i < EDGE_CASES; i++) {
+    for (j = 0; j < EDGE_CASES; j++) {
+      set_hex(&x, edge_cases[i]);
+      set_hex(&y, edge_cases[j]);
+      test_pair(&x, &y, n++);
+    }
+  }
+
+  for (i = 0; i < RANDOM_TESTS; i++) {
+    random256(&x);
+    random256(&y);
+    test_pair(&x, &y, n++);
+  }
+
+#ifdef TEST_LADDERSTEP_ASM
+  {
+    UN_256bitValue e[EDGE_CASES], r[5];
+    const fe25519 *v[5];
+    unsigned int k;
+
+    // All pairs of edge cases for the additions and subtractions (and as
+    // Xp, Zp of the ladder step), with the other coordinates rotating
+    // through the edge cases.
+    for (i = 0; i < EDGE_CASES; i++)
+      set_hex(&e[i], edge_cases[i]);
+    for (i = 0; i < EDGE_CASES; i++) {
+      for (j = 0; j < EDGE_CASES; j++) {
+        v[0] = &e[(i + j + 1) % EDGE_CASES];
+        v[1] = &e[i];
+        v[2] = &e[j];
+        v[3] = &e[(i + 2*j + 3) % EDGE_CASES];
+        v[4] = &e[(2*i + j + 5) % EDGE_CASES];
+        test_ladder(v, n++);
+      }
+    }
+
+    for (i = 0; i < RANDOM_TESTS; i++) {
+      for (k = 0; k < 5; k++) {
+        random256(&r[k]);
+        v[k] = &r[k];
+      }
+      test_ladder(v, n++);
+    }
+  }
+#endif
+
+  return failed;
+}
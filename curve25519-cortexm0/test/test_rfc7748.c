@@ -0,0 +1,172 @@
+/*
+ * Known-answer test of crypto_scalarmult_curve25519 with the test vectors
+ * of RFC 7748:
+ *
+ * - the two vectors of section 5.2,
+ * - the iterated computation of section 5.2 after 1 and 1,000 iterations
+ *   (and after 1,000,000 iterations if started with argument "-l"; this
+ *   takes a while),
+ * - the Diffie-Hellman example of section 6.1.
+ *
+ * The vectors are also computed with the incremental API
+ * (crypto_scalarmult_curve25519_init/_step/_finish) for several slice
+ * sizes. In addition, crypto_scalarmult_curve25519_base (fixed-base table) is
+ * compared with crypto_scalarmult_curve25519 for the base point u = 9
+ * for BASE_TESTS pseudo-random scalars.
+ *
+ * Links against either the assembly or the portable field arithmetic
+ * kernels (see ../Makefile).
+ * Public domain.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "../api.h"
+
+#define BASE_TESTS 1000
+
+struct testvector {
+  const char *scalar;
+  const char *u;
+  const char *result;
+};
+
+static const struct testvector vectors[] = {
+  // Section 5.2.
+  { "a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4",
+    "e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c",
+    "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552" },
+  { "4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d",
+    "e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493",
+    "95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957" },
+  // Section 6.1: public keys of Alice and Bob.
+  { "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a",
+    "0900000000000000000000000000000000000000000000000000000000000000",
+    "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a" },
+  { "5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb",
+    "0900000000000000000000000000000000000000000000000000000000000000",
+    "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f" },
+  // Section 6.1: shared secret, computed by Alice and by Bob.
+  { "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a",
+    "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f",
+    "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742" },
+  { "5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb",
+    "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a",
+    "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742" },
+};
+
+struct iteration {
+  unsigned long count;
+  const char *result;
+};
+
+static const struct iteration iterations[] = {
+  { 1,
+    "422c8e7a6227d7bca1350b3e2bb7279f7897b87bb6854b783c60e80311ae3079" },
+  { 1000,
+    "684cf59ba83309552800ef566f2f4d3c1c3887c49360e3875f2eb94d99532c51" },
+  { 1000000,
+    "7c3911e0ab2586fd864497297e575e6f3bc601c0883c30df5f4dd2d24f665424" },
+};
+
+static void unhex(unsigned char *out, const char *hex)
+{
+  unsigned int i;
+
+  for (i = 0; i < 32; i++)
+    sscanf(hex + 2*i, "%2hhx", &out[i]);
+}
+
+static int check(const char *what, unsigned long i,
+                 const unsigned char *out, const char *expected)
+{
+  unsigned char e[32];
+
+  unhex(e, expected);
+  if (memcmp(out, e, 32) != 0) {
+    printf("FAIL %s %lu\n", what, i);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned char scalar[32];
+  unsigned char u[32];
+  unsigned char k[32];
+  unsigned char out[32];
+  unsigned long i;
+  unsigned int n;
+  unsigned int iterationcount = 2;
+  unsigned int j;
+  unsigned long rnd = 1;
+  static const unsigned int slices[] = { 1, 7, 8, 64, 255, 0 };
+  crypto_scalarmult_curve25519_state st;
+  int left, lastleft;
+  int failed = 0;
+
+  if (argc > 1 && strcmp(argv[1], "-l") == 0)
+    iterationcount = 3;
+
+  for (n = 0; n < sizeof(vectors)/sizeof(vectors[0]); n++) {
+    unhex(scalar, vectors[n].scalar);
+    unhex(u, vectors[n].u);
+    crypto_scalarmult_curve25519(out, scalar, u);
+    failed |= check("vector", n, out, vectors[n].result);
+
+    for (j = 0; j < sizeof(slices)/sizeof(slices[0]); j++) {
+      crypto_scalarmult_curve25519_init(&st, scalar, u);
+      lastleft = crypto_scalarmult_curve25519_step(&st, 0);
+      if (slices[j] > 0) {
+        while ((left = crypto_scalarmult_curve25519_step(&st, slices[j])) > 0) {
+          if (lastleft - left != (int) slices[j]) {
+            printf("FAIL step %u returns %d after %d\n", slices[j], left,
+                   lastleft);
+            failed = 1;
+            break;
+          }
+          lastleft = left;
+        }
+      }
+      crypto_scalarmult_curve25519_finish(out, &st);
+      failed |= check("incremental vector", n, out, vectors[n].result);
+    }
+  }
+
+  // crypto_scalarmult_curve25519_base uses the same base point (u = 9).
+  unhex(scalar, vectors[2].scalar);
+  crypto_scalarmult_curve25519_base(out, scalar);
+  failed |= check("base", 2, out, vectors[2].result);
+
+  memset(u, 0, 32);
+  u[0] = 9;
+  for (i = 0; i < BASE_TESTS; i++) {
+    for (j = 0; j < 32; j++) {
+      rnd = rnd * 1103515245 + 12345;
+      scalar[j] = (i < 2) ? -i : (rnd >> 16);
+    }
+    crypto_scalarmult_curve25519(k, scalar, u);
+    crypto_scalarmult_curve25519_base(out, scalar);
+    if (memcmp(out, k, 32) != 0) {
+      printf("FAIL base differs from ladder %lu\n", i);
+      failed = 1;
+    }
+  }
+
+  // k = u = 9; then k, u = X25519(k, u), k.
+  memset(k, 0, 32);
+  k[0] = 9;
+  memcpy(u, k, 32);
+  i = 0;
+  for (n = 0; n < iterationcount; n++) {
+    for (; i < iterations[n].count; i++) {
+      crypto_scalarmult_curve25519(out, k, u);
+      memcpy(u, k, 32);
+      memcpy(k, out, 32);
+    }
+    failed |= check("iterations", i, k, iterations[n].result);
+  }
+
+  return failed;
+}
@@ -15,6 +15,7 @@
  */
 
 #include "hd44780nrf51.h"
+#include <string.h>
 #include <nrf_gpio.h>
 #include <nrf_delay.h>
 
@@ -23,11 +24,19 @@
 // Waiting time for slow instructions [ms]. Must be longer than 1.52 ms.
 #define LONG_WAIT 2
 
+// DDRAM address counter of an asynchronously updated display not known 
+// (yet).
+#define ADDR_UNKNOWN 0xff
+
+// Level of pin RS of an asynchronously updated display not known (yet).
+#define RS_UNKNOWN 0xff
+
 // The following definitions should make it easy to port the code to other
 // platforms than nRF51.
 #define PIN_CFG_OUTPOUT(X) nrf_gpio_cfg_output(X)
-#define PIN_CLR(X) nrf_gpio_pin_clear(X)
-#define PIN_SET(X) nrf_gpio_pin_set(X)
+// Set or clear all pins of a mask with one register write (OUTSET, OUTCLR).
+#define PINS_CLR(MASK) nrf_gpio_pins_clear(MASK)
+#define PINS_SET(MASK) nrf_gpio_pins_set(MASK)
 #define DELAY_MS(X) nrf_delay_ms(X)
 #define DELAY_US(X) nrf_delay_us(X)
 
@@ -48,52 +57,28 @@ static void long_instr_wait()
 }
 
 /**
- * Send enable pulse.
+ * Send a nibble of 4 bits. The four bits are the 4 LSBs of parameter 
+ * "bits".
  *
- * The enable pin is set high for 1 us, then low for 1 us.
+ * The data pins to be cleared are cleared first; the data pins to be set 
+ * are set together with the enable pin. The data is latched on the 
+ * falling edge of the enable pin. The enable pin is set high for 1 us.
  * According to the data sheet, the pulse width must be at least 450 ns,
- * and the maximum cycle time at least 1 us.
- *
- * @param lcd definition of the LCD display to be used. 
- */ 
-static void enable(const struct hd44780 *lcd)
-{
-     // Send pulse of 1 us width.
-     PIN_SET(lcd->pin_e);
-     DELAY_US(1);
-     // Clear pin for 1 us.
-     PIN_CLR(lcd->pin_e);
-     DELAY_US(1);
-}
-
-/**
- * Set nibble of 4 bits on data pins. The four bits are the 4 LSBs of
- * parameter "bits".
+ * the cycle time at least 1 us (ensured by the pulse width and the 
+ * following register writes), and the data must be set up 195 ns before 
+ * the falling edge.
  *
  * @param lcd definition of the LCD display to be used.
- * @param bits the 4 LSBs of this byte will be used to set the nibble.
+ * @param bits the 4 LSBs of this byte will be sent.
  */
-static void set_nibble(const struct hd44780 *lcd, uint8_t bits)
+static void send_nibble(const struct hd44780 *lcd, uint8_t bits)
 {
-     if (bits&0x1)
-	  PIN_SET(lcd->pin_db4);
-     else
-	  PIN_CLR(lcd->pin_db4);
+     uint32_t set = lcd->nibbles[bits & 0x0f];
 
-     if (bits&0x2)
-	  PIN_SET(lcd->pin_db5);
-     else
-	  PIN_CLR(lcd->pin_db5);
-
-     if (bits&0x4)
-	  PIN_SET(lcd->pin_db6);
-     else
-	  PIN_CLR(lcd->pin_db6);
-
-     if (bits&0x8)
-	  PIN_SET(lcd->pin_db7);
-     else
-	  PIN_CLR(lcd->pin_db7);
+     PINS_CLR(lcd->mask_data & ~set);
+     PINS_SET(set | lcd->mask_e);
+     DELAY_US(1);
+     PINS_CLR(lcd->mask_e);
 }
 
 /**
@@ -105,13 +90,23 @@ static void set_nibble(const struct hd44780 *lcd, uint8_t bits)
  */
 static void send_byte(const struct hd44780 *lcd, uint8_t data)
 {     
-     uint8_t nibble = (data >> 4);
-     set_nibble(lcd, nibble);
-     enable(lcd);
+     send_nibble(lcd, data >> 4);
+     send_nibble(lcd, data & 0x0f);
+}
 
-     nibble = (data & 0x0f);
-     set_nibble(lcd, nibble);
-     enable(lcd);
+/**
+ * Calculate the masks of the pins.
+ *
+ * @param lcd definition of the LCD display to be used. 
+ */
+static void init_masks(struct hd44780 *lcd)
+{
+     lcd->mask_rs = 1ul << lcd->pin_rs;
+     lcd->mask_e = 1ul << lcd->pin_e;
+     for (unsigned int v = 0; v < 16; v++)
+	  lcd->nibbles[v] = HD44780_NIBBLE_MASK(v, lcd->pin_db4, lcd->pin_db5,
+						lcd->pin_db6, lcd->pin_db7);
+     lcd->mask_data = lcd->nibbles[0xf];
 }
 
 /**
@@ -132,12 +127,7 @@ static void init_pins(const struct hd44780 *lcd)
      PIN_CFG_OUTPOUT(lcd->pin_db7);
 
      // Set all pins low.
-     PIN_CLR(lcd->pin_rs);
-     PIN_CLR(lcd->pin_e);
-     PIN_CLR(lcd->pin_db4);
-     PIN_CLR(lcd->pin_db5);
-     PIN_CLR(lcd->pin_db6);
-     PIN_CLR(lcd->pin_db7);
+     PINS_CLR(lcd->mask_rs | lcd->mask_e | lcd->mask_data);
 }
 
 /**
@@ -155,7 +145,7 @@ static void init_pins(const struct hd44780 *lcd)
  */
 static void cmd_function_set(const struct hd44780 *lcd) 
 {
-     PIN_CLR(lcd->pin_rs);
+     PINS_CLR(lcd->mask_rs);
 
      // Byte pattern: 0 0 1 DL N F * *
      // DL = 0: 4 bits data length; DL = 1: 8 bit data length
@@ -179,7 +169,7 @@ static void cmd_function_set(const struct hd44780 *lcd)
 static void cmd_display_on_off(const struct hd44780 *lcd, bool display_on,
 			       bool cursor_on, bool cursor_blinking) 
 {
-     PIN_CLR(lcd->pin_rs);
+     PINS_CLR(lcd->mask_rs);
 
      // Byte pattern: 0 0 0 0 1 D C B
      // D: 0 = display off; 1 = display on
@@ -204,7 +194,7 @@ static void cmd_display_on_off(const struct hd44780 *lcd, bool display_on,
  */
 static void cmd_clear_display(const struct hd44780 *lcd)
 {
-     PIN_CLR(lcd->pin_rs);
+     PINS_CLR(lcd->mask_rs);
 
      // Byte pattern: 0 0 0 0 0 0 0 1
      uint8_t data = 0x01;
@@ -221,7 +211,7 @@ static void cmd_clear_display(const struct hd44780 *lcd)
  */
 static void cmd_set_ddram_addr(const struct hd44780 *lcd, uint8_t addr)
 {
-     PIN_CLR(lcd->pin_rs);
+     PINS_CLR(lcd->mask_rs);
 
      uint8_t data = 0x80;
      data |= (addr & 0x7f);
@@ -242,7 +232,7 @@ static void cmd_set_ddram_addr(const struct hd44780 *lcd, uint8_t addr)
 static void cmd_set_entry_mode(const struct hd44780 *lcd, bool incdec,
      bool shift)
 {
-     PIN_CLR(lcd->pin_rs);
+     PINS_CLR(lcd->mask_rs);
 
      // Byte pattern: 0 0 0 0 0 1 ID S
      // ID: increase (1) or decrease (0) DDRAM position after writing character.
@@ -275,24 +265,20 @@ static void init_sequence(const struct hd44780 *lcd)
      // 1.7 V). 
      DELAY_MS(100);
 
-     PIN_CLR(lcd->pin_rs);
+     PINS_CLR(lcd->mask_rs);
 
-     set_nibble(lcd, 0x03);
-     enable(lcd);
+     send_nibble(lcd, 0x03);
      // Need to wait more than 4.1 ms.
      DELAY_MS(9);
      
-     set_nibble(lcd, 0x03);
-     enable(lcd);
+     send_nibble(lcd, 0x03);
      // Need to wait more than 100 us.
      DELAY_US(200);
 
-     set_nibble(lcd, 0x03);
-     enable(lcd);
+     send_nibble(lcd, 0x03);
      short_instr_wait();
 
-     set_nibble(lcd, 0x02);
-     enable(lcd);
+     send_nibble(lcd, 0x02);
      short_instr_wait();
      
      // Set number of rows, font, and 4-bit mode.
@@ -309,8 +295,11 @@ static void init_sequence(const struct hd44780 *lcd)
      cmd_set_entry_mode(lcd, true, false);
 }
 
-void hd44780_init(const struct hd44780 *lcd)
+void hd44780_init(struct hd44780 *lcd)
 {
+     if (lcd->mask_data == 0)
+	  init_masks(lcd);
+
      init_pins(lcd);
      
      init_sequence(lcd);
@@ -330,7 +319,7 @@ void hd44780_print_line(const struct hd44780 *lcd, const char *text,
      else
 	  cmd_set_ddram_addr(lcd, HD44780_2nd_LINE_OFFSET);
 
-     PIN_SET(lcd->pin_rs);
+     PINS_SET(lcd->mask_rs);
      for (unsigned int i = 0; i < length; i++) {
 	  uint8_t character = text[i];
 	  send_byte(lcd, character);
@@ -352,7 +341,7 @@ void hd44780_clear_line(const struct hd44780 *lcd, unsigned int line)
      else
 	  cmd_set_ddram_addr(lcd, HD44780_2nd_LINE_OFFSET);
 
-     PIN_SET(lcd->pin_rs);
+     PINS_SET(lcd->mask_rs);
      for (unsigned int i = 0; i < lcd->columns; i++) {
 	  uint8_t character = ' ';
 	  send_byte(lcd, character);
@@ -361,3 +350,83 @@ void hd44780_clear_line(const struct hd44780 *lcd, unsigned int line)
 	  // incremented by 1.
      }
 }
+
+/**
+ * Number of rows and columns of a display updated asynchronously.
+ */
+static unsigned int async_rows(const struct hd44780_async *async)
+{
+     return (async->lcd->rows < 2 ? async->lcd->rows : 2);
+}
+
+static unsigned int async_columns(const struct hd44780_async *async)
+{
+     return (async->lcd->columns < HD44780_ASYNC_MAX_COLUMNS ? 
+	     async->lcd->columns : HD44780_ASYNC_MAX_COLUMNS);
+}
+
+void hd44780_async_init(struct hd44780_async *async, 
+			const struct hd44780 *lcd)
+{
+     async->lcd = lcd;
+     // A cleared display shows spaces.
+     memset(async->frame, ' ', sizeof(async->frame));
+     memset(async->ddram, ' ', sizeof(async->ddram));
+     async->addr = ADDR_UNKNOWN;
+     async->rs = RS_UNKNOWN;
+}
+
+void hd44780_async_print_line(struct hd44780_async *async, const char *text,
+			      unsigned int length, unsigned int line)
+{
+     if (line >= async_rows(async))
+	  return;
+
+     unsigned int columns = async_columns(async);
+     for (unsigned int i = 0; i < columns; i++)
+	  async->frame[line][i] = (i < length ? text[i] : ' ');
+}
+
+bool hd44780_async_step(struct hd44780_async *async)
+{
+     const struct hd44780 *lcd = async->lcd;
+     unsigned int rows = async_rows(async);
+     unsigned int columns = async_columns(async);
+
+     for (unsigned int row = 0; row < rows; row++) {
+	  for (unsigned int column = 0; column < columns; column++) {
+	       char character = async->frame[row][column];
+	       if (character == async->ddram[row][column])
+		    continue;
+
+	       uint8_t addr = column;
+	       if (row == 1)
+		    addr += HD44780_2nd_LINE_OFFSET;
+	       if (async->addr != addr) {
+		    // Set DDRAM address; the character is written by the 
+		    // next step.
+		    if (async->rs != 0) {
+			 PINS_CLR(lcd->mask_rs);
+			 async->rs = 0;
+		    }
+		    send_byte(lcd, 0x80 | addr);
+		    async->addr = addr;
+	       } else {
+		    // RS is only written when it changes, as by 
+		    // hd44780_print_line() once per line.
+		    if (async->rs != 1) {
+			 PINS_SET(lcd->mask_rs);
+			 async->rs = 1;
+		    }
+		    send_byte(lcd, character);
+		    async->ddram[row][column] = character;
+		    // After the write operation, the DDRAM address is 
+		    // automatically incremented by 1.
+		    async->addr++;
+	       }
+	       return true;
+	  }
+     }
+
+     return false;
+}
@@ -18,12 +18,18 @@
 #define HD44780NRF51_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifndef HD44780_2nd_LINE_OFFSET
 // The DDRAM memory offset of the second line of the display.
 #define HD44780_2nd_LINE_OFFSET 0x40
 #endif
 
+#ifndef HD44780_ASYNC_MAX_COLUMNS
+// Max. number of columns of a display updated asynchronously.
+#define HD44780_ASYNC_MAX_COLUMNS 16
+#endif
+
 /**
  * Pins connected to the LCD.
  *
@@ -32,6 +38,12 @@
  * The LCD is time-driven using wait statements rather than testing the
  * busy flag. Thus, we do never read from the display and assume that the r/w 
  * pin of the display has been hard-wired to GND (fixed write mode).
+ *
+ * The pins are written through the OUTSET and OUTCLR registers of the GPIO
+ * port, so a nibble is put on the data pins with one write of each 
+ * register. The masks of the pins are calculated by hd44780_init() unless
+ * the structure has been initialized with HD44780_PINS(), which 
+ * calculates them at compile time.
  */
 struct hd44780 {
      unsigned int pin_rs;  /**< Register select */
@@ -42,14 +54,57 @@ struct hd44780 {
      unsigned int pin_db7; /**< Data pin 7 */
      unsigned int rows;    /**< Number of rows (1 or 2) */
      unsigned int columns; /**< Number of columns */
+     uint32_t mask_rs;     /**< Mask of pin RS */
+     uint32_t mask_e;      /**< Mask of pin E */
+     uint32_t mask_data;   /**< Mask of pins DB4-7 */
+     uint32_t nibbles[16]; /**< Masks of the data pins set per nibble */
 };
 
 /**
- * Initialization of the LCD.
+ * Mask of the data pins set for the nibble with value v.
+ */
+#define HD44780_NIBBLE_MASK(v, db4, db5, db6, db7) \
+     ((((v) & 0x1) ? 1ul << (db4) : 0) | (((v) & 0x2) ? 1ul << (db5) : 0) | \
+      (((v) & 0x4) ? 1ul << (db6) : 0) | (((v) & 0x8) ? 1ul << (db7) : 0))
+
+/**
+ * Initializer of the pins and masks of struct hd44780 for a pinout known 
+ * at compile time, e.g.:
+ *
+ * struct hd44780 lcd = {HD44780_PINS(16, 19, 12, 13, 14, 15), 
+ *                       .rows = 2, .columns = 16};
+ */
+#define HD44780_PINS(rs, e, db4, db5, db6, db7) \
+     .pin_rs = (rs), .pin_e = (e), \
+     .pin_db4 = (db4), .pin_db5 = (db5), .pin_db6 = (db6), .pin_db7 = (db7), \
+     .mask_rs = 1ul << (rs), .mask_e = 1ul << (e), \
+     .mask_data = HD44780_NIBBLE_MASK(0xf, db4, db5, db6, db7), \
+     .nibbles = { \
+	  HD44780_NIBBLE_MASK(0x0, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0x1, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0x2, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0x3, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0x4, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0x5, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0x6, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0x7, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0x8, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0x9, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0xa, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0xb, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0xc, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0xd, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0xe, db4, db5, db6, db7), \
+	  HD44780_NIBBLE_MASK(0xf, db4, db5, db6, db7) \
+     }
+
+/**
+ * Initialization of the LCD. Calculates the masks of the pins, unless they
+ * have been set by HD44780_PINS().
  *
  *  @param lcd definition of the LCD display to be used.
  */
-void hd44780_init(const struct hd44780 *lcd);
+void hd44780_init(struct hd44780 *lcd);
 
 /**
  * Turn the display, cursor, and cursor blinking on or off.  
@@ -89,4 +144,58 @@ void hd44780_clear_display(const struct hd44780 *lcd);
  */
 void hd44780_clear_line(const struct hd44780 *lcd, unsigned int line);
 
+/**
+ * Display updated asynchronously.
+ *
+ * The text to be shown (frame) is written to RAM without waiting for the 
+ * display. The display is updated by calling hd44780_async_step() 
+ * repeatedly, e.g., from a timer interrupt, which sends one instruction
+ * per call. A shadow of the DDRAM of the display is kept, so only cells
+ * that differ from the frame are written, and the display is never 
+ * cleared (which takes 1.52 ms).
+ */
+struct hd44780_async {
+     const struct hd44780 *lcd;
+     char frame[2][HD44780_ASYNC_MAX_COLUMNS]; /**< Text to be shown */
+     char ddram[2][HD44780_ASYNC_MAX_COLUMNS]; /**< Text shown */
+     uint8_t addr; /**< DDRAM address counter of the display */
+     uint8_t rs;   /**< Level of pin RS */
+};
+
+/**
+ * Initialization of asynchronous updates of an LCD initialized and 
+ * cleared by hd44780_init(). The display must not be written by other 
+ * functions afterwards.
+ *
+ * @param async the state of asynchronous updates.
+ * @param lcd definition of the LCD display to be used (at most 
+ * HD44780_ASYNC_MAX_COLUMNS columns are used).
+ */
+void hd44780_async_init(struct hd44780_async *async, 
+			const struct hd44780 *lcd);
+
+/**
+ * Sets one line of the text to be shown. The rest of the line is filled
+ * with spaces. The display is updated by hd44780_async_step().
+ *
+ * @param async the state of asynchronous updates.
+ * @param text text to be printed.
+ * @param length length of text.
+ * @param line line (0 or 1) where the text is to be printed.
+ */
+void hd44780_async_print_line(struct hd44780_async *async, const char *text,
+			      unsigned int length, unsigned int line);
+
+/**
+ * Sends the next instruction of updating the display (setting the DDRAM
+ * address or writing a changed character). After an instruction has been
+ * sent, the next call must be at least 37 us later (execution time of 
+ * the instruction). Calls must not interrupt each other.
+ *
+ * @param async the state of asynchronous updates.
+ * @return true if an instruction has been sent; false if the display 
+ * shows the frame.
+ */
+bool hd44780_async_step(struct hd44780_async *async);
+
 #endif
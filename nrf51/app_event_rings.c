@@ -0,0 +1,167 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include "app_event_rings.h"
+
+// Loads and stores of the ring indices. The acquire/release semantics order 
+// the accesses to the event with respect to the index updates. On the 
+// (single core) Cortex-M0, only the compiler needs to be kept from 
+// reordering; the host tests run producers and consumer on different cores.
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+// The host simulation delivers pending interrupts whenever the main loop 
+// looks for events (see sim/Makefile).
+#ifdef APP_EVENT_POLL_HOOK
+void APP_EVENT_POLL_HOOK(void);
+#endif
+
+#define RING_MASK (APP_EVENT_RING_SIZE - 1)
+#define PAYLOADS_MASK (APP_EVENT_PAYLOAD_SLOTS - 1)
+
+void app_event_rings_init(struct app_event_rings *rings)
+{
+     unsigned int i;
+
+     for (i = 0; i < APP_EVENT_SOURCE_COUNT; i++) {
+	  rings->rings[i].head = 0;
+	  rings->rings[i].tail = 0;
+     }
+
+     // All payload slots are free.
+     for (i = 0; i < APP_EVENT_PAYLOAD_SLOTS; i++)
+	  rings->free_payloads[i] = i;
+     rings->free_payloads_head = APP_EVENT_PAYLOAD_SLOTS;
+     rings->free_payloads_tail = 0;
+}
+
+static int ring_add(struct app_event_ring *ring, struct app_event event)
+{
+     // Only the producer writes head.
+     uint32_t head = ring->head;
+
+     if (head - LOAD_ACQUIRE(&ring->tail) == APP_EVENT_RING_SIZE)
+	  return -1;
+
+     ring->events[head & RING_MASK] = event;
+     STORE_RELEASE(&ring->head, head + 1);
+
+     return 0;
+}
+
+int app_event_rings_add(struct app_event_rings *rings, 
+			enum app_event_source source, struct app_event event)
+{
+     event.payload = 0;
+     return ring_add(&rings->rings[source], event);
+}
+
+int app_event_rings_add_payload(struct app_event_rings *rings, 
+				enum app_event_source source, 
+				struct app_event event, 
+				const uint8_t *data, unsigned int length)
+{
+     struct app_event_ring *ring = &rings->rings[source];
+
+     if (length > APP_EVENT_PAYLOAD_SIZE)
+	  return -1;
+
+     // Check for space in the ring first, so we do not need to give back 
+     // the slot. Only we add to this ring, so the space cannot vanish.
+     if (ring->head - LOAD_ACQUIRE(&ring->tail) == APP_EVENT_RING_SIZE)
+	  return -1;
+
+     // Take a free slot (we are the only consumer of the free slots).
+     uint32_t tail = rings->free_payloads_tail;
+     if (LOAD_ACQUIRE(&rings->free_payloads_head) == tail)
+	  return -1;
+     uint8_t slot = rings->free_payloads[tail & PAYLOADS_MASK];
+     STORE_RELEASE(&rings->free_payloads_tail, tail + 1);
+
+     struct app_event_payload *payload = &rings->payloads[slot];
+     for (unsigned int i = 0; i < length; i++)
+	  payload->data[i] = data[i];
+     payload->length = length;
+
+     event.payload = slot + 1;
+     return ring_add(ring, event);
+}
+
+const struct app_event_payload *app_event_rings_payload(
+     struct app_event_rings *rings, struct app_event event)
+{
+     if (event.payload == 0)
+	  return NULL;
+
+     return &rings->payloads[event.payload - 1];
+}
+
+void app_event_rings_release(struct app_event_rings *rings, 
+			     struct app_event event)
+{
+     if (event.payload == 0)
+	  return;
+
+     // Only the main loop gives back slots.
+     uint32_t head = rings->free_payloads_head;
+     rings->free_payloads[head & PAYLOADS_MASK] = event.payload - 1;
+     STORE_RELEASE(&rings->free_payloads_head, head + 1);
+}
+
+static int ring_get(struct app_event_ring *ring, struct app_event *event)
+{
+     // Only the consumer writes tail.
+     uint32_t tail = ring->tail;
+
+     if (LOAD_ACQUIRE(&ring->head) == tail)
+	  return -1;
+
+     *event = ring->events[tail & RING_MASK];
+     STORE_RELEASE(&ring->tail, tail + 1);
+
+     return 0;
+}
+
+int app_event_rings_get(struct app_event_rings *rings, 
+			struct app_event *event)
+{
+     unsigned int i;
+
+#ifdef APP_EVENT_POLL_HOOK
+     APP_EVENT_POLL_HOOK();
+#endif
+
+     for (i = 0; i < APP_EVENT_SOURCE_COUNT; i++) {
+	  if (ring_get(&rings->rings[i], event) == 0)
+	       return 0;
+     }
+
+     return -1;
+}
+
+unsigned int app_event_rings_drain(struct app_event_rings *rings, 
+				   struct app_event *events, unsigned int max)
+{
+     unsigned int n = 0;
+
+     while (n < max && app_event_rings_get(rings, &events[n]) == 0)
+	  n++;
+
+     return n;
+}
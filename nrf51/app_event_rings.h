@@ -0,0 +1,175 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef APP_EVENT_RINGS_H
+#define APP_EVENT_RINGS_H
+
+#include <stdint.h>
+
+// Application events are passed from interrupt handlers to the main loop
+// through one single-producer/single-consumer ring per event source. 
+// Each ring is written by exactly one context (the interrupt handler of 
+// its source) and read by the main loop only, so no interrupts need to be
+// disabled: the producer owns the head index, the consumer owns the tail 
+// index, and both are only written with release semantics after the 
+// event itself has been written or read.
+//
+// The sources are listed in order of priority (highest first). The main 
+// loop takes events from the non-empty ring of highest priority. Within 
+// one source, events are delivered in FIFO order.
+enum app_event_source {
+     // BLE events (softdevice event interrupt).
+     APP_EVENT_SOURCE_BLE,
+     // Persistent storage callbacks (softdevice system events, same 
+     // interrupt as BLE events, but separate ring to keep one producer 
+     // per ring also if this changes).
+     APP_EVENT_SOURCE_PSTORE,
+     // App timer handlers.
+     APP_EVENT_SOURCE_TIMER,
+     // Button handlers (called from the app timer interrupt).
+     APP_EVENT_SOURCE_BUTTON,
+     // Events created by the main loop itself (e.g., background work 
+     // done).
+     APP_EVENT_SOURCE_APP,
+     APP_EVENT_SOURCE_COUNT
+};
+
+// Number of events per ring. Must be a power of two.
+#ifndef APP_EVENT_RING_SIZE
+#define APP_EVENT_RING_SIZE 8
+#endif
+
+#if (APP_EVENT_RING_SIZE & (APP_EVENT_RING_SIZE - 1)) != 0
+#error "APP_EVENT_RING_SIZE must be a power of two"
+#endif
+
+// Events may carry a payload (e.g., the data of a GATT write), which is 
+// stored in a slot of a statically allocated pool. The slot belongs to the
+// event from app_event_rings_add_payload() until the main loop hands it 
+// back with app_event_rings_release() after processing the event. This 
+// way, the data of consecutive writes does not overwrite each other, even
+// if the main loop is slower than the client.
+//
+// Only one source may add events with payload (the pool is a 
+// single-producer/single-consumer structure, too): APP_EVENT_SOURCE_BLE.
+
+// Number of payload slots. Must be a power of two, at most 255.
+#ifndef APP_EVENT_PAYLOAD_SLOTS
+#define APP_EVENT_PAYLOAD_SLOTS 8
+#endif
+
+// Max. length of a payload [bytes]: the longest write with the default 
+// ATT MTU (23 bytes), or a reassembled long write of up to 36 bytes.
+#ifndef APP_EVENT_PAYLOAD_SIZE
+#define APP_EVENT_PAYLOAD_SIZE 36
+#endif
+
+#if (APP_EVENT_PAYLOAD_SLOTS & (APP_EVENT_PAYLOAD_SLOTS - 1)) != 0 || \
+     APP_EVENT_PAYLOAD_SLOTS > 255
+#error "APP_EVENT_PAYLOAD_SLOTS must be a power of two less than 256"
+#endif
+
+struct app_event {
+     uint8_t event_type;
+     // Number of the payload slot plus one; 0 if the event has no payload.
+     uint8_t payload;
+};
+
+struct app_event_payload {
+     uint8_t length;
+     uint8_t data[APP_EVENT_PAYLOAD_SIZE];
+};
+
+struct app_event_ring {
+     struct app_event events[APP_EVENT_RING_SIZE];
+     // Free-running counters of added (head) and removed (tail) events. 
+     // The ring is empty iff head == tail, full iff 
+     // head - tail == APP_EVENT_RING_SIZE.
+     uint32_t head;
+     uint32_t tail;
+};
+
+struct app_event_rings {
+     struct app_event_ring rings[APP_EVENT_SOURCE_COUNT];
+     struct app_event_payload payloads[APP_EVENT_PAYLOAD_SLOTS];
+     // Ring of free payload slot numbers. Written by the main loop when 
+     // releasing an event, read by the source adding events with payload.
+     uint8_t free_payloads[APP_EVENT_PAYLOAD_SLOTS];
+     uint32_t free_payloads_head;
+     uint32_t free_payloads_tail;
+};
+
+void app_event_rings_init(struct app_event_rings *rings);
+
+/**
+ * Add an event to the ring of the given source. Must only be called from 
+ * the context of this source.
+ *
+ * @return 0 on success; -1 if the ring is full.
+ */
+int app_event_rings_add(struct app_event_rings *rings, 
+			enum app_event_source source, struct app_event event);
+
+/**
+ * Add an event with payload to the ring of the given source. The payload
+ * is copied into a free slot of the payload pool. Must only be called from
+ * the context of the (only) source adding events with payload.
+ *
+ * @return 0 on success; -1 if the ring is full, no payload slot is free, 
+ * or the payload is too long.
+ */
+int app_event_rings_add_payload(struct app_event_rings *rings, 
+				enum app_event_source source, 
+				struct app_event event, 
+				const uint8_t *data, unsigned int length);
+
+/**
+ * Payload of an event, or NULL if the event has no payload. Only valid 
+ * until the event is released.
+ */
+const struct app_event_payload *app_event_rings_payload(
+     struct app_event_rings *rings, struct app_event event);
+
+/**
+ * Hand the payload slot of a processed event back to the pool (no-op for 
+ * events without payload). Must be called by the main loop for every 
+ * event taken from the rings, once it is processed.
+ */
+void app_event_rings_release(struct app_event_rings *rings, 
+			     struct app_event event);
+
+/**
+ * Get the next event of highest priority. Must only be called from the
+ * main loop.
+ *
+ * @return 0 on success; -1 if all rings are empty.
+ */
+int app_event_rings_get(struct app_event_rings *rings, 
+			struct app_event *event);
+
+/**
+ * Get up to max events at once, in the same order as repeated calls of 
+ * app_event_rings_get() would return them. Must only be called from the
+ * main loop.
+ *
+ * @return number of events written to events.
+ */
+unsigned int app_event_rings_drain(struct app_event_rings *rings, 
+				   struct app_event *events, unsigned int max);
+
+#endif
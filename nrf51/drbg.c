@@ -0,0 +1,218 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <avrnacl.h>
+#include "drbg.h"
+
+#define BLOCK_LENGTH crypto_hashblocks_sha512_BLOCKBYTES
+
+extern const unsigned char avrnacl_sha512_iv[64];
+
+// Part of the message of an HMAC.
+struct part {
+     const uint8_t *data;
+     unsigned int length;
+};
+
+// SHA-512 of a message given in parts (the inner hash of HMAC).
+struct hash {
+     uint8_t h[64];
+     uint8_t block[BLOCK_LENGTH];
+     unsigned int fill;
+     uint32_t length;
+};
+
+static void hash_update(struct hash *hash, const uint8_t *data,
+			unsigned int length)
+{
+     hash->length += length;
+     while (length > 0) {
+	  unsigned int n = BLOCK_LENGTH - hash->fill;
+	  if (n > length)
+	       n = length;
+	  memcpy(&hash->block[hash->fill], data, n);
+	  hash->fill += n;
+	  data += n;
+	  length -= n;
+	  if (hash->fill == BLOCK_LENGTH) {
+	       crypto_hashblocks_sha512(hash->h, hash->block, BLOCK_LENGTH);
+	       hash->fill = 0;
+	  }
+     }
+}
+
+static void hash_finish(struct hash *hash)
+{
+     uint64_t bits = ((uint64_t) hash->length) << 3;
+
+     hash->block[hash->fill++] = 0x80;
+     if (hash->fill > BLOCK_LENGTH - 16) {
+	  memset(&hash->block[hash->fill], 0, BLOCK_LENGTH - hash->fill);
+	  crypto_hashblocks_sha512(hash->h, hash->block, BLOCK_LENGTH);
+	  hash->fill = 0;
+     }
+     memset(&hash->block[hash->fill], 0, BLOCK_LENGTH - 8 - hash->fill);
+     for (unsigned int i = 0; i < 8; i++)
+	  hash->block[BLOCK_LENGTH - 1 - i] = (uint8_t) (bits >> (8*i));
+     crypto_hashblocks_sha512(hash->h, hash->block, BLOCK_LENGTH);
+}
+
+/**
+ * Set the HMAC key K (DRBG_OUTLEN bytes, shorter than a block).
+ */
+static void set_key(struct drbg *drbg, const uint8_t k[DRBG_OUTLEN])
+{
+     uint8_t padded[BLOCK_LENGTH];
+
+     memcpy(drbg->inner, avrnacl_sha512_iv, 64);
+     memset(padded, 0x36, BLOCK_LENGTH);
+     for (unsigned int i = 0; i < DRBG_OUTLEN; i++)
+	  padded[i] ^= k[i];
+     crypto_hashblocks_sha512(drbg->inner, padded, BLOCK_LENGTH);
+
+     memcpy(drbg->outer, avrnacl_sha512_iv, 64);
+     memset(padded, 0x5c, BLOCK_LENGTH);
+     for (unsigned int i = 0; i < DRBG_OUTLEN; i++)
+	  padded[i] ^= k[i];
+     crypto_hashblocks_sha512(drbg->outer, padded, BLOCK_LENGTH);
+
+     memset(padded, 0, BLOCK_LENGTH);
+}
+
+/**
+ * out = HMAC(K, V || separator || provided data), without the separator if
+ * it is negative. out may be V.
+ */
+static void hmac(struct drbg *drbg, uint8_t out[DRBG_OUTLEN], int separator,
+		 const struct part *provided, unsigned int parts)
+{
+     struct hash hash;
+
+     memcpy(hash.h, drbg->inner, 64);
+     hash.fill = 0;
+     hash.length = BLOCK_LENGTH;
+     hash_update(&hash, drbg->v, DRBG_OUTLEN);
+     if (separator >= 0) {
+	  uint8_t byte = (uint8_t) separator;
+	  hash_update(&hash, &byte, 1);
+     }
+     for (unsigned int i = 0; i < parts; i++)
+	  hash_update(&hash, provided[i].data, provided[i].length);
+     hash_finish(&hash);
+
+     // Outer hash: one block with the inner hash, padding, and the length
+     // of the outer padding block plus the inner hash (192 bytes).
+     memcpy(hash.block, hash.h, 64);
+     memcpy(hash.h, drbg->outer, 64);
+     hash.block[64] = 0x80;
+     memset(&hash.block[65], 0, BLOCK_LENGTH - 65);
+     hash.block[BLOCK_LENGTH - 2] = (192*8) >> 8;
+     hash.block[BLOCK_LENGTH - 1] = (uint8_t) (192*8);
+     crypto_hashblocks_sha512(hash.h, hash.block, BLOCK_LENGTH);
+     memcpy(out, hash.h, DRBG_OUTLEN);
+
+     memset(&hash, 0, sizeof(hash));
+}
+
+/**
+ * HMAC_DRBG_Update (SP 800-90A, 10.1.2.2).
+ */
+static void update(struct drbg *drbg, const struct part *provided,
+		   unsigned int parts)
+{
+     uint8_t k[DRBG_OUTLEN];
+     unsigned int length = 0;
+
+     for (unsigned int i = 0; i < parts; i++)
+	  length += provided[i].length;
+
+     for (int separator = 0; separator < 2; separator++) {
+	  hmac(drbg, k, separator, provided, parts);
+	  set_key(drbg, k);
+	  hmac(drbg, drbg->v, -1, NULL, 0);
+	  if (length == 0)
+	       break;
+     }
+
+     memset(k, 0, sizeof(k));
+}
+
+void drbg_instantiate(struct drbg *drbg,
+		      const uint8_t *entropy, unsigned int entropy_length,
+		      const uint8_t *nonce, unsigned int nonce_length,
+		      const uint8_t *personalization,
+		      unsigned int personalization_length)
+{
+     const struct part seed[] = {
+	  {entropy, entropy_length},
+	  {nonce, nonce_length},
+	  {personalization, personalization_length}
+     };
+     uint8_t k[DRBG_OUTLEN];
+
+     memset(k, 0x00, DRBG_OUTLEN);
+     set_key(drbg, k);
+     memset(drbg->v, 0x01, DRBG_OUTLEN);
+     update(drbg, seed, 3);
+     drbg->reseed_counter = 1;
+}
+
+void drbg_reseed(struct drbg *drbg,
+		 const uint8_t *entropy, unsigned int entropy_length,
+		 const uint8_t *additional, unsigned int additional_length)
+{
+     const struct part seed[] = {
+	  {entropy, entropy_length},
+	  {additional, additional_length}
+     };
+
+     update(drbg, seed, 2);
+     drbg->reseed_counter = 1;
+}
+
+int drbg_generate(struct drbg *drbg, uint8_t *out, unsigned int length,
+		  const uint8_t *additional, unsigned int additional_length)
+{
+     const struct part input = {additional, additional_length};
+
+     if (drbg->reseed_counter > DRBG_RESEED_INTERVAL ||
+	 length > DRBG_MAX_REQUEST)
+	  return -1;
+
+     if (additional_length > 0)
+	  update(drbg, &input, 1);
+
+     while (length > 0) {
+	  unsigned int n = length < DRBG_OUTLEN ? length : DRBG_OUTLEN;
+	  hmac(drbg, drbg->v, -1, NULL, 0);
+	  memcpy(out, drbg->v, n);
+	  out += n;
+	  length -= n;
+     }
+
+     update(drbg, &input, 1);
+     drbg->reseed_counter++;
+
+     return 0;
+}
+
+uint32_t drbg_requests(const struct drbg *drbg)
+{
+     return drbg->reseed_counter - 1;
+}
@@ -0,0 +1,99 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DRBG_H
+#define DRBG_H
+
+#include <stdint.h>
+
+// Deterministic random bit generator: HMAC_DRBG with SHA-512 as specified
+// in NIST SP 800-90A (without prediction resistance), security strength
+// 256 bits. It is seeded with entropy from the random number generator of
+// the softdevice, and turns it into any number of random bytes without
+// waiting for the hardware to produce more entropy.
+//
+// Instead of the key K, the SHA-512 chaining values after compressing the
+// inner and outer HMAC padding blocks of K are kept, so computing
+// HMAC(K, V) takes two compressions instead of four. The key changes with
+// every update of the state, so this saves the padding blocks of all
+// further HMACs under the same key.
+//
+// The DRBG only computes; collecting the entropy and deciding when to
+// reseed is up to the caller.
+
+// Length of the output of SHA-512 (and of V) [bytes].
+#define DRBG_OUTLEN 64
+
+// Minimum entropy input for instantiating and reseeding (security strength
+// 256 bits) [bytes]. SP 800-90A also requires a nonce of at least half the
+// security strength when instantiating.
+#define DRBG_MIN_ENTROPY 32
+#define DRBG_MIN_NONCE 16
+
+// Max. number of bytes per request (SP 800-90A: 2^19 bits).
+#define DRBG_MAX_REQUEST 65535
+
+// Number of requests after which the DRBG must be reseeded. SP 800-90A
+// allows up to 2^48; the caller should reseed much earlier whenever new
+// entropy is available.
+#ifndef DRBG_RESEED_INTERVAL
+#define DRBG_RESEED_INTERVAL 0x10000ul
+#endif
+
+struct drbg {
+     // SHA-512 chaining values after the inner and outer padding blocks
+     // of HMAC with key K.
+     uint8_t inner[64];
+     uint8_t outer[64];
+     uint8_t v[DRBG_OUTLEN];
+     uint32_t reseed_counter;
+};
+
+/**
+ * Instantiate the DRBG from entropy input, a nonce, and an optional
+ * personalization string (length 0 if none). The seed material is the
+ * concatenation of the three.
+ */
+void drbg_instantiate(struct drbg *drbg,
+		      const uint8_t *entropy, unsigned int entropy_length,
+		      const uint8_t *nonce, unsigned int nonce_length,
+		      const uint8_t *personalization,
+		      unsigned int personalization_length);
+
+/**
+ * Reseed with new entropy input and optional additional input.
+ */
+void drbg_reseed(struct drbg *drbg,
+		 const uint8_t *entropy, unsigned int entropy_length,
+		 const uint8_t *additional, unsigned int additional_length);
+
+/**
+ * Generate random bytes, with optional additional input.
+ *
+ * @return 0 on success; -1 if the DRBG must be reseeded first, or the
+ * request is too long.
+ */
+int drbg_generate(struct drbg *drbg, uint8_t *out, unsigned int length,
+		  const uint8_t *additional, unsigned int additional_length);
+
+/**
+ * Number of requests since instantiating or the last reseed.
+ */
+uint32_t drbg_requests(const struct drbg *drbg);
+
+#endif
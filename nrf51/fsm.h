@@ -0,0 +1,70 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FSM_H
+#define FSM_H
+
+#include <stdint.h>
+#include "app_event_rings.h"
+
+// Table-driven state machine. The transition table has one entry per
+// (state, event) pair, so the transition for an event is found with a
+// single lookup. An entry names an action and the next state. Actions are
+// numbers (indices into a table of action functions) rather than function
+// pointers, so an entry takes two bytes of flash. Actions are shared by
+// all entries doing the same thing (e.g., aborting when the client
+// disconnects), so a new state or protocol mode mostly adds table entries
+// rather than code.
+//
+// Entries not set (all zero) ignore the event. An action may set the state
+// itself (e.g., if the next state depends on a check); its entry then
+// keeps the state (FSM_ACTION).
+
+// Action number 0: no action.
+#define FSM_NO_ACTION 0
+
+// Next state 0: keep the current state (or the state set by the action).
+// Other states are stored plus one.
+#define FSM_SAME_STATE 0
+
+struct fsm_transition {
+     uint8_t action;
+     uint8_t next_state;
+};
+
+// Entry: do the action, then go to the given state.
+#define FSM_TRANSITION(action, state) {(action), (state) + 1}
+// Entry: do the action, and keep the state (unless the action sets it).
+#define FSM_ACTION(action) {(action), FSM_SAME_STATE}
+// Entry: go to the given state without an action.
+#define FSM_GOTO(state) {FSM_NO_ACTION, (state) + 1}
+
+typedef void (*fsm_action_t)(struct app_event event);
+
+// Description of a state machine for checking its tables on the host (see
+// sim/transitions.c). The transition table is a two-dimensional array
+// [states][events].
+struct fsm {
+     const struct fsm_transition *transitions;
+     const fsm_action_t *actions;
+     uint8_t state_count;
+     uint8_t event_count;
+     uint8_t action_count;
+};
+
+#endif
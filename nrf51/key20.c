@@ -16,6 +16,7 @@
  * limitations under the License.
  */
 
+#include <stdio.h>
 #include <string.h>
 #include <nrf.h>
 #include <nrf_gpio.h>
@@ -24,12 +25,16 @@
 #include <ble_advdata.h>
 #include <app_timer.h>
 #include <app_button.h>
+#include <app_util_platform.h>
 #include <pstorage.h>
 #include <curve25519-cortexm0.h>
 #include <avrnacl.h>
 #include <hd44780nrf51.h>
 #include <ble_hci.h>
-#include "app_event_queue.h"
+#include "app_event_rings.h"
+#include "key_store.h"
+#include "fsm.h"
+#include "drbg.h"
 
 // Pinout of development board (DK):
 // * Pin 17: Button 1
@@ -63,15 +68,128 @@
 #define PIN_LCD_DB7 6
 #endif
 
-// Maximum number of pending application events. 
 // In order to decouple event processing from event generation happening
-// in the context of interrupts, we use an application event queue.
-// Application events are then processed outside the interrupt context.
-#define APP_EVENT_QUEUE_SIZE 16
-
-// Number of keys.
+// in the context of interrupts, we use application event rings (one per
+// interrupt source, see app_event_rings.h). Application events are then 
+// processed outside the interrupt context. The main loop takes up to 
+// APP_EVENT_BATCH_SIZE events from the rings at once.
+#define APP_EVENT_BATCH_SIZE 8
+
+// Number of keys. Keys are read directly from flash (see key_store.h), so
+// the number of keys costs neither RAM nor boot time. The key number of the
+// protocol is a single byte, so at most 256 keys are possible. The key store
+// must have enough pages for KEY_COUNT keys (see KEY_STORE_PAGES).
 #define KEY_COUNT 4
 
+// If defined, the precomputed HMAC state of each key (see 
+// crypto_auth_hmacsha512256_beforenm()) is stored in flash next to the key
+// when the key is stored, so checking an HMAC takes two instead of four 
+// SHA-512 compressions. This costs 128 bytes of flash per key (a 1 kB page
+// holds 6 instead of 31 keys), but no RAM, since key records are read 
+// directly from flash. Undefine it to store up to 256 keys in fewer pages.
+// The key store has a different layout (and magic) with this option, so
+// switching it on or off formats the key store, i.e., all keys need to be
+// exchanged again.
+#define PSTORE_HMAC_STATES
+
+// If defined, key 0 is a master secret, and clients unlock with keys 
+// derived from it instead of keys stored in flash: a client sends a 
+// credential ID (CREDENTIAL_ID_LENGTH bytes) in place of the key number 
+// in the unlock characteristic, and its key is 
+//
+//   HMAC-SHA512-256(master secret, CREDENTIAL_KDF_LABEL || credential ID).
+//
+// So any number of credentials can be issued (and revoked by exchanging the
+// master secret) by whoever knows the master secret, without flash slots 
+// per credential. The master secret is set by a key exchange with key 
+// number 0. The HMAC states of the latest CREDENTIAL_CACHE_SIZE derived 
+// keys are kept in RAM (least recently used entry is replaced), so 
+// checking the HMAC of a cached credential takes two SHA-512 compressions
+// instead of six (eight without PSTORE_HMAC_STATES) for deriving the key 
+// and its HMAC state first.
+//#define MASTER_KEY_DERIVATION
+#define CREDENTIAL_ID_LENGTH 3
+#define CREDENTIAL_CACHE_SIZE 4
+#define CREDENTIAL_KDF_LABEL "Key20 credential"
+
+// If defined, the current nonce is published in the scan response 
+// (manufacturer specific data with company identifier 
+// ADV_NONCE_COMPANY_ID: [rotation counter, 16 bit little endian][nonce]).
+// A client that scans actively can compute the HMAC before connecting and 
+// write it to the unlock characteristic right after connecting, without 
+// subscribing to the nonce characteristic. Subscribing still works. The 
+// nonce is rotated whenever advertising starts again, i.e., a nonce is 
+// used by at most one connection, and every ADV_NONCE_ROTATION while 
+// advertising, so a nonce is not valid longer than an authentication 
+// attempt. The rotation counter is incremented with every new nonce.
+//#define ADVERTISED_NONCE
+#define ADV_NONCE_COMPANY_ID 0xffff
+
+// If defined, the client HMAC is checked as soon as it is complete, and the
+// lock is actuated right away. Then the device disconnects the client. 
+// Otherwise, the HMAC is checked when the client has disconnected, so 
+// unlocking waits for the client to tear down the link (or for the 
+// supervision timeout if the link is lost).
+//#define EARLY_ACTUATION
+
+// If defined, a client stays connected after a successful unlock (session)
+// and unlocks again with a single write of [UNLOCK_SESSION][first 
+// SESSION_TAG_LENGTH bytes of the HMAC of the next nonce]. After each 
+// unlock, both sides derive the next nonce from the current one:
+//
+//   nonce' = first NONCE_LENGTH bytes of 
+//            SHA-512(SESSION_CHAIN_LABEL || nonce),
+//
+// so it needs not be sent. Each nonce is accepted once. If the client 
+// does not unlock within AUTH_TIMER_TIMEOUT, the nonce is replaced by a 
+// new random nonce, which is indicated to the client (it must have 
+// subscribed to the nonce characteristic), so no nonce is valid for 
+// longer than without sessions. A wrong HMAC, an unconfirmed indication, 
+// or no unlock within SESSION_IDLE_TIMEOUT end the session (the device 
+// disconnects). The HMAC is checked as soon as it is complete (like with
+// EARLY_ACTUATION), and the expected HMAC of the next nonce is computed in
+// the background after each unlock.
+//#define PERSISTENT_SESSIONS
+#define SESSION_CHAIN_LABEL "Key20 session"
+#define SESSION_TAG_LENGTH 16
+
+// Number of flash pages of the key store (see key_store.h), including the
+// spare page. A 1 kB page holds up to 31 keys (6 keys with 
+// PSTORE_HMAC_STATES). The keys are spread evenly over the pages, and the
+// space left in a page is the log of the page: storing a key appends it to
+// the log of its page, and only if the log is full, the page is rewritten
+// into the spare page. With 4 keys and PSTORE_HMAC_STATES, a page has a 
+// log of 2 keys. Changing KEY_COUNT or KEY_STORE_PAGES changes the layout,
+// i.e., formats the key store.
+// PSTORAGE_NUM_OF_PAGES (pstorage_platform.h) must be at least 
+// KEY_STORE_PAGES.
+#define KEY_STORE_PAGES 2
+
+// Number of scalar bits (Montgomery ladder steps) of the shared secret 
+// calculation done in one slice of background work. Between slices, the 
+// main loop processes pending events. One ladder step takes about 1 ms on
+// the nRF51.
+#define ECDH_SLICE_BITS 8
+
+// Number of server keypairs for key exchanges, which are generated in the 
+// background after booting and after each key exchange. With a keypair 
+// ready, a key exchange only needs to calculate the shared secret.
+#define KEYPAIR_POOL_SIZE 1
+
+// Nonces and secret keys are generated by a deterministic random bit 
+// generator (HMAC_DRBG, see drbg.h), so they never wait for the random 
+// number generator of the softdevice, which produces a byte in about 
+// 0.7 ms and keeps at most 64 bytes. The DRBG is instantiated with entropy
+// from the softdevice when booting. Fresh entropy is collected from the 
+// softdevice whenever bytes are available, and the DRBG is reseeded in the
+// background after DRBG_RESEED_REQUESTS requests.
+#define DRBG_RESEED_REQUESTS 32
+#define DRBG_PERSONALIZATION "Key20"
+
+// Number of nonces generated in the background, so a new nonce is ready
+// when the next client connects.
+#define NONCE_POOL_SIZE 2
+
 // Application-level events.
 #define APP_EVENT_AUTH_TIMEOUT 0
 #define APP_EVENT_BUTTON_RED_PRESSED 1
@@ -86,6 +204,13 @@
 #define APP_EVENT_LOCK_ACTION_TIMEOUT 10
 #define APP_EVENT_INDICATION_NONCE_RCVD 11
 #define APP_EVENT_INDICATION_CFG_OUT_RCVD 12
+#define APP_EVENT_SHARED_SECRET_READY 13
+#define APP_EVENT_KEY_STORED 14
+#define APP_EVENT_HMAC_RCVD 15
+#define APP_EVENT_NONCE_TIMEOUT 16
+#define APP_EVENT_SESSION_UNLOCK_RCVD 17
+#define APP_EVENT_SESSION_TIMEOUT 18
+#define APP_EVENT_COUNT 19
 
 // Length of Diffie-Hellman keys using Eliptic Curve 25519 [bytes].
 #define ECDH_KEY_LENGTH crypto_scalarmult_curve25519_BYTES
@@ -99,8 +224,38 @@
 // Max. length of the Nonce characteristic.
 #define MAX_LENGTH_NONCE_CHAR 16
  
+// Clients identify the key of their HMAC by a key number, or by a 
+// credential ID with MASTER_KEY_DERIVATION [bytes].
+#ifdef MASTER_KEY_DERIVATION
+#define CLIENT_ID_LENGTH CREDENTIAL_ID_LENGTH
+#else
+#define CLIENT_ID_LENGTH 1
+#endif
+
+// Unlock messages written to the Unlock characteristic:
+//
+// - Protocol version 1: the HMAC is written in two parts with two writes 
+//   of [client ID][part (0 or 1)][16 bytes of HMAC].
+// - Protocol version 2: the complete HMAC is written with a single long 
+//   (queued) write of [UNLOCK_VERSION_2][client ID][32 bytes of HMAC].
+//
+// Both are told apart by their length [bytes].
+#define UNLOCK_VERSION_2 0x02
+#define LENGTH_UNLOCK_PART (CLIENT_ID_LENGTH + 1 + 16)
+#define LENGTH_UNLOCK_V2 (1 + CLIENT_ID_LENGTH + HMAC512_256)
+// Unlock within a session (see PERSISTENT_SESSIONS): [UNLOCK_SESSION][first
+// SESSION_TAG_LENGTH bytes of HMAC].
+#define UNLOCK_SESSION 0x03
+#define LENGTH_UNLOCK_SESSION (1 + SESSION_TAG_LENGTH)
+
 // Max. length of Unlock characteristic [bytes].
-#define MAX_LENGTH_UNLOCK_CHAR 18
+#define MAX_LENGTH_UNLOCK_CHAR LENGTH_UNLOCK_V2
+
+// Size of the memory for queued writes (long writes of the Unlock 
+// characteristic, see ble_evt_handler()). Every prepared write takes 6 
+// bytes (handle, offset, length) plus its data; the list of writes is 
+// terminated by an invalid handle (2 bytes) [bytes].
+#define QUEUED_WRITES_MEM_SIZE 64
 
 // Max. length of config-in characteristic [bytes].
 #define MAX_LENGTH_CFG_IN_CHAR 18
@@ -151,6 +306,11 @@
 #define APP_TIMER_PRESCALER 0
 #define APP_TIMER_QUEUE_SIZE 6
 
+// Interval of the display updates, which send one instruction to the LCD 
+// per timer interrupt (instructions take 37 us; the app timer requires at 
+// least 5 ticks, i.e., 153 us).
+#define DISPLAY_TIMER_INTERVAL 5
+
 // Delay for debouncing buttons [ms].
 #define BUTTON_DETECTION_DELAY APP_TIMER_TICKS(50, APP_TIMER_PRESCALER)
 
@@ -160,6 +320,12 @@
 // Time for operating the lock [ms].
 #define LOCK_ACTION_TIMER_TIMEOUT APP_TIMER_TICKS(2000, APP_TIMER_PRESCALER)
 
+// Rotation period of the advertised nonce (see ADVERTISED_NONCE).
+#define ADV_NONCE_ROTATION AUTH_TIMER_TIMEOUT
+
+// Time a session is kept without unlocks (see PERSISTENT_SESSIONS).
+#define SESSION_IDLE_TIMEOUT APP_TIMER_TICKS(60000, APP_TIMER_PRESCALER)
+
 // Service and charateristic UUIDs in Little Endian format.
 // The 16 bit values will become byte 12 and 13 of the 128 bit UUID:
 // 0x0a9dXXXX-5ff4-4c58-8a53627de7cf1faf
@@ -175,45 +341,81 @@
 enum app_states {idle, cfg_wait_connection, cfg_wait_subscription, 
 		 cfg_wait_key_part1, cfg_wait_key_part2, cfg_wait_decision, 
 		 auth_wait_hmac_part1, auth_wait_hmac_part2, cfg_wait_key_store, 
-		 auth_wait_lock_action_timeout, booting, cfg_wait_disconnect,
+		 booting, cfg_wait_disconnect,
 		 auth_wait_disconnect, aborted_wait_disconnect, 
 		 auth_wait_subscription, auth_wait_nonce_rcvd,
-		 cfg_wait_server_key_part1_rcvd, cfg_wait_server_key_part2_rcvd};
+		 cfg_wait_server_key_part1_rcvd, cfg_wait_server_key_part2_rcvd,
+		 cfg_wait_shared_secret, session_wait_unlock,
+		 APP_STATE_COUNT};
 
 enum app_states app_state;
 
-// A valid key store will have this (random) pattern as the first bytes.
-// If not, this is an indication that the key store has never been
-// written before, thus, there are not valid keys stored, and the
-// key store should be initialized ("formatted") first.
-// pstore_preamble must be word aligned to be used as memory location for
-// pstorage operations.
-uint8_t pstore_preamble[] __attribute__((aligned(4))) = 
-      {0xfe, 0xec, 0x91, 0xf1, 0x06, 0xc4,
-      0x40, 0x24, 0xbf, 0x19, 0x69, 0x7f, 
-      0x96, 0x4d, 0xc6, 0x67};
-
-// Definition of the LCD. 
+// States of the lock. The lock is actuated independently of the 
+// application states: while it is actuated, the device advertises and 
+// accepts new authentication sessions, and a further successful unlock
+// extends the actuation.
+enum lock_states {lock_released, lock_actuated};
+
+enum lock_states lock_state = lock_released;
+
+// The lock action timer is restarted whenever the actuation is extended.
+// Each start gets a new generation number, which the timer handler 
+// records, so the timeout of an earlier start, which might still be 
+// queued, is ignored.
+uint32_t lock_action_generation = 0;
+volatile uint32_t lock_action_generation_fired;
+
+// Pages of a valid key store start with this (random) pattern. If no 
+// page does, the key store has never been written before, thus, there are
+// no valid keys stored, and the key store is formatted when the first key
+// is stored.
+#ifdef PSTORE_HMAC_STATES
+#define KEY_STORE_MAGIC 0xdf1f7cf4
+#else
+#define KEY_STORE_MAGIC 0x4f1cefd9
+#endif
+
+// Definition of the LCD. The masks of the pins for writing the GPIO 
+// registers are calculated at compile time from the pinout.
 struct hd44780 lcd = {
-      .pin_rs = PIN_LCD_RS, 
-      .pin_e = PIN_LCD_E, 
-      .pin_db4 = PIN_LCD_DB4, 
-      .pin_db5 = PIN_LCD_DB5, 
-      .pin_db6 = PIN_LCD_DB6,
-      .pin_db7 = PIN_LCD_DB7, 
+      HD44780_PINS(PIN_LCD_RS, PIN_LCD_E, PIN_LCD_DB4, PIN_LCD_DB5,
+		   PIN_LCD_DB6, PIN_LCD_DB7),
       .rows = 2,
       .columns = 16
 };
 
+// Text shown on the LCD, which is updated in the background (see 
+// display_text()).
+struct hd44780_async lcd_async;
+bool is_display_updating = false;
+
+APP_TIMER_DEF(display_timer);
 APP_TIMER_DEF(auth_timer);
 APP_TIMER_DEF(lock_action_timer);
+#ifdef ADVERTISED_NONCE
+APP_TIMER_DEF(nonce_timer);
+#endif
+#ifdef PERSISTENT_SESSIONS
+APP_TIMER_DEF(session_timer);
+#endif
+
+// A key together with its precomputed HMAC state, i.e., the SHA-512 
+// chaining values after the ipad and opad blocks of the HMAC. Starting from
+// this state, checking an HMAC takes two instead of four SHA-512 
+// compressions. Key records are stored in flash and never copied to RAM.
+struct key_record {
+     uint8_t key[ECDH_KEY_LENGTH];
+     crypto_auth_hmacsha512256_state hmac_state;
+};
 
-// keys variable must be word aligned to be used as memory location for
-// pstorage operations.
-uint8_t keys[KEY_COUNT][ECDH_KEY_LENGTH] __attribute__((aligned(4)));
-// Bitset signaling which keys are valid (key is valid iff bit != 0).
-// First key = bit0, second key = bit1, etc.
-uint8_t keys_valid = 0;
+// Number of bytes of a key record stored in flash. Without 
+// PSTORE_HMAC_STATES, only the key is stored, and the HMAC is computed 
+// from the key.
+#ifdef PSTORE_HMAC_STATES
+#define KEY_RECORD_PSTORE_SIZE sizeof(struct key_record)
+#else
+#define KEY_RECORD_PSTORE_SIZE ECDH_KEY_LENGTH
+#endif
 
 uint8_t uuid_type;
 uint16_t service_handle;
@@ -229,6 +431,29 @@ uint16_t conn_handle = BLE_CONN_HANDLE_INVALID;
 
 uint8_t nonce[NONCE_LENGTH];
 
+// Deterministic random bit generator, fresh entropy for the next reseed
+// (drbg_entropy_count bytes collected), and pre-generated nonces (the 
+// first nonce_pool_count entries are valid).
+struct drbg drbg;
+uint8_t drbg_entropy[DRBG_MIN_ENTROPY];
+unsigned int drbg_entropy_count = 0;
+uint8_t nonce_pool[NONCE_POOL_SIZE][NONCE_LENGTH];
+unsigned int nonce_pool_count = 0;
+
+#ifdef ADVERTISED_NONCE
+// Rotation counter of the advertised nonce, and the manufacturer specific 
+// data of the scan response: [counter][nonce].
+uint16_t nonce_counter = 0;
+uint8_t adv_nonce_data[2+NONCE_LENGTH];
+#endif
+
+#ifdef PERSISTENT_SESSIONS
+// The client has subscribed to the nonce characteristic, and an indication
+// of the nonce has not been confirmed yet.
+bool is_nonce_subscribed = false;
+bool is_nonce_indication_pending = false;
+#endif
+
 // During Diffie-Hellman key exchange, we need to keep some temporary keys.
 // All keys are stored and transmitted in Little Endian format.
 uint8_t keyexchange_server_secret_key[ECDH_KEY_LENGTH];
@@ -237,20 +462,81 @@ uint8_t keyexchange_client_public_key[ECDH_KEY_LENGTH];
 uint8_t keyexchange_shared_secret[ECDH_KEY_LENGTH];
 uint8_t keyexchange_key_no = 0;
 
-// For unlocking, the client has to provide an HMAC and key number.
-uint8_t unlock_key_no = 0;
+// Pre-generated server keypairs (see KEYPAIR_POOL_SIZE). The first 
+// keypair_pool_count entries are valid.
+struct ecdh_keypair {
+     uint8_t secret_key[ECDH_KEY_LENGTH];
+     uint8_t public_key[ECDH_KEY_LENGTH];
+};
+struct ecdh_keypair keypair_pool[KEYPAIR_POOL_SIZE];
+unsigned int keypair_pool_count = 0;
+// State of the shared secret calculation, which is done in slices in the
+// background (see ecdh_shared_secret_step()).
+crypto_scalarmult_curve25519_state keyexchange_ecdh_state;
+bool is_keyexchange_ecdh_running = false;
+
+// For unlocking, the client has to provide an HMAC and key number (or 
+// credential ID).
+uint8_t unlock_client_id[CLIENT_ID_LENGTH];
 uint8_t unlock_hmac_client[HMAC512_256];
 
-struct app_event_queue app_event_queue;
+// Memory for queued writes, provided to the softdevice on request. The 
+// queued writes of an unlock message of protocol version 2 are 
+// reassembled in unlock_long_write when they are executed.
+uint32_t queued_writes_mem[QUEUED_WRITES_MEM_SIZE/4];
+uint8_t unlock_long_write[LENGTH_UNLOCK_V2];
+
+#ifdef MASTER_KEY_DERIVATION
+// Expected HMAC of the current nonce for the credential ID named by the 
+// first part of the client HMAC. It is computed in the background while 
+// the second part is in flight, so checking the HMAC of the client after 
+// disconnection is usually only a (constant-time) comparison. 
+uint8_t expected_hmac[HMAC512_256];
+// Credential ID of the expected HMAC, if is_expected_hmac_valid; to 
+// compute the expected HMAC for, if is_expected_hmac_pending.
+uint8_t expected_hmac_client_id[CLIENT_ID_LENGTH];
+bool is_expected_hmac_valid = false;
+bool is_expected_hmac_pending = false;
+#else
+// Expected HMACs of the current nonce for all valid keys. These are 
+// computed in the background, one key per slice, while the nonce 
+// indication and the HMAC of the client are in flight, so checking the 
+// HMAC of the client is usually only a (constant-time) comparison. 
+uint8_t expected_hmacs[KEY_COUNT][HMAC512_256];
+// Bitset of keys whose expected HMAC has been computed for the current nonce.
+uint8_t expected_hmacs_valid = 0;
+// Bitset of keys to compute the expected HMAC for.
+uint8_t expected_hmacs_pending = 0;
+#endif
+
+#ifdef MASTER_KEY_DERIVATION
+// HMAC states of derived keys (see MASTER_KEY_DERIVATION).
+struct credential_cache_entry {
+     uint8_t credential_id[CREDENTIAL_ID_LENGTH];
+     // Value of credential_cache_clock when the entry was used last; 0 if 
+     // the entry is empty.
+     uint32_t last_use;
+     crypto_auth_hmacsha512256_state hmac_state;
+};
+struct credential_cache_entry credential_cache[CREDENTIAL_CACHE_SIZE];
+uint32_t credential_cache_clock = 0;
+#endif
+
+struct app_event_rings app_event_rings;
 
 pstorage_handle_t pstore_handle;
-volatile bool is_pstore_ready = false;
+struct key_store key_store;
+uint8_t key_store_map[KEY_STORE_PAGES-1];
+uint32_t key_store_buffer[KEY_STORE_BUFFER_WORDS(KEY_RECORD_PSTORE_SIZE)];
 
 // Prototypes.
 
 static void display_text(const char *text1, unsigned int length1,
 			 const char *text2, unsigned int length2);
 static void set_nonce_char();
+#ifdef ADVERTISED_NONCE
+static void rotate_nonce();
+#endif
 
 // Implementations.
 
@@ -284,8 +570,10 @@ static void led_init()
  */
 static void die()
 {
-     display_text("Error", 5, NULL, 0);
+     // The display is not updated in the background anymore.
      __disable_irq();
+     hd44780_clear_display(&lcd);
+     hd44780_print_line(&lcd, "Error", 5, 0);
  
      // In a development system, we loop forever.
      // Remove the endless loop in a productive system to auto-reset.
@@ -314,55 +602,211 @@ static void start_advertising()
     adv_params.interval = ADV_INTERVAL;
     adv_params.timeout = ADV_TIMEOUT;
 
+#ifdef ADVERTISED_NONCE
+    // Never advertise a nonce that a previous connection has seen.
+    rotate_nonce();
+#endif
+
     err_code = sd_ble_gap_adv_start(&adv_params);
     if (err_code != NRF_SUCCESS)
 	 die();
 }
 
+// The data of writes to the cfg_in and unlock characteristics is passed 
+// to the main loop as event payload and only copied to the key exchange 
+// and unlock state when the event is processed (see key_part_rcvd() and 
+// hmac_part_rcvd()). So a client may send writes back to back without 
+// overwriting data the main loop has not processed yet.
+
 static void char_cfg_in_write_evt(ble_gatts_evt_write_t *evt_write)
 {
-     uint8_t key_part_number;
      struct app_event app_event;
 
      if (evt_write->handle == char_handle_cfg_in.value_handle && 
 	 evt_write->len == MAX_LENGTH_CFG_IN_CHAR) {
-	  keyexchange_key_no = evt_write->data[0];
-	  if (keyexchange_key_no >= KEY_COUNT) {
+	  if (evt_write->data[0] >= KEY_COUNT) {
 	       // Invalid key number. 
 	       return;
 	  }
-	  key_part_number = evt_write->data[1];
-	  if (key_part_number == 0) 
-	       memcpy(keyexchange_client_public_key, 
-		      &evt_write->data[2], 16);
-	  else
-	       memcpy(&keyexchange_client_public_key[16], 
-		      &evt_write->data[2], 16);
 	  app_event.event_type = APP_EVENT_KEY_PART_RCVD;
-	  app_event_queue_add(&app_event_queue, app_event);
+	  app_event_rings_add_payload(&app_event_rings, APP_EVENT_SOURCE_BLE,
+				      app_event, evt_write->data, 
+				      evt_write->len);
      }
 }
 
-static void char_unlock_write_evt(ble_gatts_evt_write_t *evt_write)
+// Writes to the Unlock characteristic require authorization, so the 
+// application sees the writes of a long write (prepared writes) and their
+// execution.
+
+/**
+ * A part of the HMAC (protocol version 1) has been written.
+ *
+ * @return GATT status of the write.
+ */
+static uint16_t char_unlock_write_evt(ble_gatts_evt_write_t *evt_write)
 {
-     uint8_t key_part_number;
      struct app_event app_event;
      
-     if (evt_write->handle == char_handle_unlock.value_handle && 
-	 evt_write->len == MAX_LENGTH_UNLOCK_CHAR) {
-	  unlock_key_no = evt_write->data[0];
-	  if (unlock_key_no >= KEY_COUNT) {
-	       // Invalid key number.
-	       return;
-	  }
-	  key_part_number = evt_write->data[1];
-	  if (key_part_number == 0) 
-	       memcpy(&unlock_hmac_client[0], &evt_write->data[2], 16);
+#ifdef PERSISTENT_SESSIONS
+     if (evt_write->len == LENGTH_UNLOCK_SESSION && 
+	 evt_write->data[0] == UNLOCK_SESSION) {
+	  app_event.event_type = APP_EVENT_SESSION_UNLOCK_RCVD;
+	  app_event_rings_add_payload(&app_event_rings, APP_EVENT_SOURCE_BLE,
+				      app_event, &evt_write->data[1], 
+				      SESSION_TAG_LENGTH);
+	  return BLE_GATT_STATUS_SUCCESS;
+     }
+#endif
+     if (evt_write->len != LENGTH_UNLOCK_PART)
+	  return BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH;
+#ifndef MASTER_KEY_DERIVATION
+     if (evt_write->data[0] >= KEY_COUNT) {
+	  // Invalid key number.
+	  return BLE_GATT_STATUS_SUCCESS;
+     }
+#endif
+     app_event.event_type = APP_EVENT_HMAC_PART_RCVD;
+     app_event_rings_add_payload(&app_event_rings, APP_EVENT_SOURCE_BLE,
+				 app_event, evt_write->data, evt_write->len);
+     return BLE_GATT_STATUS_SUCCESS;
+}
+
+/**
+ * A long write of the Unlock characteristic (protocol version 2) is 
+ * executed. Reassembles the prepared writes from the memory for queued 
+ * writes. Prepared writes must follow each other without gaps.
+ *
+ * @return GATT status of the execute write request.
+ */
+static uint16_t char_unlock_execute_write_evt()
+{
+     struct app_event app_event;
+     const uint8_t *queue = (const uint8_t *) queued_writes_mem;
+     unsigned int pos = 0;
+     unsigned int len = 0;
+
+     while (pos + 2 <= QUEUED_WRITES_MEM_SIZE) {
+	  uint16_t handle = queue[pos] | (queue[pos+1] << 8);
+	  if (handle == BLE_GATT_HANDLE_INVALID)
+	       break;
+	  if (pos + 6 > QUEUED_WRITES_MEM_SIZE)
+	       return BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH;
+	  uint16_t offset = queue[pos+2] | (queue[pos+3] << 8);
+	  uint16_t length = queue[pos+4] | (queue[pos+5] << 8);
+	  if (handle != char_handle_unlock.value_handle || offset != len)
+	       return BLE_GATT_STATUS_ATTERR_INVALID_OFFSET;
+	  if (len + length > LENGTH_UNLOCK_V2 || 
+	      pos + 6 + length > QUEUED_WRITES_MEM_SIZE)
+	       return BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH;
+	  memcpy(&unlock_long_write[len], &queue[pos+6], length);
+	  len += length;
+	  pos += 6 + length;
+     }
+
+     if (len != LENGTH_UNLOCK_V2 || unlock_long_write[0] != UNLOCK_VERSION_2)
+	  return BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH;
+#ifndef MASTER_KEY_DERIVATION
+     if (unlock_long_write[1] >= KEY_COUNT) {
+	  // Invalid key number.
+	  return BLE_GATT_STATUS_SUCCESS;
+     }
+#endif
+     // The payload is the message without the version.
+     app_event.event_type = APP_EVENT_HMAC_RCVD;
+     app_event_rings_add_payload(&app_event_rings, APP_EVENT_SOURCE_BLE,
+				 app_event, &unlock_long_write[1], 
+				 LENGTH_UNLOCK_V2 - 1);
+     return BLE_GATT_STATUS_SUCCESS;
+}
+
+static void char_unlock_authorize_evt(
+     ble_gatts_evt_rw_authorize_request_t *request)
+{
+     ble_gatts_evt_write_t *evt_write = &request->request.write;
+     uint16_t status = BLE_GATT_STATUS_ATTERR_WRITE_NOT_PERMITTED;
+
+     if (request->type != BLE_GATTS_AUTHORIZE_TYPE_WRITE)
+	  return;
+
+     switch (evt_write->op) {
+     case BLE_GATTS_OP_WRITE_REQ :
+	  if (evt_write->handle == char_handle_unlock.value_handle)
+	       status = char_unlock_write_evt(evt_write);
+	  break;
+     case BLE_GATTS_OP_PREP_WRITE_REQ :
+	  // The write is queued by the softdevice and checked when it is 
+	  // executed.
+	  if (evt_write->handle != char_handle_unlock.value_handle)
+	       status = BLE_GATT_STATUS_ATTERR_WRITE_NOT_PERMITTED;
+	  else if (evt_write->offset + evt_write->len > LENGTH_UNLOCK_V2)
+	       status = BLE_GATT_STATUS_ATTERR_INVALID_OFFSET;
 	  else
-	       memcpy(&unlock_hmac_client[16], &evt_write->data[2], 16);
-	  app_event.event_type = APP_EVENT_HMAC_PART_RCVD;
-	  app_event_queue_add(&app_event_queue, app_event);
+	       status = BLE_GATT_STATUS_SUCCESS;
+	  break;
+     case BLE_GATTS_OP_EXEC_WRITE_REQ_NOW :
+	  status = char_unlock_execute_write_evt();
+	  break;
+     case BLE_GATTS_OP_EXEC_WRITE_REQ_CANCEL :
+	  status = BLE_GATT_STATUS_SUCCESS;
+	  break;
      }
+
+     ble_gatts_rw_authorize_reply_params_t reply;
+     memset(&reply, 0, sizeof(reply));
+     reply.type = BLE_GATTS_AUTHORIZE_TYPE_WRITE;
+     reply.params.write.gatt_status = status;
+     if (sd_ble_gatts_rw_authorize_reply(conn_handle, &reply) != NRF_SUCCESS)
+	  die();
+}
+
+/**
+ * Take over the part of the client public key carried by an 
+ * APP_EVENT_KEY_PART_RCVD event: [key number][part][16 bytes of key].
+ */
+static void key_part_rcvd(struct app_event event)
+{
+     const struct app_event_payload *payload = 
+	  app_event_rings_payload(&app_event_rings, event);
+
+     keyexchange_key_no = payload->data[0];
+     if (payload->data[1] == 0) 
+	  memcpy(keyexchange_client_public_key, &payload->data[2], 16);
+     else
+	  memcpy(&keyexchange_client_public_key[16], &payload->data[2], 16);
+}
+
+/**
+ * Take over the part of the client HMAC carried by an 
+ * APP_EVENT_HMAC_PART_RCVD event: [key number or credential ID][part][16
+ * bytes of HMAC].
+ */
+static void hmac_part_rcvd(struct app_event event)
+{
+     const struct app_event_payload *payload = 
+	  app_event_rings_payload(&app_event_rings, event);
+
+     memcpy(unlock_client_id, payload->data, CLIENT_ID_LENGTH);
+     if (payload->data[CLIENT_ID_LENGTH] == 0) 
+	  memcpy(&unlock_hmac_client[0], &payload->data[CLIENT_ID_LENGTH+1], 
+		 16);
+     else
+	  memcpy(&unlock_hmac_client[16], &payload->data[CLIENT_ID_LENGTH+1], 
+		 16);
+}
+
+/**
+ * Take over the client HMAC carried by an APP_EVENT_HMAC_RCVD event: [key 
+ * number or credential ID][32 bytes of HMAC].
+ */
+static void hmac_rcvd(struct app_event event)
+{
+     const struct app_event_payload *payload = 
+	  app_event_rings_payload(&app_event_rings, event);
+
+     memcpy(unlock_client_id, payload->data, CLIENT_ID_LENGTH);
+     memcpy(unlock_hmac_client, &payload->data[CLIENT_ID_LENGTH], 
+	    HMAC512_256);
 }
 
 static void cccd_cfg_out_write_evt(ble_gatts_evt_write_t *evt_write)
@@ -379,7 +823,7 @@ static void cccd_cfg_out_write_evt(ble_gatts_evt_write_t *evt_write)
      if (evt_write->handle == char_handle_cfg_out.cccd_handle) {
 	  if (evt_write->data[0] == 0x02 && evt_write->data[1] == 0x00) {
 	       app_event.event_type = APP_EVENT_SUBSCRIBED_CFG_OUT;
-	       app_event_queue_add(&app_event_queue, app_event);
+	       app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_BLE, app_event);
 	  }
      }
 }
@@ -398,7 +842,7 @@ static void cccd_nonce_write_evt(ble_gatts_evt_write_t *evt_write)
      if (evt_write->handle == char_handle_nonce.cccd_handle) {
 	  if (evt_write->data[0] == 0x02 && evt_write->data[1] == 0x00) {
 	       app_event.event_type = APP_EVENT_SUBSCRIBED_NONCE;
-	       app_event_queue_add(&app_event_queue, app_event);
+	       app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_BLE, app_event);
 	  }
      }
 }
@@ -419,7 +863,7 @@ static void nonce_indication_hvc_evt(ble_gatts_evt_hvc_t *evt_hvc)
 
      if (evt_hvc->handle == char_handle_nonce.value_handle) {
 	  app_event.event_type = APP_EVENT_INDICATION_NONCE_RCVD;
-	  app_event_queue_add(&app_event_queue, app_event);
+	  app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_BLE, app_event);
      }
 }
 
@@ -429,7 +873,7 @@ static void cfg_out_indication_hvc_evt(ble_gatts_evt_hvc_t *evt_hvc)
 
      if (evt_hvc->handle == char_handle_cfg_out.value_handle) {
 	  app_event.event_type = APP_EVENT_INDICATION_CFG_OUT_RCVD;
-	  app_event_queue_add(&app_event_queue, app_event);
+	  app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_BLE, app_event);
      }
 }
 
@@ -442,12 +886,12 @@ static void ble_evt_handler(ble_evt_t *ble_evt)
      case BLE_GAP_EVT_CONNECTED:
 	  conn_handle = ble_evt->evt.gap_evt.conn_handle;
 	  app_event.event_type = APP_EVENT_CLIENT_CONNECTED;
-	  app_event_queue_add(&app_event_queue, app_event);
+	  app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_BLE, app_event);
 	  break;
      case BLE_GAP_EVT_DISCONNECTED:
 	  conn_handle = BLE_CONN_HANDLE_INVALID;
 	  app_event.event_type = APP_EVENT_CLIENT_DISCONNECTED;
-	  app_event_queue_add(&app_event_queue, app_event);
+	  app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_BLE, app_event);
 	  break;
      case BLE_GAP_EVT_SEC_PARAMS_REQUEST:
 	  // Pairing not supported.
@@ -458,10 +902,26 @@ static void ble_evt_handler(ble_evt_t *ble_evt)
      case BLE_GATTS_EVT_WRITE:
           evt_write = &ble_evt->evt.gatts_evt.params.write;
 	  char_cfg_in_write_evt(evt_write);
-	  char_unlock_write_evt(evt_write);
 	  cccd_cfg_out_write_evt(evt_write);
 	  cccd_nonce_write_evt(evt_write);
 	  break;
+     case BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST:
+	  char_unlock_authorize_evt(
+	       &ble_evt->evt.gatts_evt.params.authorize_request);
+	  break;
+     case BLE_EVT_USER_MEM_REQUEST:
+	  {
+	       // Queued writes are processed by the application.
+	       ble_user_mem_block_t block = {
+		    .p_mem = (uint8_t *) queued_writes_mem,
+		    .len = QUEUED_WRITES_MEM_SIZE
+	       };
+	       if (sd_ble_user_mem_reply(conn_handle, &block) != NRF_SUCCESS)
+		    die();
+	  }
+	  break;
+     case BLE_EVT_USER_MEM_RELEASE:
+	  break;
      case BLE_GATTS_EVT_HVC:
 	  // Indication has been acknowledged by the client.
 	  nonce_indication_hvc_evt(&ble_evt->evt.gatts_evt.params.hvc);
@@ -622,11 +1082,14 @@ static void add_characteristic_unlock(uint16_t service_handle)
 
      // Define characteristic presentation format.
      // This characteristic transports a 256 bit HMAC to authenticate the
-     // door open request. 256 bit = 32 bytes are too long for a 
-     // characteristic. So we split up the request into two 16 byte write
-     // operations to the characteristic. Moreover, we include the key 
-     // and HMAC part number in the request as another byte. Thus, this is 
-     // a 18 byte opaque struct.
+     // door open request. The value is an opaque struct of variable length
+     // (see UNLOCK_VERSION_2): with protocol version 1, the HMAC is split
+     // into two writes of [client ID][part][16 bytes of HMAC]; with 
+     // protocol version 2, it is written at once by a long write of 
+     // [UNLOCK_VERSION_2][client ID][32 bytes of HMAC], which is longer 
+     // than the default ATT MTU allows for a single write. The writes are 
+     // checked and reassembled with write authorization (see 
+     // char_unlock_authorize_evt()).
      ble_gatts_char_pf_t char_presentation_format;
      memset(&char_presentation_format, 0, sizeof(char_presentation_format));
      char_presentation_format.format = BLE_GATT_CPF_FORMAT_STRUCT;
@@ -660,10 +1123,12 @@ static void add_characteristic_unlock(uint16_t service_handle)
      char_attr_meta_data.vloc = BLE_GATTS_VLOC_STACK;
      // always request read authorization from application 
      char_attr_meta_data.rd_auth = 0;
-     // always request write authorization from application
-     char_attr_meta_data.wr_auth = 0;
-     // variable length attribute
-     char_attr_meta_data.vlen = 0;
+     // always request write authorization from application (to check 
+     // and reassemble long writes, see char_unlock_authorize_evt())
+     char_attr_meta_data.wr_auth = 1;
+     // variable length attribute (unlock messages of protocol version 1 
+     // and 2)
+     char_attr_meta_data.vlen = 1;
 
      // Define characteristic attributes. 
      ble_gatts_attr_t char_attributes;
@@ -917,26 +1382,76 @@ static void advertising_init(void)
      advdata.uuids_complete.uuid_cnt = sizeof(adv_uuids)/sizeof(adv_uuids[0]);
      advdata.uuids_complete.p_uuids = adv_uuids;
      
+#ifdef ADVERTISED_NONCE
+     // The current nonce goes into the scan response.
+     ble_advdata_manuf_data_t manuf_data;
+     manuf_data.company_identifier = ADV_NONCE_COMPANY_ID;
+     adv_nonce_data[0] = (uint8_t) nonce_counter;
+     adv_nonce_data[1] = (uint8_t) (nonce_counter >> 8);
+     memcpy(&adv_nonce_data[2], nonce, NONCE_LENGTH);
+     manuf_data.data.p_data = adv_nonce_data;
+     manuf_data.data.size = sizeof(adv_nonce_data);
+
+     ble_advdata_t srdata;
+     memset(&srdata, 0, sizeof(srdata));
+     srdata.p_manuf_specific_data = &manuf_data;
+
+     if (ble_advdata_set(&advdata, &srdata) != NRF_SUCCESS)
+	  die();
+#else
      // No scan response data needs to be defined (second parameter) since 
      // everything fits into the advertisement message (the scan response can 
      // be requested by the central device to get more information from the 
      // peripheral).
      if (ble_advdata_set(&advdata, NULL) != NRF_SUCCESS)
 	  die();
+#endif
 }
 
 static void lock_action_timer_evt_handler(void *p_context)
 {
-     UNUSED_PARAMETER(p_context);
+     lock_action_generation_fired = (uint32_t) (uintptr_t) p_context;
      struct app_event app_event = {.event_type = APP_EVENT_LOCK_ACTION_TIMEOUT};
-     app_event_queue_add(&app_event_queue, app_event);
+     app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_TIMER, app_event);
 }
 
 static void auth_timer_evt_handler(void *p_context)
 {
      UNUSED_PARAMETER(p_context);
      struct app_event app_event = {.event_type = APP_EVENT_AUTH_TIMEOUT};
-     app_event_queue_add(&app_event_queue, app_event);
+     app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_TIMER, app_event);
+}
+
+#ifdef PERSISTENT_SESSIONS
+static void session_timer_evt_handler(void *p_context)
+{
+     UNUSED_PARAMETER(p_context);
+     struct app_event app_event = {.event_type = APP_EVENT_SESSION_TIMEOUT};
+     app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_TIMER, app_event);
+}
+#endif
+
+#ifdef ADVERTISED_NONCE
+static void nonce_timer_evt_handler(void *p_context)
+{
+     UNUSED_PARAMETER(p_context);
+     struct app_event app_event = {.event_type = APP_EVENT_NONCE_TIMEOUT};
+     app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_TIMER, app_event);
+}
+#endif
+
+static void display_timer_evt_handler(void *p_context)
+{
+     UNUSED_PARAMETER(p_context);
+     // One instruction per interrupt; the timer is restarted until the 
+     // display shows the text.
+     if (!hd44780_async_step(&lcd_async)) {
+	  is_display_updating = false;
+	  return;
+     }
+     if (app_timer_start(display_timer, DISPLAY_TIMER_INTERVAL, NULL) != 
+	 NRF_SUCCESS)
+	  die();
 }
 
 static void timers_init()
@@ -945,6 +1460,10 @@ static void timers_init()
      // BLE softdevice).
      APP_TIMER_INIT(APP_TIMER_PRESCALER, APP_TIMER_QUEUE_SIZE, false);
 
+     if (app_timer_create(&display_timer, APP_TIMER_MODE_SINGLE_SHOT,
+			  display_timer_evt_handler) != NRF_SUCCESS)
+	  die();
+
      if (app_timer_create(&lock_action_timer, APP_TIMER_MODE_SINGLE_SHOT,
 			  lock_action_timer_evt_handler) != NRF_SUCCESS)
 	  die();
@@ -952,11 +1471,26 @@ static void timers_init()
      if (app_timer_create(&auth_timer, APP_TIMER_MODE_SINGLE_SHOT,
 			  auth_timer_evt_handler) != NRF_SUCCESS)
 	  die();
+
+#ifdef ADVERTISED_NONCE
+     if (app_timer_create(&nonce_timer, APP_TIMER_MODE_SINGLE_SHOT,
+			  nonce_timer_evt_handler) != NRF_SUCCESS)
+	  die();
+#endif
+
+#ifdef PERSISTENT_SESSIONS
+     if (app_timer_create(&session_timer, APP_TIMER_MODE_SINGLE_SHOT,
+			  session_timer_evt_handler) != NRF_SUCCESS)
+	  die();
+#endif
 }
 
 static void start_lock_action_timer()
 {
-     if (app_timer_start(lock_action_timer, LOCK_ACTION_TIMER_TIMEOUT, NULL) !=
+     app_timer_stop(lock_action_timer);
+     lock_action_generation++;
+     if (app_timer_start(lock_action_timer, LOCK_ACTION_TIMER_TIMEOUT, 
+			 (void *) (uintptr_t) lock_action_generation) !=
 	 NRF_SUCCESS)
 	  die();
 }
@@ -973,6 +1507,31 @@ static void stop_auth_timer()
      app_timer_stop(auth_timer);
 }
 
+#ifdef PERSISTENT_SESSIONS
+static void restart_session_timer()
+{
+     app_timer_stop(session_timer);
+     if (app_timer_start(session_timer, SESSION_IDLE_TIMEOUT, NULL) != 
+	 NRF_SUCCESS)
+	  die();
+}
+
+static void stop_session_timer()
+{
+     app_timer_stop(session_timer);
+}
+#endif
+
+#ifdef ADVERTISED_NONCE
+static void restart_nonce_timer()
+{
+     app_timer_stop(nonce_timer);
+     if (app_timer_start(nonce_timer, ADV_NONCE_ROTATION, NULL) != 
+	 NRF_SUCCESS)
+	  die();
+}
+#endif
+
 static void button_evt_handler(uint8_t pin_no, uint8_t button_action)
 {
      struct app_event app_event;
@@ -981,13 +1540,13 @@ static void button_evt_handler(uint8_t pin_no, uint8_t button_action)
      case PIN_BUTTON_RED :
 	  if (APP_BUTTON_PUSH == button_action) {
 	       app_event.event_type = APP_EVENT_BUTTON_RED_PRESSED;
-	       app_event_queue_add(&app_event_queue, app_event);
+	       app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_BUTTON, app_event);
 	  }
 	  break;
      case PIN_BUTTON_GREEN :
 	  if (APP_BUTTON_PUSH == button_action) {
 	       app_event.event_type = APP_EVENT_BUTTON_GREEN_PRESSED;
-	       app_event_queue_add(&app_event_queue, app_event);
+	       app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_BUTTON, app_event);
 	  }
 	  break;
      }
@@ -1013,39 +1572,139 @@ static void start_button_event_detection()
 	  die();
 }
 
-static void create_nonce()
+/**
+ * Get random bytes from the softdevice, waiting until enough bytes are 
+ * available. Only used for seeding the DRBG when booting, or if it must 
+ * be reseeded before the collected entropy is complete.
+ */
+static void sd_rand_wait(uint8_t *buffer, unsigned int length)
 {
      uint8_t available;
-     unsigned int remaining = NONCE_LENGTH;
      unsigned int offset = 0;
-     while (remaining > 0) {
+     while (length > 0) {
 	  if (sd_rand_application_bytes_available_get(&available) != 
 	      NRF_SUCCESS)
 	       die();
-	  uint8_t length = (remaining < available) ? remaining : available;
-	  if (sd_rand_application_vector_get(&nonce[offset], length) != 
+	  uint8_t n = (length < available) ? length : available;
+	  if (sd_rand_application_vector_get(&buffer[offset], n) != 
+	      NRF_SUCCESS)
+	       die();
+	  length -= n;
+	  offset += n;
+     }
+}
+
+/**
+ * Get the random bytes available from the softdevice into the entropy 
+ * for the next reseed, without waiting.
+ *
+ * @return true if the entropy is complete.
+ */
+static bool drbg_entropy_collect()
+{
+     uint8_t available;
+     unsigned int remaining = DRBG_MIN_ENTROPY - drbg_entropy_count;
+     if (remaining > 0) {
+	  if (sd_rand_application_bytes_available_get(&available) != 
 	      NRF_SUCCESS)
 	       die();
-	  remaining -= length;
-	  offset += length;
+	  uint8_t n = (remaining < available) ? remaining : available;
+	  if (n > 0 && sd_rand_application_vector_get(
+		   &drbg_entropy[drbg_entropy_count], n) != NRF_SUCCESS)
+	       die();
+	  drbg_entropy_count += n;
+     }
+
+     return drbg_entropy_count == DRBG_MIN_ENTROPY;
+}
+
+static void drbg_reseed_collected()
+{
+     drbg_reseed(&drbg, drbg_entropy, DRBG_MIN_ENTROPY, NULL, 0);
+     memset(drbg_entropy, 0, sizeof(drbg_entropy));
+     drbg_entropy_count = 0;
+}
+
+static void random_init()
+{
+     uint8_t seed[DRBG_MIN_ENTROPY + DRBG_MIN_NONCE];
+     sd_rand_wait(seed, sizeof(seed));
+     drbg_instantiate(&drbg, seed, DRBG_MIN_ENTROPY, 
+		      &seed[DRBG_MIN_ENTROPY], DRBG_MIN_NONCE,
+		      (const uint8_t *) DRBG_PERSONALIZATION,
+		      sizeof(DRBG_PERSONALIZATION) - 1);
+     memset(seed, 0, sizeof(seed));
+}
+
+/**
+ * Generate random bytes with the DRBG. If the DRBG must be reseeded (the
+ * background reseeding has not kept up), the entropy is completed first.
+ */
+static void random_bytes(uint8_t *buffer, unsigned int length)
+{
+     if (drbg_generate(&drbg, buffer, length, NULL, 0) == 0)
+	  return;
+
+     sd_rand_wait(&drbg_entropy[drbg_entropy_count], 
+		  DRBG_MIN_ENTROPY - drbg_entropy_count);
+     drbg_entropy_count = DRBG_MIN_ENTROPY;
+     drbg_reseed_collected();
+     if (drbg_generate(&drbg, buffer, length, NULL, 0) != 0)
+	  die();
+}
+
+/**
+ * Collect entropy, and reseed the DRBG if it is due and the entropy is 
+ * complete. This is one slice of background work.
+ *
+ * @return true if the DRBG has been reseeded.
+ */
+static bool drbg_reseed_step()
+{
+     if (!drbg_entropy_collect() || 
+	 drbg_requests(&drbg) < DRBG_RESEED_REQUESTS)
+	  return false;
+
+     drbg_reseed_collected();
+     return true;
+}
+
+/**
+ * Generate the next nonce of the nonce pool. This is one slice of 
+ * background work.
+ *
+ * @return true if a nonce has been generated; false if the pool is full.
+ */
+static bool nonce_pool_step()
+{
+     if (nonce_pool_count == NONCE_POOL_SIZE)
+	  return false;
+
+     random_bytes(nonce_pool[nonce_pool_count], NONCE_LENGTH);
+     nonce_pool_count++;
+
+     return true;
+}
+
+/**
+ * Replace the nonce by one from the nonce pool, or by a new one if the 
+ * pool is empty. The pool is refilled in the background.
+ */
+static void create_nonce()
+{
+     if (nonce_pool_count == 0) {
+	  random_bytes(nonce, NONCE_LENGTH);
+	  return;
      }
+
+     nonce_pool_count--;
+     memcpy(nonce, nonce_pool[nonce_pool_count], NONCE_LENGTH);
+     memset(nonce_pool[nonce_pool_count], 0, NONCE_LENGTH);
 }
 
 static void ecdh_secret_key(uint8_t secret_key[ECDH_KEY_LENGTH])
 {
-    uint8_t available;
-    unsigned int remaining = ECDH_KEY_LENGTH;
-    unsigned int offset = 0;
-    while (remaining > 0) {
-	 if (sd_rand_application_bytes_available_get(&available) != NRF_SUCCESS)
-	      die();
-	 uint8_t length = (remaining < available) ? remaining : available;
-	 if (sd_rand_application_vector_get(&secret_key[offset], length) != 
-	     NRF_SUCCESS)
-	      die();
-	 remaining -= length;
-	 offset += length;
-    }
+    random_bytes(secret_key, ECDH_KEY_LENGTH);
 
     // We need to clear bits 0-2 and set bit 254 to prevent small-subgroup 
     // attacks and timing attacks, respectively.
@@ -1061,17 +1720,99 @@ static void ecdh_public_key(uint8_t public_key[ECDH_KEY_LENGTH],
      crypto_scalarmult_curve25519_base(public_key, secret_key);
 }
 
-static void ecdh_shared_secret(uint8_t shared_secret[ECDH_KEY_LENGTH],
-			       const uint8_t my_secret_key[ECDH_KEY_LENGTH],
-			       const uint8_t other_public_key[ECDH_KEY_LENGTH])
+/**
+ * Generate the next keypair of the keypair pool. This is one slice of 
+ * background work.
+ *
+ * @return true if a keypair has been generated; false if the pool is full.
+ */
+static bool keypair_pool_step()
+{
+     if (keypair_pool_count == KEYPAIR_POOL_SIZE)
+	  return false;
+
+     struct ecdh_keypair *keypair = &keypair_pool[keypair_pool_count];
+     ecdh_secret_key(keypair->secret_key);
+     ecdh_public_key(keypair->public_key, keypair->secret_key);
+     keypair_pool_count++;
+
+     return true;
+}
+
+/**
+ * Take a keypair from the keypair pool. If the pool is empty (e.g., 
+ * the previous key exchange was only a moment ago), a new keypair is 
+ * generated. The pool is refilled in the background.
+ */
+static void keypair_pool_take(uint8_t secret_key[ECDH_KEY_LENGTH],
+			      uint8_t public_key[ECDH_KEY_LENGTH])
+{
+     if (keypair_pool_count == 0) {
+	  ecdh_secret_key(secret_key);
+	  ecdh_public_key(public_key, secret_key);
+	  return;
+     }
+
+     keypair_pool_count--;
+     struct ecdh_keypair *keypair = &keypair_pool[keypair_pool_count];
+     memcpy(secret_key, keypair->secret_key, ECDH_KEY_LENGTH);
+     memcpy(public_key, keypair->public_key, ECDH_KEY_LENGTH);
+     memset(keypair, 0, sizeof(*keypair));
+}
+
+/**
+ * Start calculating the shared secret of the key exchange from the server
+ * secret key and the client public key. The calculation is done in slices 
+ * of background work by ecdh_shared_secret_step(). When it is done, 
+ * the shared secret is in keyexchange_shared_secret, and event 
+ * APP_EVENT_SHARED_SECRET_READY is added to the event queue.
+ */
+static void ecdh_shared_secret_start()
+{
+     crypto_scalarmult_curve25519_init(&keyexchange_ecdh_state, 
+				       keyexchange_server_secret_key,
+				       keyexchange_client_public_key);
+     is_keyexchange_ecdh_running = true;
+}
+
+/**
+ * Cancel the calculation of the shared secret.
+ */
+static void ecdh_shared_secret_cancel()
+{
+     is_keyexchange_ecdh_running = false;
+     memset(&keyexchange_ecdh_state, 0, sizeof(keyexchange_ecdh_state));
+}
+
+/**
+ * Do the next ECDH_SLICE_BITS ladder steps of the shared secret 
+ * calculation, or the final inversion if all steps are done. This is one 
+ * slice of background work.
+ *
+ * @return true if a slice has been computed; false if there is no work left.
+ */
+static bool ecdh_shared_secret_step()
 {
-     crypto_scalarmult_curve25519(shared_secret, my_secret_key, 
-				  other_public_key);
+     if (!is_keyexchange_ecdh_running)
+	  return false;
+
+     if (crypto_scalarmult_curve25519_step(&keyexchange_ecdh_state, 
+					   ECDH_SLICE_BITS) == 0) {
+	  crypto_scalarmult_curve25519_finish(keyexchange_shared_secret,
+					      &keyexchange_ecdh_state);
+	  is_keyexchange_ecdh_running = false;
+	  struct app_event app_event = 
+	       {.event_type = APP_EVENT_SHARED_SECRET_READY};
+	  app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_APP, app_event);
+     }
+
+     return true;
 }
 
 static void display_init()
 {
      hd44780_init(&lcd);
+     hd44780_async_init(&lcd_async, &lcd);
 }
 
 static void display_on()
@@ -1084,24 +1825,64 @@ static void display_off()
      hd44780_display_on_off(&lcd, false, false, false);
 }
 
+/**
+ * Show two lines of text (NULL: empty line). Only the characters that 
+ * differ from the text shown are written to the LCD, which is done in the
+ * background by the display timer, so this does not wait for the LCD.
+ */
 static void display_text(const char *text1, unsigned int length1,
 			 const char *text2, unsigned int length2)
 {
-     hd44780_clear_display(&lcd);
-     if (text1 != NULL)
-	  hd44780_print_line(&lcd, text1, length1, 0);
-     if (text2 != NULL)
-	  hd44780_print_line(&lcd, text2, length2, 1);
+     hd44780_async_print_line(&lcd_async, text1, text1 != NULL ? length1 : 0,
+			      0);
+     hd44780_async_print_line(&lcd_async, text2, text2 != NULL ? length2 : 0,
+			      1);
+
+     // Start the display timer unless the display is being updated 
+     // already (then, the timer handler sends the new text, too).
+     bool is_idle;
+     CRITICAL_REGION_ENTER();
+     is_idle = !is_display_updating;
+     is_display_updating = true;
+     CRITICAL_REGION_EXIT();
+     if (is_idle && app_timer_start(display_timer, DISPLAY_TIMER_INTERVAL, 
+				    NULL) != NRF_SUCCESS)
+	  die();
+}
+
+/**
+ * Idle screen: the lock might still be actuated by an earlier unlock.
+ */
+static void display_ready()
+{
+     if (lock_state == lock_actuated)
+	  display_text("Opening door", 12, NULL, 0);
+     else
+	  display_text("Ready", 5, NULL, 0);
 }
 
 static void nonce_init()
 {
+     random_init();
      create_nonce();
 }
 
-static void binary_to_hexstr(char *str, const uint8_t *binary, unsigned int len)
+#ifdef ADVERTISED_NONCE
+/**
+ * Create a new nonce and publish it in the scan response.
+ */
+static void rotate_nonce()
 {
-     char *nextchar = str;
+     create_nonce();
+     nonce_counter++;
+     advertising_init();
+     restart_nonce_timer();
+}
+#endif
+
+static void binary_to_hexstr(char *str, const uint8_t *binary, unsigned int len)
+{
+     char *nextchar = str;
      for (unsigned int i = 0; i < len; i++) {
 	  nextchar += sprintf(nextchar, "%02X", binary[i]);
      }
@@ -1123,37 +1904,24 @@ static void display_shared_secret_hash()
      display_text("Key checksum", 12, str, 16);
 }
 
-static void store_key(unsigned int keyno)
-{
-     const unsigned int offset = sizeof(pstore_preamble) + 
-	  keyno*ECDH_KEY_LENGTH;
-     is_pstore_ready = false;
-
-     // Should we use the store or update operation? 
-     // Store: "Flash memory is unreliable when writing to a block already 
-     // containing data, a clear operation is needed."
-     // Update: "When using the update routine the Persistent Storage Manager 
-     // will use a swap area to conserve the blocks not affected. The data 
-     // page backed up in the swap area, the data page is erased, the non 
-     // affected blocks are copied back, then the updated block is stored. 
-     // It is not possible to update multiple blocks in one API call. Module 
-     // detects if backing up the page is needed or not and optimizes 
-     // accordingly."
-     // So write is unreliable, update is reliable. But update is very slow 
-     // compared to write:
-     // "Flash write operation takes up to 46.3 us and flash erase takes up 
-     // to 22.3 ms."
-     // Moreover, there's a limit number of erase-write cycles, specifically
-     // for nRF51 "20,000 minimum write/erase cycles".
-     // We will not store keys very often. So we should opt for reliability
-     // using the update operation in a productive system.
-     /*
-     if (pstorage_store(&pstore_handle, keys[keyno], ECDH_KEY_LENGTH, 
-			offset) != NRF_SUCCESS)
-	  die();
-     */
-     if (pstorage_update(&pstore_handle, keys[keyno], ECDH_KEY_LENGTH, 
-                         offset) != NRF_SUCCESS)
+static void store_key(unsigned int keyno, const uint8_t *key)
+{
+     struct key_record record;
+
+     memcpy(record.key, key, ECDH_KEY_LENGTH);
+#ifdef PSTORE_HMAC_STATES
+     crypto_auth_hmacsha512256_beforenm(&record.hmac_state, key);
+#endif
+
+     // The key store appends the key to the log of its page, or rewrites
+     // the page into its spare page (one page erase) if the log is full. 
+     // Compared to updating the key in place with pstorage_update() (back 
+     // up the page in the swap page, erase the page, copy back), this 
+     // saves at least a page erase, and spreads the erase cycles over all
+     // pages of the store. The main loop keeps running 
+     // while the flash is written; APP_EVENT_KEY_STORED signals completion.
+     if (key_store_write(&key_store, keyno, (uint8_t *) &record) != 0 ||
+	 key_store_commit(&key_store) != 0)
 	  die();
 }
 
@@ -1164,95 +1932,49 @@ static void pstore_cb_handler(pstorage_handle_t *handle, uint8_t op_code,
      if (result != NRF_SUCCESS)
 	  die();
 
+     // Flash operations of the key store are continued by the main loop.
      // The following switch statement is supposed to fall through.
      switch(op_code) {
-     case PSTORAGE_LOAD_OP_CODE :
      case PSTORAGE_STORE_OP_CODE :
      case PSTORAGE_CLEAR_OP_CODE :
-     case PSTORAGE_UPDATE_OP_CODE :
-	  is_pstore_ready = true;
-	  if (app_state != booting) {
+	  {
 	       struct app_event app_event = 
 		    {.event_type = APP_EVENT_PSTORE_READY};
-	       app_event_queue_add(&app_event_queue, app_event);
+	       app_event_rings_add(&app_event_rings, APP_EVENT_SOURCE_PSTORE, 
+				   app_event);
 	  }
      }
 }
 
-static bool is_key_valid(unsigned int keyno)
-{
-     // An all zero pattern indicates an invalid key.
-     for (unsigned int i = 0; i < ECDH_KEY_LENGTH; i++)
-	  if (keys[keyno][i] != 0x00)
-	       return true;
-
-     // All bytes are zero -> invalid key.
-     return false;
-}
-
-static bool load_keys()
+/**
+ * Flash interface of the key store: erase a page of the key store.
+ */
+static int pstore_erase(unsigned int page)
 {
-     uint8_t preamble[sizeof(pstore_preamble)];
-
-     // Read preamble (random pattern) to see whether keystore contains valid 
-     // keys. If storage is read for the first time without previous writing,
-     // it is highly unlikely that the pseudo-random pattern will be found.
-
-     is_pstore_ready = false;
-     if (pstorage_load(preamble, &pstore_handle, sizeof(preamble), 0)
-	 != NRF_SUCCESS)
-	  die();
-     // Busy waiting for pstore to become ready.
-     while (!is_pstore_ready);
-     for (unsigned int i = 0; i < sizeof(preamble); i++) {
-	  if (pstore_preamble[i] != preamble[i])
-	       return false;
-     }
-
-     // Preamble OK. Stored data is valid.
-     
-     // Load keys.
-     unsigned int storage_offset = sizeof(preamble);
-     uint8_t flag = 0x01;
-     for (unsigned int i = 0; i < KEY_COUNT; i++) {
-	  is_pstore_ready = false;
-	  if (pstorage_load(keys[i], &pstore_handle, ECDH_KEY_LENGTH, 
-			    storage_offset) != NRF_SUCCESS)
-	       die();
-	  // Busy waiting for pstore to become ready.
-	  while (!is_pstore_ready);
-	  if (is_key_valid(i))
-	       keys_valid |= flag;
-	  flag <<= 1;
-	  storage_offset += ECDH_KEY_LENGTH;
-     }
-
-     return true;
+     pstorage_handle_t handle;
+     if (pstorage_block_identifier_get(&pstore_handle, page, &handle) != 
+	 NRF_SUCCESS)
+	  return -1;
+     // Clearing a whole page erases it without using the swap page.
+     if (pstorage_clear(&handle, PSTORAGE_FLASH_PAGE_SIZE) != NRF_SUCCESS)
+	  return -1;
+     return 0;
 }
 
-static void format_pstore()
+/**
+ * Flash interface of the key store: write to a page of the key store.
+ */
+static int pstore_write(unsigned int page, unsigned int offset,
+			const uint32_t *data, unsigned int size)
 {
-     is_pstore_ready = false;
-     if (pstorage_clear(&pstore_handle, sizeof(pstore_preamble) + 
-			KEY_COUNT*ECDH_KEY_LENGTH) != NRF_SUCCESS)
-	  die();
-     while (!is_pstore_ready);
-
-     is_pstore_ready = false;
-     if (pstorage_store(&pstore_handle, pstore_preamble, 
-			sizeof(pstore_preamble), 0) != NRF_SUCCESS)
-	  die();
-     while (!is_pstore_ready);
-
-     unsigned int offset = sizeof(pstore_preamble);
-     for (unsigned int i = 0; i < KEY_COUNT; i++) {
-	  is_pstore_ready = false;
-	  if (pstorage_store(&pstore_handle, keys[i], 
-			     ECDH_KEY_LENGTH, offset) != NRF_SUCCESS)
-	       die();
-	  while (!is_pstore_ready);
-	  offset += ECDH_KEY_LENGTH;
-     }
+     pstorage_handle_t handle;
+     if (pstorage_block_identifier_get(&pstore_handle, page, &handle) != 
+	 NRF_SUCCESS)
+	  return -1;
+     if (pstorage_store(&handle, (uint8_t *) data, size, offset) != 
+	 NRF_SUCCESS)
+	  return -1;
+     return 0;
 }
 
 static void pstore_init()
@@ -1260,21 +1982,29 @@ static void pstore_init()
      if (pstorage_init() != NRF_SUCCESS)
 	  die();
 
+     // One pstorage block per page of the key store.
      pstorage_module_param_t param;
-     param.block_size = sizeof(pstore_preamble) + KEY_COUNT*ECDH_KEY_LENGTH;
-     param.block_count = 1;
+     param.block_size = PSTORAGE_FLASH_PAGE_SIZE;
+     param.block_count = KEY_STORE_PAGES;
      param.cb = pstore_cb_handler;
      if (pstorage_register(&param, &pstore_handle) != NRF_SUCCESS)
 	  die();
 
-     if (!load_keys()) {
-	  // First time usage of pstore (nothing written yet to pstore).
-	  format_pstore();
-	  // No data could be read from pstore -> all keys are invalid.
-	  for (unsigned int key = 0; key < KEY_COUNT; key++)
-	       memset(keys[key], 0, ECDH_KEY_LENGTH);
-	  keys_valid = 0;
-     }
+     // The block identifier is the flash address of the block. Keys are 
+     // read directly from the (memory-mapped) flash when needed, so 
+     // nothing is loaded here. Fails if the pages cannot hold KEY_COUNT 
+     // keys.
+     struct key_store_flash flash = {
+	  .erase = pstore_erase,
+	  .write = pstore_write,
+	  .base = (const uint8_t *) pstore_handle.block_id,
+	  .page_size = PSTORAGE_FLASH_PAGE_SIZE,
+	  .page_count = KEY_STORE_PAGES
+     };
+     if (key_store_init(&key_store, &flash, KEY_STORE_MAGIC, KEY_COUNT, 
+			KEY_RECORD_PSTORE_SIZE, key_store_map, 
+			key_store_buffer) != 0)
+	  die();
 }
 
 static void indicate_nonce()
@@ -1319,34 +2049,369 @@ static void indicate_public_key(unsigned int part)
 	  die();
 }
 
+/**
+ * Actuate the lock for LOCK_ACTION_TIMER_TIMEOUT. If the lock is already
+ * actuated, the actuation is extended.
+ */
 static void lock_action_start()
 {
      // The lock is active high.
      nrf_gpio_pin_set(PIN_LOCK);
      start_lock_action_timer();
+     lock_state = lock_actuated;
 }
 
 static void lock_action_stop()
 {
      // The lock is active high.
      nrf_gpio_pin_clear(PIN_LOCK);
+     lock_state = lock_released;
+}
+
+static void lock_transition(struct app_event event)
+{
+     switch (lock_state) {
+     case lock_released :
+	  break;
+     case lock_actuated :
+	  if (event.event_type == APP_EVENT_LOCK_ACTION_TIMEOUT &&
+	      lock_action_generation_fired == lock_action_generation) {
+	       lock_action_stop();
+	       if (app_state == idle || app_state == session_wait_unlock)
+		    display_ready();
+	  }
+	  break;
+     default :
+	  die();
+     }
+}
+
+/**
+ * HMAC of a message with a key read directly from flash.
+ *
+ * @return false if the key is not valid.
+ */
+static bool key_hmac(uint8_t *hmac, const uint8_t *msg, unsigned int len, 
+		     unsigned int keyno)
+{
+     const struct key_record *record = 
+	  (const struct key_record *) key_store_read(&key_store, keyno);
+     if (record == NULL)
+	  return false;
+
+#ifdef PSTORE_HMAC_STATES
+     crypto_auth_hmacsha512256_afternm(hmac, msg, len, &record->hmac_state);
+#else
+     crypto_auth_hmacsha512256(hmac, msg, len, record->key);
+#endif
+     return true;
+}
+
+#ifdef MASTER_KEY_DERIVATION
+static void credential_cache_clear()
+{
+     for (unsigned int i = 0; i < CREDENTIAL_CACHE_SIZE; i++)
+	  credential_cache[i].last_use = 0;
+     credential_cache_clock = 0;
+}
+
+/**
+ * HMAC state of the key of a credential, from the cache or derived from 
+ * the master secret (replacing the least recently used cache entry).
+ *
+ * @return NULL if there is no master secret.
+ */
+static const crypto_auth_hmacsha512256_state *credential_hmac_state(
+     const uint8_t *credential_id)
+{
+     struct credential_cache_entry *lru = &credential_cache[0];
+
+     credential_cache_clock++;
+     for (unsigned int i = 0; i < CREDENTIAL_CACHE_SIZE; i++) {
+	  struct credential_cache_entry *entry = &credential_cache[i];
+	  if (entry->last_use != 0 && 
+	      memcmp(entry->credential_id, credential_id, 
+		     CREDENTIAL_ID_LENGTH) == 0) {
+	       entry->last_use = credential_cache_clock;
+	       return &entry->hmac_state;
+	  }
+	  if (entry->last_use < lru->last_use)
+	       lru = entry;
+     }
+
+     uint8_t msg[sizeof(CREDENTIAL_KDF_LABEL) - 1 + CREDENTIAL_ID_LENGTH];
+     uint8_t key[HMAC512_256];
+     memcpy(msg, CREDENTIAL_KDF_LABEL, sizeof(CREDENTIAL_KDF_LABEL) - 1);
+     memcpy(&msg[sizeof(CREDENTIAL_KDF_LABEL) - 1], credential_id, 
+	    CREDENTIAL_ID_LENGTH);
+     if (!key_hmac(key, msg, sizeof(msg), 0))
+	  return NULL;
+     crypto_auth_hmacsha512256_beforenm(&lru->hmac_state, key);
+     memset(key, 0, sizeof(key));
+     memcpy(lru->credential_id, credential_id, CREDENTIAL_ID_LENGTH);
+     lru->last_use = credential_cache_clock;
+
+     return &lru->hmac_state;
+}
+#endif
+
+#ifdef MASTER_KEY_DERIVATION
+/**
+ * Start computing the expected HMAC of the current nonce for a credential 
+ * in the background. 
+ */
+static void expected_hmac_start(const uint8_t *client_id)
+{
+     is_expected_hmac_valid = false;
+     is_expected_hmac_pending = true;
+     memcpy(expected_hmac_client_id, client_id, CLIENT_ID_LENGTH);
+}
+
+/**
+ * Cancel the background computation of the expected HMAC and invalidate 
+ * the expected HMAC.
+ */
+static void expected_hmac_cancel()
+{
+     is_expected_hmac_valid = false;
+     is_expected_hmac_pending = false;
+}
+
+/**
+ * Compute the HMAC of the current nonce with the key of a credential.
+ *
+ * @return false if there is no master secret.
+ */
+static bool credential_hmac(uint8_t *hmac, const uint8_t *credential_id)
+{
+     const crypto_auth_hmacsha512256_state *state = 
+	  credential_hmac_state(credential_id);
+     if (state == NULL)
+	  return false;
+     crypto_auth_hmacsha512256_afternm(hmac, nonce, NONCE_LENGTH, state);
+     return true;
 }
 
+/**
+ * Compute the pending expected HMAC. This is one slice of background work,
+ * which is called from the main loop whenever no application events are 
+ * pending. 
+ *
+ * @return true if a slice has been computed; false if there is no work left.
+ */
+static bool expected_hmac_step()
+{
+     if (!is_expected_hmac_pending)
+	  return false;
+
+     is_expected_hmac_pending = false;
+     is_expected_hmac_valid = credential_hmac(expected_hmac, 
+					      expected_hmac_client_id);
+
+     return true;
+}
+
+/**
+ * Make the expected HMAC of the current nonce for the client of the unlock 
+ * request available.
+ *
+ * @return the expected HMAC, or NULL if the key of the client is not valid.
+ */
+static const uint8_t *expected_hmac_finish()
+{
+     // Usually, the expected HMAC has already been computed in the background.
+     // If not (e.g., very fast client, or the credential ID of the second 
+     // part differs from the first one), compute it now.
+     if (!is_expected_hmac_valid || 
+	 memcmp(expected_hmac_client_id, unlock_client_id, 
+		CLIENT_ID_LENGTH) != 0) {
+	  memcpy(expected_hmac_client_id, unlock_client_id, CLIENT_ID_LENGTH);
+	  is_expected_hmac_valid = credential_hmac(expected_hmac, 
+						   unlock_client_id);
+     }
+     return is_expected_hmac_valid ? expected_hmac : NULL;
+}
+#else
+/**
+ * Start computing the expected HMACs of the current nonce for all valid 
+ * keys in the background. Must be called whenever a client may start 
+ * using a new nonce.
+ */
+static void expected_hmacs_start()
+{
+     expected_hmacs_valid = 0;
+     expected_hmacs_pending = (1 << KEY_COUNT) - 1;
+}
+
+/**
+ * Start computing the expected HMAC of the current nonce for a single key 
+ * in the background (within a session, the key is known).
+ */
+static void expected_hmac_start(const uint8_t *client_id)
+{
+     expected_hmacs_valid = 0;
+     expected_hmacs_pending = (1 << client_id[0]);
+}
+
+/**
+ * Cancel the background computation of expected HMACs and invalidate the 
+ * HMACs computed so far.
+ */
+static void expected_hmac_cancel()
+{
+     expected_hmacs_valid = 0;
+     expected_hmacs_pending = 0;
+}
+
+/**
+ * Compute the expected HMAC of the next pending valid key. This is one 
+ * slice of background work, which is called from the main loop whenever 
+ * no application events are pending. 
+ *
+ * @return true if a slice has been computed; false if there is no work left.
+ */
+static bool expected_hmac_step()
+{
+     for (unsigned int keyno = 0; keyno < KEY_COUNT; keyno++) {
+	  if ( ((1 << keyno)&expected_hmacs_pending) == 0)
+	       continue;
+	  expected_hmacs_pending &= ~(1 << keyno);
+	  if (key_hmac(expected_hmacs[keyno], nonce, NONCE_LENGTH, keyno)) {
+	       expected_hmacs_valid |= (1 << keyno);
+	       return true;
+	  }
+     }
+
+     return false;
+}
+
+/**
+ * Make the expected HMAC of the current nonce for the client of the unlock 
+ * request available.
+ *
+ * @return the expected HMAC, or NULL if the key of the client is not valid.
+ */
+static const uint8_t *expected_hmac_finish()
+{
+     unsigned int keyno = unlock_client_id[0];
+
+     // Usually, the expected HMAC has already been computed in the background.
+     // If not (e.g., very fast client), compute it now.
+     if ( ((1 << keyno)&expected_hmacs_valid) == 0) {
+	  if (!key_hmac(expected_hmacs[keyno], nonce, NONCE_LENGTH, keyno))
+	       return NULL;
+	  expected_hmacs_valid |= (1 << keyno);
+     }
+     return expected_hmacs[keyno];
+}
+#endif
+
 static bool check_auth()
 {
-     if ( ((1 << unlock_key_no)&keys_valid) == 0)
+     const uint8_t *expected_hmac = expected_hmac_finish();
+     if (expected_hmac == NULL)
 	  return false;
 
-     // crypto_auth_hmacsha512256_verify() returns 0 on successful
-     // verification.
-     if (crypto_auth_hmacsha512256_verify(unlock_hmac_client, 
-					  nonce, NONCE_LENGTH, 
-					  keys[unlock_key_no]) == 0)
+     // crypto_verify_32() compares in constant time and returns 0 if both
+     // HMACs are equal.
+     if (crypto_verify_32(unlock_hmac_client, expected_hmac) == 0)
 	  return true;
      else
 	  return false;
 }
 
+#if defined(EARLY_ACTUATION) || defined(PERSISTENT_SESSIONS)
+/**
+ * Disconnect the client. The client might have disconnected already; the 
+ * ISR has then invalidated the connection handle, and the disconnection 
+ * event is still pending.
+ */
+static void disconnect_client()
+{
+     if (conn_handle == BLE_CONN_HANDLE_INVALID)
+	  return;
+     uint32_t err_code = sd_ble_gap_disconnect(
+	  conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+     if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_INVALID_STATE &&
+	 err_code != BLE_ERROR_INVALID_CONN_HANDLE)
+	  die();
+}
+#endif
+
+#ifdef PERSISTENT_SESSIONS
+/**
+ * Replace the nonce by the next nonce of the session chain.
+ */
+static void session_next_nonce()
+{
+     uint8_t msg[sizeof(SESSION_CHAIN_LABEL) - 1 + NONCE_LENGTH];
+     uint8_t hash[SHA512_HASH_LENGTH];
+
+     memcpy(msg, SESSION_CHAIN_LABEL, sizeof(SESSION_CHAIN_LABEL) - 1);
+     memcpy(&msg[sizeof(SESSION_CHAIN_LABEL) - 1], nonce, NONCE_LENGTH);
+     crypto_hash_sha512(hash, msg, sizeof(msg));
+     memcpy(nonce, hash, NONCE_LENGTH);
+}
+
+/**
+ * The client has unlocked (first HMAC or within the session): actuate the 
+ * lock and wait for the next unlock with the next nonce of the chain.
+ */
+static void session_unlock()
+{
+     display_text("Opening door", 12, NULL, 0);
+     lock_action_start();
+     session_next_nonce();
+     expected_hmac_start(unlock_client_id);
+     stop_auth_timer();
+     start_auth_timer();
+     restart_session_timer();
+     app_state = session_wait_unlock;
+}
+
+/**
+ * End the session: disconnect the client.
+ */
+static void session_end()
+{
+     stop_auth_timer();
+     stop_session_timer();
+     expected_hmac_cancel();
+     disconnect_client();
+     app_state = aborted_wait_disconnect;
+}
+#endif
+
+/**
+ * The client HMAC is complete. With EARLY_ACTUATION or PERSISTENT_SESSIONS,
+ * check it right away. With EARLY_ACTUATION, actuate the lock and 
+ * disconnect the client; with PERSISTENT_SESSIONS, actuate the lock and 
+ * start a session. Otherwise, wait for the client to disconnect.
+ */
+static void auth_hmac_complete()
+{
+#if defined(EARLY_ACTUATION) || defined(PERSISTENT_SESSIONS)
+     stop_auth_timer();
+     bool is_authenticated = check_auth();
+     expected_hmac_cancel();
+#ifdef PERSISTENT_SESSIONS
+     if (is_authenticated) {
+	  session_unlock();
+	  return;
+     }
+#endif
+     if (is_authenticated) {
+	  display_text("Opening door", 12, NULL, 0);
+	  lock_action_start();
+     }
+     disconnect_client();
+     // Authentication is over; only the disconnection is missing.
+     app_state = aborted_wait_disconnect;
+#else
+     app_state = auth_wait_disconnect;
+#endif
+}
+
 /*
 static void set_nonce_char() 
 {
@@ -1362,298 +2427,479 @@ static void set_nonce_char()
 }
 */
 
-static void state_transition(struct app_event event) 
+// Actions of the state machine (see the transition table below). Actions 
+// are shared by all transitions doing the same thing.
+#define ACTION_CFG_START 1
+#define ACTION_CFG_CANCEL 2
+#define ACTION_DISCONNECT 3
+#define ACTION_CLIENT_GONE 4
+#define ACTION_READY 5
+#define ACTION_AUTH_START 6
+#define ACTION_KEY_PART1 7
+#define ACTION_KEY_PART2 8
+#define ACTION_SHARED_SECRET_READY 9
+#define ACTION_SERVER_KEY_PART2 10
+#define ACTION_STORE_KEY 11
+#define ACTION_SEND_NONCE 12
+#define ACTION_HMAC_PART1 13
+#define ACTION_HMAC_PART2 14
+#define ACTION_HMAC 15
+#define ACTION_CHECK_AUTH 16
+#define ACTION_ROTATE_NONCE 17
+#define ACTION_SESSION_UNLOCK 18
+#define ACTION_SESSION_NEW_NONCE 19
+#define ACTION_SESSION_END 20
+#define ACTION_SESSION_NONCE_RCVD 21
+#define ACTION_SESSION_SUBSCRIBED 22
+#define ACTION_COUNT 23
+
+/**
+ * Red button pressed while idle: wait for the client of a key exchange.
+ */
+static void action_cfg_start(struct app_event event)
 {
-     switch (app_state) {
-     case idle :
-	  if (event.event_type == APP_EVENT_BUTTON_RED_PRESSED) {
-	       display_text("Waiting for", 11, "client key", 10);
-	       app_state = cfg_wait_connection;
-	  } else if (event.event_type == APP_EVENT_CLIENT_CONNECTED) {
-	       display_text("Authentication", 14, NULL, 0);
-	       start_auth_timer();
-	       // If we sometimes use bonding, note that bonded devices might 
-	       // already have subscribed when they connect. Subscriptions 
-	       // are stored for bonded devices. 
-	       app_state = auth_wait_subscription;
-	  }
-	  break;
-     case cfg_wait_connection :
-	  if (event.event_type == APP_EVENT_BUTTON_RED_PRESSED) {
-	       // At this stage, another button press will abort configuration.
-	       app_state = idle;
-	       display_text("Ready", 5, NULL, 0);	       
-	  } else if (event.event_type == APP_EVENT_CLIENT_CONNECTED) {
-	       // If we sometimes use bonding, note that bonded devices might 
-	       // already have subscribed when they connect. Subscriptions 
-	       // are stored for bonded devices. 
-	       app_state = cfg_wait_subscription;
-	  }
-	  break;
-     case cfg_wait_subscription :
-	  if (event.event_type == APP_EVENT_BUTTON_RED_PRESSED) {
-	       // At this stage, another button press will abort configuration.
-	       // We need to disconnect the already connected client.
-	       if (sd_ble_gap_disconnect(
-			conn_handle, 
-			BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION) !=
-		   NRF_SUCCESS)
-		    die();
-	       app_state = aborted_wait_disconnect;
-	  } else if (event.event_type == APP_EVENT_CLIENT_DISCONNECTED) {
-	       // Configuration aborted through client disconnection.
-	       app_state = idle;
-	       start_advertising();
-	       display_text("Ready", 5, NULL, 0);
-	  } else if (event.event_type == APP_EVENT_SUBSCRIBED_CFG_OUT)
-	       app_state = cfg_wait_key_part1;
-	  break;
-     case cfg_wait_key_part1 :
-	  if (event.event_type == APP_EVENT_BUTTON_RED_PRESSED) {
-	       // At this stage, another button press will abort configuration.
-	       // We need to disconnect the already connected client.
-	       if (sd_ble_gap_disconnect(
-			conn_handle, 
-			BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION) !=
-		   NRF_SUCCESS)
-		    die();
-	       app_state = aborted_wait_disconnect;
-	  } else if (event.event_type == APP_EVENT_CLIENT_DISCONNECTED) {
-	       // Configuration aborted through client disconnection.
-	       app_state = idle;
-	       start_advertising();
-	       display_text("Ready", 5, NULL, 0);
-	  } else if (event.event_type == APP_EVENT_KEY_PART_RCVD)
-	       app_state = cfg_wait_key_part2;
-	  break;
-     case cfg_wait_key_part2 : 
-	  if (event.event_type == APP_EVENT_BUTTON_RED_PRESSED) {
-	       // At this stage, another button press will abort configuration.
-	       // We need to disconnect the already connected client.
-	       if (sd_ble_gap_disconnect(
-			conn_handle, 
-			BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION) !=
-		   NRF_SUCCESS)
-		    die();
-	       app_state = aborted_wait_disconnect;
-	  } else if (event.event_type == APP_EVENT_CLIENT_DISCONNECTED) {
-	       // Configuration aborted through client disconnection.
-	       app_state = idle;
-	       start_advertising();
-	       display_text("Ready", 5, NULL, 0);
-	  } else if (event.event_type == APP_EVENT_KEY_PART_RCVD) {
-	       // Received public key from client.
-	       // Now server calculates its keypair and the shared secret.
-	       // The server's public key is then send to the client 
-	       // to also let the client calculate the shared secret.
-	       display_text("Calculating", 11, "secret", 6);
-	       ecdh_secret_key(keyexchange_server_secret_key);
-	       ecdh_public_key(keyexchange_server_public_key, 
-			       keyexchange_server_secret_key);
-	       ecdh_shared_secret(keyexchange_shared_secret, 
-				  keyexchange_server_secret_key, 
-				  keyexchange_client_public_key);
-	       display_shared_secret_hash();
-	       // Send server public key as indication to client. 
-	       indicate_public_key(0); // Sending part 1 of server key.
-	       app_state = cfg_wait_server_key_part1_rcvd;
-	  }    
-	  break;
-     case cfg_wait_server_key_part1_rcvd :
-	  if (event.event_type == APP_EVENT_BUTTON_RED_PRESSED) {
-	       // At this stage, another button press will abort configuration.
-	       // We need to disconnect the already connected client.
-	       if (sd_ble_gap_disconnect(
-			conn_handle, 
-			BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION) !=
-		   NRF_SUCCESS)
-		    die();
-	       app_state = aborted_wait_disconnect;
-	  } else if (event.event_type == APP_EVENT_CLIENT_DISCONNECTED) {
-	       // Configuration aborted through client disconnection.
-	       app_state = idle;
-	       start_advertising();
-	       display_text("Ready", 5, NULL, 0);
-	  } else if (event.event_type == APP_EVENT_INDICATION_CFG_OUT_RCVD) {
-	       indicate_public_key(1); // Sending part 2 of server key.
-	       app_state = cfg_wait_server_key_part2_rcvd;
-	  }
-	  break;
-     case cfg_wait_server_key_part2_rcvd :
-	  if (event.event_type == APP_EVENT_BUTTON_RED_PRESSED) {
-	       // At this stage, another button press will abort configuration.
-	       // We need to disconnect the already connected client.
-	       if (sd_ble_gap_disconnect(
-			conn_handle, 
-			BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION) !=
-		   NRF_SUCCESS)
-		    die();
-	       app_state = aborted_wait_disconnect;
-	  } else if (event.event_type == APP_EVENT_CLIENT_DISCONNECTED) {
-	       // Configuration aborted through client disconnection.
-	       app_state = idle;
-	       start_advertising();
-	       display_text("Ready", 5, NULL, 0);
-	  } else if (event.event_type == APP_EVENT_INDICATION_CFG_OUT_RCVD) {
-	       app_state = cfg_wait_disconnect;
-	  }
-	  break;
-     case cfg_wait_disconnect :
-	  // After the client received the server public key, it
-	  // should disconnect.
-	  if (event.event_type == APP_EVENT_BUTTON_RED_PRESSED) {
-	       // At this stage, another button press will abort configuration.
-	       // We need to disconnect the already connected client.
-	       if (sd_ble_gap_disconnect(
-			conn_handle, 
-			BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION) !=
-		   NRF_SUCCESS)
-		    die();
-	       app_state = aborted_wait_disconnect;
-	  } else if (event.event_type == APP_EVENT_CLIENT_DISCONNECTED) {
-	       app_state = cfg_wait_decision;
-	  }
-	  break;
-     case cfg_wait_decision :
-	  if (event.event_type == APP_EVENT_BUTTON_RED_PRESSED) {
-	       // User aborted.
-	       display_text("Ready", 5, NULL, 0);
-	       app_state = idle;
-	       start_advertising();
-	  } else if (event.event_type == APP_EVENT_BUTTON_GREEN_PRESSED) {
-	       // User confirmed. 
-	       // Make new shared secret effective.
-	       memcpy(keys[keyexchange_key_no], keyexchange_shared_secret,
-		      ECDH_KEY_LENGTH);
-	       uint8_t mask = (1 << keyexchange_key_no);
-	       keys_valid |= mask;
-	       // Make exchanged shared secret persistent.
-	       display_text("Storing key", 11, NULL, 0);
-	       store_key(keyexchange_key_no);
-	       app_state = cfg_wait_key_store;
-	  }
-	  break;
-     case cfg_wait_key_store :
-	  if (event.event_type == APP_EVENT_PSTORE_READY) {
-	       display_text("Ready", 5, NULL, 0);
-	       app_state = idle;
-	       start_advertising();
-	  }
-	  break;
-     case auth_wait_subscription :
-          if (event.event_type == APP_EVENT_AUTH_TIMEOUT) {
-	       // Timeout -> abort authentication.
-	       // Disconnect still connected client.
-	       if (sd_ble_gap_disconnect(
-			conn_handle, 
-			BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION) !=
-		   NRF_SUCCESS)
-		    die();
-	       app_state = aborted_wait_disconnect;
-	  } else if (event.event_type == APP_EVENT_CLIENT_DISCONNECTED) {
-	       // Authentication aborted through client disconnection.
-	       stop_auth_timer();
-	       app_state = idle;
-	       start_advertising();
-	       display_text("Ready", 5, NULL, 0);
-	  } else if (event.event_type == APP_EVENT_SUBSCRIBED_NONCE) {
-	       // Create a new nonce for next authentication request.
-	       create_nonce();
-	       // Send nonce to client as indication.
-	       indicate_nonce();
-	       app_state = auth_wait_nonce_rcvd;
-	  }
-          break;
-     case auth_wait_nonce_rcvd :
-          if (event.event_type == APP_EVENT_AUTH_TIMEOUT) {
-	       // Timeout -> abort authentication.
-	       // Disconnect still connected client.
-	       if (sd_ble_gap_disconnect(
-			conn_handle, 
-			BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION) !=
-		   NRF_SUCCESS)
-		    die();
-	       app_state = aborted_wait_disconnect;
-	  } else if (event.event_type == APP_EVENT_CLIENT_DISCONNECTED) {
-	       // Authentication aborted through client disconnection.
-	       stop_auth_timer();
-	       app_state = idle;
-	       start_advertising();
-	       display_text("Ready", 5, NULL, 0);
-	  } else if (event.event_type == APP_EVENT_INDICATION_NONCE_RCVD) {
-	       app_state = auth_wait_hmac_part1;
-	  }
-	  break;
-     case auth_wait_hmac_part1 :
-	  if (event.event_type == APP_EVENT_AUTH_TIMEOUT) {
-	       // Timeout -> abort authentication.
-	       // Disconnect still connected client.
-	       if (sd_ble_gap_disconnect(
-			conn_handle, 
-			BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION) !=
-		   NRF_SUCCESS)
-		    die();
-	       app_state = aborted_wait_disconnect;
-	  } else if (event.event_type == APP_EVENT_CLIENT_DISCONNECTED) {
-	       // Authentication aborted through client disconnection.
-	       stop_auth_timer();
-	       app_state = idle;
-	       start_advertising();
-	       display_text("Ready", 5, NULL, 0);
-	  } else if (event.event_type == APP_EVENT_HMAC_PART_RCVD)
-	       app_state = auth_wait_hmac_part2;
-	  break;
-     case auth_wait_hmac_part2 :
-	  if (event.event_type == APP_EVENT_AUTH_TIMEOUT) {
-	       // Timeout -> abort authentication.
-	       // Disconnect still connected client.
-	       if (sd_ble_gap_disconnect(
-			conn_handle, 
-			BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION) !=
-		   NRF_SUCCESS)
-		    die();
-	       app_state = aborted_wait_disconnect;
-	  } else if (event.event_type == APP_EVENT_CLIENT_DISCONNECTED) {
-	       // Authentication aborted through client disconnection.
-	       stop_auth_timer();
-	       app_state = idle;
-	       start_advertising();
-	       display_text("Ready", 5, NULL, 0);
-	  } else if (event.event_type == APP_EVENT_HMAC_PART_RCVD)
-	       app_state = auth_wait_disconnect;
-	  break;
-     case auth_wait_disconnect :
-	  if (event.event_type == APP_EVENT_CLIENT_DISCONNECTED) {
-	       stop_auth_timer();
-	       if (check_auth()) {
-		    display_text("Opening door", 12, NULL, 0);
-		    lock_action_start();
-		    app_state = auth_wait_lock_action_timeout;
-	       } else {
-		    display_text("Ready", 5, NULL, 0);
-		    app_state = idle;
-		    start_advertising();
-	       }
-	  }
-	  break;
-     case auth_wait_lock_action_timeout :
-	  if (event.event_type == APP_EVENT_LOCK_ACTION_TIMEOUT) {
-	       lock_action_stop();
-	       app_state = idle;
-	       start_advertising();
-	       display_text("Ready", 5, NULL, 0);
-	  }
-	  break;
-     case aborted_wait_disconnect :
-	  if (event.event_type == APP_EVENT_CLIENT_DISCONNECTED) {
-	       app_state = idle;
-	       start_advertising();
-	       display_text("Ready", 5, NULL, 0);
-	  }
-	  break;
-     default :
+     display_text("Waiting for", 11, "client key", 10);
+}
+
+/**
+ * Red button pressed again before the client connected: abort the key 
+ * exchange.
+ */
+static void action_cfg_cancel(struct app_event event)
+{
+     display_ready();
+}
+
+/**
+ * Abort (key exchange aborted by the user, or authentication timeout): 
+ * disconnect the client, and stop background work for it.
+ */
+static void action_disconnect(struct app_event event)
+{
+     if (sd_ble_gap_disconnect(conn_handle, 
+			       BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION) !=
+	 NRF_SUCCESS)
 	  die();
+     ecdh_shared_secret_cancel();
+     expected_hmac_cancel();
+}
+
+/**
+ * The client has disconnected (or the device has disconnected it after
+ * aborting): stop the timers and background work of the connection, and
+ * wait for the next client.
+ */
+static void action_client_gone(struct app_event event)
+{
+     stop_auth_timer();
+#ifdef PERSISTENT_SESSIONS
+     stop_session_timer();
+#endif
+     ecdh_shared_secret_cancel();
+     expected_hmac_cancel();
+     start_advertising();
+     display_ready();
+}
+
+/**
+ * Key exchange finished or aborted after the client disconnected: wait for
+ * the next client.
+ */
+static void action_ready(struct app_event event)
+{
+     display_ready();
+     start_advertising();
+}
+
+static void action_auth_start(struct app_event event)
+{
+     display_text("Authentication", 14, NULL, 0);
+     start_auth_timer();
+#ifdef PERSISTENT_SESSIONS
+     is_nonce_subscribed = false;
+     is_nonce_indication_pending = false;
+#endif
+#if defined(ADVERTISED_NONCE) && !defined(MASTER_KEY_DERIVATION)
+     // The client already has the advertised nonce, and its HMAC may 
+     // follow right away.
+     expected_hmacs_start();
+#endif
+     // If we sometimes use bonding, note that bonded devices might 
+     // already have subscribed when they connect. Subscriptions 
+     // are stored for bonded devices. 
+}
+
+static void action_key_part1(struct app_event event)
+{
+     key_part_rcvd(event);
+}
+
+static void action_key_part2(struct app_event event)
+{
+     key_part_rcvd(event);
+     // Received public key from client.
+     // Now server takes a keypair from the pool and calculates the 
+     // shared secret. The server's public key is then send to the 
+     // client to also let the client calculate the shared secret.
+     display_text("Calculating", 11, "secret", 6);
+     keypair_pool_take(keyexchange_server_secret_key, 
+		       keyexchange_server_public_key);
+     // The shared secret is calculated in the background, so 
+     // events are still processed meanwhile.
+     ecdh_shared_secret_start();
+}
+
+static void action_shared_secret_ready(struct app_event event)
+{
+     display_shared_secret_hash();
+     // Send server public key as indication to client. 
+     indicate_public_key(0); // Sending part 1 of server key.
+}
+
+static void action_server_key_part2(struct app_event event)
+{
+     indicate_public_key(1); // Sending part 2 of server key.
+}
+
+/**
+ * User confirmed the key checksum: make the exchanged shared secret 
+ * persistent. The new key is effective when the key store has written it.
+ */
+static void action_store_key(struct app_event event)
+{
+     display_text("Storing key", 11, NULL, 0);
+     store_key(keyexchange_key_no, keyexchange_shared_secret);
+#ifdef MASTER_KEY_DERIVATION
+     // Keys derived from the old master secret are invalid.
+     if (keyexchange_key_no == 0)
+	  credential_cache_clear();
+#endif
+}
+
+static void action_send_nonce(struct app_event event)
+{
+#ifdef PERSISTENT_SESSIONS
+     is_nonce_subscribed = true;
+#endif
+     // Create a new nonce for next authentication request.
+     create_nonce();
+     // Send nonce to client as indication.
+     indicate_nonce();
+#ifndef MASTER_KEY_DERIVATION
+     // While the nonce and HMAC are in flight, compute the expected HMACs 
+     // in the background.
+     expected_hmacs_start();
+#endif
+}
+
+static void action_hmac_part1(struct app_event event)
+{
+     hmac_part_rcvd(event);
+#ifdef MASTER_KEY_DERIVATION
+     // While the second part is in flight, compute the expected HMAC of the
+     // credential in the background.
+     expected_hmac_start(unlock_client_id);
+#endif
+}
+
+static void action_hmac_part2(struct app_event event)
+{
+     hmac_part_rcvd(event);
+     auth_hmac_complete();
+}
+
+/**
+ * Complete HMAC (protocol version 2). With MASTER_KEY_DERIVATION, unless it
+ * is checked right away (EARLY_ACTUATION, PERSISTENT_SESSIONS), compute the
+ * expected HMAC of the credential in the background until the client 
+ * disconnects.
+ */
+static void action_hmac(struct app_event event)
+{
+     hmac_rcvd(event);
+#ifdef MASTER_KEY_DERIVATION
+     expected_hmac_start(unlock_client_id);
+#endif
+     auth_hmac_complete();
+}
+
+static void action_check_auth(struct app_event event)
+{
+     stop_auth_timer();
+     bool is_authenticated = check_auth();
+     expected_hmac_cancel();
+     // The lock is actuated independently, so the device is ready for the
+     // next client right away.
+     if (is_authenticated)
+	  lock_action_start();
+     display_ready();
+     start_advertising();
+}
+
+#ifdef ADVERTISED_NONCE
+/**
+ * A client may be using the advertised nonce from the moment it connects 
+ * until its disconnection has been processed, so the nonce is only 
+ * rotated while the device waits for connections. Otherwise, it is rotated
+ * when advertising starts again.
+ */
+static void action_rotate_nonce(struct app_event event)
+{
+     if (conn_handle == BLE_CONN_HANDLE_INVALID)
+	  rotate_nonce();
+}
+#endif
+
+#ifdef PERSISTENT_SESSIONS
+static void action_session_unlock(struct app_event event)
+{
+     const struct app_event_payload *payload = 
+	  app_event_rings_payload(&app_event_rings, event);
+     const uint8_t *expected_hmac = expected_hmac_finish();
+     // crypto_verify_16() compares in constant time.
+     bool is_authenticated = expected_hmac != NULL &&
+	  crypto_verify_16(payload->data, expected_hmac) == 0;
+     expected_hmac_cancel();
+     if (is_authenticated)
+	  session_unlock();
+     else
+	  session_end();
+}
+
+/**
+ * The nonce has been valid for AUTH_TIMER_TIMEOUT -> replace it by a new 
+ * random nonce.
+ */
+static void action_session_new_nonce(struct app_event event)
+{
+     if (!is_nonce_subscribed || is_nonce_indication_pending) {
+	  session_end();
+     } else {
+	  create_nonce();
+	  indicate_nonce();
+	  is_nonce_indication_pending = true;
+	  expected_hmac_start(unlock_client_id);
+	  start_auth_timer();
+     }
+}
+
+static void action_session_end(struct app_event event)
+{
+     session_end();
+}
+
+static void action_session_nonce_rcvd(struct app_event event)
+{
+     is_nonce_indication_pending = false;
+}
+
+static void action_session_subscribed(struct app_event event)
+{
+     is_nonce_subscribed = true;
+}
+#endif
+
+// Actions of this build. Actions of options not enabled are NULL, so 
+// entries referring to them must be enabled with the option, too.
+static const fsm_action_t actions[ACTION_COUNT] = {
+     [ACTION_CFG_START] = action_cfg_start,
+     [ACTION_CFG_CANCEL] = action_cfg_cancel,
+     [ACTION_DISCONNECT] = action_disconnect,
+     [ACTION_CLIENT_GONE] = action_client_gone,
+     [ACTION_READY] = action_ready,
+     [ACTION_AUTH_START] = action_auth_start,
+     [ACTION_KEY_PART1] = action_key_part1,
+     [ACTION_KEY_PART2] = action_key_part2,
+     [ACTION_SHARED_SECRET_READY] = action_shared_secret_ready,
+     [ACTION_SERVER_KEY_PART2] = action_server_key_part2,
+     [ACTION_STORE_KEY] = action_store_key,
+     [ACTION_SEND_NONCE] = action_send_nonce,
+     [ACTION_HMAC_PART1] = action_hmac_part1,
+     [ACTION_HMAC_PART2] = action_hmac_part2,
+     [ACTION_HMAC] = action_hmac,
+     [ACTION_CHECK_AUTH] = action_check_auth,
+#ifdef ADVERTISED_NONCE
+     [ACTION_ROTATE_NONCE] = action_rotate_nonce,
+#endif
+#ifdef PERSISTENT_SESSIONS
+     [ACTION_SESSION_UNLOCK] = action_session_unlock,
+     [ACTION_SESSION_NEW_NONCE] = action_session_new_nonce,
+     [ACTION_SESSION_END] = action_session_end,
+     [ACTION_SESSION_NONCE_RCVD] = action_session_nonce_rcvd,
+     [ACTION_SESSION_SUBSCRIBED] = action_session_subscribed,
+#endif
+};
+
+// Transitions common to all states of the key exchange with a connected 
+// client: another press of the red button aborts the key exchange (the 
+// client is disconnected), and so does the client by disconnecting.
+#define CFG_CONNECTED_TRANSITIONS \
+     [APP_EVENT_BUTTON_RED_PRESSED] = \
+          FSM_TRANSITION(ACTION_DISCONNECT, aborted_wait_disconnect), \
+     [APP_EVENT_CLIENT_DISCONNECTED] = \
+          FSM_TRANSITION(ACTION_CLIENT_GONE, idle)
+
+// Transitions common to all states of an authentication before the HMAC is
+// complete: the authentication is aborted on timeout (the client is 
+// disconnected) or if the client disconnects.
+#define AUTH_TRANSITIONS \
+     [APP_EVENT_AUTH_TIMEOUT] = \
+          FSM_TRANSITION(ACTION_DISCONNECT, aborted_wait_disconnect), \
+     [APP_EVENT_CLIENT_DISCONNECTED] = \
+          FSM_TRANSITION(ACTION_CLIENT_GONE, idle)
+
+// Transition table: (state, event) -> (action, next state). Events not 
+// listed for a state are ignored. No events are processed while booting.
+static const struct fsm_transition transitions[APP_STATE_COUNT][APP_EVENT_COUNT] = {
+     [idle] = {
+	  [APP_EVENT_BUTTON_RED_PRESSED] = 
+	       FSM_TRANSITION(ACTION_CFG_START, cfg_wait_connection),
+	  [APP_EVENT_CLIENT_CONNECTED] = 
+	       FSM_TRANSITION(ACTION_AUTH_START, auth_wait_subscription),
+#ifdef ADVERTISED_NONCE
+	  [APP_EVENT_NONCE_TIMEOUT] = FSM_ACTION(ACTION_ROTATE_NONCE),
+#endif
+     },
+     [cfg_wait_connection] = {
+	  // At this stage, another button press will abort configuration.
+	  [APP_EVENT_BUTTON_RED_PRESSED] = 
+	       FSM_TRANSITION(ACTION_CFG_CANCEL, idle),
+	  [APP_EVENT_CLIENT_CONNECTED] = FSM_GOTO(cfg_wait_subscription),
+#ifdef ADVERTISED_NONCE
+	  [APP_EVENT_NONCE_TIMEOUT] = FSM_ACTION(ACTION_ROTATE_NONCE),
+#endif
+     },
+     [cfg_wait_subscription] = {
+	  CFG_CONNECTED_TRANSITIONS,
+	  [APP_EVENT_SUBSCRIBED_CFG_OUT] = FSM_GOTO(cfg_wait_key_part1),
+     },
+     [cfg_wait_key_part1] = {
+	  CFG_CONNECTED_TRANSITIONS,
+	  [APP_EVENT_KEY_PART_RCVD] = 
+	       FSM_TRANSITION(ACTION_KEY_PART1, cfg_wait_key_part2),
+     },
+     [cfg_wait_key_part2] = {
+	  CFG_CONNECTED_TRANSITIONS,
+	  [APP_EVENT_KEY_PART_RCVD] = 
+	       FSM_TRANSITION(ACTION_KEY_PART2, cfg_wait_shared_secret),
+     },
+     [cfg_wait_shared_secret] = {
+	  CFG_CONNECTED_TRANSITIONS,
+	  [APP_EVENT_SHARED_SECRET_READY] = 
+	       FSM_TRANSITION(ACTION_SHARED_SECRET_READY, 
+			      cfg_wait_server_key_part1_rcvd),
+     },
+     [cfg_wait_server_key_part1_rcvd] = {
+	  CFG_CONNECTED_TRANSITIONS,
+	  [APP_EVENT_INDICATION_CFG_OUT_RCVD] = 
+	       FSM_TRANSITION(ACTION_SERVER_KEY_PART2, 
+			      cfg_wait_server_key_part2_rcvd),
+     },
+     [cfg_wait_server_key_part2_rcvd] = {
+	  CFG_CONNECTED_TRANSITIONS,
+	  [APP_EVENT_INDICATION_CFG_OUT_RCVD] = FSM_GOTO(cfg_wait_disconnect),
+     },
+     [cfg_wait_disconnect] = {
+	  // After the client received the server public key, it should 
+	  // disconnect.
+	  [APP_EVENT_BUTTON_RED_PRESSED] = 
+	       FSM_TRANSITION(ACTION_DISCONNECT, aborted_wait_disconnect),
+	  [APP_EVENT_CLIENT_DISCONNECTED] = FSM_GOTO(cfg_wait_decision),
+     },
+     [cfg_wait_decision] = {
+	  // User aborted.
+	  [APP_EVENT_BUTTON_RED_PRESSED] = FSM_TRANSITION(ACTION_READY, idle),
+	  // User confirmed. 
+	  [APP_EVENT_BUTTON_GREEN_PRESSED] = 
+	       FSM_TRANSITION(ACTION_STORE_KEY, cfg_wait_key_store),
+     },
+     [cfg_wait_key_store] = {
+	  [APP_EVENT_KEY_STORED] = FSM_TRANSITION(ACTION_READY, idle),
+     },
+     [auth_wait_subscription] = {
+	  AUTH_TRANSITIONS,
+	  [APP_EVENT_SUBSCRIBED_NONCE] = 
+	       FSM_TRANSITION(ACTION_SEND_NONCE, auth_wait_nonce_rcvd),
+#ifdef ADVERTISED_NONCE
+	  // HMAC of the advertised nonce, written right after connecting.
+	  [APP_EVENT_HMAC_PART_RCVD] = 
+	       FSM_TRANSITION(ACTION_HMAC_PART1, auth_wait_hmac_part2),
+	  [APP_EVENT_HMAC_RCVD] = FSM_ACTION(ACTION_HMAC),
+#endif
+     },
+     [auth_wait_nonce_rcvd] = {
+	  AUTH_TRANSITIONS,
+	  [APP_EVENT_INDICATION_NONCE_RCVD] = FSM_GOTO(auth_wait_hmac_part1),
+     },
+     [auth_wait_hmac_part1] = {
+	  AUTH_TRANSITIONS,
+	  [APP_EVENT_HMAC_PART_RCVD] = 
+	       FSM_TRANSITION(ACTION_HMAC_PART1, auth_wait_hmac_part2),
+	  [APP_EVENT_HMAC_RCVD] = FSM_ACTION(ACTION_HMAC),
+     },
+     [auth_wait_hmac_part2] = {
+	  AUTH_TRANSITIONS,
+	  [APP_EVENT_HMAC_PART_RCVD] = FSM_ACTION(ACTION_HMAC_PART2),
+     },
+     [auth_wait_disconnect] = {
+	  [APP_EVENT_CLIENT_DISCONNECTED] = 
+	       FSM_TRANSITION(ACTION_CHECK_AUTH, idle),
+     },
+#ifdef PERSISTENT_SESSIONS
+     [session_wait_unlock] = {
+	  [APP_EVENT_SESSION_UNLOCK_RCVD] = FSM_ACTION(ACTION_SESSION_UNLOCK),
+	  [APP_EVENT_AUTH_TIMEOUT] = FSM_ACTION(ACTION_SESSION_NEW_NONCE),
+	  [APP_EVENT_SESSION_TIMEOUT] = FSM_ACTION(ACTION_SESSION_END),
+	  [APP_EVENT_INDICATION_NONCE_RCVD] = 
+	       FSM_ACTION(ACTION_SESSION_NONCE_RCVD),
+	  [APP_EVENT_SUBSCRIBED_NONCE] = FSM_ACTION(ACTION_SESSION_SUBSCRIBED),
+	  [APP_EVENT_CLIENT_DISCONNECTED] = 
+	       FSM_TRANSITION(ACTION_CLIENT_GONE, idle),
+     },
+#endif
+     [aborted_wait_disconnect] = {
+	  [APP_EVENT_CLIENT_DISCONNECTED] = 
+	       FSM_TRANSITION(ACTION_CLIENT_GONE, idle),
+     },
+};
+
+// The state machine for checking the tables on the host (sim/transitions.c).
+const struct fsm app_fsm = {
+     .transitions = &transitions[0][0],
+     .actions = actions,
+     .state_count = APP_STATE_COUNT,
+     .event_count = APP_EVENT_COUNT,
+     .action_count = ACTION_COUNT
+};
+
+static void state_transition(struct app_event event) 
+{
+     // Flash operations of the key store complete in any state. Only the
+     // completion of the whole commit is an event for the state machine.
+     if (event.event_type == APP_EVENT_PSTORE_READY) {
+	  int result = key_store_flash_done(&key_store);
+	  if (result < 0)
+	       die();
+	  else if (result == 0)
+	       return;
+	  event.event_type = APP_EVENT_KEY_STORED;
+     }
+
+     // The lock has its own state machine, which runs in parallel.
+     if (event.event_type == APP_EVENT_LOCK_ACTION_TIMEOUT) {
+	  lock_transition(event);
+	  return;
      }
+
+     if (app_state >= APP_STATE_COUNT || event.event_type >= APP_EVENT_COUNT)
+	  die();
+
+     const struct fsm_transition *transition = 
+	  &transitions[app_state][event.event_type];
+     if (transition->action != FSM_NO_ACTION)
+	  actions[transition->action](event);
+     if (transition->next_state != FSM_SAME_STATE)
+	  app_state = transition->next_state - 1;
 }
 
 int main(void)
@@ -1662,11 +2908,13 @@ int main(void)
 
      led_init();
 
+     // The display is updated by a timer.
+     timers_init();
+
      display_init();
      display_on();
      display_text("Booting", 7, NULL, 0);
 
-     timers_init();
      buttons_init();
      lock_init();
      ble_stack_init();
@@ -1675,9 +2923,9 @@ int main(void)
      service_init();
      advertising_init();
      pstore_init();
-     app_event_queue_init(&app_event_queue);
+     app_event_rings_init(&app_event_rings);
 	  
-     display_text("Ready", 5, NULL, 0);
+     display_ready();
 
      // We could trigger a change of connection parameters. However,
      // for the very short interaction between peripheral and central,
@@ -1691,19 +2939,33 @@ int main(void)
      start_advertising();
 
      while (1) {
-	  // The following function puts the processor into sleep mode
+	  // If there is background work, do one slice of it. Otherwise,
+	  // the following function puts the processor into sleep mode
 	  // and waits for interrupts to wake up. Wakeup events include
 	  // events from the softdevice, which are processed in the BLE event 
 	  // loop, or other events like interrupts from application timers and
 	  // pressed buttons.
-	  sd_app_evt_wait();
+	  // The key exchange goes first, since the user is waiting for it.
+	  // Refilling the pools has the lowest priority; reseeding the 
+	  // DRBG goes before, so the pools are refilled with fresh entropy.
+	  if (!ecdh_shared_secret_step() && !expected_hmac_step() && 
+	      !drbg_reseed_step() && !nonce_pool_step() && 
+	      !keypair_pool_step())
+	       sd_app_evt_wait();
 
 	  // Interrupts create application-level events and put them
-	  // into the event queue, which is processed outside the interrupt 
+	  // into the event rings, which are processed outside the interrupt 
 	  // context and with a priority low enough not to block time-critical
 	  // operations, e.g., from the softdevice.
-	  struct app_event app_event;
-	  while (app_event_queue_get(&app_event_queue, &app_event) != -1)
-	       state_transition(app_event);
+	  struct app_event app_events[APP_EVENT_BATCH_SIZE];
+	  unsigned int n;
+	  while ((n = app_event_rings_drain(&app_event_rings, app_events, 
+					    APP_EVENT_BATCH_SIZE)) > 0) {
+	       for (unsigned int i = 0; i < n; i++) {
+		    state_transition(app_events[i]);
+		    // Hand back the payload (if any) of the processed event.
+		    app_event_rings_release(&app_event_rings, app_events[i]);
+	       }
+	  }
      }
 }
@@ -0,0 +1,628 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "key_store.h"
+
+// Erased flash.
+#define ERASED_WORD 0xffffffff
+
+// Flag of staged slots that are deleted.
+#define STAGED_DELETED 0x8000
+
+#define CHUNK_WORDS (KEY_STORE_CHUNK_SIZE/4)
+
+// Page header (word offsets).
+#define HEADER_MAGIC 0
+// Logical page number (lower half word) and slots per page (upper half 
+// word).
+#define HEADER_PAGE 1
+#define HEADER_ERASE_COUNT 2
+// Written last (word by word): a page is valid only if its header is
+// complete.
+#define HEADER_SEQUENCE 3
+
+// Tag of a log record: position of the slot and flags in the lower half 
+// word, and their complement in the upper half word, so erased tags are 
+// not valid.
+#define TAG_POS 0x3fff
+#define TAG_DELETED 0x4000
+// Last record of a commit: the records of a commit are valid only if the
+// tag of the last one has been written.
+#define TAG_LAST 0x8000
+
+static const uint32_t *page_words(const struct key_store *store,
+				  unsigned int page)
+{
+     return (const uint32_t *) (store->flash.base + 
+				page*store->flash.page_size);
+}
+
+static unsigned int logical_page_count(const struct key_store *store)
+{
+     return store->flash.page_count - 1;
+}
+
+static int is_header_valid(const struct key_store *store, unsigned int page)
+{
+     const uint32_t *p = page_words(store, page);
+     return p[HEADER_MAGIC] == store->magic && 
+	  (p[HEADER_PAGE] & 0xffff) < logical_page_count(store) &&
+	  (p[HEADER_PAGE] >> 16) == store->slots_per_page &&
+	  p[HEADER_SEQUENCE] != ERASED_WORD;
+}
+
+/**
+ * Erase count of a page, as far as known (0 if the header is not valid).
+ */
+static uint32_t erase_count(const struct key_store *store, unsigned int page)
+{
+     if (!is_header_valid(store, page))
+	  return 0;
+     return page_words(store, page)[HEADER_ERASE_COUNT];
+}
+
+/**
+ * Validity bit of the slot at position pos of a physical page.
+ */
+static int is_slot_valid(const struct key_store *store, unsigned int page, 
+			 unsigned int pos)
+{
+     const uint32_t *bitmap = page_words(store, page) + 
+	  KEY_STORE_HEADER_SIZE/4;
+     return (bitmap[pos/32] & (1ul << (pos%32))) == 0;
+}
+
+static uint32_t make_tag(unsigned int bits)
+{
+     return bits | ((~bits & 0xffff) << 16);
+}
+
+static int is_tag_valid(uint32_t tag)
+{
+     return (tag >> 16) == (~tag & 0xffff);
+}
+
+/**
+ * Record number r of the log of a physical page: tag, followed by data.
+ */
+static const uint32_t *log_record(const struct key_store *store,
+				  unsigned int page, unsigned int r)
+{
+     return page_words(store, page) + 
+	  (store->log_offset + r*(4 + store->data_size))/4;
+}
+
+/**
+ * Latest committed data of the slot at position pos of a physical page: 
+ * the newest valid record of the slot in the log, otherwise the slot.
+ *
+ * @return NULL if the slot is empty or deleted.
+ */
+static const uint8_t *committed_data(const struct key_store *store,
+				     unsigned int page, unsigned int pos)
+{
+     int is_committed = 0;
+
+     // Records after the last record of the latest commit belong to a 
+     // commit that has been interrupted.
+     for (unsigned int r = store->log_records; r-- > 0; ) {
+	  const uint32_t *record = log_record(store, page, r);
+	  if (!is_tag_valid(record[0]))
+	       continue;
+	  if (record[0] & TAG_LAST)
+	       is_committed = 1;
+	  if (is_committed && (record[0] & TAG_POS) == pos) {
+	       if (record[0] & TAG_DELETED)
+		    return NULL;
+	       return (const uint8_t *) (record + 1);
+	  }
+     }
+
+     if (!is_slot_valid(store, page, pos))
+	  return NULL;
+     return ((const uint8_t *) page_words(store, page)) + 
+	  store->slots_offset + pos*store->data_size;
+}
+
+int key_store_init(struct key_store *store, const struct key_store_flash *flash,
+		   uint32_t magic, unsigned int slot_count,
+		   unsigned int data_size, uint8_t *map, uint32_t *buffer)
+{
+     if (flash->page_count < 2 || flash->page_count > KEY_STORE_MAX_PAGES ||
+	 flash->page_size%4 != 0 || data_size == 0 || data_size%4 != 0 || 
+	 slot_count == 0 || slot_count > KEY_STORE_MAX_SLOTS ||
+	 KEY_STORE_HEADER_SIZE + 4 + data_size > flash->page_size)
+	  return -1;
+
+     store->flash = *flash;
+     store->magic = magic;
+     store->slot_count = slot_count;
+     store->data_size = data_size;
+     store->map = map;
+     store->buffer = buffer;
+     store->staged_count = 0;
+     store->sequence = 0;
+     store->target = flash->page_count - 1;
+     store->op = KEY_STORE_IDLE;
+
+     // The slots are spread evenly over the logical pages, the rest of 
+     // each page is its log.
+     unsigned int s = (slot_count + logical_page_count(store) - 1)/
+	  logical_page_count(store);
+     store->slots_per_page = s;
+     store->slots_offset = KEY_STORE_HEADER_SIZE + 4*((s + 31)/32);
+     if (s > TAG_POS || store->slots_offset + s*data_size > flash->page_size)
+	  return -1;
+     store->log_offset = store->slots_offset + s*data_size;
+     store->log_records = (flash->page_size - store->log_offset)/
+	  (4 + data_size);
+
+     // Physical page of each logical page: valid header and highest 
+     // sequence number (a rewrite might have been interrupted before the 
+     // old page was erased).
+     for (unsigned int i = 0; i < logical_page_count(store); i++)
+	  map[i] = KEY_STORE_NO_PAGE;
+     for (unsigned int page = 0; page < flash->page_count; page++) {
+	  if (!is_header_valid(store, page))
+	       continue;
+	  const uint32_t *header = page_words(store, page);
+	  unsigned int logical = header[HEADER_PAGE] & 0xffff;
+	  if (map[logical] == KEY_STORE_NO_PAGE || 
+	      header[HEADER_SEQUENCE] > 
+	      page_words(store, map[logical])[HEADER_SEQUENCE])
+	       map[logical] = page;
+	  if (header[HEADER_SEQUENCE] > store->sequence)
+	       store->sequence = header[HEADER_SEQUENCE];
+     }
+
+     return 0;
+}
+
+const uint8_t *key_store_read(const struct key_store *store,
+			      unsigned int slot)
+{
+     if (slot >= store->slot_count)
+	  return NULL;
+
+     unsigned int page = store->map[slot/store->slots_per_page];
+     if (page == KEY_STORE_NO_PAGE)
+	  return NULL;
+
+     return committed_data(store, page, slot%store->slots_per_page);
+}
+
+static uint8_t *staged_data(struct key_store *store, unsigned int i)
+{
+     return ((uint8_t *) (store->buffer + CHUNK_WORDS)) + i*store->data_size;
+}
+
+int key_store_write(struct key_store *store, unsigned int slot,
+		    const uint8_t *data)
+{
+     if (store->op != KEY_STORE_IDLE || slot >= store->slot_count)
+	  return -1;
+
+     // A slot written several times before a commit is only staged once.
+     unsigned int i;
+     for (i = 0; i < store->staged_count; i++) {
+	  if ((store->staged[i] & ~STAGED_DELETED) == slot)
+	       break;
+     }
+     if (i == store->staged_count) {
+	  if (store->staged_count == KEY_STORE_MAX_STAGED)
+	       return -1;
+	  store->staged_count++;
+     }
+
+     if (data == NULL) {
+	  store->staged[i] = slot | STAGED_DELETED;
+     } else {
+	  store->staged[i] = slot;
+	  memcpy(staged_data(store, i), data, store->data_size);
+     }
+
+     return 0;
+}
+
+/**
+ * Staged slot at position pos of the logical page being rewritten.
+ *
+ * @return index into staged; -1 if not staged.
+ */
+static int find_staged(struct key_store *store, unsigned int pos)
+{
+     unsigned int slot = store->page*store->slots_per_page + pos;
+     for (unsigned int i = 0; i < store->staged_count; i++) {
+	  if ((store->staged[i] & ~STAGED_DELETED) == slot)
+	       return i;
+     }
+     return -1;
+}
+
+/**
+ * Is the slot at position pos of the page being rewritten valid in the 
+ * new page?
+ */
+static int is_new_slot_valid(struct key_store *store, unsigned int pos)
+{
+     unsigned int old = store->map[store->page];
+     int i = find_staged(store, pos);
+
+     if (i >= 0)
+	  return (store->staged[i] & STAGED_DELETED) == 0;
+     if (store->page*store->slots_per_page + pos >= store->slot_count)
+	  return 0;
+     return old != KEY_STORE_NO_PAGE && 
+	  committed_data(store, old, pos) != NULL;
+}
+
+/**
+ * Word at the given word offset of the new page (bitmap or slot data).
+ */
+static uint32_t new_page_word(struct key_store *store, unsigned int word)
+{
+     unsigned int bitmap_word = word - KEY_STORE_HEADER_SIZE/4;
+
+     if (word < store->slots_offset/4) {
+	  uint32_t bits = ERASED_WORD;
+	  for (unsigned int bit = 0; bit < 32; bit++) {
+	       unsigned int pos = bitmap_word*32 + bit;
+	       if (pos < store->slots_per_page && is_new_slot_valid(store, pos))
+		    bits &= ~(1ul << bit);
+	  }
+	  return bits;
+     }
+
+     unsigned int pos = (4*word - store->slots_offset)/store->data_size;
+     unsigned int data_word = (4*word - store->slots_offset)%store->data_size/4;
+     if (!is_new_slot_valid(store, pos))
+	  return ERASED_WORD;
+     int i = find_staged(store, pos);
+     if (i >= 0)
+	  return ((uint32_t *) staged_data(store, i))[data_word];
+     return ((const uint32_t *) committed_data(store, store->map[store->page],
+					       pos))[data_word];
+}
+
+static int is_page_erased(const struct key_store *store, unsigned int page)
+{
+     const uint32_t *p = page_words(store, page);
+     for (unsigned int i = 0; i < store->flash.page_size/4; i++) {
+	  if (p[i] != ERASED_WORD)
+	       return 0;
+     }
+     return 1;
+}
+
+/**
+ * Write the next chunk of the new page that is not erased, or the header
+ * if all chunks have been written.
+ */
+static int write_next_chunk(struct key_store *store)
+{
+     unsigned int end = store->slots_offset + 
+	  store->slots_per_page*store->data_size;
+
+     while (store->offset < end) {
+	  unsigned int size = end - store->offset;
+	  if (size > KEY_STORE_CHUNK_SIZE)
+	       size = KEY_STORE_CHUNK_SIZE;
+	  int is_erased = 1;
+	  for (unsigned int i = 0; i < size/4; i++) {
+	       store->buffer[i] = new_page_word(store, store->offset/4 + i);
+	       if (store->buffer[i] != ERASED_WORD)
+		    is_erased = 0;
+	  }
+	  if (!is_erased) {
+	       store->chunk_size = size;
+	       store->op = KEY_STORE_WRITE_BODY;
+	       return store->flash.write(store->target, store->offset, 
+					 store->buffer, size);
+	  }
+	  // Nothing to program.
+	  store->offset += size;
+     }
+
+     // The header makes the new page replace the old one.
+     store->buffer[HEADER_MAGIC] = store->magic;
+     store->buffer[HEADER_PAGE] = store->page | (store->slots_per_page << 16);
+     store->buffer[HEADER_SEQUENCE] = store->sequence + 1;
+     store->buffer[HEADER_ERASE_COUNT] = store->target_erase_count;
+     store->chunk_size = KEY_STORE_HEADER_SIZE;
+     store->op = KEY_STORE_WRITE_HEADER;
+     return store->flash.write(store->target, 0, store->buffer, 
+			       KEY_STORE_HEADER_SIZE);
+}
+
+/**
+ * Start rewriting the page being written into the spare page (or another 
+ * logical page first, for static wear levelling). 
+ */
+static int start_rewrite(struct key_store *store)
+{
+     unsigned int logical_count = logical_page_count(store);
+
+     // Spare page: a physical page not used by any logical page (round 
+     // robin, if there are several).
+     unsigned int target = store->target;
+     int is_used;
+     do {
+	  target = (target + 1)%store->flash.page_count;
+	  is_used = 0;
+	  for (unsigned int i = 0; i < logical_count; i++) {
+	       if (store->map[i] == target)
+		    is_used = 1;
+	  }
+     } while (is_used);
+     store->target = target;
+
+     // Static wear levelling: move the logical page with the least worn 
+     // physical page to the spare page if the spare page is worn much 
+     // more.
+     uint32_t spare_count = erase_count(store, target);
+     for (unsigned int i = 0; i < logical_count; i++) {
+	  if (store->map[i] != KEY_STORE_NO_PAGE && 
+	      erase_count(store, store->map[i]) + KEY_STORE_WEAR_THRESHOLD < 
+	      spare_count) {
+	       spare_count = erase_count(store, store->map[i]) + 
+		    KEY_STORE_WEAR_THRESHOLD;
+	       store->page = i;
+	  }
+     }
+
+     store->offset = KEY_STORE_HEADER_SIZE;
+     store->target_erase_count = erase_count(store, target);
+     if (is_page_erased(store, target))
+	  return write_next_chunk(store);
+
+     store->target_erase_count++;
+     store->op = KEY_STORE_ERASE;
+     return store->flash.erase(target);
+}
+
+/**
+ * Next staged slot of the logical page being written.
+ *
+ * @return index into staged; -1 if there is none from index i on.
+ */
+static int next_staged(struct key_store *store, unsigned int i)
+{
+     for (; i < store->staged_count; i++) {
+	  if ((store->staged[i] & ~STAGED_DELETED)/store->slots_per_page == 
+	      store->page)
+	       return i;
+     }
+     return -1;
+}
+
+/**
+ * First record of the log of the page being written to which its staged
+ * slots can be appended: the records after the last record that is not 
+ * erased must be free, and the latest commit of the log must have 
+ * completed (otherwise, its records would become valid with the appended
+ * ones).
+ *
+ * @return record number; -1 if the page must be rewritten.
+ */
+static int find_log_space(struct key_store *store)
+{
+     unsigned int page = store->map[store->page];
+     unsigned int count = 0;
+     int end = -1;
+
+     if (page == KEY_STORE_NO_PAGE)
+	  return -1;
+     for (int i = next_staged(store, 0); i >= 0; i = next_staged(store, i + 1))
+	  count++;
+
+     for (unsigned int r = store->log_records; r-- > 0; ) {
+	  const uint32_t *record = log_record(store, page, r);
+	  if (end < 0) {
+	       for (unsigned int i = 0; i < 1 + store->data_size/4; i++) {
+		    if (record[i] != ERASED_WORD)
+			 end = r + 1;
+	       }
+	  }
+	  if (is_tag_valid(record[0])) {
+	       if (!(record[0] & TAG_LAST))
+		    return -1;
+	       break;
+	  }
+     }
+     if (end < 0)
+	  end = 0;
+
+     if (end + count > store->log_records)
+	  return -1;
+     return end;
+}
+
+/**
+ * Write the data of the staged slot being appended (if not deleted), or 
+ * its tag.
+ */
+static int write_record(struct key_store *store)
+{
+     unsigned int page = store->map[store->page];
+     unsigned int slot = store->staged[store->index];
+     unsigned int offset = store->log_offset + 
+	  store->record*(4 + store->data_size);
+
+     if (store->op != KEY_STORE_WRITE_RECORD_DATA && 
+	 !(slot & STAGED_DELETED)) {
+	  store->op = KEY_STORE_WRITE_RECORD_DATA;
+	  return store->flash.write(page, offset + 4, 
+				    (uint32_t *) staged_data(store, 
+							     store->index),
+				    store->data_size);
+     }
+
+     unsigned int bits = (slot & ~STAGED_DELETED)%store->slots_per_page;
+     if (slot & STAGED_DELETED)
+	  bits |= TAG_DELETED;
+     if (next_staged(store, store->index + 1) < 0)
+	  bits |= TAG_LAST;
+     store->buffer[0] = make_tag(bits);
+     store->op = KEY_STORE_WRITE_RECORD_TAG;
+     return store->flash.write(page, offset, store->buffer, 4);
+}
+
+/**
+ * Start writing the staged slots of the next logical page: append them to
+ * its log, or rewrite the page if they do not fit.
+ */
+static int start_page(struct key_store *store)
+{
+     store->page = (store->staged[0] & ~STAGED_DELETED)/store->slots_per_page;
+
+     int record = find_log_space(store);
+     if (record < 0)
+	  return start_rewrite(store);
+
+     store->record = record;
+     store->index = 0;
+     store->op = KEY_STORE_IDLE;
+     return write_record(store);
+}
+
+int key_store_commit(struct key_store *store)
+{
+     if (store->op != KEY_STORE_IDLE)
+	  return -1;
+     if (store->staged_count == 0)
+	  return 1;
+
+     if (start_page(store) != 0) {
+	  store->op = KEY_STORE_IDLE;
+	  return -1;
+     }
+
+     return 0;
+}
+
+/**
+ * The staged slots of the page being written are in flash. Remove them 
+ * from the staged slots.
+ */
+static void unstage_page(struct key_store *store)
+{
+     unsigned int n = 0;
+
+     for (unsigned int i = 0; i < store->staged_count; i++) {
+	  if ((store->staged[i] & ~STAGED_DELETED)/store->slots_per_page == 
+	      store->page)
+	       continue;
+	  if (n != i) {
+	       store->staged[n] = store->staged[i];
+	       memcpy(staged_data(store, n), staged_data(store, i), 
+		      store->data_size);
+	  }
+	  n++;
+     }
+     store->staged_count = n;
+}
+
+/**
+ * The page being rewritten has replaced the old one.
+ */
+static void finish_rewrite(struct key_store *store)
+{
+     store->map[store->page] = store->target;
+     store->sequence++;
+     unstage_page(store);
+}
+
+int key_store_flash_done(struct key_store *store)
+{
+     const uint8_t *target = (const uint8_t *) page_words(store, 
+							   store->target);
+     const uint8_t *record;
+     int next;
+
+     switch (store->op) {
+     case KEY_STORE_ERASE :
+	  if (write_next_chunk(store) != 0)
+	       break;
+	  return 0;
+     case KEY_STORE_WRITE_BODY :
+	  // Worn flash?
+	  if (memcmp(target + store->offset, store->buffer, 
+		     store->chunk_size) != 0)
+	       break;
+	  store->offset += store->chunk_size;
+	  if (write_next_chunk(store) != 0)
+	       break;
+	  return 0;
+     case KEY_STORE_WRITE_HEADER :
+	  if (memcmp(target, store->buffer, KEY_STORE_HEADER_SIZE) != 0)
+	       break;
+	  finish_rewrite(store);
+	  if (store->staged_count == 0) {
+	       store->op = KEY_STORE_IDLE;
+	       return 1;
+	  }
+	  // Slots of further logical pages (or the staged slots after a 
+	  // wear levelling move).
+	  if (start_page(store) != 0)
+	       break;
+	  return 0;
+     case KEY_STORE_WRITE_RECORD_DATA :
+	  record = (const uint8_t *) log_record(store, store->map[store->page],
+						store->record);
+	  if (memcmp(record + 4, staged_data(store, store->index), 
+		     store->data_size) != 0 || write_record(store) != 0)
+	       break;
+	  return 0;
+     case KEY_STORE_WRITE_RECORD_TAG :
+	  record = (const uint8_t *) log_record(store, store->map[store->page],
+						store->record);
+	  if (memcmp(record, store->buffer, 4) != 0)
+	       break;
+	  next = next_staged(store, store->index + 1);
+	  if (next >= 0) {
+	       store->record++;
+	       store->index = next;
+	       store->op = KEY_STORE_IDLE;
+	       if (write_record(store) != 0)
+		    break;
+	       return 0;
+	  }
+	  unstage_page(store);
+	  if (store->staged_count == 0) {
+	       store->op = KEY_STORE_IDLE;
+	       return 1;
+	  }
+	  if (start_page(store) != 0)
+	       break;
+	  return 0;
+     default :
+	  break;
+     }
+
+     // Commit failed. The remaining slots stay staged, so the commit can 
+     // be retried.
+     store->op = KEY_STORE_IDLE;
+     return -1;
+}
+
+int key_store_is_busy(const struct key_store *store)
+{
+     return store->op != KEY_STORE_IDLE;
+}
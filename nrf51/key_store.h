@@ -0,0 +1,230 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KEY_STORE_H
+#define KEY_STORE_H
+
+#include <stdint.h>
+
+// Store of fixed-size records ("slots", e.g., keys) in flash pages. 
+//
+// Slots have fixed positions: slot s is at position s%S of logical page
+// s/S, where S is the number of slots per page (the slots are spread 
+// evenly over the logical pages). Every logical page is stored in one 
+// physical page; one physical page more than logical pages is required 
+// (spare page). Finding a slot only takes the mapping of its logical page
+// to a physical page (one byte of RAM per logical page) and a look at the
+// log of that page, and slots are read directly from the memory-mapped 
+// flash, so neither RAM nor lookup time nor mount time grow with the 
+// number of slots.
+//
+// Flash layout of a page:
+//
+//   header: magic, logical page number and S, erase count, sequence 
+//           number (4 bytes each)
+//   validity bitmap: one bit per slot (0: slot valid), padded to words
+//   slots: S times data_size bytes
+//   log: the rest of the page, records of a tag (4 bytes: position of
+//        the slot, deleted, last record of a commit) and data_size bytes
+//
+// Flash can only be programmed once after erasing, so written slots are 
+// appended to the log of their page: the data of a record is written 
+// first, then its tag. The records of a commit only become valid with 
+// the tag of the last one, so a commit interrupted by a power loss leaves
+// the page as before. The newest valid record of a slot overrides the 
+// slot in the page. Appending takes no page erase.
+//
+// If the log of a page is full, the page is rewritten into the spare 
+// page: the spare page is erased, the bitmap and the slots (their latest 
+// data) are copied from the old page, and the header is written last. 
+// Only then, the new page with an empty log replaces the old one (higher 
+// sequence number), which becomes the next spare page. A rewrite 
+// interrupted by a power loss leaves the old page in place. All slots of 
+// one logical page written before a commit are written by a single append
+// or rewrite.
+//
+// The spare page changes with every rewrite, so pages are erased equally 
+// often if all logical pages are written equally often. Otherwise (a few
+// "hot" slots), the spare page gets worn more than the pages of "cold" 
+// logical pages. If its erase count exceeds the lowest erase count of 
+// all pages by KEY_STORE_WEAR_THRESHOLD, the coldest logical page is 
+// moved to the spare page first (static wear levelling).
+//
+// Flash operations are asynchronous: the store starts an operation through
+// the flash interface, and the application calls key_store_flash_done()
+// when the operation has completed. All functions must be called from the
+// same context (the main loop).
+
+// Size of the page header [bytes].
+#define KEY_STORE_HEADER_SIZE 16
+
+// Max. number of slots.
+#define KEY_STORE_MAX_SLOTS 0x7fff
+
+// Max. number of physical pages.
+#define KEY_STORE_MAX_PAGES 255
+
+// Max. number of slots written before a commit.
+#ifndef KEY_STORE_MAX_STAGED
+#define KEY_STORE_MAX_STAGED 4
+#endif
+
+// Number of bytes copied from the old page to the new page with one 
+// flash write (RAM buffer). Multiple of 4.
+#ifndef KEY_STORE_CHUNK_SIZE
+#define KEY_STORE_CHUNK_SIZE 128
+#endif
+
+// Difference of erase counts triggering static wear levelling.
+#ifndef KEY_STORE_WEAR_THRESHOLD
+#define KEY_STORE_WEAR_THRESHOLD 16
+#endif
+
+// Size of the buffer (see key_store_init()) [32 bit words]: copy buffer 
+// and data of the slots written before a commit.
+#define KEY_STORE_BUFFER_WORDS(data_size) \
+     ((KEY_STORE_CHUNK_SIZE + KEY_STORE_MAX_STAGED*(data_size))/4)
+
+// Physical page number of logical pages not stored yet.
+#define KEY_STORE_NO_PAGE 0xff
+
+// Flash interface. Both operations start an asynchronous operation and
+// return 0 if it has been started, otherwise -1. Data passed to write
+// stays unchanged until the operation has completed.
+struct key_store_flash {
+     // Erase page number page.
+     int (*erase)(unsigned int page);
+     // Program size bytes (multiple of 4) at the given offset of a page.
+     int (*write)(unsigned int page, unsigned int offset,
+		  const uint32_t *data, unsigned int size);
+     // Memory-mapped flash. Pages follow each other without gaps.
+     const uint8_t *base;
+     unsigned int page_size;
+     // Number of physical pages (logical pages plus one).
+     unsigned int page_count;
+};
+
+enum key_store_op {
+     KEY_STORE_IDLE,
+     KEY_STORE_ERASE,
+     KEY_STORE_WRITE_BODY,
+     KEY_STORE_WRITE_HEADER,
+     KEY_STORE_WRITE_RECORD_DATA,
+     KEY_STORE_WRITE_RECORD_TAG
+};
+
+struct key_store {
+     struct key_store_flash flash;
+     uint32_t magic;
+     unsigned int slot_count;
+     // Size of the data of a slot (multiple of 4) [bytes].
+     unsigned int data_size;
+     unsigned int slots_per_page;
+     // Offset of the first slot within a page [bytes].
+     unsigned int slots_offset;
+     // Offset of the log within a page [bytes], and number of records of
+     // the log.
+     unsigned int log_offset;
+     unsigned int log_records;
+     // Physical page of each logical page (KEY_STORE_NO_PAGE if none).
+     uint8_t *map;
+     // Copy buffer followed by the data of the staged slots.
+     uint32_t *buffer;
+     // Slots written since the last commit (bit 15 set if deleted).
+     uint16_t staged[KEY_STORE_MAX_STAGED];
+     unsigned int staged_count;
+     // Highest sequence number of all pages.
+     uint32_t sequence;
+     // Rewrite in progress: logical page, physical target page, erase 
+     // count of the target page, offset of the current (or next) chunk, 
+     // and size of the chunk being written.
+     unsigned int page;
+     unsigned int target;
+     uint32_t target_erase_count;
+     unsigned int offset;
+     unsigned int chunk_size;
+     // Append in progress: record of the log and staged slot being 
+     // written (logical page as above).
+     unsigned int record;
+     unsigned int index;
+     enum key_store_op op;
+};
+
+/**
+ * Initialize the store and find the physical page of every logical page 
+ * (only page headers are read). Does not write flash.
+ *
+ * @param magic identifies the format of the store (e.g., changes with
+ * data_size).
+ * @param map array of page_count-1 entries.
+ * @param buffer array of KEY_STORE_BUFFER_WORDS(data_size) words.
+ * @return 0 on success; -1 if the parameters are invalid or the pages do
+ * not hold slot_count slots. Pages of a different number of slots per page
+ * (slot_count or page_count changed) are not valid, i.e., the store is
+ * formatted by the next commit.
+ */
+int key_store_init(struct key_store *store, const struct key_store_flash *flash,
+		   uint32_t magic, unsigned int slot_count,
+		   unsigned int data_size, uint8_t *map, uint32_t *buffer);
+
+/**
+ * Latest committed data of a slot, read directly from flash. Valid until
+ * the next commit completes. Takes constant time (at most the records of
+ * the log of one page are looked at).
+ *
+ * @return pointer to data_size bytes; NULL if the slot is empty.
+ */
+const uint8_t *key_store_read(const struct key_store *store,
+			      unsigned int slot);
+
+/**
+ * Write the data of a slot (NULL deletes the slot). The data is copied,
+ * and written to flash with the next commit.
+ *
+ * @return 0 on success; -1 if a commit is in progress, the slot is
+ * invalid, or KEY_STORE_MAX_STAGED other slots have been written since 
+ * the last commit.
+ */
+int key_store_write(struct key_store *store, unsigned int slot,
+		    const uint8_t *data);
+
+/**
+ * Start writing all slots written since the last commit to flash.
+ * Completion is reported by key_store_flash_done().
+ *
+ * @return 0 if started; 1 if there is nothing to commit; -1 if a commit is
+ * already in progress or the flash operation could not be started.
+ */
+int key_store_commit(struct key_store *store);
+
+/**
+ * To be called when the flash operation started by the store has
+ * completed. Starts the next operation of the commit, if any.
+ *
+ * @return 1 if the commit has completed; 0 if it is still in progress; -1
+ * if a flash operation could not be started or the flash could not be
+ * programmed (the slots stay staged, so the commit can be retried).
+ */
+int key_store_flash_done(struct key_store *store);
+
+/**
+ * @return non-zero iff a commit is in progress.
+ */
+int key_store_is_busy(const struct key_store *store);
+
+#endif
@@ -0,0 +1,748 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Scripted central (the smartphone app), driving the firmware through one 
+// key exchange followed by a number of unlock operations.
+//
+// Key exchange: the user presses the red button and starts the key exchange
+// in the app. The central connects, subscribes to the cfg-out 
+// characteristic, writes its public key in two parts to the cfg-in 
+// characteristic, receives the public key of the device in two indications 
+// of cfg-out, and disconnects. The user then confirms the key checksum by 
+// pressing the green button, and the device stores the key. Latency is 
+// measured from the connection request of the central until the device is 
+// idle again.
+//
+// Unlock: the central connects, subscribes to the nonce characteristic, 
+// receives the nonce as indication, writes the HMAC of the nonce in two 
+// parts to the unlock characteristic, and disconnects. Latency is measured 
+// from the connection request of the central until the device actuates the
+// lock.
+//
+// With credential IDs (option -d, firmware built with 
+// MASTER_KEY_DERIVATION), the key exchange sets the master secret, and 
+// the central unlocks with keys derived from it for credential IDs 1, 2, 
+// ..., used round robin. Unlocks with a credential ID used for the first 
+// time are measured as "unlock (new ID)" (the firmware has to derive the
+// key), the others as "unlock (seen ID)" (cached by the firmware if there 
+// are at most CREDENTIAL_CACHE_SIZE credential IDs).
+//
+// With long writes (option -l), the central writes the unlock message of 
+// protocol version 2 ([0x02][key number or credential ID][32 bytes of 
+// HMAC]) with prepare write requests of at most PREP_WRITE_LENGTH bytes 
+// each, followed by an execute write request, instead of writing the HMAC
+// in two parts.
+//
+// With the advertised nonce (option -a, firmware built with 
+// ADVERTISED_NONCE), the central takes the nonce from the scan response 
+// received right before connecting, and writes the HMAC right after 
+// connecting instead of subscribing to the nonce characteristic. Every 
+// unlock must see a new nonce (rotation counter changed).
+//
+// With a disconnect delay (option -w), the central keeps the link for the 
+// given time after writing the HMAC before it disconnects (e.g., a slow 
+// app). With EARLY_ACTUATION, the firmware actuates the lock and 
+// disconnects as soon as the HMAC is complete, so the lock may be actuated
+// while the central is still connected.
+//
+// With a dropped link (option -x), the link is lost in the connection 
+// event of the last write of the HMAC, right after the write. The firmware
+// then handles the HMAC when the connection handle is already invalid 
+// (e.g., the app is killed, or the phone moves out of range).
+//
+// In rush mode (option -r, a busy entrance), the next unlock operation 
+// starts UNLOCK_PAUSE after the lock has been actuated, i.e., usually 
+// while the lock is still actuated, instead of UNLOCK_PAUSE after it has 
+// been released. A successful unlock then only extends the actuation (the
+// firmware sets the lock pin again).
+//
+// With sessions (option -p, firmware built with PERSISTENT_SESSIONS), the
+// central keeps the link after the first unlock, and unlocks again with a
+// single write of [0x03][first 16 bytes of the HMAC] of the next nonce of
+// the session chain. These unlocks are measured as "unlock (session)", 
+// from the write until the device actuates the lock. If the device ends 
+// the session, the central connects again for the next unlock. Option -g
+// sets the pause between unlock operations (UNLOCK_PAUSE by default); 
+// with a pause longer than AUTH_TIMER_TIMEOUT, the device replaces the 
+// nonce of the session, and indicates the new one.
+
+#include <string.h>
+#include <curve25519-cortexm0.h>
+#include <avrnacl.h>
+#include "sim.h"
+
+// UUIDs of the characteristics (see key20.c).
+#define UUID_CHARACTERISTIC_NONCE 0x0002
+#define UUID_CHARACTERISTIC_UNLOCK 0x0003
+#define UUID_CHARACTERISTIC_CFG_IN 0x0004
+#define UUID_CHARACTERISTIC_CFG_OUT 0x0005
+
+#define KEY_LENGTH crypto_scalarmult_curve25519_BYTES
+#define NONCE_LENGTH 16
+#define PART_LENGTH 16
+
+// Unlock message of protocol version 2 (see key20.c).
+#define UNLOCK_VERSION_2 0x02
+
+// Unlock message within a session, and nonce chain (see 
+// PERSISTENT_SESSIONS in key20.c).
+#define UNLOCK_SESSION 0x03
+#define SESSION_TAG_LENGTH 16
+#define SESSION_CHAIN_LABEL "Key20 session"
+
+// Max. data of a prepare write request (ATT MTU 23) [bytes].
+#define PREP_WRITE_LENGTH 18
+
+// Manufacturer specific data of the scan response with the nonce (see 
+// ADVERTISED_NONCE in key20.c): [company ID][counter][nonce].
+#define ADV_NONCE_COMPANY_ID 0xffff
+#define ADV_NONCE_DATA_LENGTH (2+2+NONCE_LENGTH)
+
+// Credential IDs (see MASTER_KEY_DERIVATION in key20.c).
+#define CREDENTIAL_ID_LENGTH 3
+#define CREDENTIAL_KDF_LABEL "Key20 credential"
+
+// Time between pressing the red button and starting the key exchange in
+// the app [us].
+#define USER_START_DELAY 500000
+
+// Pause between two unlock operations after the lock has been released 
+// (default of sim_config.unlock_pause) [us].
+#define UNLOCK_PAUSE sim_config.unlock_pause
+
+// Time after disconnection until an unlock operation is considered to have 
+// failed if the lock is not actuated [us].
+#define UNLOCK_TIMEOUT 1000000
+
+enum central_states {c_wait_boot, c_kx_press_button, c_kx_start, 
+		     c_kx_connect, c_kx_subscribe, c_kx_write_key_part1,
+		     c_kx_write_key_part2, c_kx_wait_server_key, 
+		     c_kx_disconnect, c_kx_wait_key_store, c_unlock_start, 
+		     c_unlock_connect, c_unlock_subscribe, c_unlock_wait_nonce,
+		     c_unlock_write_hmac_part1, c_unlock_write_hmac_part2, 
+		     c_unlock_prepare_write, c_unlock_execute_write,
+		     c_unlock_linger, c_unlock_disconnect, c_unlock_wait_lock, 
+		     c_unlock_wait_release, c_session_wait};
+
+static enum central_states central_state = c_wait_boot;
+
+// Time of the next scripted action.
+static uint64_t wakeup = SIM_NEVER;
+
+static unsigned int unlocks_done = 0;
+
+// Lock actuated (and released) during the current unlock operation.
+static bool is_lock_actuated;
+static bool is_lock_released;
+
+// Connected in a session (PERSISTENT_SESSIONS), i.e., the next unlock 
+// operation is a single write.
+static bool is_session_open = false;
+
+// Outgoing PDUs: at most one write request in flight, and possibly one 
+// confirmation of an indication.
+static bool is_write_pending = false;
+static bool is_write_in_flight = false;
+static uint8_t write_op;
+static uint16_t write_handle;
+static uint16_t write_offset;
+static uint8_t write_data[BLE_GATT_MAX_DATA_LEN];
+static uint16_t write_len;
+static bool is_confirmation_pending = false;
+static uint16_t confirmation_handle;
+static bool is_terminate_pending = false;
+// The write pending or in flight is the last write of the HMAC (option -x).
+static bool is_drop_pending = false;
+static bool is_link_dropped = false;
+
+static uint32_t rand_state;
+static uint8_t secret_key[KEY_LENGTH];
+static uint8_t public_key[KEY_LENGTH];
+static uint8_t server_public_key[KEY_LENGTH];
+static uint8_t server_key_parts_rcvd;
+static uint8_t shared_secret[KEY_LENGTH];
+static uint8_t nonce[NONCE_LENGTH];
+static bool is_nonce_rcvd;
+// Rotation counter of the advertised nonce used by the last unlock.
+static bool is_nonce_counter_valid = false;
+static uint16_t nonce_counter;
+static uint8_t hmac[crypto_auth_hmacsha512256_BYTES];
+static uint8_t credential_id[CREDENTIAL_ID_LENGTH];
+// Unlock message of protocol version 2, and length already prepared.
+static uint8_t long_write[1+CREDENTIAL_ID_LENGTH+crypto_auth_hmacsha512256_BYTES];
+static uint16_t long_write_len;
+static uint16_t long_write_offset;
+
+static void write(uint16_t handle, const uint8_t *data, uint16_t len)
+{
+     is_write_pending = true;
+     write_op = BLE_GATTS_OP_WRITE_REQ;
+     write_handle = handle;
+     write_offset = 0;
+     memcpy(write_data, data, len);
+     write_len = len;
+}
+
+/**
+ * Prepare the next part of the long write of the unlock message.
+ */
+static void prepare_write()
+{
+     uint16_t len = long_write_len - long_write_offset;
+     if (len > PREP_WRITE_LENGTH)
+	  len = PREP_WRITE_LENGTH;
+     is_write_pending = true;
+     write_op = BLE_GATTS_OP_PREP_WRITE_REQ;
+     write_handle = sim_gatts_value_handle(UUID_CHARACTERISTIC_UNLOCK);
+     write_offset = long_write_offset;
+     memcpy(write_data, &long_write[long_write_offset], len);
+     write_len = len;
+     long_write_offset += len;
+}
+
+static void execute_write()
+{
+     is_write_pending = true;
+     is_drop_pending = sim_config.drop_link;
+     write_op = BLE_GATTS_OP_EXEC_WRITE_REQ_NOW;
+     write_handle = BLE_GATT_HANDLE_INVALID;
+     write_offset = 0;
+     write_len = 0;
+}
+
+static void write_part(uint16_t uuid, unsigned int part, const uint8_t *data)
+{
+     uint8_t pdu[2+PART_LENGTH];
+     pdu[0] = sim_config.key_no;
+     pdu[1] = part;
+     memcpy(&pdu[2], &data[part*PART_LENGTH], PART_LENGTH);
+     write(sim_gatts_value_handle(uuid), pdu, sizeof(pdu));
+}
+
+/**
+ * Write a part of the HMAC to the unlock characteristic: [key number or
+ * credential ID][part][16 bytes of HMAC].
+ */
+static void write_hmac_part(unsigned int part)
+{
+     uint8_t pdu[CREDENTIAL_ID_LENGTH+1+PART_LENGTH];
+     unsigned int id_length = 1;
+
+     if (sim_config.credentials > 0) {
+	  id_length = CREDENTIAL_ID_LENGTH;
+	  memcpy(pdu, credential_id, CREDENTIAL_ID_LENGTH);
+     } else {
+	  pdu[0] = sim_config.key_no;
+     }
+     pdu[id_length] = part;
+     memcpy(&pdu[id_length+1], &hmac[part*PART_LENGTH], PART_LENGTH);
+     write(sim_gatts_value_handle(UUID_CHARACTERISTIC_UNLOCK), pdu, 
+	   id_length+1+PART_LENGTH);
+     is_drop_pending = sim_config.drop_link && part == 1;
+}
+
+static void subscribe(uint16_t uuid)
+{
+     // Enable indications.
+     const uint8_t cccd[] = {0x02, 0x00};
+     write(sim_gatts_cccd_handle(uuid), cccd, sizeof(cccd));
+}
+
+static void disconnect()
+{
+     is_terminate_pending = true;
+}
+
+static void keypair()
+{
+     for (unsigned int i = 0; i < KEY_LENGTH; i++)
+	  secret_key[i] = (uint8_t) sim_random(&rand_state);
+     secret_key[0] &= 248;
+     secret_key[KEY_LENGTH-1] &= 127;
+     secret_key[KEY_LENGTH-1] |= 64;
+     crypto_scalarmult_curve25519_base(public_key, secret_key);
+}
+
+static void unlock_connect()
+{
+     if (sim_config.credentials > 0) {
+	  // Credential IDs are little endian.
+	  uint32_t id = 1 + unlocks_done%sim_config.credentials;
+	  for (unsigned int i = 0; i < CREDENTIAL_ID_LENGTH; i++)
+	       credential_id[i] = (uint8_t) (id >> (8*i));
+	  sim_measure_begin(unlocks_done < sim_config.credentials ? 
+			    "unlock (new ID)" : "unlock (seen ID)");
+     } else {
+	  sim_measure_begin("unlock");
+     }
+     is_nonce_rcvd = false;
+     is_lock_actuated = false;
+     is_lock_released = false;
+     sim_link_connect();
+     central_state = c_unlock_connect;
+}
+
+/**
+ * Unlock within the session: write the truncated HMAC of the current nonce
+ * of the session chain.
+ */
+static void session_unlock()
+{
+     uint8_t pdu[1+SESSION_TAG_LENGTH];
+
+     sim_measure_begin("unlock (session)");
+     is_lock_actuated = false;
+     is_lock_released = false;
+     crypto_auth_hmacsha512256(hmac, nonce, NONCE_LENGTH, shared_secret);
+     pdu[0] = UNLOCK_SESSION;
+     memcpy(&pdu[1], hmac, SESSION_TAG_LENGTH);
+     write(sim_gatts_value_handle(UUID_CHARACTERISTIC_UNLOCK), pdu, 
+	   sizeof(pdu));
+     central_state = c_session_wait;
+     wakeup = sim_now + UNLOCK_TIMEOUT;
+}
+
+/**
+ * Step the nonce chain of the session (the device does the same when it 
+ * actuates the lock).
+ */
+static void session_next_nonce()
+{
+     uint8_t msg[sizeof(SESSION_CHAIN_LABEL) - 1 + NONCE_LENGTH];
+     uint8_t hash[crypto_hash_sha512_BYTES];
+
+     memcpy(msg, SESSION_CHAIN_LABEL, sizeof(SESSION_CHAIN_LABEL) - 1);
+     memcpy(&msg[sizeof(SESSION_CHAIN_LABEL) - 1], nonce, NONCE_LENGTH);
+     crypto_hash_sha512(hash, msg, sizeof(msg));
+     memcpy(nonce, hash, NONCE_LENGTH);
+}
+
+static void unlock_start()
+{
+     central_state = c_unlock_start;
+     wakeup = sim_now + UNLOCK_PAUSE;
+}
+
+void central_start(void)
+{
+     rand_state = sim_config.seed ^ 0x5a5a5a5a;
+     central_state = c_kx_press_button;
+     wakeup = sim_now;
+}
+
+uint64_t central_next(void)
+{
+     return wakeup;
+}
+
+void central_fire(void)
+{
+     wakeup = SIM_NEVER;
+
+     switch (central_state) {
+     case c_kx_press_button :
+	  sim_button_press(SIM_PIN_BUTTON_RED, sim_now);
+	  central_state = c_kx_start;
+	  wakeup = sim_now + USER_START_DELAY;
+	  break;
+     case c_kx_start :
+	  sim_measure_begin("key exchange");
+	  keypair();
+	  server_key_parts_rcvd = 0;
+	  sim_link_connect();
+	  central_state = c_kx_connect;
+	  break;
+     case c_unlock_start :
+	  unlock_connect();
+	  break;
+     case c_unlock_linger :
+	  disconnect();
+	  central_state = c_unlock_disconnect;
+	  break;
+     case c_unlock_wait_lock :
+	  // Timeout: lock has not been actuated.
+	  sim_measure_end(false);
+	  if (++unlocks_done == sim_config.unlocks)
+	       sim_finish();
+	  unlock_start();
+	  break;
+     case c_unlock_wait_release :
+	  // Pause after lock release is over.
+	  if (++unlocks_done == sim_config.unlocks)
+	       sim_finish();
+	  unlock_connect();
+	  break;
+     case c_session_wait :
+	  if (!is_lock_actuated)
+	       sim_fail("central: lock not actuated within session");
+	  if (++unlocks_done == sim_config.unlocks)
+	       sim_finish();
+	  if (is_session_open)
+	       session_unlock();
+	  else
+	       unlock_connect();
+	  break;
+     default :
+	  break;
+     }
+}
+
+/**
+ * Compute HMAC of received nonce and send first part.
+ */
+static void unlock_send_hmac()
+{
+     if (sim_config.credentials > 0) {
+	  uint8_t msg[sizeof(CREDENTIAL_KDF_LABEL) - 1 + CREDENTIAL_ID_LENGTH];
+	  uint8_t key[crypto_auth_hmacsha512256_BYTES];
+	  memcpy(msg, CREDENTIAL_KDF_LABEL, sizeof(CREDENTIAL_KDF_LABEL) - 1);
+	  memcpy(&msg[sizeof(CREDENTIAL_KDF_LABEL) - 1], credential_id, 
+		 CREDENTIAL_ID_LENGTH);
+	  crypto_auth_hmacsha512256(key, msg, sizeof(msg), shared_secret);
+	  crypto_auth_hmacsha512256(hmac, nonce, NONCE_LENGTH, key);
+     } else {
+	  crypto_auth_hmacsha512256(hmac, nonce, NONCE_LENGTH, shared_secret);
+     }
+
+     if (sim_config.long_write) {
+	  long_write[0] = UNLOCK_VERSION_2;
+	  if (sim_config.credentials > 0) {
+	       memcpy(&long_write[1], credential_id, CREDENTIAL_ID_LENGTH);
+	       long_write_len = 1 + CREDENTIAL_ID_LENGTH;
+	  } else {
+	       long_write[1] = sim_config.key_no;
+	       long_write_len = 2;
+	  }
+	  memcpy(&long_write[long_write_len], hmac, sizeof(hmac));
+	  long_write_len += sizeof(hmac);
+	  long_write_offset = 0;
+	  prepare_write();
+	  central_state = c_unlock_prepare_write;
+     } else {
+	  write_hmac_part(0);
+	  central_state = c_unlock_write_hmac_part1;
+     }
+}
+
+/**
+ * Take the nonce from the manufacturer specific data of a scan response.
+ */
+void central_on_scan_response(const uint8_t *data, uint8_t len)
+{
+     if (!sim_config.adv_nonce || central_state != c_unlock_connect)
+	  return;
+
+     // AD structures: [length][type][data].
+     for (unsigned int i = 0; i + 1 < len; i += 1 + data[i]) {
+	  const uint8_t *ad = &data[i+2];
+	  if (data[i] != 1 + ADV_NONCE_DATA_LENGTH || i + 1 + data[i] > len ||
+	      data[i+1] != BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA ||
+	      (ad[0] | (ad[1] << 8)) != ADV_NONCE_COMPANY_ID)
+	       continue;
+	  uint16_t counter = ad[2] | (ad[3] << 8);
+	  if (is_nonce_counter_valid && counter == nonce_counter)
+	       sim_fail("central: advertised nonce not rotated");
+	  nonce_counter = counter;
+	  is_nonce_counter_valid = true;
+	  memcpy(nonce, &ad[4], NONCE_LENGTH);
+	  is_nonce_rcvd = true;
+	  return;
+     }
+}
+
+void central_on_connected(void)
+{
+     switch (central_state) {
+     case c_kx_connect :
+	  subscribe(UUID_CHARACTERISTIC_CFG_OUT);
+	  central_state = c_kx_subscribe;
+	  break;
+     case c_unlock_connect :
+	  if (sim_config.adv_nonce) {
+	       if (!is_nonce_rcvd)
+		    sim_fail("central: no nonce in scan response");
+	       unlock_send_hmac();
+	  } else {
+	       subscribe(UUID_CHARACTERISTIC_NONCE);
+	       central_state = c_unlock_subscribe;
+	  }
+	  break;
+     default :
+	  sim_fail("central: unexpected connection");
+     }
+}
+
+void central_on_disconnected(void)
+{
+     is_write_pending = false;
+     is_write_in_flight = false;
+     is_confirmation_pending = false;
+     is_terminate_pending = false;
+     is_drop_pending = false;
+     is_link_dropped = false;
+
+     switch (central_state) {
+     case c_kx_disconnect :
+	  // User confirms the key checksum.
+	  sim_button_press(SIM_PIN_BUTTON_GREEN, sim_now);
+	  central_state = c_kx_wait_key_store;
+	  break;
+     case c_session_wait :
+	  // Session ended by the device (or by a failed unlock, which the 
+	  // pending timeout reports).
+	  is_session_open = false;
+	  break;
+     case c_unlock_write_hmac_part2 :
+     case c_unlock_execute_write :
+     case c_unlock_linger :
+	  // Disconnected by the firmware (EARLY_ACTUATION).
+     case c_unlock_disconnect :
+	  if (is_lock_released || (is_lock_actuated && sim_config.rush)) {
+	       central_state = c_unlock_wait_release;
+	       wakeup = sim_now + UNLOCK_PAUSE;
+	  } else if (is_lock_actuated) {
+	       central_state = c_unlock_wait_release;
+	       wakeup = SIM_NEVER;
+	  } else {
+	       central_state = c_unlock_wait_lock;
+	       wakeup = sim_now + UNLOCK_TIMEOUT;
+	  }
+	  break;
+     default :
+	  sim_fail("central: unexpected disconnection");
+     }
+}
+
+/**
+ * The complete HMAC has been written: disconnect (after the disconnect 
+ * delay, if any).
+ */
+static void unlock_hmac_written()
+{
+     if (sim_config.session) {
+	  // Keep the link; the device actuates the lock and starts the 
+	  // session.
+	  is_session_open = true;
+	  central_state = c_session_wait;
+	  if (!is_lock_actuated)
+	       wakeup = sim_now + UNLOCK_TIMEOUT;
+     } else if (sim_config.disconnect_delay > 0) {
+	  central_state = c_unlock_linger;
+	  wakeup = sim_now + sim_config.disconnect_delay;
+     } else {
+	  disconnect();
+	  central_state = c_unlock_disconnect;
+     }
+}
+
+/**
+ * Compute shared secret once both parts of the server key have been 
+ * received.
+ */
+static void kx_finish()
+{
+     crypto_scalarmult_curve25519(shared_secret, secret_key, 
+				  server_public_key);
+     disconnect();
+     central_state = c_kx_disconnect;
+}
+
+void central_on_write_rsp(void)
+{
+     is_write_in_flight = false;
+
+     switch (central_state) {
+     case c_kx_subscribe :
+	  write_part(UUID_CHARACTERISTIC_CFG_IN, 0, public_key);
+	  central_state = c_kx_write_key_part1;
+	  break;
+     case c_kx_write_key_part1 :
+	  write_part(UUID_CHARACTERISTIC_CFG_IN, 1, public_key);
+	  central_state = c_kx_write_key_part2;
+	  break;
+     case c_kx_write_key_part2 :
+	  central_state = c_kx_wait_server_key;
+	  if (server_key_parts_rcvd == 0x03)
+	       kx_finish();
+	  break;
+     case c_unlock_subscribe :
+	  central_state = c_unlock_wait_nonce;
+	  if (is_nonce_rcvd)
+	       unlock_send_hmac();
+	  break;
+     case c_unlock_write_hmac_part1 :
+	  write_hmac_part(1);
+	  central_state = c_unlock_write_hmac_part2;
+	  break;
+     case c_unlock_write_hmac_part2 :
+	  unlock_hmac_written();
+	  break;
+     case c_unlock_prepare_write :
+	  if (long_write_offset < long_write_len) {
+	       prepare_write();
+	  } else {
+	       execute_write();
+	       central_state = c_unlock_execute_write;
+	  }
+	  break;
+     case c_unlock_execute_write :
+	  unlock_hmac_written();
+	  break;
+     case c_session_wait :
+	  break;
+     default :
+	  sim_fail("central: unexpected write response");
+     }
+}
+
+void central_on_indication(uint16_t handle, const uint8_t *data, uint16_t len)
+{
+     is_confirmation_pending = true;
+     confirmation_handle = handle;
+
+     if (handle == sim_gatts_value_handle(UUID_CHARACTERISTIC_NONCE)) {
+	  if (len != NONCE_LENGTH)
+	       sim_fail("central: invalid nonce length %u", len);
+	  memcpy(nonce, data, NONCE_LENGTH);
+	  is_nonce_rcvd = true;
+	  if (central_state == c_unlock_wait_nonce)
+	       unlock_send_hmac();
+     } else if (handle == sim_gatts_value_handle(UUID_CHARACTERISTIC_CFG_OUT)) {
+	  if (len != 2+PART_LENGTH || data[0] != sim_config.key_no || 
+	      data[1] > 1)
+	       sim_fail("central: invalid server key part");
+	  memcpy(&server_public_key[data[1]*PART_LENGTH], &data[2], 
+		 PART_LENGTH);
+	  server_key_parts_rcvd |= (1 << data[1]);
+	  if (server_key_parts_rcvd == 0x03 && 
+	      central_state == c_kx_wait_server_key)
+	       kx_finish();
+     }
+}
+
+bool central_tx(uint8_t *op, uint16_t *handle, uint16_t *offset, 
+		uint8_t *data, uint16_t *len, bool *is_confirmation, 
+		bool *is_terminate)
+{
+     *is_confirmation = false;
+     *is_terminate = false;
+
+     if (is_confirmation_pending) {
+	  is_confirmation_pending = false;
+	  *is_confirmation = true;
+	  *handle = confirmation_handle;
+	  *len = 0;
+	  return true;
+     }
+
+     if (is_write_in_flight)
+	  return false;
+
+     if (is_write_pending) {
+	  is_write_pending = false;
+	  is_write_in_flight = true;
+	  *op = write_op;
+	  *handle = write_handle;
+	  *offset = write_offset;
+	  memcpy(data, write_data, write_len);
+	  *len = write_len;
+	  is_link_dropped = is_drop_pending;
+	  is_drop_pending = false;
+	  return true;
+     }
+
+     if (is_terminate_pending) {
+	  is_terminate_pending = false;
+	  *is_terminate = true;
+	  return true;
+     }
+
+     return false;
+}
+
+bool central_drops_link(void)
+{
+     bool is_dropped = is_link_dropped;
+     is_link_dropped = false;
+     return is_dropped;
+}
+
+void central_on_pin_change(uint32_t pin, bool level)
+{
+     if (pin != SIM_PIN_LOCK)
+	  return;
+
+     bool is_hmac_written = central_state == c_unlock_write_hmac_part2 ||
+	  central_state == c_unlock_execute_write || 
+	  central_state == c_unlock_linger || 
+	  central_state == c_unlock_disconnect;
+
+     if (sim_config.session && 
+	 (is_hmac_written || central_state == c_session_wait)) {
+	  // Actuated within the session (or when it starts): the next unlock
+	  // uses the next nonce of the chain.
+	  if (level && !is_lock_actuated) {
+	       sim_measure_end(true);
+	       is_lock_actuated = true;
+	       session_next_nonce();
+	       wakeup = sim_config.rush ? sim_now + UNLOCK_PAUSE : SIM_NEVER;
+	  } else if (!level && is_lock_actuated) {
+	       is_lock_released = true;
+	       if (!sim_config.rush)
+		    wakeup = sim_now + UNLOCK_PAUSE;
+	  } else if (level) {
+	       sim_fail("central: unexpected lock actuation");
+	  }
+	  return;
+     }
+
+     if (level && central_state == c_unlock_wait_lock) {
+	  sim_measure_end(true);
+	  is_lock_actuated = true;
+	  central_state = c_unlock_wait_release;
+	  wakeup = sim_config.rush ? sim_now + UNLOCK_PAUSE : SIM_NEVER;
+     } else if (level && is_hmac_written && !is_lock_actuated) {
+	  // Actuated before disconnection (EARLY_ACTUATION).
+	  sim_measure_end(true);
+	  is_lock_actuated = true;
+     } else if (!level && central_state == c_unlock_wait_release && 
+		!sim_config.rush) {
+	  // Lock released -> next unlock operation after a pause.
+	  wakeup = sim_now + UNLOCK_PAUSE;
+     } else if (!level && is_hmac_written && is_lock_actuated) {
+	  is_lock_released = true;
+     } else if (level) {
+	  sim_fail("central: unexpected lock actuation");
+     }
+}
+
+/**
+ * Check whether the key exchange has finished (called whenever the firmware
+ * waits for events).
+ */
+void central_poll(void)
+{
+     if (central_state == c_kx_wait_key_store && 
+	 strcmp(sim_state_name(app_state), "idle") == 0) {
+	  sim_measure_end(true);
+	  if (sim_config.unlocks == 0)
+	       sim_finish();
+	  unlock_start();
+     }
+}
@@ -0,0 +1,47 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stand-in for app_button.h of the nRF51 SDK (host simulation).
+// Button presses are scripted by the simulation.
+
+#ifndef APP_BUTTON_H__
+#define APP_BUTTON_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nrf_error.h"
+#include "nrf_gpio.h"
+
+#define APP_BUTTON_PUSH 1
+#define APP_BUTTON_RELEASE 0
+
+typedef void (*app_button_handler_t)(uint8_t pin_no, uint8_t button_action);
+
+typedef struct {
+     uint8_t pin_no;
+     uint8_t active_state;
+     nrf_gpio_pin_pull_t pull_cfg;
+     app_button_handler_t button_handler;
+} app_button_cfg_t;
+
+uint32_t app_button_init(app_button_cfg_t *p_buttons, uint8_t button_count,
+			 uint32_t detection_delay);
+uint32_t app_button_enable(void);
+uint32_t app_button_disable(void);
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stand-in for app_timer.h of the nRF51 SDK (host simulation).
+// Timers run in virtual time.
+
+#ifndef APP_TIMER_H__
+#define APP_TIMER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nrf_error.h"
+#include "app_util.h"
+
+#define APP_TIMER_CLOCK_FREQ 32768
+
+#define APP_TIMER_TICKS(MS, PRESCALER) \
+     ((uint32_t) (((MS) * (uint64_t) APP_TIMER_CLOCK_FREQ) / \
+		  (((PRESCALER) + 1) * 1000)))
+
+typedef void (*app_timer_timeout_handler_t)(void *p_context);
+
+typedef enum {
+     APP_TIMER_MODE_SINGLE_SHOT,
+     APP_TIMER_MODE_REPEATED
+} app_timer_mode_t;
+
+typedef struct {
+     bool is_created;
+     bool is_running;
+     app_timer_mode_t mode;
+     app_timer_timeout_handler_t handler;
+     void *p_context;
+     uint32_t ticks;
+     uint64_t expiry;
+} app_timer_t;
+
+typedef app_timer_t *app_timer_id_t;
+
+#define APP_TIMER_DEF(timer_id) \
+     static app_timer_t timer_id##_data; \
+     static const app_timer_id_t timer_id = &timer_id##_data
+
+#define APP_TIMER_INIT(PRESCALER, OP_QUEUES_SIZE, SCHEDULER_FUNC) \
+     app_timer_init((PRESCALER), (OP_QUEUES_SIZE), (SCHEDULER_FUNC))
+
+uint32_t app_timer_init(uint32_t prescaler, uint8_t op_queues_size, 
+			bool use_scheduler);
+uint32_t app_timer_create(app_timer_id_t const *p_timer_id, 
+			  app_timer_mode_t mode,
+			  app_timer_timeout_handler_t timeout_handler);
+uint32_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, 
+			 void *p_context);
+uint32_t app_timer_stop(app_timer_id_t timer_id);
+
+#endif
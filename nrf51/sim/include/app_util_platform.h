@@ -16,31 +16,21 @@
  * limitations under the License.
  */
 
-#ifndef APP_EVENT_QUEUE_H
-#define APP_EVENT_QUEUE_H
+// Stand-in for app_util_platform.h of the nRF51 SDK (host simulation).
 
-#include <stdint.h>
-
-#ifndef APP_EVENT_QUEUE_SIZE
-#define APP_EVENT_QUEUE_SIZE 16
-#endif
+#ifndef APP_UTIL_PLATFORM_H__
+#define APP_UTIL_PLATFORM_H__
 
-struct app_event {
-     uint8_t event_type;
-};
-
-struct app_event_queue {
-     struct app_event events[APP_EVENT_QUEUE_SIZE];
-     unsigned int size;
-     unsigned int free;
-     unsigned int head;
-     unsigned int tail;
-};
-
-void app_event_queue_init(struct app_event_queue *queue);
+#include <stdint.h>
+#include "app_util.h"
 
-int app_event_queue_add(struct app_event_queue *queue, struct app_event event);
+// Deliver pending "interrupts" (events that became due in virtual time) 
+// before entering a critical region. This way, long computations of the
+// main loop are interrupted at the same places where the firmware 
+// synchronizes with interrupt handlers.
+void sim_irq_poll(void);
 
-int app_event_queue_get(struct app_event_queue *queue, struct app_event *event);
+#define CRITICAL_REGION_ENTER() sim_irq_poll()
+#define CRITICAL_REGION_EXIT()
 
 #endif
@@ -0,0 +1,361 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stand-in for ble.h of the S110 softdevice (host simulation).
+// Contains the subset of GAP and GATTS definitions used by Key20. Structure
+// members are named as in the softdevice headers, but the layout is not 
+// binary compatible.
+
+#ifndef BLE_H__
+#define BLE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "nrf_error.h"
+
+#define BLE_CONN_HANDLE_INVALID 0xFFFF
+#define BLE_GATT_HANDLE_INVALID 0x0000
+
+#define BLE_GATT_MAX_DATA_LEN 64
+
+#define BLE_UUID_TYPE_UNKNOWN 0x00
+#define BLE_UUID_TYPE_BLE 0x01
+#define BLE_UUID_TYPE_VENDOR_BEGIN 0x02
+
+// Event IDs.
+#define BLE_EVT_USER_MEM_REQUEST 0x02
+#define BLE_EVT_USER_MEM_RELEASE 0x03
+#define BLE_GAP_EVT_CONNECTED 0x10
+#define BLE_GAP_EVT_DISCONNECTED 0x11
+#define BLE_GAP_EVT_SEC_PARAMS_REQUEST 0x13
+#define BLE_GAP_EVT_TIMEOUT 0x1B
+#define BLE_GATTS_EVT_WRITE 0x50
+#define BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST 0x51
+#define BLE_GATTS_EVT_HVC 0x53
+#define BLE_GATTS_EVT_SYS_ATTR_MISSING 0x54
+
+#define BLE_GAP_ADDR_TYPE_RANDOM_STATIC 0x01
+#define BLE_GAP_ADDR_CYCLE_MODE_NONE 0x00
+
+#define BLE_GAP_ADV_TYPE_ADV_IND 0x00
+#define BLE_GAP_ADV_FP_ANY 0x00
+
+#define BLE_GAP_ADV_FLAG_LE_GENERAL_DISC_MODE 0x02
+#define BLE_GAP_ADV_FLAG_BR_EDR_NOT_SUPPORTED 0x04
+#define BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE \
+     (BLE_GAP_ADV_FLAG_LE_GENERAL_DISC_MODE | \
+      BLE_GAP_ADV_FLAG_BR_EDR_NOT_SUPPORTED)
+#define BLE_GAP_ADV_MAX_SIZE 31
+
+#define BLE_GAP_AD_TYPE_FLAGS 0x01
+#define BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE 0x03
+#define BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE 0x07
+#define BLE_GAP_AD_TYPE_SHORT_LOCAL_NAME 0x08
+#define BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME 0x09
+#define BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA 0xff
+
+#define BLE_GAP_SEC_STATUS_PAIRING_NOT_SUPP 0x85
+
+#define BLE_GATTS_SRVC_TYPE_PRIMARY 0x01
+
+#define BLE_GATTS_VLOC_STACK 0x01
+#define BLE_GATTS_VLOC_USER 0x02
+
+#define BLE_GATT_HVX_NOTIFICATION 0x01
+#define BLE_GATT_HVX_INDICATION 0x02
+
+#define BLE_GATT_CPF_FORMAT_STRUCT 0x1B
+
+#define BLE_USER_MEM_TYPE_GATTS_QUEUED_WRITES 0x01
+
+// Write operations.
+#define BLE_GATTS_OP_WRITE_REQ 0x01
+#define BLE_GATTS_OP_WRITE_CMD 0x02
+#define BLE_GATTS_OP_PREP_WRITE_REQ 0x04
+#define BLE_GATTS_OP_EXEC_WRITE_REQ_CANCEL 0x05
+#define BLE_GATTS_OP_EXEC_WRITE_REQ_NOW 0x06
+
+#define BLE_GATTS_AUTHORIZE_TYPE_READ 0x01
+#define BLE_GATTS_AUTHORIZE_TYPE_WRITE 0x02
+
+#define BLE_GATT_STATUS_SUCCESS 0x0000
+#define BLE_GATT_STATUS_ATTERR_WRITE_NOT_PERMITTED 0x0103
+#define BLE_GATT_STATUS_ATTERR_INVALID_OFFSET 0x0107
+#define BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH 0x010D
+
+#define BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(ptr) \
+     do { (ptr)->sm = 0; (ptr)->lv = 0; } while (0)
+#define BLE_GAP_CONN_SEC_MODE_SET_OPEN(ptr) \
+     do { (ptr)->sm = 1; (ptr)->lv = 1; } while (0)
+
+typedef struct {
+     uint8_t uuid128[16];
+} ble_uuid128_t;
+
+typedef struct {
+     uint16_t uuid;
+     uint8_t type;
+} ble_uuid_t;
+
+typedef struct {
+     uint8_t addr_type;
+     uint8_t addr[6];
+} ble_gap_addr_t;
+
+typedef struct {
+     uint8_t sm : 4;
+     uint8_t lv : 4;
+} ble_gap_conn_sec_mode_t;
+
+typedef struct {
+     uint16_t min_conn_interval;
+     uint16_t max_conn_interval;
+     uint16_t slave_latency;
+     uint16_t conn_sup_timeout;
+} ble_gap_conn_params_t;
+
+typedef struct {
+     uint8_t type;
+     const ble_gap_addr_t *p_peer_addr;
+     uint8_t fp;
+     const void *p_whitelist;
+     uint16_t interval;
+     uint16_t timeout;
+} ble_gap_adv_params_t;
+
+typedef struct {
+     uint8_t service_changed : 1;
+} ble_gatts_enable_params_t;
+
+typedef struct {
+     ble_gatts_enable_params_t gatts_enable_params;
+} ble_enable_params_t;
+
+typedef struct {
+     uint8_t broadcast : 1;
+     uint8_t read : 1;
+     uint8_t write_wo_resp : 1;
+     uint8_t write : 1;
+     uint8_t notify : 1;
+     uint8_t indicate : 1;
+     uint8_t auth_signed_wr : 1;
+} ble_gatt_char_props_t;
+
+typedef struct {
+     uint8_t format;
+     int8_t exponent;
+     uint16_t unit;
+     uint8_t name_space;
+     uint16_t desc;
+} ble_gatts_char_pf_t;
+
+typedef struct {
+     ble_gap_conn_sec_mode_t read_perm;
+     ble_gap_conn_sec_mode_t write_perm;
+     uint8_t vlen : 1;
+     uint8_t vloc : 2;
+     uint8_t rd_auth : 1;
+     uint8_t wr_auth : 1;
+} ble_gatts_attr_md_t;
+
+typedef struct {
+     ble_gatt_char_props_t char_props;
+     uint8_t *p_char_user_desc;
+     uint16_t char_user_desc_max_size;
+     uint16_t char_user_desc_size;
+     ble_gatts_char_pf_t *p_char_pf;
+     ble_gatts_attr_md_t *p_user_desc_md;
+     ble_gatts_attr_md_t *p_cccd_md;
+     ble_gatts_attr_md_t *p_sccd_md;
+} ble_gatts_char_md_t;
+
+typedef struct {
+     ble_uuid_t *p_uuid;
+     ble_gatts_attr_md_t *p_attr_md;
+     uint16_t init_len;
+     uint16_t init_offs;
+     uint16_t max_len;
+     uint8_t *p_value;
+} ble_gatts_attr_t;
+
+typedef struct {
+     uint16_t value_handle;
+     uint16_t user_desc_handle;
+     uint16_t cccd_handle;
+     uint16_t sccd_handle;
+} ble_gatts_char_handles_t;
+
+typedef struct {
+     uint16_t handle;
+     uint8_t type;
+     uint16_t offset;
+     uint16_t *p_len;
+     uint8_t *p_data;
+} ble_gatts_hvx_params_t;
+
+typedef struct {
+     uint16_t len;
+     uint16_t offset;
+     uint8_t *p_value;
+} ble_gatts_value_t;
+
+typedef struct {
+     uint8_t bond : 1;
+     uint8_t mitm : 1;
+     uint8_t io_caps : 3;
+     uint8_t oob : 1;
+     uint8_t min_key_size;
+     uint8_t max_key_size;
+} ble_gap_sec_params_t;
+
+typedef struct {
+     ble_gap_addr_t peer_addr;
+     ble_gap_conn_params_t conn_params;
+} ble_gap_evt_connected_t;
+
+typedef struct {
+     uint8_t reason;
+} ble_gap_evt_disconnected_t;
+
+typedef struct {
+     uint8_t *p_mem;
+     uint16_t len;
+} ble_user_mem_block_t;
+
+typedef struct {
+     uint8_t type;
+} ble_evt_user_mem_request_t;
+
+typedef struct {
+     uint8_t type;
+     ble_user_mem_block_t mem_block;
+} ble_evt_user_mem_release_t;
+
+typedef struct {
+     uint16_t conn_handle;
+     union {
+	  ble_evt_user_mem_request_t user_mem_request;
+	  ble_evt_user_mem_release_t user_mem_release;
+     } params;
+} ble_common_evt_t;
+
+typedef struct {
+     uint16_t conn_handle;
+     union {
+	  ble_gap_evt_connected_t connected;
+	  ble_gap_evt_disconnected_t disconnected;
+     } params;
+} ble_gap_evt_t;
+
+typedef struct {
+     uint16_t handle;
+     uint8_t op;
+     uint16_t offset;
+     uint16_t len;
+     uint8_t data[BLE_GATT_MAX_DATA_LEN];
+} ble_gatts_evt_write_t;
+
+typedef struct {
+     uint16_t handle;
+} ble_gatts_evt_hvc_t;
+
+typedef struct {
+     uint8_t type;
+     union {
+	  ble_gatts_evt_write_t write;
+     } request;
+} ble_gatts_evt_rw_authorize_request_t;
+
+typedef struct {
+     uint16_t conn_handle;
+     union {
+	  ble_gatts_evt_write_t write;
+	  ble_gatts_evt_rw_authorize_request_t authorize_request;
+	  ble_gatts_evt_hvc_t hvc;
+     } params;
+} ble_gatts_evt_t;
+
+typedef struct {
+     uint16_t gatt_status;
+} ble_gatts_write_authorize_params_t;
+
+typedef struct {
+     uint8_t type;
+     union {
+	  ble_gatts_write_authorize_params_t write;
+     } params;
+} ble_gatts_rw_authorize_reply_params_t;
+
+typedef struct {
+     uint16_t evt_id;
+     uint16_t evt_len;
+} ble_evt_hdr_t;
+
+typedef struct {
+     ble_evt_hdr_t header;
+     union {
+	  ble_common_evt_t common_evt;
+	  ble_gap_evt_t gap_evt;
+	  ble_gatts_evt_t gatts_evt;
+     } evt;
+} ble_evt_t;
+
+uint32_t sd_ble_enable(ble_enable_params_t *p_ble_enable_params);
+uint32_t sd_ble_uuid_vs_add(const ble_uuid128_t *p_vs_uuid, uint8_t *p_uuid_type);
+uint32_t sd_ble_uuid_encode(const ble_uuid_t *p_uuid, uint8_t *p_uuid_le_len,
+			    uint8_t *p_uuid_le);
+uint32_t sd_ble_user_mem_reply(uint16_t conn_handle, 
+			       const ble_user_mem_block_t *p_block);
+
+uint32_t sd_ble_gap_address_get(ble_gap_addr_t *p_addr);
+uint32_t sd_ble_gap_address_set(uint8_t addr_cycle_mode, 
+				 const ble_gap_addr_t *p_addr);
+uint32_t sd_ble_gap_device_name_set(const ble_gap_conn_sec_mode_t *p_write_perm,
+				    const uint8_t *p_dev_name, uint16_t len);
+uint32_t sd_ble_gap_device_name_get(uint8_t *p_dev_name, uint16_t *p_len);
+uint32_t sd_ble_gap_ppcp_set(const ble_gap_conn_params_t *p_conn_params);
+uint32_t sd_ble_gap_adv_data_set(const uint8_t *p_data, uint8_t dlen, 
+				 const uint8_t *p_sr_data, uint8_t srdlen);
+uint32_t sd_ble_gap_adv_start(const ble_gap_adv_params_t *p_adv_params);
+uint32_t sd_ble_gap_adv_stop(void);
+uint32_t sd_ble_gap_disconnect(uint16_t conn_handle, uint8_t hci_status_code);
+uint32_t sd_ble_gap_sec_params_reply(uint16_t conn_handle, uint8_t sec_status,
+				     const ble_gap_sec_params_t *p_sec_params,
+				     const void *p_sec_keyset);
+
+uint32_t sd_ble_gatts_service_add(uint8_t type, const ble_uuid_t *p_uuid, 
+				  uint16_t *p_handle);
+uint32_t sd_ble_gatts_characteristic_add(uint16_t service_handle,
+					 const ble_gatts_char_md_t *p_char_md,
+					 const ble_gatts_attr_t *p_attr_char_value,
+					 ble_gatts_char_handles_t *p_handles);
+uint32_t sd_ble_gatts_value_set(uint16_t conn_handle, uint16_t handle,
+				ble_gatts_value_t *p_value);
+uint32_t sd_ble_gatts_hvx(uint16_t conn_handle, 
+			  const ble_gatts_hvx_params_t *p_hvx_params);
+uint32_t sd_ble_gatts_rw_authorize_reply(
+     uint16_t conn_handle, 
+     const ble_gatts_rw_authorize_reply_params_t *p_rw_authorize_reply_params);
+uint32_t sd_ble_gatts_sys_attr_set(uint16_t conn_handle, 
+				   const uint8_t *p_sys_attr_data, 
+				   uint16_t len, uint32_t flags);
+
+uint32_t sd_rand_application_bytes_available_get(uint8_t *p_bytes_available);
+uint32_t sd_rand_application_vector_get(uint8_t *p_buff, uint8_t length);
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stand-in for ble_advdata.h of the nRF51 SDK (host simulation).
+
+#ifndef BLE_ADVDATA_H__
+#define BLE_ADVDATA_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ble.h"
+
+typedef enum {
+     BLE_ADVDATA_NO_NAME,
+     BLE_ADVDATA_SHORT_NAME,
+     BLE_ADVDATA_FULL_NAME
+} ble_advdata_name_type_t;
+
+typedef struct {
+     uint16_t uuid_cnt;
+     ble_uuid_t *p_uuids;
+} ble_advdata_uuid_list_t;
+
+typedef struct {
+     uint16_t size;
+     uint8_t *p_data;
+} uint8_array_t;
+
+typedef struct {
+     uint16_t company_identifier;
+     uint8_array_t data;
+} ble_advdata_manuf_data_t;
+
+typedef struct {
+     ble_advdata_name_type_t name_type;
+     uint8_t short_name_len;
+     bool include_appearance;
+     uint8_t flags;
+     int8_t *p_tx_power_level;
+     ble_advdata_uuid_list_t uuids_more_available;
+     ble_advdata_uuid_list_t uuids_complete;
+     ble_advdata_uuid_list_t uuids_solicited;
+     ble_advdata_manuf_data_t *p_manuf_specific_data;
+} ble_advdata_t;
+
+uint32_t ble_advdata_set(const ble_advdata_t *p_advdata, 
+			 const ble_advdata_t *p_srdata);
+
+#endif
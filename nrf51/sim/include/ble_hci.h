@@ -0,0 +1,28 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stand-in for ble_hci.h of the S110 softdevice (host simulation).
+
+#ifndef BLE_HCI_H__
+#define BLE_HCI_H__
+
+#define BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION 0x13
+#define BLE_HCI_LOCAL_HOST_TERMINATED_CONNECTION 0x16
+#define BLE_HCI_CONN_INTERVAL_UNACCEPTABLE 0x3B
+
+#endif
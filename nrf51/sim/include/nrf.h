@@ -0,0 +1,44 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stand-in for nrf.h of the nRF51 SDK (host simulation).
+
+#ifndef NRF_H
+#define NRF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nrf_error.h"
+
+#define __INLINE inline
+
+// There are no interrupts to disable in the simulation. Events are delivered
+// by the simulation whenever the firmware waits for events or enters a
+// critical region.
+#define __disable_irq()
+#define __enable_irq()
+
+// Reset of the system. The simulation treats a reset as fatal error 
+// (see die() in key20.c).
+uint32_t sd_nvic_SystemReset(void);
+
+// Wait for events. In the simulation, this advances the virtual time to 
+// the next event and delivers it.
+uint32_t sd_app_evt_wait(void);
+
+#endif
@@ -0,0 +1,30 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stand-in for nrf_delay.h of the nRF51 SDK (host simulation).
+// Busy waiting advances the virtual time and is accounted as CPU time.
+
+#ifndef NRF_DELAY_H
+#define NRF_DELAY_H
+
+#include <stdint.h>
+
+void nrf_delay_us(uint32_t us);
+void nrf_delay_ms(uint32_t ms);
+
+#endif
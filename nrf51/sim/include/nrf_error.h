@@ -0,0 +1,46 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stand-in for nrf_error.h of the nRF51 SDK (host simulation).
+// Only the error codes used by Key20 and the simulation are defined.
+
+#ifndef NRF_ERROR_H__
+#define NRF_ERROR_H__
+
+#define NRF_ERROR_BASE_NUM 0x0
+
+#define NRF_SUCCESS (NRF_ERROR_BASE_NUM + 0)
+#define NRF_ERROR_INTERNAL (NRF_ERROR_BASE_NUM + 3)
+#define NRF_ERROR_NO_MEM (NRF_ERROR_BASE_NUM + 4)
+#define NRF_ERROR_NOT_FOUND (NRF_ERROR_BASE_NUM + 5)
+#define NRF_ERROR_INVALID_PARAM (NRF_ERROR_BASE_NUM + 7)
+#define NRF_ERROR_INVALID_STATE (NRF_ERROR_BASE_NUM + 8)
+#define NRF_ERROR_INVALID_LENGTH (NRF_ERROR_BASE_NUM + 9)
+#define NRF_ERROR_DATA_SIZE (NRF_ERROR_BASE_NUM + 12)
+#define NRF_ERROR_INVALID_ADDR (NRF_ERROR_BASE_NUM + 16)
+#define NRF_ERROR_BUSY (NRF_ERROR_BASE_NUM + 17)
+
+// SoC library (nrf_error_soc.h).
+#define NRF_ERROR_SOC_BASE_NUM (0x2000)
+#define NRF_ERROR_SOC_RAND_NOT_ENOUGH_VALUES (NRF_ERROR_SOC_BASE_NUM + 3)
+
+// Stack (ble_err.h).
+#define NRF_ERROR_STK_BASE_NUM (0x3000)
+#define BLE_ERROR_INVALID_CONN_HANDLE (NRF_ERROR_STK_BASE_NUM + 0x002)
+
+#endif
@@ -0,0 +1,74 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stand-in for pstorage.h of the nRF51 SDK (host simulation).
+// Persistent storage is simulated by a RAM image of the flash pages. As 
+// with the SDK, block identifiers are the (host) addresses of the blocks,
+// so the flash can be read directly.
+
+#ifndef PSTORAGE_H__
+#define PSTORAGE_H__
+
+#include <stdint.h>
+#include "nrf_error.h"
+
+#define PSTORAGE_FLASH_PAGE_SIZE 1024
+#define PSTORAGE_NUM_OF_PAGES 2
+#define PSTORAGE_MIN_BLOCK_SIZE 0x0010
+#define PSTORAGE_MAX_BLOCK_SIZE PSTORAGE_FLASH_PAGE_SIZE
+
+#define PSTORAGE_CLEAR_OP_CODE 0x01
+#define PSTORAGE_STORE_OP_CODE 0x02
+#define PSTORAGE_LOAD_OP_CODE 0x03
+#define PSTORAGE_UPDATE_OP_CODE 0x04
+
+typedef uintptr_t pstorage_block_t;
+
+typedef struct {
+     uint32_t module_id;
+     pstorage_block_t block_id;
+} pstorage_handle_t;
+
+typedef uint16_t pstorage_size_t;
+
+typedef void (*pstorage_ntf_cb_t)(pstorage_handle_t *p_handle, uint8_t op_code,
+				  uint32_t result, uint8_t *p_data, 
+				  uint32_t data_len);
+
+typedef struct {
+     pstorage_ntf_cb_t cb;
+     pstorage_size_t block_size;
+     pstorage_size_t block_count;
+} pstorage_module_param_t;
+
+uint32_t pstorage_init(void);
+uint32_t pstorage_register(pstorage_module_param_t *p_module_param,
+			   pstorage_handle_t *p_block_id);
+uint32_t pstorage_load(uint8_t *p_dest, pstorage_handle_t *p_src,
+		       pstorage_size_t size, pstorage_size_t offset);
+uint32_t pstorage_store(pstorage_handle_t *p_dest, uint8_t *p_src,
+			pstorage_size_t size, pstorage_size_t offset);
+uint32_t pstorage_update(pstorage_handle_t *p_dest, uint8_t *p_src,
+			 pstorage_size_t size, pstorage_size_t offset);
+uint32_t pstorage_clear(pstorage_handle_t *p_base_id, pstorage_size_t size);
+uint32_t pstorage_block_identifier_get(pstorage_handle_t *p_base_id,
+				       pstorage_size_t block_num,
+				       pstorage_handle_t *p_block_id);
+void pstorage_sys_event_handler(uint32_t sys_evt);
+
+#endif
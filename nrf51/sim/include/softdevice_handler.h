@@ -0,0 +1,40 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stand-in for softdevice_handler.h of the nRF51 SDK (host simulation).
+
+#ifndef SOFTDEVICE_HANDLER_H__
+#define SOFTDEVICE_HANDLER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ble.h"
+
+#define NRF_CLOCK_LFCLKSRC_XTAL_20_PPM 0
+
+typedef void (*ble_evt_handler_t)(ble_evt_t *p_ble_evt);
+typedef void (*sys_evt_handler_t)(uint32_t evt_id);
+
+// Nothing to initialize in the simulation.
+#define SOFTDEVICE_HANDLER_INIT(CLOCK_SOURCE, USE_SCHEDULER) \
+     do { (void) (CLOCK_SOURCE); (void) (USE_SCHEDULER); } while (0)
+
+uint32_t softdevice_ble_evt_handler_set(ble_evt_handler_t ble_evt_handler);
+uint32_t softdevice_sys_evt_handler_set(sys_evt_handler_t sys_evt_handler);
+
+#endif
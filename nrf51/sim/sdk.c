@@ -0,0 +1,610 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Stand-ins for the nRF51 SDK libraries and drivers used by Key20: 
+// softdevice handler, advertising data, application timers, buttons, 
+// persistent storage, GPIOs, and delays.
+
+#include <stdio.h>
+#include <string.h>
+#include <nrf.h>
+#include <nrf_gpio.h>
+#include <nrf_delay.h>
+#include <softdevice_handler.h>
+#include <ble_advdata.h>
+#include <app_timer.h>
+#include <app_button.h>
+#include <pstorage.h>
+#include "sim.h"
+
+// Maximum number of application timers.
+#define SIM_MAX_TIMERS 8
+
+// Maximum number of scripted button presses pending at the same time.
+#define SIM_MAX_BUTTON_PRESSES 4
+
+// Flash timing (maximum values according to the nRF51822 product 
+// specification) [us]. While the flash is written or erased, the CPU is 
+// halted.
+#define SIM_FLASH_WORD_WRITE_TIME 46
+#define SIM_FLASH_PAGE_ERASE_TIME 22300
+
+ble_evt_handler_t sim_ble_evt_handler = NULL;
+sys_evt_handler_t sim_sys_evt_handler = NULL;
+
+static app_timer_t *timers[SIM_MAX_TIMERS];
+static unsigned int timer_count = 0;
+static uint32_t timer_prescaler;
+
+static app_button_cfg_t *buttons;
+static unsigned int button_count = 0;
+static uint64_t button_detection_delay;
+static bool is_buttons_enabled = false;
+
+struct button_press {
+     uint8_t pin;
+     uint64_t time;
+};
+static struct button_press button_presses[SIM_MAX_BUTTON_PRESSES];
+static unsigned int button_press_count = 0;
+
+static uint8_t flash[PSTORAGE_NUM_OF_PAGES*PSTORAGE_FLASH_PAGE_SIZE] 
+     __attribute__((aligned(4)));
+static pstorage_module_param_t pstore_module;
+static bool is_pstore_registered = false;
+
+// Flash statistics.
+static unsigned long flash_erases[PSTORAGE_NUM_OF_PAGES];
+static unsigned long flash_words;
+static uint64_t flash_busy_time;
+
+static uint32_t gpio_out = 0;
+
+uint32_t softdevice_ble_evt_handler_set(ble_evt_handler_t ble_evt_handler)
+{
+     sim_ble_evt_handler = ble_evt_handler;
+     return NRF_SUCCESS;
+}
+
+uint32_t softdevice_sys_evt_handler_set(sys_evt_handler_t sys_evt_handler)
+{
+     sim_sys_evt_handler = sys_evt_handler;
+     return NRF_SUCCESS;
+}
+
+/**
+ * Append an AD structure ([length][type][data]) to advertising data.
+ */
+static uint32_t ad_append(uint8_t *buf, uint8_t *len, uint8_t type, 
+			  const uint8_t *data, uint16_t data_len)
+{
+     if (*len + 2 + data_len > BLE_GAP_ADV_MAX_SIZE)
+	  return NRF_ERROR_DATA_SIZE;
+     buf[(*len)++] = (uint8_t) (1 + data_len);
+     buf[(*len)++] = type;
+     memcpy(&buf[*len], data, data_len);
+     *len += data_len;
+     return NRF_SUCCESS;
+}
+
+/**
+ * Encode advertising data like the SDK: flags, name, complete list of 
+ * UUIDs (one UUID size per list), and manufacturer specific data.
+ */
+static uint32_t advdata_encode(const ble_advdata_t *advdata, uint8_t *buf,
+			       uint8_t *len)
+{
+     uint8_t data[BLE_GAP_ADV_MAX_SIZE];
+     uint16_t data_len;
+     uint32_t err_code;
+
+     *len = 0;
+     if (advdata->flags != 0) {
+	  err_code = ad_append(buf, len, BLE_GAP_AD_TYPE_FLAGS, 
+			       &advdata->flags, 1);
+	  if (err_code != NRF_SUCCESS)
+	       return err_code;
+     }
+     if (advdata->name_type != BLE_ADVDATA_NO_NAME) {
+	  data_len = sizeof(data);
+	  if (sd_ble_gap_device_name_get(data, &data_len) != NRF_SUCCESS)
+	       return NRF_ERROR_DATA_SIZE;
+	  uint8_t type = BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME;
+	  if (advdata->name_type == BLE_ADVDATA_SHORT_NAME && 
+	      advdata->short_name_len < data_len) {
+	       data_len = advdata->short_name_len;
+	       type = BLE_GAP_AD_TYPE_SHORT_LOCAL_NAME;
+	  }
+	  err_code = ad_append(buf, len, type, data, data_len);
+	  if (err_code != NRF_SUCCESS)
+	       return err_code;
+     }
+     if (advdata->uuids_complete.uuid_cnt > 0) {
+	  uint8_t uuid_len = 0;
+	  data_len = 0;
+	  for (unsigned int i = 0; i < advdata->uuids_complete.uuid_cnt; i++) {
+	       uint8_t uuid_le[16];
+	       if (sd_ble_uuid_encode(&advdata->uuids_complete.p_uuids[i], 
+				      &uuid_len, uuid_le) != NRF_SUCCESS)
+		    return NRF_ERROR_INVALID_PARAM;
+	       if (data_len + uuid_len > sizeof(data))
+		    return NRF_ERROR_DATA_SIZE;
+	       memcpy(&data[data_len], uuid_le, uuid_len);
+	       data_len += uuid_len;
+	  }
+	  err_code = ad_append(buf, len, uuid_len == 2 ? 
+			       BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE :
+			       BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE,
+			       data, data_len);
+	  if (err_code != NRF_SUCCESS)
+	       return err_code;
+     }
+     if (advdata->p_manuf_specific_data != NULL) {
+	  const ble_advdata_manuf_data_t *manuf = 
+	       advdata->p_manuf_specific_data;
+	  if (2 + manuf->data.size > sizeof(data))
+	       return NRF_ERROR_DATA_SIZE;
+	  data[0] = (uint8_t) manuf->company_identifier;
+	  data[1] = (uint8_t) (manuf->company_identifier >> 8);
+	  memcpy(&data[2], manuf->data.p_data, manuf->data.size);
+	  err_code = ad_append(buf, len, 
+			       BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA,
+			       data, 2 + manuf->data.size);
+	  if (err_code != NRF_SUCCESS)
+	       return err_code;
+     }
+     return NRF_SUCCESS;
+}
+
+uint32_t ble_advdata_set(const ble_advdata_t *p_advdata, 
+			 const ble_advdata_t *p_srdata)
+{
+     uint8_t data[BLE_GAP_ADV_MAX_SIZE];
+     uint8_t len;
+     uint8_t sr_data[BLE_GAP_ADV_MAX_SIZE];
+     uint8_t sr_len = 0;
+     uint32_t err_code;
+
+     err_code = advdata_encode(p_advdata, data, &len);
+     if (err_code != NRF_SUCCESS)
+	  return err_code;
+     if (p_srdata != NULL) {
+	  err_code = advdata_encode(p_srdata, sr_data, &sr_len);
+	  if (err_code != NRF_SUCCESS)
+	       return err_code;
+     }
+     return sd_ble_gap_adv_data_set(data, len, sr_data, sr_len);
+}
+
+/**
+ * Convert app timer ticks to virtual time [us].
+ */
+static uint64_t ticks_to_us(uint32_t ticks)
+{
+     return ((uint64_t) ticks)*1000000*(timer_prescaler+1)/
+	  APP_TIMER_CLOCK_FREQ;
+}
+
+uint32_t app_timer_init(uint32_t prescaler, uint8_t op_queues_size, 
+			bool use_scheduler)
+{
+     timer_prescaler = prescaler;
+     timer_count = 0;
+     return NRF_SUCCESS;
+}
+
+uint32_t app_timer_create(app_timer_id_t const *p_timer_id, 
+			  app_timer_mode_t mode,
+			  app_timer_timeout_handler_t timeout_handler)
+{
+     if (timer_count == SIM_MAX_TIMERS)
+	  return NRF_ERROR_NO_MEM;
+     if (timeout_handler == NULL)
+	  return NRF_ERROR_INVALID_PARAM;
+
+     app_timer_t *timer = *p_timer_id;
+     memset(timer, 0, sizeof(*timer));
+     timer->is_created = true;
+     timer->mode = mode;
+     timer->handler = timeout_handler;
+     timers[timer_count++] = timer;
+
+     return NRF_SUCCESS;
+}
+
+uint32_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, 
+			 void *p_context)
+{
+     // The app timer requires a minimum timeout of 5 ticks.
+     if (!timer_id->is_created || timeout_ticks < 5)
+	  return NRF_ERROR_INVALID_PARAM;
+
+     timer_id->is_running = true;
+     timer_id->ticks = timeout_ticks;
+     timer_id->p_context = p_context;
+     timer_id->expiry = sim_now + ticks_to_us(timeout_ticks);
+
+     return NRF_SUCCESS;
+}
+
+uint32_t app_timer_stop(app_timer_id_t timer_id)
+{
+     if (!timer_id->is_created)
+	  return NRF_ERROR_INVALID_PARAM;
+
+     timer_id->is_running = false;
+
+     return NRF_SUCCESS;
+}
+
+uint64_t sim_timers_next(void)
+{
+     uint64_t next = SIM_NEVER;
+     for (unsigned int i = 0; i < timer_count; i++) {
+	  if (timers[i]->is_running && timers[i]->expiry < next)
+	       next = timers[i]->expiry;
+     }
+     return next;
+}
+
+void sim_timers_fire(void)
+{
+     app_timer_t *timer = NULL;
+     for (unsigned int i = 0; i < timer_count; i++) {
+	  if (timers[i]->is_running && 
+	      (timer == NULL || timers[i]->expiry < timer->expiry))
+	       timer = timers[i];
+     }
+     if (timer == NULL)
+	  return;
+
+     if (timer->mode == APP_TIMER_MODE_REPEATED)
+	  timer->expiry += ticks_to_us(timer->ticks);
+     else
+	  timer->is_running = false;
+
+     sim_trace("timer expired");
+     SIM_CALL_FIRMWARE(timer->handler(timer->p_context));
+}
+
+uint32_t app_button_init(app_button_cfg_t *p_buttons, uint8_t button_count_,
+			 uint32_t detection_delay)
+{
+     buttons = p_buttons;
+     button_count = button_count_;
+     button_detection_delay = ticks_to_us(detection_delay);
+     return NRF_SUCCESS;
+}
+
+uint32_t app_button_enable(void)
+{
+     is_buttons_enabled = true;
+     return NRF_SUCCESS;
+}
+
+uint32_t app_button_disable(void)
+{
+     is_buttons_enabled = false;
+     return NRF_SUCCESS;
+}
+
+void sim_button_press(uint8_t pin, uint64_t t)
+{
+     if (button_press_count == SIM_MAX_BUTTON_PRESSES)
+	  sim_fail("too many pending button presses");
+
+     // The button handler is called after the detection (debouncing) delay.
+     button_presses[button_press_count].pin = pin;
+     button_presses[button_press_count].time = t + button_detection_delay;
+     button_press_count++;
+}
+
+uint64_t sim_buttons_next(void)
+{
+     uint64_t next = SIM_NEVER;
+     for (unsigned int i = 0; i < button_press_count; i++) {
+	  if (button_presses[i].time < next)
+	       next = button_presses[i].time;
+     }
+     return next;
+}
+
+void sim_buttons_fire(void)
+{
+     if (button_press_count == 0)
+	  return;
+
+     unsigned int next = 0;
+     for (unsigned int i = 1; i < button_press_count; i++) {
+	  if (button_presses[i].time < button_presses[next].time)
+	       next = i;
+     }
+     uint8_t pin = button_presses[next].pin;
+     button_presses[next] = button_presses[--button_press_count];
+
+     if (!is_buttons_enabled)
+	  return;
+     for (unsigned int i = 0; i < button_count; i++) {
+	  if (buttons[i].pin_no == pin) {
+	       sim_trace("button pressed (pin %u)", pin);
+	       SIM_CALL_FIRMWARE(buttons[i].button_handler(pin, 
+							   APP_BUTTON_PUSH));
+	  }
+     }
+}
+
+// The persistent storage is simulated by PSTORAGE_NUM_OF_PAGES flash 
+// pages. Operations complete synchronously: the time for writing and 
+// erasing the flash is accounted for as CPU time (the CPU is halted while 
+// the flash is busy), and the callback of the module is called before 
+// returning. Erased pages and programmed words are counted.
+
+/**
+ * Block the CPU for erasing a page.
+ */
+static void flash_erase(unsigned int page)
+{
+     flash_erases[page]++;
+     flash_busy_time += SIM_FLASH_PAGE_ERASE_TIME;
+     sim_busy(SIM_FLASH_PAGE_ERASE_TIME);
+}
+
+/**
+ * Block the CPU for programming the given number of words.
+ */
+static void flash_program(unsigned int words)
+{
+     flash_words += words;
+     flash_busy_time += words*SIM_FLASH_WORD_WRITE_TIME;
+     sim_busy(words*SIM_FLASH_WORD_WRITE_TIME);
+}
+
+uint32_t pstorage_init(void)
+{
+     memset(flash, 0xff, sizeof(flash));
+     is_pstore_registered = false;
+     return NRF_SUCCESS;
+}
+
+uint32_t pstorage_register(pstorage_module_param_t *p_module_param,
+			   pstorage_handle_t *p_block_id)
+{
+     if (is_pstore_registered)
+	  return NRF_ERROR_NO_MEM;
+     if (p_module_param->cb == NULL || 
+	 p_module_param->block_size < PSTORAGE_MIN_BLOCK_SIZE ||
+	 p_module_param->block_size > PSTORAGE_MAX_BLOCK_SIZE ||
+	 p_module_param->block_size%4 != 0 ||
+	 p_module_param->block_size*p_module_param->block_count > 
+	 sizeof(flash))
+	  return NRF_ERROR_INVALID_PARAM;
+
+     pstore_module = *p_module_param;
+     is_pstore_registered = true;
+     p_block_id->module_id = 0;
+     p_block_id->block_id = (uintptr_t) flash;
+
+     return NRF_SUCCESS;
+}
+
+uint32_t pstorage_block_identifier_get(pstorage_handle_t *p_base_id,
+				       pstorage_size_t block_num,
+				       pstorage_handle_t *p_block_id)
+{
+     if (!is_pstore_registered)
+	  return NRF_ERROR_INVALID_STATE;
+     if (block_num >= pstore_module.block_count)
+	  return NRF_ERROR_INVALID_PARAM;
+
+     p_block_id->module_id = p_base_id->module_id;
+     p_block_id->block_id = p_base_id->block_id + 
+	  block_num*pstore_module.block_size;
+
+     return NRF_SUCCESS;
+}
+
+/**
+ * Check parameters of a pstorage operation.
+ *
+ * @return NRF_SUCCESS and the offset into the flash image, if valid.
+ */
+static uint32_t pstore_check(pstorage_handle_t *handle, const uint8_t *data,
+			     pstorage_size_t size, pstorage_size_t offset,
+			     unsigned int *flash_offset)
+{
+     if (!is_pstore_registered)
+	  return NRF_ERROR_INVALID_STATE;
+     // Data must be word aligned.
+     if (((uintptr_t) data)%4 != 0 || size%4 != 0 || offset%4 != 0)
+	  return NRF_ERROR_INVALID_ADDR;
+     if (handle->block_id < (uintptr_t) flash)
+	  return NRF_ERROR_INVALID_PARAM;
+     *flash_offset = handle->block_id - (uintptr_t) flash + offset;
+     if (size == 0 || *flash_offset + size > 
+	 pstore_module.block_size*pstore_module.block_count)
+	  return NRF_ERROR_INVALID_PARAM;
+     return NRF_SUCCESS;
+}
+
+uint32_t pstorage_load(uint8_t *p_dest, pstorage_handle_t *p_src,
+		       pstorage_size_t size, pstorage_size_t offset)
+{
+     unsigned int flash_offset;
+     uint32_t err_code = pstore_check(p_src, p_dest, size, offset, 
+				      &flash_offset);
+     if (err_code != NRF_SUCCESS)
+	  return err_code;
+
+     memcpy(p_dest, &flash[flash_offset], size);
+     pstore_module.cb(p_src, PSTORAGE_LOAD_OP_CODE, NRF_SUCCESS, p_dest, size);
+
+     return NRF_SUCCESS;
+}
+
+uint32_t pstorage_store(pstorage_handle_t *p_dest, uint8_t *p_src,
+			pstorage_size_t size, pstorage_size_t offset)
+{
+     unsigned int flash_offset;
+     uint32_t err_code = pstore_check(p_dest, p_src, size, offset, 
+				      &flash_offset);
+     if (err_code != NRF_SUCCESS)
+	  return err_code;
+
+     // Writing flash can only clear bits.
+     uint8_t *dest = &flash[flash_offset];
+     for (unsigned int i = 0; i < size; i++)
+	  dest[i] &= p_src[i];
+     flash_program(size/4);
+     pstore_module.cb(p_dest, PSTORAGE_STORE_OP_CODE, NRF_SUCCESS, p_src, size);
+
+     return NRF_SUCCESS;
+}
+
+/**
+ * Change part of a page using the swap page: erase swap page, copy page 
+ * to swap page, erase page, copy swap page back.
+ */
+static void flash_swap(unsigned int page)
+{
+     flash_erase(page);
+     flash_program(PSTORAGE_FLASH_PAGE_SIZE/4);
+     // The swap page is not part of the flash image, but its erase cycles
+     // count as well.
+     flash_erases[page]++;
+     flash_busy_time += SIM_FLASH_PAGE_ERASE_TIME;
+     sim_busy(SIM_FLASH_PAGE_ERASE_TIME);
+     flash_program(PSTORAGE_FLASH_PAGE_SIZE/4);
+}
+
+uint32_t pstorage_update(pstorage_handle_t *p_dest, uint8_t *p_src,
+			 pstorage_size_t size, pstorage_size_t offset)
+{
+     unsigned int flash_offset;
+     uint32_t err_code = pstore_check(p_dest, p_src, size, offset, 
+				      &flash_offset);
+     if (err_code != NRF_SUCCESS)
+	  return err_code;
+
+     memcpy(&flash[flash_offset], p_src, size);
+     flash_swap(flash_offset/PSTORAGE_FLASH_PAGE_SIZE);
+     pstore_module.cb(p_dest, PSTORAGE_UPDATE_OP_CODE, NRF_SUCCESS, p_src, 
+		      size);
+
+     return NRF_SUCCESS;
+}
+
+uint32_t pstorage_clear(pstorage_handle_t *p_base_id, pstorage_size_t size)
+{
+     unsigned int flash_offset;
+     uint32_t err_code = pstore_check(p_base_id, NULL, size, 0, 
+				      &flash_offset);
+     if (err_code != NRF_SUCCESS)
+	  return err_code;
+
+     memset(&flash[flash_offset], 0xff, size);
+     if (size == PSTORAGE_FLASH_PAGE_SIZE && 
+	 flash_offset%PSTORAGE_FLASH_PAGE_SIZE == 0)
+	  flash_erase(flash_offset/PSTORAGE_FLASH_PAGE_SIZE);
+     else
+	  flash_swap(flash_offset/PSTORAGE_FLASH_PAGE_SIZE);
+     pstore_module.cb(p_base_id, PSTORAGE_CLEAR_OP_CODE, NRF_SUCCESS, NULL, 
+		      size);
+
+     return NRF_SUCCESS;
+}
+
+void sim_flash_report(void)
+{
+     printf("flash: %lu words programmed, erases per page", flash_words);
+     for (unsigned int i = 0; i < PSTORAGE_NUM_OF_PAGES; i++)
+	  printf(" %lu", flash_erases[i]);
+     printf(", CPU blocked %.3f ms\n", flash_busy_time/1000.0);
+}
+
+void pstorage_sys_event_handler(uint32_t sys_evt)
+{
+     // Operations complete synchronously; nothing to do.
+}
+
+void nrf_gpio_cfg_output(uint32_t pin_number)
+{
+}
+
+static void gpio_write(uint32_t pin_number, bool level)
+{
+     bool old_level = (gpio_out & (1ul << pin_number)) != 0;
+     if (level)
+	  gpio_out |= (1ul << pin_number);
+     else
+	  gpio_out &= ~(1ul << pin_number);
+
+     // Setting the lock pin again while it is set is reported, too (the 
+     // firmware extends the actuation).
+     if (pin_number == SIM_PIN_LOCK && (old_level != level || level)) {
+	  sim_enter();
+	  sim_trace("lock %s", !level ? "off" : old_level ? "on (extended)" : 
+		    "on");
+	  central_on_pin_change(pin_number, level);
+	  sim_leave();
+     }
+}
+
+void nrf_gpio_pin_set(uint32_t pin_number)
+{
+     gpio_write(pin_number, true);
+}
+
+void nrf_gpio_pin_clear(uint32_t pin_number)
+{
+     gpio_write(pin_number, false);
+}
+
+void nrf_gpio_pins_set(uint32_t pin_mask)
+{
+     for (uint32_t pin = 0; pin < 32; pin++)
+	  if (pin_mask & (1ul << pin))
+	       gpio_write(pin, true);
+}
+
+void nrf_gpio_pins_clear(uint32_t pin_mask)
+{
+     for (uint32_t pin = 0; pin < 32; pin++)
+	  if (pin_mask & (1ul << pin))
+	       gpio_write(pin, false);
+}
+
+uint32_t nrf_gpio_pin_read(uint32_t pin_number)
+{
+     return (gpio_out >> pin_number) & 1;
+}
+
+bool sim_gpio_get(uint32_t pin)
+{
+     return (gpio_out & (1ul << pin)) != 0;
+}
+
+void nrf_delay_us(uint32_t us)
+{
+     sim_busy(us);
+}
+
+void nrf_delay_ms(uint32_t ms)
+{
+     sim_busy(((uint64_t) ms)*1000);
+}
@@ -0,0 +1,494 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Host simulation of Key20: virtual time, event scheduling, accounting of 
+// latencies, and main function.
+//
+// Usage: key20-sim [-i conn_interval_ms] [-c cpu_scale] [-n unlocks] 
+//                  [-k key_no] [-d credentials] [-l] [-a] 
+//                  [-w disconnect_delay_ms] [-x] [-r] [-g unlock_pause_ms] 
+//                  [-p] [-e rand_byte_us] [-t] [-s seed] [-v]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <nrf.h>
+#include <app_util_platform.h>
+#include "sim.h"
+
+// Abort simulations running longer than this [us] of virtual time.
+#define SIM_TIME_LIMIT (600ull*1000000)
+
+// Maximum number of different measurements (boot, key exchange, unlock 
+// with new and seen credentials).
+#define SIM_MAX_MEASUREMENTS 5
+
+// Names of the firmware states (generated from enum app_states in key20.c).
+static const char *const state_names[] = {
+#include "state_names.h"
+};
+
+#define STATE_COUNT (sizeof(state_names)/sizeof(state_names[0]))
+
+// Entry point of the firmware (main() of key20.c).
+int key20_main(void);
+
+struct sim_config sim_config = {
+     .conn_interval = 30000,
+     .cpu_scale = 1.0,
+     .unlocks = 5,
+     .key_no = 0,
+     .credentials = 0,
+     .long_write = false,
+     .unlock_pause = 500000,
+     .seed = 1,
+     .verbose = false
+};
+
+uint64_t sim_now = 0;
+
+// Nesting depth of sim_enter().
+static unsigned int sim_depth = 0;
+// Host CPU time at the last sim_leave() [ns].
+static uint64_t host_mark;
+// Firmware state at the last sim_leave(). CPU time is accounted to the state
+// in which the firmware started to run.
+static int leave_state;
+// True while the simulation delivers events to the firmware.
+static bool is_in_irq = false;
+static bool is_booted = false;
+
+// Time, CPU time, and connection events spent in one firmware state during
+// a measurement.
+struct phase {
+     uint64_t wait;
+     uint64_t cpu;
+     unsigned int conn_events;
+     unsigned int order;
+};
+
+static struct phase phases[STATE_COUNT];
+static unsigned int phase_count;
+static bool is_measuring = false;
+static const char *measure_name;
+static uint64_t measure_start;
+
+// Summary of all measurements with the same name.
+struct summary {
+     const char *name;
+     unsigned int count;
+     unsigned int failures;
+     uint64_t latency_min;
+     uint64_t latency_max;
+     uint64_t latency_sum;
+     uint64_t cpu_sum;
+     unsigned int conn_events_sum;
+};
+
+static struct summary summaries[SIM_MAX_MEASUREMENTS];
+static unsigned int summary_count = 0;
+
+static uint64_t host_cpu_time()
+{
+     struct timespec ts;
+     clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+     return ((uint64_t) ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+static double ms(uint64_t us)
+{
+     return us/1000.0;
+}
+
+static struct phase *phase_of(int state)
+{
+     if (state < 0 || state >= (int) STATE_COUNT)
+	  sim_fail("invalid firmware state %d", state);
+     struct phase *p = &phases[state];
+     if (p->order == 0)
+	  p->order = ++phase_count;
+     return p;
+}
+
+static void account_cpu(int state, uint64_t us)
+{
+     if (us == 0)
+	  return;
+     sim_now += us;
+     if (is_measuring)
+	  phase_of(state)->cpu += us;
+}
+
+static void account_wait(uint64_t until)
+{
+     if (until <= sim_now)
+	  return;
+     if (is_measuring)
+	  phase_of(app_state)->wait += until - sim_now;
+     sim_now = until;
+}
+
+void sim_account_conn_event(void)
+{
+     if (is_measuring)
+	  phase_of(app_state)->conn_events++;
+}
+
+void sim_enter(void)
+{
+     if (sim_depth++ > 0)
+	  return;
+
+     uint64_t host_elapsed = host_cpu_time() - host_mark;
+     account_cpu(leave_state, 
+		 (uint64_t) (host_elapsed*sim_config.cpu_scale/1000.0));
+}
+
+void sim_leave(void)
+{
+     if (--sim_depth > 0)
+	  return;
+
+     leave_state = app_state;
+     host_mark = host_cpu_time();
+}
+
+void sim_busy(uint64_t us)
+{
+     sim_enter();
+     account_cpu(app_state, us);
+     sim_leave();
+}
+
+void sim_trace(const char *fmt, ...)
+{
+     if (!sim_config.verbose)
+	  return;
+
+     va_list ap;
+     va_start(ap, fmt);
+     printf("[%10.3f ms] %-32s ", ms(sim_now), state_names[app_state]);
+     vprintf(fmt, ap);
+     printf("\n");
+     va_end(ap);
+}
+
+void sim_fail(const char *fmt, ...)
+{
+     va_list ap;
+     va_start(ap, fmt);
+     fprintf(stderr, "key20-sim: error at %.3f ms: ", ms(sim_now));
+     vfprintf(stderr, fmt, ap);
+     fprintf(stderr, "\n");
+     va_end(ap);
+     exit(2);
+}
+
+uint32_t sim_random(uint32_t *state)
+{
+     uint32_t x = *state;
+     if (x == 0)
+	  x = 0x9e3779b9;
+     x ^= x << 13;
+     x ^= x >> 17;
+     x ^= x << 5;
+     *state = x;
+     return x;
+}
+
+void sim_measure_begin(const char *name)
+{
+     memset(phases, 0, sizeof(phases));
+     phase_count = 0;
+     is_measuring = true;
+     measure_name = name;
+     measure_start = sim_now;
+}
+
+static struct summary *summary_of(const char *name)
+{
+     for (unsigned int i = 0; i < summary_count; i++) {
+	  if (strcmp(summaries[i].name, name) == 0)
+	       return &summaries[i];
+     }
+     if (summary_count == SIM_MAX_MEASUREMENTS)
+	  sim_fail("too many measurements");
+     struct summary *s = &summaries[summary_count++];
+     memset(s, 0, sizeof(*s));
+     s->name = name;
+     s->latency_min = SIM_NEVER;
+     return s;
+}
+
+void sim_measure_end(bool success)
+{
+     if (!is_measuring)
+	  return;
+     is_measuring = false;
+
+     uint64_t latency = sim_now - measure_start;
+     uint64_t cpu = 0;
+     unsigned int conn_events = 0;
+     for (unsigned int i = 0; i < STATE_COUNT; i++) {
+	  cpu += phases[i].cpu;
+	  conn_events += phases[i].conn_events;
+     }
+
+     struct summary *s = summary_of(measure_name);
+     s->count++;
+     if (!success)
+	  s->failures++;
+     if (latency < s->latency_min)
+	  s->latency_min = latency;
+     if (latency > s->latency_max)
+	  s->latency_max = latency;
+     s->latency_sum += latency;
+     s->cpu_sum += cpu;
+     s->conn_events_sum += conn_events;
+
+     printf("%s #%u%s: %.3f ms, %u connection events, CPU %.3f ms\n",
+	    measure_name, s->count, success ? "" : " (FAILED)", ms(latency),
+	    conn_events, ms(cpu));
+     printf("  %-32s %8s %12s %12s\n", "state", "conn.ev.", "wait [ms]", 
+	    "CPU [ms]");
+     for (unsigned int order = 1; order <= phase_count; order++) {
+	  for (unsigned int i = 0; i < STATE_COUNT; i++) {
+	       if (phases[i].order != order)
+		    continue;
+	       printf("  %-32s %8u %12.3f %12.3f\n", state_names[i], 
+		      phases[i].conn_events, ms(phases[i].wait), 
+		      ms(phases[i].cpu));
+	  }
+     }
+}
+
+/**
+ * Print summary of all measurements and terminate.
+ */
+void sim_finish(void)
+{
+     unsigned int failures = 0;
+
+     printf("summary (connection interval %.2f ms, CPU scale %g):\n",
+	    ms(sim_config.conn_interval), sim_config.cpu_scale);
+     printf("  %-16s %5s %10s %10s %10s %10s %10s\n", "measurement", "count",
+	    "min [ms]", "avg [ms]", "max [ms]", "conn.ev.", "CPU [ms]");
+     for (unsigned int i = 0; i < summary_count; i++) {
+	  struct summary *s = &summaries[i];
+	  printf("  %-16s %5u %10.3f %10.3f %10.3f %10.1f %10.3f\n", s->name,
+		 s->count, ms(s->latency_min), ms(s->latency_sum/s->count), 
+		 ms(s->latency_max), ((double) s->conn_events_sum)/s->count,
+		 ms(s->cpu_sum/s->count));
+	  failures += s->failures;
+     }
+     sim_flash_report();
+
+     if (failures > 0) {
+	  printf("%u operation(s) failed\n", failures);
+	  exit(1);
+     }
+     exit(0);
+}
+
+const char *sim_state_name(int state)
+{
+     if (state < 0 || state >= (int) STATE_COUNT)
+	  return "?";
+     return state_names[state];
+}
+
+/**
+ * Deliver the next event due at or before the given time.
+ *
+ * @return true if an event has been delivered.
+ */
+static bool fire_next(uint64_t limit)
+{
+     uint64_t t_link = sim_link_next();
+     uint64_t t_timers = sim_timers_next();
+     uint64_t t_buttons = sim_buttons_next();
+     uint64_t t_central = central_next();
+
+     uint64_t t = t_link;
+     if (t_timers < t)
+	  t = t_timers;
+     if (t_buttons < t)
+	  t = t_buttons;
+     if (t_central < t)
+	  t = t_central;
+
+     if (t == SIM_NEVER || t > limit)
+	  return false;
+     if (t > SIM_TIME_LIMIT)
+	  sim_fail("time limit exceeded");
+
+     // Events that became due while the firmware was busy are delivered 
+     // late, i.e., at the current time.
+     account_wait(t);
+
+     is_in_irq = true;
+     if (t == t_central)
+	  central_fire();
+     else if (t == t_timers)
+	  sim_timers_fire();
+     else if (t == t_buttons)
+	  sim_buttons_fire();
+     else
+	  sim_link_fire();
+     is_in_irq = false;
+
+     return true;
+}
+
+uint32_t sd_app_evt_wait(void)
+{
+     sim_enter();
+
+     if (!is_booted) {
+	  is_booted = true;
+	  sim_measure_end(true);
+	  central_start();
+     }
+
+     central_poll();
+
+     if (!fire_next(SIM_NEVER))
+	  sim_fail("deadlock: no more events (state %s)", 
+		   state_names[app_state]);
+
+     sim_leave();
+
+     return NRF_SUCCESS;
+}
+
+void sim_irq_poll(void)
+{
+     if (is_in_irq || sim_depth > 0)
+	  return;
+
+     sim_enter();
+     while (fire_next(sim_now));
+     sim_leave();
+}
+
+uint32_t sd_nvic_SystemReset(void)
+{
+     sim_enter();
+     sim_fail("firmware reset (die) in state %s", state_names[app_state]);
+}
+
+static void usage()
+{
+     fprintf(stderr, "usage: key20-sim [-i conn_interval_ms] [-c cpu_scale] "
+	     "[-n unlocks] [-k key_no] [-d credentials] [-l] [-a] "
+	     "[-w disconnect_delay_ms] [-x] [-r] [-g unlock_pause_ms] [-p] "
+	     "[-e rand_byte_us] [-t] [-s seed] [-v]\n");
+     exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+     int opt;
+     while ((opt = getopt(argc, argv, "i:c:n:k:d:law:xrg:pe:ts:v")) != -1) {
+	  switch (opt) {
+	  case 'i' :
+	       // Connection interval is a multiple of 1.25 ms between 
+	       // 7.5 ms and 4 s.
+	       sim_config.conn_interval = (uint32_t) (atof(optarg)*1000);
+	       if (sim_config.conn_interval < 7500 || 
+		   sim_config.conn_interval > 4000000 || 
+		   sim_config.conn_interval%1250 != 0)
+		    usage();
+	       break;
+	  case 'c' :
+	       sim_config.cpu_scale = atof(optarg);
+	       if (sim_config.cpu_scale < 0)
+		    usage();
+	       break;
+	  case 'n' :
+	       sim_config.unlocks = atoi(optarg);
+	       break;
+	  case 'k' :
+	       sim_config.key_no = atoi(optarg);
+	       break;
+	  case 'd' :
+	       sim_config.credentials = atoi(optarg);
+	       break;
+	  case 'l' :
+	       sim_config.long_write = true;
+	       break;
+	  case 'a' :
+	       sim_config.adv_nonce = true;
+	       break;
+	  case 'w' :
+	       if (atof(optarg) < 0)
+		    usage();
+	       sim_config.disconnect_delay = (uint32_t) (atof(optarg)*1000);
+	       break;
+	  case 'x' :
+	       sim_config.drop_link = true;
+	       break;
+	  case 'r' :
+	       sim_config.rush = true;
+	       break;
+	  case 'g' :
+	       if (atof(optarg) < 0)
+		    usage();
+	       sim_config.unlock_pause = (uint32_t) (atof(optarg)*1000);
+	       break;
+	  case 'p' :
+	       sim_config.session = true;
+	       break;
+	  case 'e' :
+	       if (atof(optarg) < 0)
+		    usage();
+	       sim_config.rand_byte_time = (uint32_t) atof(optarg);
+	       break;
+	  case 't' :
+	       sim_config.check_transitions = true;
+	       break;
+	  case 's' :
+	       sim_config.seed = strtoul(optarg, NULL, 0);
+	       break;
+	  case 'v' :
+	       sim_config.verbose = true;
+	       break;
+	  default :
+	       usage();
+	  }
+     }
+     // A dropped link can neither linger nor carry a session.
+     if (sim_config.drop_link && 
+	 (sim_config.disconnect_delay > 0 || sim_config.session))
+	  usage();
+
+     if (sim_config.check_transitions)
+	  return sim_check_transitions() == 0 ? 0 : 1;
+
+     sim_measure_begin("boot");
+     sim_depth = 1;
+     sim_leave();
+
+     key20_main();
+
+     return 0;
+}
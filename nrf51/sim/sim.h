@@ -0,0 +1,183 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Internal interface of the host simulation of Key20.
+//
+// The firmware (key20.c) runs unmodified as a host process. Softdevice and
+// SDK functions are replaced by stand-ins that run in discrete virtual time: 
+// whenever the firmware waits for events (sd_app_evt_wait()), the virtual 
+// time jumps to the next scheduled event (connection event, timer expiry, 
+// button press), which is then delivered to the firmware. CPU time spent by 
+// the firmware is measured on the host, scaled by a configurable factor, and 
+// added to the virtual time, so long computations delay the processing of 
+// later events just like on the device.
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <ble.h>
+#include <softdevice_handler.h>
+
+// Virtual time [us] meaning "never".
+#define SIM_NEVER UINT64_MAX
+
+// Pins of the nRF51 DK (the simulated firmware is built for the DK).
+// Must match the pinout in key20.c.
+#define SIM_PIN_BUTTON_RED 17
+#define SIM_PIN_BUTTON_GREEN 18
+#define SIM_PIN_LOCK 22
+
+// Parameters of a simulation run.
+struct sim_config {
+     uint32_t conn_interval;  // connection interval [us]
+     double cpu_scale;        // device CPU time per host CPU time
+     unsigned int unlocks;    // number of unlock operations
+     unsigned int key_no;     // key slot used by the central
+     // Number of credential IDs used round robin for unlocking with 
+     // MASTER_KEY_DERIVATION (see key20.c); 0: unlock with key_no.
+     unsigned int credentials;
+     // Unlock with a long write (protocol version 2) instead of two writes.
+     bool long_write;
+     // Take the nonce from the scan response (firmware built with 
+     // ADVERTISED_NONCE, see key20.c) instead of subscribing to the nonce 
+     // characteristic.
+     bool adv_nonce;
+     // Time the central keeps the link after writing the HMAC [us].
+     uint32_t disconnect_delay;
+     // Drop the link in the connection event of the last write of the HMAC,
+     // so the firmware sees the disconnection before it checks the HMAC.
+     bool drop_link;
+     // Start the next unlock operation a pause after the lock has been 
+     // actuated instead of released (high traffic).
+     bool rush;
+     // Pause between two unlock operations [us].
+     uint32_t unlock_pause;
+     // Keep the link after unlocking and unlock again within the session 
+     // (firmware built with PERSISTENT_SESSIONS, see key20.c).
+     bool session;
+     // Time the random number generator of the softdevice takes per byte 
+     // [us]; 0: random bytes are always available.
+     uint32_t rand_byte_time;
+     // Check the transition table of the firmware instead of simulating.
+     bool check_transitions;
+     uint32_t seed;           // seed of the pseudo random number generators
+     bool verbose;            // trace events
+};
+
+extern struct sim_config sim_config;
+
+// Current virtual time [us].
+extern uint64_t sim_now;
+
+// Firmware state (enum app_states in key20.c; enums are int-sized on the
+// host).
+extern int app_state;
+
+// Handlers registered by the firmware.
+extern ble_evt_handler_t sim_ble_evt_handler;
+extern sys_evt_handler_t sim_sys_evt_handler;
+
+// The simulation alternates between running firmware code and simulation
+// code. sim_enter() is called when control passes from the firmware to the
+// simulation; the host CPU time used by the firmware since the last 
+// sim_leave() is then accounted as device CPU time. sim_leave() is called 
+// when control passes back to the firmware. 
+void sim_enter(void);
+void sim_leave(void);
+
+// Firmware busy waiting or blocked (e.g., during flash operations) for the 
+// given time [us]. Advances the virtual time and accounts for it as CPU time.
+void sim_busy(uint64_t us);
+
+// Call a firmware (interrupt) handler from simulation code, accounting for 
+// its CPU time.
+#define SIM_CALL_FIRMWARE(CALL) do { sim_leave(); CALL; sim_enter(); } while (0)
+
+void sim_trace(const char *fmt, ...) 
+     __attribute__((format(printf, 1, 2)));
+
+// Abort the simulation with an error.
+void sim_fail(const char *fmt, ...) 
+     __attribute__((noreturn, format(printf, 1, 2)));
+
+// Deterministic pseudo random numbers (xorshift32).
+uint32_t sim_random(uint32_t *state);
+
+// Measurement of latencies. Between sim_measure_begin() and 
+// sim_measure_end(), the virtual time is accounted per firmware state
+// (waiting time, CPU time, and consumed connection events).
+void sim_measure_begin(const char *name);
+void sim_measure_end(bool success);
+void sim_account_conn_event(void);
+
+// Print a summary of all measurements and terminate the simulation.
+void sim_finish(void) __attribute__((noreturn));
+
+const char *sim_state_name(int state);
+
+// Check the transition table of the firmware (transitions.c); prints all
+// entries if verbose.
+//
+// @return number of errors.
+int sim_check_transitions(void);
+
+// Link layer and GATT server (softdevice.c).
+uint64_t sim_link_next(void);
+void sim_link_fire(void);
+void sim_link_connect(void);
+bool sim_link_is_connected(void);
+uint16_t sim_gatts_value_handle(uint16_t uuid);
+uint16_t sim_gatts_cccd_handle(uint16_t uuid);
+
+// Timers, buttons, flash, GPIOs (sdk.c).
+uint64_t sim_timers_next(void);
+void sim_timers_fire(void);
+uint64_t sim_buttons_next(void);
+void sim_buttons_fire(void);
+void sim_button_press(uint8_t pin, uint64_t t);
+bool sim_gpio_get(uint32_t pin);
+// Print erase cycles, programmed words and blocking time of the flash.
+void sim_flash_report(void);
+
+// Scripted central (central.c).
+// Start the scripted scenario (called once the firmware has booted).
+void central_start(void);
+uint64_t central_next(void);
+void central_fire(void);
+void central_on_scan_response(const uint8_t *data, uint8_t len);
+void central_on_connected(void);
+void central_on_disconnected(void);
+// Next PDU of the central, if any: a write (op is BLE_GATTS_OP_WRITE_REQ, 
+// BLE_GATTS_OP_PREP_WRITE_REQ, or BLE_GATTS_OP_EXEC_WRITE_REQ_NOW), the 
+// confirmation of an indication, or the termination of the link.
+bool central_tx(uint8_t *op, uint16_t *handle, uint16_t *offset, 
+		uint8_t *data, uint16_t *len, bool *is_confirmation, 
+		bool *is_terminate);
+// Whether the link is lost right after the PDU returned by central_tx() 
+// (option -x).
+bool central_drops_link(void);
+void central_on_write_rsp(void);
+void central_on_indication(uint16_t handle, const uint8_t *data, uint16_t len);
+// Change of a GPIO; for the lock pin, also setting it while it is set.
+void central_on_pin_change(uint32_t pin, bool level);
+void central_poll(void);
+
+#endif
@@ -0,0 +1,739 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Stand-in for the S110 softdevice: link layer, GATT server, and random 
+// number generator.
+//
+// Link layer model: while advertising, a connection request of the central 
+// is served at the next advertising event. The central scans actively, so
+// it receives the scan response data (if any) in the same advertising 
+// event, before the connection request. Once connected, the central and 
+// the peripheral exchange at most one PDU each per connection event: 
+// first, the central (master) sends one PDU (write request, confirmation of 
+// an indication, or termination of the link). Then, the peripheral sends 
+// either the response to a write request received in the previous 
+// connection event, or a pending indication. Thus, a write request and its 
+// response take two connection events, and an indication and its 
+// confirmation take two connection events.
+//
+// GATT server model: writes to attributes with write authorization are 
+// passed to the application as authorization requests, which the 
+// application has to reply to before returning from the event handler. 
+// Prepared writes (long writes) are queued in memory provided by the 
+// application (requested with the first prepare write of a connection) 
+// in the layout of the S110: handle, offset, length (16 bit little endian
+// each) and data of each write, terminated by an invalid handle. The 
+// application processes the queue when the write is executed.
+
+#include <string.h>
+#include <ble.h>
+#include <ble_hci.h>
+#include "sim.h"
+
+// Maximum number of characteristics of the GATT server.
+#define SIM_MAX_CHARS 8
+
+// Maximum length of an attribute value [bytes].
+#define SIM_MAX_VALUE_LEN 64
+
+// Maximum length of data of a prepare write request (ATT MTU 23) [bytes].
+#define SIM_MAX_PREP_WRITE_LEN 18
+
+// Characteristic of the GATT server.
+struct sim_char {
+     uint16_t uuid;
+     ble_gatts_char_handles_t handles;
+     uint16_t cccd_value;
+     bool wr_auth;
+};
+
+static struct sim_char chars[SIM_MAX_CHARS];
+static unsigned int char_count = 0;
+static uint16_t next_handle = 1;
+
+static bool is_advertising = false;
+static uint64_t adv_start;
+static uint64_t adv_interval;
+
+// Base of vendor specific UUIDs, device name, and scan response data.
+static ble_uuid128_t vs_uuid;
+static uint8_t device_name[BLE_GAP_ADV_MAX_SIZE];
+static uint16_t device_name_len = 0;
+static uint8_t sr_data[BLE_GAP_ADV_MAX_SIZE];
+static uint8_t sr_data_len = 0;
+
+static bool is_connect_requested = false;
+static bool is_connected = false;
+static uint64_t next_conn_event;
+static unsigned int conn_event_counter;
+
+// Disconnection requested by the peripheral.
+static bool is_disconnect_requested = false;
+
+// Write response to be sent in the connection event with the given number.
+static bool is_write_rsp_pending = false;
+static unsigned int write_rsp_conn_event;
+
+// Indication queued by the peripheral.
+static bool is_hvx_pending = false;
+static bool is_hvx_in_flight = false;
+static uint16_t hvx_handle;
+static uint8_t hvx_data[SIM_MAX_VALUE_LEN];
+static uint16_t hvx_len;
+
+// Memory for queued writes provided by the application, and used length 
+// (without the terminating handle).
+static bool is_user_mem_requested = false;
+static ble_user_mem_block_t user_mem;
+static uint16_t user_mem_used;
+static bool is_queue_authorized;
+
+// Authorization request waiting for the reply of the application, and 
+// the replied status.
+static bool is_authorize_pending = false;
+static uint16_t authorize_status;
+
+static uint32_t rand_state;
+
+// Random bytes kept by the softdevice (see sim_config.rand_byte_time), at 
+// virtual time rand_time.
+#define RAND_POOL_SIZE 64
+static unsigned int rand_pool = RAND_POOL_SIZE;
+static uint64_t rand_time;
+
+// CPU time of one poll of the random number generator by the firmware [us].
+#define RAND_POLL_TIME 2
+
+static struct sim_char *find_char_by_handle(uint16_t handle)
+{
+     for (unsigned int i = 0; i < char_count; i++) {
+	  if (chars[i].handles.value_handle == handle || 
+	      chars[i].handles.cccd_handle == handle)
+	       return &chars[i];
+     }
+     return NULL;
+}
+
+static void deliver(ble_evt_t *ble_evt)
+{
+     if (sim_ble_evt_handler != NULL)
+	  SIM_CALL_FIRMWARE(sim_ble_evt_handler(ble_evt));
+}
+
+static void deliver_connected()
+{
+     ble_evt_t ble_evt;
+     memset(&ble_evt, 0, sizeof(ble_evt));
+     ble_evt.header.evt_id = BLE_GAP_EVT_CONNECTED;
+     ble_evt.evt.gap_evt.conn_handle = 0;
+     deliver(&ble_evt);
+}
+
+static void deliver_disconnected(uint8_t reason)
+{
+     ble_evt_t ble_evt;
+     memset(&ble_evt, 0, sizeof(ble_evt));
+     ble_evt.header.evt_id = BLE_GAP_EVT_DISCONNECTED;
+     ble_evt.evt.gap_evt.conn_handle = 0;
+     ble_evt.evt.gap_evt.params.disconnected.reason = reason;
+     deliver(&ble_evt);
+}
+
+static void deliver_write(uint16_t handle, const uint8_t *data, uint16_t len)
+{
+     ble_evt_t ble_evt;
+     memset(&ble_evt, 0, sizeof(ble_evt));
+     ble_evt.header.evt_id = BLE_GATTS_EVT_WRITE;
+     ble_evt.evt.gatts_evt.conn_handle = 0;
+     ble_evt.evt.gatts_evt.params.write.handle = handle;
+     ble_evt.evt.gatts_evt.params.write.len = len;
+     memcpy(ble_evt.evt.gatts_evt.params.write.data, data, len);
+     deliver(&ble_evt);
+}
+
+/**
+ * Pass a write to an attribute with write authorization to the application.
+ *
+ * @return GATT status replied by the application.
+ */
+static uint16_t deliver_authorize_request(uint8_t op, uint16_t handle, 
+					  uint16_t offset, const uint8_t *data,
+					  uint16_t len)
+{
+     ble_evt_t ble_evt;
+     memset(&ble_evt, 0, sizeof(ble_evt));
+     ble_evt.header.evt_id = BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST;
+     ble_evt.evt.gatts_evt.conn_handle = 0;
+     ble_gatts_evt_rw_authorize_request_t *request = 
+	  &ble_evt.evt.gatts_evt.params.authorize_request;
+     request->type = BLE_GATTS_AUTHORIZE_TYPE_WRITE;
+     request->request.write.handle = handle;
+     request->request.write.op = op;
+     request->request.write.offset = offset;
+     request->request.write.len = len;
+     memcpy(request->request.write.data, data, len);
+     is_authorize_pending = true;
+     deliver(&ble_evt);
+     if (is_authorize_pending)
+	  sim_fail("no reply to authorization request (handle %u)", handle);
+     return authorize_status;
+}
+
+static void deliver_user_mem_request()
+{
+     ble_evt_t ble_evt;
+     memset(&ble_evt, 0, sizeof(ble_evt));
+     ble_evt.header.evt_id = BLE_EVT_USER_MEM_REQUEST;
+     ble_evt.evt.common_evt.conn_handle = 0;
+     ble_evt.evt.common_evt.params.user_mem_request.type = 
+	  BLE_USER_MEM_TYPE_GATTS_QUEUED_WRITES;
+     is_user_mem_requested = true;
+     deliver(&ble_evt);
+}
+
+static void deliver_user_mem_release()
+{
+     ble_evt_t ble_evt;
+     memset(&ble_evt, 0, sizeof(ble_evt));
+     ble_evt.header.evt_id = BLE_EVT_USER_MEM_RELEASE;
+     ble_evt.evt.common_evt.conn_handle = 0;
+     ble_evt.evt.common_evt.params.user_mem_release.type = 
+	  BLE_USER_MEM_TYPE_GATTS_QUEUED_WRITES;
+     ble_evt.evt.common_evt.params.user_mem_release.mem_block = user_mem;
+     deliver(&ble_evt);
+}
+
+static void put_uint16(uint8_t *p, uint16_t value)
+{
+     p[0] = value & 0xff;
+     p[1] = value >> 8;
+}
+
+/**
+ * Queue a prepared write in the memory of the application.
+ *
+ * @return GATT status.
+ */
+static uint16_t prepare_write(uint16_t handle, uint16_t offset, 
+			      const uint8_t *data, uint16_t len)
+{
+     struct sim_char *c = find_char_by_handle(handle);
+     if (c == NULL || c->handles.value_handle != handle)
+	  return BLE_GATT_STATUS_ATTERR_WRITE_NOT_PERMITTED;
+     if (!is_user_mem_requested)
+	  deliver_user_mem_request();
+     // Entry and terminating handle must fit.
+     if (user_mem.p_mem == NULL || user_mem_used + 6 + len + 2 > user_mem.len)
+	  return BLE_GATT_STATUS_ATTERR_INVALID_ATT_VAL_LENGTH;
+
+     if (c->wr_auth) {
+	  uint16_t status = deliver_authorize_request(
+	       BLE_GATTS_OP_PREP_WRITE_REQ, handle, offset, data, len);
+	  if (status != BLE_GATT_STATUS_SUCCESS)
+	       return status;
+	  is_queue_authorized = true;
+     }
+
+     uint8_t *entry = &user_mem.p_mem[user_mem_used];
+     put_uint16(&entry[0], handle);
+     put_uint16(&entry[2], offset);
+     put_uint16(&entry[4], len);
+     memcpy(&entry[6], data, len);
+     user_mem_used += 6 + len;
+     put_uint16(&user_mem.p_mem[user_mem_used], BLE_GATT_HANDLE_INVALID);
+
+     return BLE_GATT_STATUS_SUCCESS;
+}
+
+/**
+ * Execute the queued writes.
+ *
+ * @return GATT status.
+ */
+static uint16_t execute_write()
+{
+     uint16_t status = BLE_GATT_STATUS_SUCCESS;
+
+     // Writes to attributes without authorization are not used by Key20.
+     if (is_queue_authorized)
+	  status = deliver_authorize_request(BLE_GATTS_OP_EXEC_WRITE_REQ_NOW, 
+					     BLE_GATT_HANDLE_INVALID, 0, NULL,
+					     0);
+     is_queue_authorized = false;
+     user_mem_used = 0;
+     if (user_mem.p_mem != NULL)
+	  put_uint16(user_mem.p_mem, BLE_GATT_HANDLE_INVALID);
+
+     return status;
+}
+
+static void deliver_hvc(uint16_t handle)
+{
+     ble_evt_t ble_evt;
+     memset(&ble_evt, 0, sizeof(ble_evt));
+     ble_evt.header.evt_id = BLE_GATTS_EVT_HVC;
+     ble_evt.evt.gatts_evt.conn_handle = 0;
+     ble_evt.evt.gatts_evt.params.hvc.handle = handle;
+     deliver(&ble_evt);
+}
+
+static void link_lost(uint8_t reason)
+{
+     is_connected = false;
+     is_disconnect_requested = false;
+     is_write_rsp_pending = false;
+     is_hvx_pending = false;
+     is_hvx_in_flight = false;
+     if (is_user_mem_requested && user_mem.p_mem != NULL)
+	  deliver_user_mem_release();
+     is_user_mem_requested = false;
+     memset(&user_mem, 0, sizeof(user_mem));
+     user_mem_used = 0;
+     is_queue_authorized = false;
+     // CCCDs of unbonded peers are reset.
+     for (unsigned int i = 0; i < char_count; i++)
+	  chars[i].cccd_value = 0;
+     sim_trace("disconnected (reason 0x%02x)", reason);
+     deliver_disconnected(reason);
+     central_on_disconnected();
+}
+
+static void conn_event()
+{
+     uint8_t op;
+     uint16_t handle;
+     uint16_t offset;
+     uint8_t data[SIM_MAX_VALUE_LEN];
+     uint16_t len;
+     bool is_confirmation;
+     bool is_terminate;
+     uint16_t status = BLE_GATT_STATUS_SUCCESS;
+
+     sim_account_conn_event();
+     conn_event_counter++;
+
+     // Master to slave.
+     if (central_tx(&op, &handle, &offset, data, &len, &is_confirmation, 
+		    &is_terminate)) {
+	  if (is_terminate) {
+	       link_lost(BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+	       return;
+	  } else if (is_confirmation) {
+	       sim_trace("confirmation of indication (handle %u)", handle);
+	       is_hvx_pending = false;
+	       is_hvx_in_flight = false;
+	       deliver_hvc(handle);
+	  } else if (op == BLE_GATTS_OP_PREP_WRITE_REQ) {
+	       sim_trace("prepare write request (handle %u, offset %u, "
+			 "%u bytes)", handle, offset, len);
+	       if (len > SIM_MAX_PREP_WRITE_LEN)
+		    sim_fail("prepare write request too long");
+	       status = prepare_write(handle, offset, data, len);
+	       is_write_rsp_pending = true;
+	       write_rsp_conn_event = conn_event_counter+1;
+	  } else if (op == BLE_GATTS_OP_EXEC_WRITE_REQ_NOW) {
+	       sim_trace("execute write request");
+	       status = execute_write();
+	       is_write_rsp_pending = true;
+	       write_rsp_conn_event = conn_event_counter+1;
+	  } else {
+	       sim_trace("write request (handle %u, %u bytes)", handle, len);
+	       struct sim_char *c = find_char_by_handle(handle);
+	       if (c != NULL && c->handles.cccd_handle == handle && len == 2)
+		    c->cccd_value = data[0] | (data[1] << 8);
+	       is_write_rsp_pending = true;
+	       write_rsp_conn_event = conn_event_counter+1;
+	       if (c != NULL && c->handles.value_handle == handle && c->wr_auth)
+		    status = deliver_authorize_request(BLE_GATTS_OP_WRITE_REQ, 
+						       handle, 0, data, len);
+	       else
+		    deliver_write(handle, data, len);
+	  }
+	  // The scripted central only sends valid writes.
+	  if (status != BLE_GATT_STATUS_SUCCESS)
+	       sim_fail("write rejected (GATT status 0x%04x)", status);
+	  if (central_drops_link()) {
+	       // Lost before the write response.
+	       link_lost(BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+	       return;
+	  }
+     }
+
+     // Slave to master.
+     if (is_write_rsp_pending && write_rsp_conn_event == conn_event_counter) {
+	  is_write_rsp_pending = false;
+	  central_on_write_rsp();
+     } else if (is_hvx_pending && !is_hvx_in_flight) {
+	  sim_trace("indication (handle %u, %u bytes)", hvx_handle, hvx_len);
+	  is_hvx_in_flight = true;
+	  central_on_indication(hvx_handle, hvx_data, hvx_len);
+     }
+     
+     if (is_disconnect_requested) {
+	  link_lost(BLE_HCI_LOCAL_HOST_TERMINATED_CONNECTION);
+	  return;
+     }
+
+     next_conn_event += sim_config.conn_interval;
+}
+
+uint64_t sim_link_next(void)
+{
+     if (is_connected)
+	  return next_conn_event;
+
+     if (is_connect_requested && is_advertising) {
+	  // Next advertising event.
+	  if (sim_now <= adv_start)
+	       return adv_start;
+	  uint64_t n = (sim_now - adv_start + adv_interval - 1)/adv_interval;
+	  return adv_start + n*adv_interval;
+     }
+
+     return SIM_NEVER;
+}
+
+void sim_link_fire(void)
+{
+     if (is_connected) {
+	  conn_event();
+     } else {
+	  if (sr_data_len > 0)
+	       central_on_scan_response(sr_data, sr_data_len);
+	  is_connect_requested = false;
+	  is_advertising = false;
+	  is_connected = true;
+	  conn_event_counter = 0;
+	  // The first connection event follows one connection interval 
+	  // after the connection request.
+	  next_conn_event = sim_now + sim_config.conn_interval;
+	  sim_trace("connected");
+	  deliver_connected();
+	  central_on_connected();
+     }
+}
+
+void sim_link_connect(void)
+{
+     is_connect_requested = true;
+}
+
+bool sim_link_is_connected(void)
+{
+     return is_connected;
+}
+
+uint16_t sim_gatts_value_handle(uint16_t uuid)
+{
+     for (unsigned int i = 0; i < char_count; i++) {
+	  if (chars[i].uuid == uuid)
+	       return chars[i].handles.value_handle;
+     }
+     sim_fail("no characteristic with UUID 0x%04x", uuid);
+}
+
+uint16_t sim_gatts_cccd_handle(uint16_t uuid)
+{
+     for (unsigned int i = 0; i < char_count; i++) {
+	  if (chars[i].uuid == uuid && 
+	      chars[i].handles.cccd_handle != BLE_GATT_HANDLE_INVALID)
+	       return chars[i].handles.cccd_handle;
+     }
+     sim_fail("no CCCD of characteristic with UUID 0x%04x", uuid);
+}
+
+uint32_t sd_ble_enable(ble_enable_params_t *p_ble_enable_params)
+{
+     rand_state = sim_config.seed;
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_uuid_vs_add(const ble_uuid128_t *p_vs_uuid, uint8_t *p_uuid_type)
+{
+     vs_uuid = *p_vs_uuid;
+     *p_uuid_type = BLE_UUID_TYPE_VENDOR_BEGIN;
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_uuid_encode(const ble_uuid_t *p_uuid, uint8_t *p_uuid_le_len,
+			    uint8_t *p_uuid_le)
+{
+     if (p_uuid->type == BLE_UUID_TYPE_BLE) {
+	  *p_uuid_le_len = 2;
+     } else if (p_uuid->type == BLE_UUID_TYPE_VENDOR_BEGIN) {
+	  // The 16 bit UUID replaces bytes 12 and 13 of the base.
+	  *p_uuid_le_len = 16;
+	  if (p_uuid_le != NULL)
+	       memcpy(p_uuid_le, vs_uuid.uuid128, 16);
+	  p_uuid_le += 12;
+     } else {
+	  return NRF_ERROR_INVALID_PARAM;
+     }
+     if (p_uuid_le != NULL) {
+	  p_uuid_le[0] = (uint8_t) p_uuid->uuid;
+	  p_uuid_le[1] = (uint8_t) (p_uuid->uuid >> 8);
+     }
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_address_get(ble_gap_addr_t *p_addr)
+{
+     memset(p_addr, 0, sizeof(*p_addr));
+     p_addr->addr_type = BLE_GAP_ADDR_TYPE_RANDOM_STATIC;
+     for (unsigned int i = 0; i < sizeof(p_addr->addr); i++)
+	  p_addr->addr[i] = 0xc0 | i;
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_address_set(uint8_t addr_cycle_mode, 
+				 const ble_gap_addr_t *p_addr)
+{
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_device_name_set(const ble_gap_conn_sec_mode_t *p_write_perm,
+				    const uint8_t *p_dev_name, uint16_t len)
+{
+     if (len > sizeof(device_name))
+	  return NRF_ERROR_INVALID_LENGTH;
+     memcpy(device_name, p_dev_name, len);
+     device_name_len = len;
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_device_name_get(uint8_t *p_dev_name, uint16_t *p_len)
+{
+     if (*p_len < device_name_len)
+	  return NRF_ERROR_DATA_SIZE;
+     memcpy(p_dev_name, device_name, device_name_len);
+     *p_len = device_name_len;
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_ppcp_set(const ble_gap_conn_params_t *p_conn_params)
+{
+     // The connection interval is chosen by the central, i.e., 
+     // the simulation configuration.
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_adv_data_set(const uint8_t *p_data, uint8_t dlen, 
+				 const uint8_t *p_sr_data, uint8_t srdlen)
+{
+     if (dlen > BLE_GAP_ADV_MAX_SIZE || srdlen > BLE_GAP_ADV_MAX_SIZE)
+	  return NRF_ERROR_INVALID_LENGTH;
+     // Advertising data is not used by the central (it always connects 
+     // to the simulated peripheral).
+     if (srdlen > 0)
+	  memcpy(sr_data, p_sr_data, srdlen);
+     sr_data_len = srdlen;
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_adv_start(const ble_gap_adv_params_t *p_adv_params)
+{
+     if (is_connected || is_advertising)
+	  return NRF_ERROR_INVALID_STATE;
+
+     sim_trace("advertising");
+     is_advertising = true;
+     adv_start = sim_now;
+     // Advertising interval is given in 0.625 ms.
+     adv_interval = p_adv_params->interval*625;
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_adv_stop(void)
+{
+     if (!is_advertising)
+	  return NRF_ERROR_INVALID_STATE;
+
+     is_advertising = false;
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_disconnect(uint16_t conn_handle, uint8_t hci_status_code)
+{
+     // Like the S110: only handle 0 is ever used; it is invalid once the 
+     // link is lost.
+     if (conn_handle != 0)
+	  return BLE_ERROR_INVALID_CONN_HANDLE;
+     if (!is_connected)
+	  return NRF_ERROR_INVALID_STATE;
+
+     is_disconnect_requested = true;
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_sec_params_reply(uint16_t conn_handle, uint8_t sec_status,
+				     const ble_gap_sec_params_t *p_sec_params,
+				     const void *p_sec_keyset)
+{
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gatts_service_add(uint8_t type, const ble_uuid_t *p_uuid, 
+				  uint16_t *p_handle)
+{
+     *p_handle = next_handle++;
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gatts_characteristic_add(uint16_t service_handle,
+					 const ble_gatts_char_md_t *p_char_md,
+					 const ble_gatts_attr_t *p_attr_char_value,
+					 ble_gatts_char_handles_t *p_handles)
+{
+     if (char_count == SIM_MAX_CHARS)
+	  return NRF_ERROR_NO_MEM;
+     if (p_attr_char_value->max_len > SIM_MAX_VALUE_LEN)
+	  return NRF_ERROR_INVALID_PARAM;
+
+     struct sim_char *c = &chars[char_count++];
+     memset(c, 0, sizeof(*c));
+     c->uuid = p_attr_char_value->p_uuid->uuid;
+     c->wr_auth = p_attr_char_value->p_attr_md->wr_auth;
+     // Characteristic declaration, value, and (optional) CCCD.
+     next_handle++;
+     c->handles.value_handle = next_handle++;
+     if (p_char_md->char_props.indicate || p_char_md->char_props.notify)
+	  c->handles.cccd_handle = next_handle++;
+     else
+	  c->handles.cccd_handle = BLE_GATT_HANDLE_INVALID;
+     c->handles.user_desc_handle = BLE_GATT_HANDLE_INVALID;
+     c->handles.sccd_handle = BLE_GATT_HANDLE_INVALID;
+     *p_handles = c->handles;
+
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gatts_value_set(uint16_t conn_handle, uint16_t handle,
+				ble_gatts_value_t *p_value)
+{
+     if (find_char_by_handle(handle) == NULL)
+	  return NRF_ERROR_INVALID_PARAM;
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gatts_hvx(uint16_t conn_handle, 
+			  const ble_gatts_hvx_params_t *p_hvx_params)
+{
+     if (!is_connected || conn_handle != 0)
+	  return NRF_ERROR_INVALID_STATE;
+
+     struct sim_char *c = find_char_by_handle(p_hvx_params->handle);
+     if (c == NULL || c->handles.value_handle != p_hvx_params->handle)
+	  return NRF_ERROR_INVALID_PARAM;
+     // Indications must have been enabled by the client.
+     if (p_hvx_params->type != BLE_GATT_HVX_INDICATION || 
+	 (c->cccd_value & 0x0002) == 0)
+	  return NRF_ERROR_INVALID_STATE;
+     // Only one indication can be in flight.
+     if (is_hvx_pending)
+	  return NRF_ERROR_BUSY;
+     if (*p_hvx_params->p_len > SIM_MAX_VALUE_LEN)
+	  return NRF_ERROR_INVALID_LENGTH;
+
+     is_hvx_pending = true;
+     is_hvx_in_flight = false;
+     hvx_handle = p_hvx_params->handle;
+     hvx_len = *p_hvx_params->p_len;
+     memcpy(hvx_data, p_hvx_params->p_data, hvx_len);
+
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_user_mem_reply(uint16_t conn_handle, 
+			       const ble_user_mem_block_t *p_block)
+{
+     if (!is_connected || conn_handle != 0 || !is_user_mem_requested)
+	  return NRF_ERROR_INVALID_STATE;
+     if (p_block == NULL) {
+	  memset(&user_mem, 0, sizeof(user_mem));
+     } else {
+	  if (p_block->len < 2)
+	       return NRF_ERROR_INVALID_LENGTH;
+	  user_mem = *p_block;
+	  user_mem_used = 0;
+	  put_uint16(user_mem.p_mem, BLE_GATT_HANDLE_INVALID);
+     }
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gatts_rw_authorize_reply(
+     uint16_t conn_handle, 
+     const ble_gatts_rw_authorize_reply_params_t *p_rw_authorize_reply_params)
+{
+     if (!is_connected || conn_handle != 0 || !is_authorize_pending)
+	  return NRF_ERROR_INVALID_STATE;
+     if (p_rw_authorize_reply_params->type != BLE_GATTS_AUTHORIZE_TYPE_WRITE)
+	  return NRF_ERROR_INVALID_PARAM;
+     is_authorize_pending = false;
+     authorize_status = p_rw_authorize_reply_params->params.write.gatt_status;
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gatts_sys_attr_set(uint16_t conn_handle, 
+				   const uint8_t *p_sys_attr_data, 
+				   uint16_t len, uint32_t flags)
+{
+     return NRF_SUCCESS;
+}
+
+static void rand_refill(void)
+{
+     if (sim_config.rand_byte_time == 0) {
+	  rand_pool = RAND_POOL_SIZE;
+	  return;
+     }
+
+     uint64_t bytes = (sim_now - rand_time)/sim_config.rand_byte_time;
+     if (rand_pool + bytes >= RAND_POOL_SIZE) {
+	  rand_pool = RAND_POOL_SIZE;
+	  rand_time = sim_now;
+     } else {
+	  rand_pool += bytes;
+	  rand_time += bytes*sim_config.rand_byte_time;
+     }
+}
+
+uint32_t sd_rand_application_bytes_available_get(uint8_t *p_bytes_available)
+{
+     // The softdevice keeps a pool of up to 64 random bytes, which is 
+     // refilled by the RNG. A firmware waiting for random bytes polls in
+     // a loop, which takes CPU time.
+     rand_refill();
+     if (rand_pool == 0)
+	  sim_busy(RAND_POLL_TIME);
+     *p_bytes_available = rand_pool;
+     return NRF_SUCCESS;
+}
+
+uint32_t sd_rand_application_vector_get(uint8_t *p_buff, uint8_t length)
+{
+     rand_refill();
+     if (length > rand_pool)
+	  return NRF_ERROR_SOC_RAND_NOT_ENOUGH_VALUES;
+     if (rand_pool == RAND_POOL_SIZE)
+	  rand_time = sim_now;
+     rand_pool -= length;
+     for (unsigned int i = 0; i < length; i++)
+	  p_buff[i] = (uint8_t) sim_random(&rand_state);
+     return NRF_SUCCESS;
+}
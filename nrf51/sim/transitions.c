@@ -0,0 +1,179 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Check of the transition table of the firmware (option -t): enumerates
+// every (state, event) pair of the table of this build (the entries
+// depend on the options of key20.c), and checks that
+//
+// - every action exists in this build and every next state is valid,
+// - events handled before the table lookup have no entries,
+// - every state handling events of a connected client also handles the
+//   disconnection of the client (otherwise, the device would be stuck in
+//   this state),
+// - every state entered through the table handles some event.
+//
+// With -v, all entries are printed.
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "sim.h"
+#include "fsm.h"
+
+// State machine of the firmware (key20.c).
+extern const struct fsm app_fsm;
+
+// Names of the events and actions (generated from key20.c).
+static const char *const event_names[] = {
+#include "event_names.h"
+};
+
+static const char *const action_names[] = {
+#include "action_names.h"
+};
+
+#define EVENT_COUNT (sizeof(event_names)/sizeof(event_names[0]))
+#define ACTION_COUNT (sizeof(action_names)/sizeof(action_names[0]))
+
+// Events handled before the table lookup (see state_transition()).
+static const char *const pre_dispatched_events[] = {
+     "PSTORE_READY", "LOCK_ACTION_TIMEOUT"
+};
+
+// Events that only occur while a client is connected.
+static const char *const client_events[] = {
+     "AUTH_TIMEOUT", "SUBSCRIBED_CFG_OUT", "SUBSCRIBED_NONCE",
+     "KEY_PART_RCVD", "HMAC_PART_RCVD", "INDICATION_NONCE_RCVD",
+     "INDICATION_CFG_OUT_RCVD", "SHARED_SECRET_READY", "HMAC_RCVD",
+     "SESSION_UNLOCK_RCVD", "SESSION_TIMEOUT"
+};
+
+#define COUNT_OF(a) (sizeof(a)/sizeof(a[0]))
+
+static int errors;
+
+static void __attribute__((format(printf, 1, 2))) error(const char *fmt, ...)
+{
+     va_list ap;
+     va_start(ap, fmt);
+     printf("transitions: error: ");
+     vprintf(fmt, ap);
+     printf("\n");
+     va_end(ap);
+     errors++;
+}
+
+static int event_no(const char *name)
+{
+     for (unsigned int e = 0; e < EVENT_COUNT; e++)
+	  if (event_names[e] != NULL && strcmp(event_names[e], name) == 0)
+	       return e;
+     return -1;
+}
+
+static const struct fsm_transition *entry(unsigned int state,
+					  unsigned int event)
+{
+     return &app_fsm.transitions[state*app_fsm.event_count + event];
+}
+
+static bool is_handled(unsigned int state, unsigned int event)
+{
+     const struct fsm_transition *t = entry(state, event);
+     return t->action != FSM_NO_ACTION || t->next_state != FSM_SAME_STATE;
+}
+
+int sim_check_transitions(void)
+{
+     unsigned int entries = 0;
+     bool is_target[256] = {false};
+
+     errors = 0;
+     if (app_fsm.event_count != EVENT_COUNT ||
+	 app_fsm.action_count != ACTION_COUNT ||
+	 strcmp(sim_state_name(app_fsm.state_count - 1), "?") == 0 ||
+	 strcmp(sim_state_name(app_fsm.state_count), "?") != 0) {
+	  error("table size differs from names");
+	  return errors;
+     }
+
+     for (unsigned int s = 0; s < app_fsm.state_count; s++) {
+	  for (unsigned int e = 0; e < app_fsm.event_count; e++) {
+	       const struct fsm_transition *t = entry(s, e);
+	       if (!is_handled(s, e))
+		    continue;
+	       entries++;
+	       const char *state = sim_state_name(s);
+	       if (t->action >= app_fsm.action_count) {
+		    error("%s/%s: invalid action", state, event_names[e]);
+	       } else if (t->action != FSM_NO_ACTION &&
+			  app_fsm.actions[t->action] == NULL) {
+		    error("%s/%s: action not in this build", state,
+			  event_names[e]);
+	       }
+	       if (t->next_state > app_fsm.state_count)
+		    error("%s/%s: invalid next state", state, event_names[e]);
+	       else if (t->next_state != FSM_SAME_STATE)
+		    is_target[t->next_state - 1] = true;
+	       if (sim_config.verbose)
+		    printf("%-32s %-24s -> %-24s %s\n", state,
+			   event_names[e],
+			   t->action < app_fsm.action_count ?
+			   action_names[t->action] : "?",
+			   t->next_state == FSM_SAME_STATE ? "(same state)" :
+			   sim_state_name(t->next_state - 1));
+	  }
+     }
+
+     for (unsigned int i = 0; i < COUNT_OF(pre_dispatched_events); i++) {
+	  int e = event_no(pre_dispatched_events[i]);
+	  for (unsigned int s = 0; e >= 0 && s < app_fsm.state_count; s++)
+	       if (is_handled(s, e))
+		    error("%s/%s: event is handled before the table",
+			  sim_state_name(s), event_names[e]);
+     }
+
+     int disconnected = event_no("CLIENT_DISCONNECTED");
+     for (unsigned int s = 0; s < app_fsm.state_count; s++) {
+	  bool is_connected = false;
+	  bool is_dead_end = true;
+	  for (unsigned int i = 0; i < COUNT_OF(client_events); i++) {
+	       int e = event_no(client_events[i]);
+	       if (e >= 0 && is_handled(s, e))
+		    is_connected = true;
+	  }
+	  for (unsigned int e = 0; e < app_fsm.event_count; e++)
+	       if (is_handled(s, e))
+		    is_dead_end = false;
+	  if (is_connected && (disconnected < 0 ||
+			       !is_handled(s, disconnected)))
+	       error("%s: client events handled, but not disconnection",
+		     sim_state_name(s));
+	  if (is_target[s] && is_dead_end)
+	       error("%s: entered, but handles no events",
+		     sim_state_name(s));
+     }
+
+     printf("transitions: %u states, %u events, %u entries, %u actions, "
+	    "table %zu bytes: %s\n", app_fsm.state_count,
+	    app_fsm.event_count, entries, app_fsm.action_count,
+	    app_fsm.state_count*app_fsm.event_count*
+	    sizeof(struct fsm_transition), errors == 0 ? "ok" : "failed");
+     return errors;
+}
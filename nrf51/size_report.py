@@ -0,0 +1,442 @@
+#!/usr/bin/env python3
+#
+# This file is part of Key20.
+#
+# Copyright 2016 Frank Duerr
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Flash, RAM, and stack report of a firmware build.
+
+    size_report.py [-n top] [--objdump cmd] [--flash-budget bytes]
+                   [--ram-budget bytes] [--softdevice-stack bytes]
+                   [--roots name,...] map [elf [su_dir ...]]
+
+Flash and RAM usage per symbol and per module are taken from the map file
+of the GNU linker (-Xlinker -Map). Objects compiled with -ffunction-sections
+and -fdata-sections have one input section per symbol; other input
+sections are attributed to their object file. An input section counts as
+flash if its output section is located in or loaded from a flash region,
+and as RAM if it is located in a RAM region (so .data counts for both).
+The regions are taken from the memory configuration of the map file, or
+from the budgets given on the command line.
+
+With the ELF file, the worst-case stack is estimated: the frame of every
+function is taken from the .su files written by -fstack-usage (searched
+recursively in the given directories), or, for functions without one
+(assembly, functions created by LTO), from the push and sub sp
+instructions of its Thumb prologue. The call graph is taken from the
+disassembly (objdump -d). Indirect calls (e.g., the actions of the state
+machine, called through a table) are assumed to call any function that
+has no direct caller. The worst case is the deepest path from main plus
+the deepest interrupt handler, plus the stack reserved for the
+softdevice. Recursion is reported, but not followed.
+"""
+
+import argparse
+import collections
+import os
+import re
+import subprocess
+import sys
+
+# Stack used by the S110 softdevice on top of the application [bytes].
+SOFTDEVICE_STACK = 1536
+
+SECTION_PREFIXES = ('.text.', '.rodata.', '.data.', '.bss.', '.sdata.',
+                    '.sbss.', '.init_array.', '.fini_array.')
+
+
+class Region:
+    def __init__(self, name, origin, length, attributes):
+        self.name = name
+        self.origin = origin
+        self.length = length
+        self.attributes = attributes
+
+    def contains(self, address):
+        return self.origin <= address < self.origin + self.length
+
+    def is_flash(self):
+        # Executable and not writable, or named like flash.
+        return (('x' in self.attributes and 'w' not in self.attributes) or
+                'FLASH' in self.name.upper() or 'ROM' in self.name.upper())
+
+
+def parse_map(path):
+    """Returns the memory regions, and a list of input sections
+    (output section, name, address, size, load address, object file)."""
+    regions = []
+    sections = []
+    with open(path) as f:
+        lines = f.read().splitlines()
+
+    i = 0
+    while i < len(lines) and not lines[i].startswith('Memory Configuration'):
+        i += 1
+    i += 1
+    while i < len(lines) and not lines[i].startswith('Linker script'):
+        fields = lines[i].split()
+        if (len(fields) >= 3 and fields[1].startswith('0x') and
+                fields[0] != 'Name' and fields[0] != '*default*'):
+            attributes = fields[3] if len(fields) > 3 else ''
+            regions.append(Region(fields[0], int(fields[1], 16),
+                                  int(fields[2], 16), attributes))
+        i += 1
+
+    output = None
+    output_load = None
+    output_address = None
+    pending = None
+    output_re = re.compile(r'^(\.\S+|\S+)\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)'
+                           r'(?:\s+load address\s+(0x[0-9a-f]+))?')
+    output_name_re = re.compile(r'^(\.\S+)\s*$')
+    input_re = re.compile(r'^ (\S+)\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(.+)$')
+    input_name_re = re.compile(r'^ (\S+)\s*$')
+    cont_re = re.compile(r'^\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(.+)$')
+    for line in lines[i:]:
+        if pending is not None:
+            # Long names are followed by address, size, and file on the
+            # next line.
+            m = cont_re.match(line)
+            if m and pending[0] == 'output':
+                output = pending[1]
+                output_address = int(m.group(1), 16)
+                load = re.search(r'load address\s+(0x[0-9a-f]+)', line)
+                output_load = int(load.group(1), 16) if load else None
+                pending = None
+                continue
+            if m:
+                sections.append((output, pending[1], int(m.group(1), 16),
+                                 int(m.group(2), 16), output_load,
+                                 output_address, m.group(3).strip()))
+                pending = None
+                continue
+            pending = None
+        m = output_re.match(line)
+        if m and not line.startswith(' '):
+            output = m.group(1)
+            output_address = int(m.group(2), 16)
+            output_load = int(m.group(4), 16) if m.group(4) else None
+            continue
+        m = output_name_re.match(line)
+        if m:
+            pending = ('output', m.group(1))
+            continue
+        if line.startswith(' *') or line.startswith(' *fill*'):
+            continue
+        m = input_re.match(line)
+        if m and not m.group(1).startswith('0x'):
+            sections.append((output, m.group(1), int(m.group(2), 16),
+                             int(m.group(3), 16), output_load,
+                             output_address, m.group(4).strip()))
+            continue
+        m = input_name_re.match(line)
+        if m and not m.group(1).startswith('0x'):
+            pending = ('input', m.group(1))
+    return regions, sections
+
+
+def module_name(path):
+    name = os.path.basename(path)
+    # Archive members: lib.a(member.o)
+    m = re.match(r'(.*)\((.*)\)$', name)
+    if m:
+        name = m.group(2)
+    if '.ltrans' in name:
+        return '(LTO)'
+    return name
+
+
+def symbol_name(section, path):
+    for prefix in SECTION_PREFIXES:
+        if section.startswith(prefix):
+            return section[len(prefix):]
+    return '%s(%s)' % (section, module_name(path))
+
+
+def classify(regions, output, address, load_address):
+    """Returns (is_flash, is_ram)."""
+    if not regions:
+        # No memory configuration (e.g., a host build): by section name.
+        if output in ('.data', '.got', '.got.plt'):
+            return True, True
+        if output in ('.bss', '.tbss', '.tdata', 'COMMON'):
+            return False, True
+        return output in ('.text', '.rodata', '.init', '.fini',
+                          '.eh_frame', '.ARM.exidx'), False
+    flash = ram = False
+    for region in regions:
+        if region.contains(address):
+            if region.is_flash():
+                flash = True
+            else:
+                ram = True
+        if load_address is not None and region.contains(load_address) \
+                and region.is_flash():
+            flash = True
+    return flash, ram
+
+
+def parse_su(dirs):
+    frames = {}
+    for d in dirs:
+        for root, _, files in os.walk(d):
+            for name in files:
+                if not name.endswith('.su'):
+                    continue
+                with open(os.path.join(root, name)) as f:
+                    for line in f:
+                        fields = line.rstrip('\n').split('\t')
+                        if len(fields) < 3:
+                            continue
+                        function = fields[0].split(':')[-1]
+                        size = int(fields[1])
+                        frames[function] = (max(size, frames.get(
+                            function, (0, ''))[0]), fields[2])
+    return frames
+
+
+def base_name(function):
+    # Clones created by the optimizer: foo.constprop.0, foo.isra.0,
+    # foo.lto_priv.0, foo.part.0
+    return function.split('.')[0]
+
+
+def parse_disassembly(objdump, elf):
+    text = subprocess.run([objdump, '-d', elf], check=True,
+                          stdout=subprocess.PIPE,
+                          universal_newlines=True).stdout
+    functions = collections.OrderedDict()
+    current = None
+    function_re = re.compile(r'^[0-9a-f]+ <([^>]+)>:$')
+    call_re = re.compile(r'\t(bl|blx|b|b\.n|b\.w|call|callq|jmp|jmpq)\s+'
+                         r'[0-9a-f]+ <([^>+]+)>')
+    indirect_re = re.compile(r'\t(blx\s+r\d+|blx\s+(ip|lr)|bx\s+r[0-9]\b|'
+                             r'call[q]?\s+\*)')
+    push_re = re.compile(r'\tpush\s+\{([^}]*)\}')
+    sub_sp_re = re.compile(r'\tsub\s+sp,\s*(?:sp,\s*)?#(\d+)')
+    for line in text.splitlines():
+        m = function_re.match(line)
+        if m:
+            current = m.group(1)
+            functions[current] = {'calls': set(), 'indirect': False,
+                                  'prologue': 0, 'instructions': 0}
+            continue
+        if current is None or '\t' not in line:
+            continue
+        info = functions[current]
+        info['instructions'] += 1
+        m = call_re.search(line)
+        if m and m.group(2) != current:
+            info['calls'].add(m.group(2))
+        elif indirect_re.search(line):
+            info['indirect'] = True
+        if info['instructions'] <= 6:
+            m = push_re.search(line)
+            if m:
+                info['prologue'] += 4*len(expand_registers(m.group(1)))
+            m = sub_sp_re.search(line)
+            if m:
+                info['prologue'] += int(m.group(1))
+    # Branches to labels inside functions are not calls.
+    for info in functions.values():
+        info['calls'] = {c for c in info['calls'] if c in functions}
+    return functions
+
+
+def expand_registers(registers):
+    result = []
+    for part in registers.split(','):
+        part = part.strip()
+        m = re.match(r'r(\d+)-r(\d+)$', part)
+        if m:
+            result.extend(range(int(m.group(1)), int(m.group(2)) + 1))
+        elif part:
+            result.append(part)
+    return result
+
+
+def stack_report(functions, frames, roots_main, out):
+    called = set()
+    for info in functions.values():
+        called |= info['calls']
+    indirect_targets = {f for f in functions
+                        if f not in called and f not in roots_main and
+                        not is_handler(f)}
+
+    def frame(function):
+        if function in frames:
+            return frames[function][0], frames[function][1]
+        if base_name(function) in frames and base_name(function) != function:
+            return frames[base_name(function)][0], 'clone'
+        return functions[function]['prologue'], 'prologue'
+
+    memo = {}
+    recursive = set()
+
+    def deepest(function, path):
+        if function in path:
+            recursive.add(function)
+            return 0, []
+        if function in memo:
+            return memo[function]
+        callees = set(functions[function]['calls'])
+        if functions[function]['indirect']:
+            callees |= indirect_targets
+        best, best_path = 0, []
+        for callee in callees:
+            depth, callee_path = deepest(callee, path | {function})
+            if depth > best:
+                best, best_path = depth, callee_path
+        result = (frame(function)[0] + best, [function] + best_path)
+        memo[function] = result
+        return result
+
+    main_depth, main_path = 0, []
+    for root in roots_main:
+        if root in functions:
+            depth, path = deepest(root, frozenset())
+            if depth > main_depth:
+                main_depth, main_path = depth, path
+    irq_depth, irq_path = 0, []
+    for function in functions:
+        if is_handler(function):
+            depth, path = deepest(function, frozenset())
+            if depth > irq_depth:
+                irq_depth, irq_path = depth, path
+
+    def print_path(title, depth, path):
+        out.write('%s: %d bytes\n' % (title, depth))
+        for function in path:
+            size, kind = frame(function)
+            out.write('  %6d  %-40s %s\n' % (size, function, kind))
+
+    print_path('deepest call path from %s' % '/'.join(roots_main),
+               main_depth, main_path)
+    print_path('deepest interrupt handler', irq_depth, irq_path)
+    if recursive:
+        out.write('recursion (not followed): %s\n' %
+                  ', '.join(sorted(recursive)))
+    unknown = sorted(f for f in functions
+                     if f not in frames and base_name(f) not in frames and
+                     functions[f]['prologue'] == 0 and
+                     functions[f]['instructions'] > 0 and
+                     (f in memo))
+    return main_depth + irq_depth, unknown
+
+
+def is_handler(function):
+    return function.endswith('_IRQHandler') or function in (
+        'SysTick_Handler', 'HardFault_Handler', 'SVC_Handler',
+        'PendSV_Handler', 'NMI_Handler')
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Flash, RAM, and stack report of a firmware build.')
+    parser.add_argument('-n', type=int, default=20,
+                        help='number of largest symbols listed')
+    parser.add_argument('--objdump', default='arm-none-eabi-objdump')
+    parser.add_argument('--flash-budget', type=int,
+                        help='flash available to the application [bytes]')
+    parser.add_argument('--ram-budget', type=int,
+                        help='RAM available to the application [bytes]')
+    parser.add_argument('--softdevice-stack', type=int,
+                        default=SOFTDEVICE_STACK)
+    parser.add_argument('--roots', default='main',
+                        help='entry points of the main context')
+    parser.add_argument('map')
+    parser.add_argument('elf', nargs='?')
+    parser.add_argument('su_dirs', nargs='*')
+    args = parser.parse_args()
+
+    regions, sections = parse_map(args.map)
+    flash_region = [r for r in regions if r.is_flash()]
+    ram_region = [r for r in regions if not r.is_flash()]
+    flash_budget = args.flash_budget or sum(r.length for r in flash_region)
+    ram_budget = args.ram_budget or sum(r.length for r in ram_region)
+
+    symbols = collections.defaultdict(lambda: [0, 0, ''])
+    modules = collections.defaultdict(lambda: [0, 0])
+    flash_total = ram_total = 0
+    for output, name, address, size, load, output_address, path in sections:
+        if size == 0:
+            continue
+        flash, ram = classify(regions, output, address, load)
+        if not flash and not ram:
+            continue
+        symbol = symbols[symbol_name(name, path)]
+        module = modules[module_name(path)]
+        symbol[2] = module_name(path)
+        if flash:
+            symbol[0] += size
+            module[0] += size
+            flash_total += size
+        if ram:
+            symbol[1] += size
+            module[1] += size
+            ram_total += size
+
+    out = sys.stdout
+    if flash_budget and ram_budget:
+        out.write('flash: %d of %d bytes (%.1f%%)\n' % (
+            flash_total, flash_budget, 100.0*flash_total/flash_budget))
+        out.write('RAM:   %d of %d bytes (%.1f%%), %d bytes left for the '
+                  'stack\n' % (ram_total, ram_budget,
+                               100.0*ram_total/ram_budget,
+                               ram_budget - ram_total))
+    else:
+        out.write('flash: %d bytes\nRAM:   %d bytes (no budget)\n' % (
+            flash_total, ram_total))
+    out.write('\nlargest symbols (flash):\n')
+    for name, (flash, ram, module) in sorted(
+            symbols.items(), key=lambda s: -s[1][0])[:args.n]:
+        if flash > 0:
+            out.write('  %6d  %-40s %s\n' % (flash, name, module))
+    out.write('\nlargest symbols (RAM):\n')
+    for name, (flash, ram, module) in sorted(
+            symbols.items(), key=lambda s: -s[1][1])[:args.n]:
+        if ram > 0:
+            out.write('  %6d  %-40s %s\n' % (ram, name, module))
+    out.write('\nmodules (flash, RAM):\n')
+    for name, (flash, ram) in sorted(modules.items(),
+                                     key=lambda m: -m[1][0]):
+        out.write('  %6d %6d  %s\n' % (flash, ram, name))
+
+    status = 0
+    if flash_budget and ram_budget and (flash_total > flash_budget or
+                                        ram_total > ram_budget):
+        status = 1
+    if args.elf:
+        out.write('\n')
+        functions = parse_disassembly(args.objdump, args.elf)
+        frames = parse_su(args.su_dirs)
+        depth, unknown = stack_report(functions, frames,
+                                      args.roots.split(','), out)
+        worst = depth + args.softdevice_stack
+        out.write('worst-case stack: %d bytes (%d + %d softdevice)' % (
+            worst, depth, args.softdevice_stack))
+        if ram_budget:
+            out.write(', %d bytes left' % (ram_budget - ram_total - worst))
+        out.write('\n')
+        if unknown:
+            out.write('no frame size known (counted as 0): %s\n' %
+                      ', '.join(unknown))
+        if ram_budget and worst > ram_budget - ram_total:
+            status = 1
+    return status
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,118 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Cycle benchmark of the crypto operations of Key20, built with the flags
+// of a build profile (see "make bench-profiles" in nrf51/Makefile) to
+// compare the profiles:
+//
+// - key pair: crypto_scalarmult_curve25519_base (new session key)
+// - shared secret: crypto_scalarmult_curve25519 (key exchange)
+// - session key: crypto_hash_sha512 of the shared secret
+// - unlock: crypto_auth_hmacsha512256_afternm of a 16 byte nonce
+// - nonce: drbg_generate of 16 bytes
+//
+// Runs bare-metal on the Cortex-M0 (cycles; instructions under QEMU with
+// -icount) or on the host (cpucycles_host.c).
+
+#include <stdio.h>
+#include <string.h>
+#include <curve25519-cortexm0.h>
+#include <avrnacl.h>
+#include "cpucycles.h"
+#include "drbg.h"
+
+#ifndef NRUNS
+#define NRUNS 8
+#endif
+
+#ifndef PROFILE
+#define PROFILE "unknown"
+#endif
+
+static uint8_t secret_key[crypto_scalarmult_curve25519_SCALARBYTES];
+static uint8_t public_key[crypto_scalarmult_curve25519_BYTES];
+static uint8_t shared_secret[crypto_scalarmult_curve25519_BYTES];
+static uint8_t hash[crypto_hash_sha512_BYTES];
+static uint8_t nonce[16];
+static uint8_t hmac[crypto_auth_hmacsha512256_BYTES];
+static crypto_auth_hmacsha512256_state hmac_state;
+static struct drbg drbg;
+
+static void report(const char *what, unsigned long long t[NRUNS + 1])
+{
+     unsigned long long d[NRUNS];
+
+     for (unsigned int i = 0; i < NRUNS; i++)
+	  d[i] = t[i + 1] - t[i];
+     // Insertion sort keeps the M0 build free of qsort().
+     for (unsigned int i = 1; i < NRUNS; i++)
+	  for (unsigned int j = i; j > 0 && d[j - 1] > d[j]; j--) {
+	       unsigned long long x = d[j];
+	       d[j] = d[j - 1];
+	       d[j - 1] = x;
+	  }
+     printf("%s %s: %llu %s\n", PROFILE, what, d[NRUNS/2], cpucycles_unit);
+}
+
+int main(void)
+{
+     unsigned long long t[NRUNS + 1];
+     uint8_t seed[DRBG_MIN_ENTROPY + DRBG_MIN_NONCE];
+
+     for (unsigned int i = 0; i < sizeof(secret_key); i++)
+	  secret_key[i] = 7*i + 1;
+     for (unsigned int i = 0; i < sizeof(seed); i++)
+	  seed[i] = 3*i;
+     drbg_instantiate(&drbg, seed, DRBG_MIN_ENTROPY,
+		      &seed[DRBG_MIN_ENTROPY], DRBG_MIN_NONCE, NULL, 0);
+
+     for (unsigned int i = 0; i <= NRUNS; i++) {
+	  t[i] = cpucycles();
+	  crypto_scalarmult_curve25519_base(public_key, secret_key);
+     }
+     report("key pair", t);
+
+     for (unsigned int i = 0; i <= NRUNS; i++) {
+	  t[i] = cpucycles();
+	  crypto_scalarmult_curve25519(shared_secret, secret_key, public_key);
+     }
+     report("shared secret", t);
+
+     for (unsigned int i = 0; i <= NRUNS; i++) {
+	  t[i] = cpucycles();
+	  crypto_hash_sha512(hash, shared_secret, sizeof(shared_secret));
+     }
+     report("session key", t);
+
+     crypto_auth_hmacsha512256_beforenm(&hmac_state, hash);
+     for (unsigned int i = 0; i <= NRUNS; i++) {
+	  t[i] = cpucycles();
+	  crypto_auth_hmacsha512256_afternm(hmac, nonce, sizeof(nonce),
+					    &hmac_state);
+     }
+     report("unlock", t);
+
+     for (unsigned int i = 0; i <= NRUNS; i++) {
+	  t[i] = cpucycles();
+	  if (drbg_generate(&drbg, nonce, sizeof(nonce), NULL, 0) != 0)
+	       return 1;
+     }
+     report("nonce", t);
+
+     return 0;
+}
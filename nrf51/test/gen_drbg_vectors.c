@@ -0,0 +1,178 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Generator of HMAC_DRBG SHA-512 test vectors computed by OpenSSL (3.0 or
+// later), an implementation independent of ../drbg.c and hmac_drbg.py:
+//
+//     gen_drbg_vectors > drbg_vectors_openssl.rsp
+//
+// The groups are those of the [SHA-512] section of the NIST CAVP file
+// HMAC_DRBG.rsp without prediction resistance: 256 bit entropy input,
+// 128 bit nonce, personalization string and additional input of 0 or 256
+// bits, 2048 returned bits. Every vector instantiates the DRBG, reseeds
+// it, generates twice, and records the second output. As in OpenSSL's own
+// CAVS tests, the entropy input and nonce are passed to the HMAC-DRBG by
+// a TEST-RAND parent. Inputs are taken from a deterministic pseudo random
+// sequence, so the output is reproducible.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <openssl/evp.h>
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+
+#define ENTROPY_LEN 32
+#define NONCE_LEN 16
+#define INPUT_LEN 32
+#define RETURNED_LEN 256
+#define COUNTS 15
+
+static uint32_t rnd_state = 0x4b657932;
+
+static void rand_bytes(unsigned char *out, unsigned int length)
+{
+     for (unsigned int i = 0; i < length; i++) {
+	  rnd_state ^= rnd_state << 13;
+	  rnd_state ^= rnd_state >> 17;
+	  rnd_state ^= rnd_state << 5;
+	  out[i] = rnd_state >> 24;
+     }
+}
+
+static void check(int ok, const char *what)
+{
+     if (!ok) {
+	  fprintf(stderr, "gen_drbg_vectors: %s failed\n", what);
+	  exit(1);
+     }
+}
+
+static void print_hex(const char *name, const unsigned char *data,
+		      unsigned int length)
+{
+     printf("%s = ", name);
+     for (unsigned int i = 0; i < length; i++)
+	  printf("%02x", data[i]);
+     printf("\n");
+}
+
+static void set_entropy(EVP_RAND_CTX *parent, unsigned char *entropy,
+			unsigned char *nonce)
+{
+     OSSL_PARAM params[3], *p = params;
+
+     *p++ = OSSL_PARAM_construct_octet_string(OSSL_RAND_PARAM_TEST_ENTROPY,
+					      entropy, ENTROPY_LEN);
+     if (nonce != NULL)
+	  *p++ = OSSL_PARAM_construct_octet_string(OSSL_RAND_PARAM_TEST_NONCE,
+						   nonce, NONCE_LEN);
+     *p = OSSL_PARAM_construct_end();
+     check(EVP_RAND_CTX_set_params(parent, params), "setting the entropy");
+}
+
+static void vector(unsigned int count, unsigned int pers_len,
+		   unsigned int add_len)
+{
+     unsigned int strength = 256;
+     unsigned char entropy[ENTROPY_LEN], nonce[NONCE_LEN];
+     unsigned char pers[INPUT_LEN], entropy_reseed[ENTROPY_LEN];
+     unsigned char add_reseed[INPUT_LEN], add1[INPUT_LEN], add2[INPUT_LEN];
+     unsigned char out[RETURNED_LEN];
+     OSSL_PARAM params[3];
+     EVP_RAND *rand;
+     EVP_RAND_CTX *parent, *drbg;
+
+     rand_bytes(entropy, ENTROPY_LEN);
+     rand_bytes(nonce, NONCE_LEN);
+     rand_bytes(pers, pers_len);
+     rand_bytes(entropy_reseed, ENTROPY_LEN);
+     rand_bytes(add_reseed, add_len);
+     rand_bytes(add1, add_len);
+     rand_bytes(add2, add_len);
+
+     rand = EVP_RAND_fetch(NULL, "TEST-RAND", NULL);
+     check(rand != NULL, "fetching TEST-RAND");
+     parent = EVP_RAND_CTX_new(rand, NULL);
+     EVP_RAND_free(rand);
+     params[0] = OSSL_PARAM_construct_uint(OSSL_RAND_PARAM_STRENGTH,
+					   &strength);
+     params[1] = OSSL_PARAM_construct_end();
+     check(parent != NULL && EVP_RAND_CTX_set_params(parent, params),
+	   "creating the parent");
+
+     rand = EVP_RAND_fetch(NULL, "HMAC-DRBG", NULL);
+     check(rand != NULL, "fetching HMAC-DRBG");
+     drbg = EVP_RAND_CTX_new(rand, parent);
+     EVP_RAND_free(rand);
+     params[0] = OSSL_PARAM_construct_utf8_string(OSSL_DRBG_PARAM_MAC,
+						  "HMAC", 0);
+     params[1] = OSSL_PARAM_construct_utf8_string(OSSL_DRBG_PARAM_DIGEST,
+						  "SHA512", 0);
+     params[2] = OSSL_PARAM_construct_end();
+     check(drbg != NULL && EVP_RAND_CTX_set_params(drbg, params),
+	   "creating the DRBG");
+
+     set_entropy(parent, entropy, nonce);
+     check(EVP_RAND_instantiate(parent, strength, 0, NULL, 0, NULL) &&
+	   EVP_RAND_instantiate(drbg, strength, 0, pers, pers_len, NULL),
+	   "instantiate");
+     set_entropy(parent, entropy_reseed, NULL);
+     check(EVP_RAND_reseed(drbg, 0, NULL, 0, add_reseed, add_len),
+	   "reseed");
+     check(EVP_RAND_generate(drbg, out, RETURNED_LEN, strength, 0,
+			     add1, add_len) &&
+	   EVP_RAND_generate(drbg, out, RETURNED_LEN, strength, 0,
+			     add2, add_len),
+	   "generate");
+     EVP_RAND_CTX_free(drbg);
+     EVP_RAND_CTX_free(parent);
+
+     printf("COUNT = %u\n", count);
+     print_hex("EntropyInput", entropy, ENTROPY_LEN);
+     print_hex("Nonce", nonce, NONCE_LEN);
+     print_hex("PersonalizationString", pers, pers_len);
+     print_hex("EntropyInputReseed", entropy_reseed, ENTROPY_LEN);
+     print_hex("AdditionalInputReseed", add_reseed, add_len);
+     print_hex("AdditionalInput", add1, add_len);
+     print_hex("AdditionalInput", add2, add_len);
+     print_hex("ReturnedBits", out, RETURNED_LEN);
+     printf("\n");
+}
+
+int main(void)
+{
+     printf("# HMAC_DRBG SHA-512 test vectors for ../drbg.c, computed by "
+	    "OpenSSL's\n# HMAC-DRBG (gen_drbg_vectors.c, "
+	    "CAVP response file format).\n\n");
+     printf("[SHA-512]\n[PredictionResistance = False]\n");
+     for (unsigned int pers_len = 0; pers_len <= INPUT_LEN;
+	  pers_len += INPUT_LEN) {
+	  for (unsigned int add_len = 0; add_len <= INPUT_LEN;
+	       add_len += INPUT_LEN) {
+	       printf("[EntropyInputLen = %u]\n[NonceLen = %u]\n"
+		      "[PersonalizationStringLen = %u]\n"
+		      "[AdditionalInputLen = %u]\n[ReturnedBitsLen = %u]\n\n",
+		      8*ENTROPY_LEN, 8*NONCE_LEN, 8*pers_len, 8*add_len,
+		      8*RETURNED_LEN);
+	       for (unsigned int count = 0; count < COUNTS; count++)
+		    vector(count, pers_len, add_len);
+	  }
+     }
+     return 0;
+}
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+#
+# This file is part of Key20.
+#
+# Copyright 2016 Frank Duerr
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Reference implementation of HMAC_DRBG with SHA-512 (NIST SP 800-90A,
+no prediction resistance), written from the specification with Python's
+hmac module, and generator of test vectors for ../drbg.c in the format of
+the NIST CAVP response files (HMAC_DRBG.rsp).
+
+    hmac_drbg.py [seed] > drbg_vectors.rsp
+
+Every vector instantiates the DRBG, reseeds it, generates ReturnedBitsLen
+bits twice (the first output is discarded), and records the second output,
+like the CAVP tests without prediction resistance. Inputs are taken from a
+deterministic pseudo random sequence, so the output is reproducible.
+"""
+
+import hashlib
+import hmac
+import random
+import sys
+
+OUTLEN = 64
+
+
+class HmacDrbg:
+    def __init__(self, entropy, nonce, personalization=b''):
+        self.k = bytes(OUTLEN)
+        self.v = b'\x01' * OUTLEN
+        self._update(entropy + nonce + personalization)
+        self.reseed_counter = 1
+
+    def _hmac(self, data):
+        return hmac.new(self.k, data, hashlib.sha512).digest()
+
+    def _update(self, provided=b''):
+        self.k = self._hmac(self.v + b'\x00' + provided)
+        self.v = self._hmac(self.v)
+        if provided:
+            self.k = self._hmac(self.v + b'\x01' + provided)
+            self.v = self._hmac(self.v)
+
+    def reseed(self, entropy, additional=b''):
+        self._update(entropy + additional)
+        self.reseed_counter = 1
+
+    def generate(self, length, additional=b''):
+        if additional:
+            self._update(additional)
+        out = b''
+        while len(out) < length:
+            self.v = self._hmac(self.v)
+            out += self.v
+        self._update(additional)
+        self.reseed_counter += 1
+        return out[:length]
+
+
+def main():
+    rng = random.Random(int(sys.argv[1]) if len(sys.argv) > 1 else 20)
+
+    def rand_bytes(n):
+        return bytes(rng.getrandbits(8) for _ in range(n))
+
+    print('# HMAC_DRBG SHA-512 test vectors for ../drbg.c, generated by')
+    print('# hmac_drbg.py (CAVP response file format).')
+    print()
+    print('[SHA-512]')
+    print('[PredictionResistance = False]')
+    # (entropy, nonce, personalization, additional input, returned bytes)
+    for lengths in [(32, 16, 0, 0, 256), (32, 16, 32, 0, 256),
+                    (32, 16, 0, 32, 256), (48, 24, 32, 32, 256),
+                    (32, 16, 0, 0, 16), (32, 16, 0, 0, 32),
+                    (32, 16, 0, 0, 65)]:
+        entropy_len, nonce_len, pers_len, add_len, ret_len = lengths
+        print('[EntropyInputLen = %d]' % (8*entropy_len))
+        print('[NonceLen = %d]' % (8*nonce_len))
+        print('[PersonalizationStringLen = %d]' % (8*pers_len))
+        print('[AdditionalInputLen = %d]' % (8*add_len))
+        print('[ReturnedBitsLen = %d]' % (8*ret_len))
+        print()
+        for count in range(3):
+            entropy = rand_bytes(entropy_len)
+            nonce = rand_bytes(nonce_len)
+            pers = rand_bytes(pers_len)
+            entropy_reseed = rand_bytes(entropy_len)
+            add_reseed = rand_bytes(add_len)
+            add1 = rand_bytes(add_len)
+            add2 = rand_bytes(add_len)
+            drbg = HmacDrbg(entropy, nonce, pers)
+            drbg.reseed(entropy_reseed, add_reseed)
+            drbg.generate(ret_len, add1)
+            returned = drbg.generate(ret_len, add2)
+            print('COUNT = %d' % count)
+            print('EntropyInput = %s' % entropy.hex())
+            print('Nonce = %s' % nonce.hex())
+            print('PersonalizationString = %s' % pers.hex())
+            print('EntropyInputReseed = %s' % entropy_reseed.hex())
+            print('AdditionalInputReseed = %s' % add_reseed.hex())
+            print('AdditionalInput = %s' % add1.hex())
+            print('AdditionalInput = %s' % add2.hex())
+            print('ReturnedBits = %s' % returned.hex())
+            print()
+
+
+if __name__ == '__main__':
+    main()
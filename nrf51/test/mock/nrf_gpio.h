@@ -0,0 +1,33 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Mock of nrf_gpio.h of the nRF51 SDK for host tests. The functions are 
+// implemented by the test.
+
+#ifndef NRF_GPIO_H__
+#define NRF_GPIO_H__
+
+#include <stdint.h>
+
+void nrf_gpio_cfg_output(uint32_t pin_number);
+void nrf_gpio_pin_set(uint32_t pin_number);
+void nrf_gpio_pin_clear(uint32_t pin_number);
+void nrf_gpio_pins_set(uint32_t pin_mask);
+void nrf_gpio_pins_clear(uint32_t pin_mask);
+
+#endif
@@ -0,0 +1,278 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host tests of the application event rings (app_event_rings.c):
+//
+// 1. Priority order and batch draining (single thread).
+// 2. Payload pool: exhaustion, ownership hand-back, data integrity 
+//    (single thread).
+// 3. Stress test: one producer thread per event source and a consumer 
+//    thread draining all rings in batches. Each producer sends a sequence 
+//    of events; the consumer checks that the events of every source 
+//    arrive completely, exactly once, and in FIFO order. The BLE producer
+//    sends events with payload, whose data is checked and released by
+//    the consumer.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "app_event_rings.h"
+
+// Number of events sent by each producer in the stress test.
+#define STRESS_EVENTS 1000000
+
+// Event types encode the source (upper 3 bits) and the lower 5 bits of the
+// sequence number.
+#define EVENT_TYPE(source, seq) ((uint8_t) (((source) << 5) | ((seq) & 31)))
+#define EVENT_SOURCE(type) ((type) >> 5)
+#define EVENT_SEQ(type) ((type) & 31)
+
+static struct app_event_rings rings;
+static volatile int failed = 0;
+
+static void fail(const char *msg, unsigned long a, unsigned long b)
+{
+     printf("FAIL %s (%lu, %lu)\n", msg, a, b);
+     failed = 1;
+}
+
+static void test_priorities()
+{
+     struct app_event event;
+     struct app_event events[4];
+     unsigned int i, n, source;
+
+     app_event_rings_init(&rings);
+
+     if (app_event_rings_get(&rings, &event) != -1)
+	  fail("get from empty rings", 0, 0);
+
+     // Fill all rings in reverse priority order.
+     for (source = APP_EVENT_SOURCE_COUNT; source-- > 0; ) {
+	  for (i = 0; i < APP_EVENT_RING_SIZE; i++) {
+	       event.event_type = EVENT_TYPE(source, i);
+	       if (app_event_rings_add(&rings, source, event) != 0)
+		    fail("add to non-full ring", source, i);
+	  }
+	  event.event_type = 0;
+	  if (app_event_rings_add(&rings, source, event) != -1)
+	       fail("add to full ring", source, 0);
+     }
+
+     // Drain in batches: all events of the first source, then of the
+     // second, etc.
+     source = 0;
+     i = 0;
+     while ((n = app_event_rings_drain(&rings, events, 4)) > 0) {
+	  for (unsigned int j = 0; j < n; j++) {
+	       if (events[j].event_type != EVENT_TYPE(source, i))
+		    fail("priority order", source, i);
+	       if (++i == APP_EVENT_RING_SIZE) {
+		    i = 0;
+		    source++;
+	       }
+	  }
+     }
+     if (source != APP_EVENT_SOURCE_COUNT)
+	  fail("drained events", source, i);
+
+     // A higher priority event overtakes pending events of lower priority.
+     event.event_type = EVENT_TYPE(APP_EVENT_SOURCE_APP, 0);
+     app_event_rings_add(&rings, APP_EVENT_SOURCE_APP, event);
+     event.event_type = EVENT_TYPE(APP_EVENT_SOURCE_BLE, 0);
+     app_event_rings_add(&rings, APP_EVENT_SOURCE_BLE, event);
+     app_event_rings_get(&rings, &event);
+     if (EVENT_SOURCE(event.event_type) != APP_EVENT_SOURCE_BLE)
+	  fail("overtaking", event.event_type, 0);
+     app_event_rings_get(&rings, &event);
+     if (EVENT_SOURCE(event.event_type) != APP_EVENT_SOURCE_APP)
+	  fail("overtaking", event.event_type, 1);
+}
+
+static void test_payloads()
+{
+     struct app_event event, event2;
+     uint8_t data[APP_EVENT_PAYLOAD_SIZE];
+     const struct app_event_payload *payload;
+     unsigned int i, round;
+
+     app_event_rings_init(&rings);
+
+     // Events without payload.
+     event.event_type = 1;
+     event.payload = 42;
+     app_event_rings_add(&rings, APP_EVENT_SOURCE_TIMER, event);
+     app_event_rings_get(&rings, &event);
+     if (app_event_rings_payload(&rings, event) != NULL)
+	  fail("payload of event without payload", event.payload, 0);
+     app_event_rings_release(&rings, event);
+
+     if (app_event_rings_add_payload(&rings, APP_EVENT_SOURCE_BLE, event,
+				     data, APP_EVENT_PAYLOAD_SIZE + 1) != -1)
+	  fail("payload too long", 0, 0);
+
+     // Several rounds through all slots (and ring positions).
+     for (round = 0; round < 3; round++) {
+	  // Use up all slots (slots are returned before the ring is full).
+	  unsigned int n = APP_EVENT_PAYLOAD_SLOTS < APP_EVENT_RING_SIZE ? 
+	       APP_EVENT_PAYLOAD_SLOTS : APP_EVENT_RING_SIZE;
+	  for (i = 0; i < n; i++) {
+	       memset(data, round*16 + i, sizeof(data));
+	       event.event_type = i;
+	       if (app_event_rings_add_payload(&rings, APP_EVENT_SOURCE_BLE, 
+					       event, data, i + 1) != 0)
+		    fail("add payload", round, i);
+	  }
+	  if (app_event_rings_add_payload(&rings, APP_EVENT_SOURCE_BLE, 
+					  event, data, 1) != -1)
+	       fail("add payload to exhausted pool or full ring", round, 0);
+
+	  for (i = 0; i < n; i++) {
+	       if (app_event_rings_get(&rings, &event) != 0 || 
+		   event.event_type != i)
+		    fail("get payload event", round, i);
+	       payload = app_event_rings_payload(&rings, event);
+	       if (payload == NULL || payload->length != i + 1 ||
+		   payload->data[0] != round*16 + i || 
+		   payload->data[i] != round*16 + i)
+		    fail("payload data", round, i);
+	       app_event_rings_release(&rings, event);
+	  }
+     }
+
+     // Payloads stay valid while newer events with payload are added.
+     memset(data, 0xaa, sizeof(data));
+     app_event_rings_add_payload(&rings, APP_EVENT_SOURCE_BLE, event, data, 
+				 sizeof(data));
+     app_event_rings_get(&rings, &event);
+     memset(data, 0x55, sizeof(data));
+     event2.event_type = 2;
+     app_event_rings_add_payload(&rings, APP_EVENT_SOURCE_BLE, event2, data,
+				 sizeof(data));
+     payload = app_event_rings_payload(&rings, event);
+     if (payload->data[0] != 0xaa || payload->data[sizeof(data)-1] != 0xaa)
+	  fail("payload overwritten", 0, 0);
+     app_event_rings_release(&rings, event);
+     app_event_rings_get(&rings, &event2);
+     payload = app_event_rings_payload(&rings, event2);
+     if (payload->data[0] != 0x55)
+	  fail("second payload", 0, 0);
+     app_event_rings_release(&rings, event2);
+}
+
+static void *producer(void *arg)
+{
+     unsigned int source = (unsigned int) (uintptr_t) arg;
+     struct app_event event;
+     unsigned long seq;
+     uint8_t data[APP_EVENT_PAYLOAD_SIZE];
+
+     for (seq = 0; seq < STRESS_EVENTS; seq++) {
+	  event.event_type = EVENT_TYPE(source, seq);
+	  // Ring full (or no free payload slot): let the consumer run 
+	  // (the test host might have a single core only).
+	  if (source == APP_EVENT_SOURCE_BLE) {
+	       memset(data, (uint8_t) seq, sizeof(data));
+	       while (app_event_rings_add_payload(&rings, source, event, data,
+						  1 + seq % sizeof(data)) != 0)
+		    sched_yield();
+	  } else {
+	       while (app_event_rings_add(&rings, source, event) != 0)
+		    sched_yield();
+	  }
+     }
+
+     return NULL;
+}
+
+static void *consumer(void *arg)
+{
+     unsigned long received[APP_EVENT_SOURCE_COUNT] = {0};
+     unsigned long total = 0;
+     struct app_event events[5];
+     unsigned int i, n, source;
+
+     while (total < STRESS_EVENTS*APP_EVENT_SOURCE_COUNT) {
+	  n = app_event_rings_drain(&rings, events, 5);
+	  if (n == 0)
+	       sched_yield();
+	  for (i = 0; i < n; i++) {
+	       source = EVENT_SOURCE(events[i].event_type);
+	       if (source >= APP_EVENT_SOURCE_COUNT) {
+		    fail("bad source", source, total);
+		    // The producers might wait forever.
+		    exit(1);
+	       }
+	       if (EVENT_SEQ(events[i].event_type) != 
+		   (received[source] & 31)) {
+		    fail("lost or reordered event", source, received[source]);
+		    exit(1);
+	       }
+	       if (source == APP_EVENT_SOURCE_BLE) {
+		    const struct app_event_payload *payload = 
+			 app_event_rings_payload(&rings, events[i]);
+		    unsigned long seq = received[source];
+		    if (payload == NULL || 
+			payload->length != 1 + seq % sizeof(payload->data) ||
+			payload->data[0] != (uint8_t) seq ||
+			payload->data[payload->length-1] != (uint8_t) seq) {
+			 fail("payload data", source, seq);
+			 exit(1);
+		    }
+	       }
+	       app_event_rings_release(&rings, events[i]);
+	       received[source]++;
+	       total++;
+	  }
+     }
+
+     struct app_event event;
+     if (app_event_rings_get(&rings, &event) != -1)
+	  fail("extra event", event.event_type, 0);
+
+     return NULL;
+}
+
+static void test_stress()
+{
+     pthread_t producers[APP_EVENT_SOURCE_COUNT];
+     pthread_t consumer_thread;
+     unsigned int source;
+
+     app_event_rings_init(&rings);
+
+     pthread_create(&consumer_thread, NULL, consumer, NULL);
+     for (source = 0; source < APP_EVENT_SOURCE_COUNT; source++)
+	  pthread_create(&producers[source], NULL, producer, 
+			 (void *) (uintptr_t) source);
+
+     for (source = 0; source < APP_EVENT_SOURCE_COUNT; source++)
+	  pthread_join(producers[source], NULL);
+     pthread_join(consumer_thread, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+     test_priorities();
+     test_payloads();
+     test_stress();
+
+     return failed;
+}
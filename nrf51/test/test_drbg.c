@@ -0,0 +1,264 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host test of the HMAC_DRBG (drbg.c).
+//
+//     test_drbg [-b] [file.rsp ...]
+//
+// 1. Test vectors in the format of the NIST CAVP response files
+//    (default: drbg_vectors.rsp, generated by hmac_drbg.py, and
+//    drbg_vectors_openssl.rsp, computed by OpenSSL's HMAC-DRBG with
+//    gen_drbg_vectors.c). The official HMAC_DRBG.rsp (without prediction
+//    resistance) can be given instead; only its [SHA-512] sections are
+//    run. Every vector instantiates the
+//    DRBG, reseeds it (if EntropyInputReseed is given), generates twice,
+//    and compares the second output.
+// 2. The DRBG refuses to generate once the reseed interval is reached,
+//    and works again after reseeding.
+//
+// With -b, the time for generating nonces and keys is measured.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "drbg.h"
+
+#define MAX_FIELD 512
+#define MAX_LINE (2*MAX_FIELD + 64)
+#define MAX_RETURNED 1024
+
+#define BENCH_REQUESTS 20000
+
+static void fail(const char *what, unsigned long a, unsigned long b)
+{
+     printf("FAIL %s (%lu, %lu)\n", what, a, b);
+     exit(1);
+}
+
+struct field {
+     uint8_t data[MAX_FIELD];
+     unsigned int length;
+     int is_set;
+};
+
+struct vector {
+     unsigned int count;
+     struct field entropy;
+     struct field nonce;
+     struct field personalization;
+     struct field entropy_reseed;
+     struct field additional_reseed;
+     struct field additional[2];
+     unsigned int additional_count;
+     struct field returned;
+};
+
+static void parse_hex(struct field *field, const char *hex, unsigned int line)
+{
+     field->length = 0;
+     field->is_set = 1;
+     while (hex[0] != '\0' && hex[1] != '\0') {
+	  unsigned int byte;
+	  if (field->length == MAX_FIELD || sscanf(hex, "%2x", &byte) != 1)
+	       fail("invalid hex string in line", line, field->length);
+	  field->data[field->length++] = byte;
+	  hex += 2;
+     }
+}
+
+static void run_vector(const struct vector *v, unsigned int line)
+{
+     struct drbg drbg;
+     uint8_t out[MAX_RETURNED];
+     unsigned int length = v->returned.length;
+
+     if (!v->entropy.is_set || !v->nonce.is_set || !v->returned.is_set ||
+	 v->additional_count != 2 || length > MAX_RETURNED)
+	  fail("incomplete vector before line", line, v->count);
+
+     drbg_instantiate(&drbg, v->entropy.data, v->entropy.length,
+		      v->nonce.data, v->nonce.length,
+		      v->personalization.data, v->personalization.length);
+     if (v->entropy_reseed.is_set)
+	  drbg_reseed(&drbg, v->entropy_reseed.data, v->entropy_reseed.length,
+		      v->additional_reseed.data,
+		      v->additional_reseed.length);
+     if (drbg_generate(&drbg, out, length, v->additional[0].data,
+		       v->additional[0].length) != 0 ||
+	 drbg_generate(&drbg, out, length, v->additional[1].data,
+		       v->additional[1].length) != 0)
+	  fail("generate failed for vector", v->count, length);
+     if (memcmp(out, v->returned.data, length) != 0)
+	  fail("returned bits of vector before line", line, v->count);
+     if (drbg_requests(&drbg) != 2)
+	  fail("request count", drbg_requests(&drbg), 2);
+}
+
+static void test_vectors(const char *path)
+{
+     FILE *f = fopen(path, "r");
+     char line[MAX_LINE];
+     unsigned int line_no = 0;
+     unsigned int vectors = 0;
+     int is_sha512 = 0;
+     int is_pending = 0;
+     struct vector v;
+
+     if (f == NULL) {
+	  perror(path);
+	  exit(1);
+     }
+
+     memset(&v, 0, sizeof(v));
+     while (fgets(line, sizeof(line), f) != NULL) {
+	  char name[64];
+	  char value[2*MAX_FIELD + 1];
+	  line_no++;
+	  line[strcspn(line, "\r\n")] = '\0';
+
+	  if (line[0] == '[') {
+	       // Section header: the hash function, or a length.
+	       if (strncmp(line, "[SHA-", 5) == 0)
+		    is_sha512 = strcmp(line, "[SHA-512]") == 0;
+	       if (strcmp(line, "[PredictionResistance = True]") == 0)
+		    fail("prediction resistance not supported, line",
+			 line_no, 0);
+	       continue;
+	  }
+	  if (!is_sha512)
+	       continue;
+
+	  value[0] = '\0';
+	  if (sscanf(line, "%63s = %1024s", name, value) < 1)
+	       continue;
+	  if (strcmp(name, "COUNT") == 0) {
+	       if (is_pending) {
+		    run_vector(&v, line_no);
+		    vectors++;
+	       }
+	       memset(&v, 0, sizeof(v));
+	       v.count = atoi(value);
+	       is_pending = 1;
+	  } else if (strcmp(name, "EntropyInput") == 0) {
+	       parse_hex(&v.entropy, value, line_no);
+	  } else if (strcmp(name, "Nonce") == 0) {
+	       parse_hex(&v.nonce, value, line_no);
+	  } else if (strcmp(name, "PersonalizationString") == 0) {
+	       parse_hex(&v.personalization, value, line_no);
+	  } else if (strcmp(name, "EntropyInputReseed") == 0) {
+	       parse_hex(&v.entropy_reseed, value, line_no);
+	  } else if (strcmp(name, "AdditionalInputReseed") == 0) {
+	       parse_hex(&v.additional_reseed, value, line_no);
+	  } else if (strcmp(name, "AdditionalInput") == 0) {
+	       if (v.additional_count == 2)
+		    fail("too many additional inputs, line", line_no, 0);
+	       parse_hex(&v.additional[v.additional_count++], value, line_no);
+	  } else if (strcmp(name, "ReturnedBits") == 0) {
+	       parse_hex(&v.returned, value, line_no);
+	       run_vector(&v, line_no);
+	       vectors++;
+	       is_pending = 0;
+	  }
+     }
+     fclose(f);
+
+     if (vectors == 0)
+	  fail("no SHA-512 vectors", 0, 0);
+     printf("  %u vectors of %s passed\n", vectors, path);
+}
+
+static void test_reseed_interval(void)
+{
+     struct drbg drbg;
+     uint8_t seed[DRBG_MIN_ENTROPY + DRBG_MIN_NONCE];
+     uint8_t out[16];
+
+     for (unsigned int i = 0; i < sizeof(seed); i++)
+	  seed[i] = i;
+     drbg_instantiate(&drbg, seed, DRBG_MIN_ENTROPY,
+		      &seed[DRBG_MIN_ENTROPY], DRBG_MIN_NONCE, NULL, 0);
+
+     // Skip most requests by setting the counter.
+     drbg.reseed_counter = DRBG_RESEED_INTERVAL - 1;
+     if (drbg_generate(&drbg, out, sizeof(out), NULL, 0) != 0 ||
+	 drbg_generate(&drbg, out, sizeof(out), NULL, 0) != 0)
+	  fail("generate before reseed interval", drbg_requests(&drbg), 0);
+     if (drbg_generate(&drbg, out, sizeof(out), NULL, 0) != -1)
+	  fail("generate after reseed interval", drbg_requests(&drbg), 0);
+     if (drbg_generate(&drbg, out, DRBG_MAX_REQUEST + 1, NULL, 0) != -1)
+	  fail("too long request", DRBG_MAX_REQUEST + 1, 0);
+
+     drbg_reseed(&drbg, seed, DRBG_MIN_ENTROPY, NULL, 0);
+     if (drbg_requests(&drbg) != 0 ||
+	 drbg_generate(&drbg, out, sizeof(out), NULL, 0) != 0 ||
+	 drbg_requests(&drbg) != 1)
+	  fail("generate after reseed", drbg_requests(&drbg), 1);
+}
+
+static void bench(unsigned int length)
+{
+     struct drbg drbg;
+     uint8_t seed[DRBG_MIN_ENTROPY + DRBG_MIN_NONCE] = {0};
+     uint8_t out[64];
+     struct timespec start, end;
+
+     drbg_instantiate(&drbg, seed, DRBG_MIN_ENTROPY,
+		      &seed[DRBG_MIN_ENTROPY], DRBG_MIN_NONCE, NULL, 0);
+     clock_gettime(CLOCK_MONOTONIC, &start);
+     for (unsigned int i = 0; i < BENCH_REQUESTS; i++)
+	  if (drbg_generate(&drbg, out, length, NULL, 0) != 0)
+	       fail("generate", i, length);
+     clock_gettime(CLOCK_MONOTONIC, &end);
+
+     double t = (end.tv_sec - start.tv_sec) +
+	  (end.tv_nsec - start.tv_nsec)/1e9;
+     printf("  %2u byte requests: %.2f us/request, %.0f bytes/s\n", length,
+	    1e6*t/BENCH_REQUESTS, length*BENCH_REQUESTS/t);
+}
+
+int main(int argc, char *argv[])
+{
+     const char *default_paths[] = {
+	  "drbg_vectors.rsp", "drbg_vectors_openssl.rsp", NULL
+     };
+     const char *paths[argc + 1];
+     unsigned int path_count = 0;
+     int is_bench = 0;
+
+     for (int i = 1; i < argc; i++) {
+	  if (strcmp(argv[i], "-b") == 0)
+	       is_bench = 1;
+	  else
+	       paths[path_count++] = argv[i];
+     }
+     paths[path_count] = NULL;
+
+     for (const char **path = path_count > 0 ? paths : default_paths;
+	  *path != NULL; path++)
+	  test_vectors(*path);
+     test_reseed_interval();
+
+     if (is_bench) {
+	  // Nonce and secret key of the key exchange.
+	  bench(16);
+	  bench(32);
+     }
+
+     return 0;
+}
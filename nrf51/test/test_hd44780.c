@@ -0,0 +1,578 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host test of the LCD driver (../../hd44780nrf51) against a model of the
+// HD44780 connected in 4-bit mode.
+//
+// The GPIO and delay functions of the SDK are mocked (see mock/). Time is
+// virtual: delays advance it, and so does every write of a GPIO register
+// (one CPU cycle at 16 MHz, a lower bound), which the test counts. The model latches nibbles on the falling
+// edge of E, executes instructions on its DDRAM, and checks the timing of
+// the data sheet:
+//
+// - E pulse width >= 450 ns, E cycle time >= 1 us, RS set up before the
+//   rising edge of E, RS and data stable while E is high,
+// - no instruction before the previous one has been executed (37 us,
+//   1.52 ms for clearing the display; 40 ms after power-on and the waits
+//   of the initialization sequence).
+//
+// 1. Initialization.
+// 2. The screens shown by Key20 during a key exchange and an unlock, with
+//    the blocking functions (clear display, print lines, as before) and
+//    with asynchronous updates stepped by a simulated timer (5 ticks of
+//    the app timer). Compares the time the CPU drives the bus per update.
+// 3. The text is changed while an asynchronous update is in progress.
+// 4. Register writes of updating all characters, blocking and
+//    asynchronously, which must not need more writes.
+// 5. Register writes per nibble of the driver as before precomputing the
+//    masks of the pins (one write per data pin, two for E) and with the
+//    masks (OUTCLR, OUTSET with E, OUTCLR of E).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <nrf_gpio.h>
+#include <nrf_delay.h>
+#include <hd44780nrf51.h>
+
+// Time of one GPIO write [ns].
+#define GPIO_WRITE_TIME 63
+
+// Interval of asynchronous steps: 5 ticks of the app timer (32768 Hz)
+// [ns].
+#define STEP_INTERVAL (5*1000000000ull/32768)
+
+// Timing of the HD44780 [ns].
+#define E_PULSE_WIDTH 450
+#define E_CYCLE_TIME 1000
+#define EXEC_TIME 37000
+#define EXEC_TIME_LONG 1520000
+#define POWER_ON_TIME 40000000
+#define INIT_WAIT_1 4100000
+#define INIT_WAIT_2 100000
+
+#define PIN_RS 1
+#define PIN_E 2
+#define PIN_DB4 3
+#define PIN_DB5 4
+#define PIN_DB6 5
+#define PIN_DB7 6
+
+#define COLUMNS 16
+#define LINE_OFFSET HD44780_2nd_LINE_OFFSET
+
+// The masks of the pins are calculated by hd44780_init(); see test_masks()
+// for HD44780_PINS().
+static struct hd44780 lcd = {
+     .pin_rs = PIN_RS,
+     .pin_e = PIN_E,
+     .pin_db4 = PIN_DB4,
+     .pin_db5 = PIN_DB5,
+     .pin_db6 = PIN_DB6,
+     .pin_db7 = PIN_DB7,
+     .rows = 2,
+     .columns = COLUMNS
+};
+
+// Virtual time [ns], and counters of the bus.
+static unsigned long long now;
+static unsigned long gpio_writes;
+static unsigned long instructions;
+
+static uint32_t gpio_out;
+
+// Model of the HD44780.
+static struct {
+     bool is_4bit;
+     bool has_high_nibble;
+     uint8_t high_nibble;
+     unsigned int init_strobes;
+     unsigned long long busy_until;
+     unsigned long long e_rise;
+     bool has_e_risen;
+     uint8_t ddram[128];
+     uint8_t addr;
+     bool is_display_on;
+} model;
+
+static void fail(const char *what, unsigned long a, unsigned long b)
+{
+     printf("FAIL %s (%lu, %lu)\n", what, a, b);
+     exit(1);
+}
+
+static void model_power_on(void)
+{
+     memset(&model, 0, sizeof(model));
+     memset(model.ddram, ' ', sizeof(model.ddram));
+     now = 0;
+     gpio_out = 0;
+     model.busy_until = POWER_ON_TIME;
+}
+
+static void model_increment_addr(void)
+{
+     // Two-line mode: 0x00..0x27 and 0x40..0x67.
+     model.addr++;
+     if (model.addr == 0x28)
+	  model.addr = 0x40;
+     else if (model.addr == 0x68)
+	  model.addr = 0x00;
+}
+
+static void model_execute(bool rs, uint8_t byte)
+{
+     unsigned long long exec_time = EXEC_TIME;
+
+     instructions++;
+     if (rs) {
+	  model.ddram[model.addr] = byte;
+	  model_increment_addr();
+     } else if (byte & 0x80) {
+	  model.addr = byte & 0x7f;
+     } else if (byte & 0x40) {
+	  fail("CGRAM address not supported", byte, 0);
+     } else if (byte & 0x20) {
+	  // Function set.
+	  model.is_4bit = (byte & 0x10) == 0;
+	  if (model.init_strobes == 1)
+	       exec_time = INIT_WAIT_1;
+	  else if (model.init_strobes == 2)
+	       exec_time = INIT_WAIT_2;
+     } else if (byte & 0x10) {
+	  fail("cursor or display shift not supported", byte, 0);
+     } else if (byte & 0x08) {
+	  model.is_display_on = (byte & 0x04) != 0;
+     } else if (byte & 0x04) {
+	  // Entry mode: the model only increments without shift.
+	  if (byte != 0x06)
+	       fail("entry mode not supported", byte, 0);
+     } else if (byte & 0x02) {
+	  model.addr = 0;
+	  exec_time = EXEC_TIME_LONG;
+     } else if (byte & 0x01) {
+	  memset(model.ddram, ' ', sizeof(model.ddram));
+	  model.addr = 0;
+	  exec_time = EXEC_TIME_LONG;
+     }
+     model.busy_until = now + exec_time;
+}
+
+static uint8_t data_nibble(void)
+{
+     return ((gpio_out >> PIN_DB4) & 1) | (((gpio_out >> PIN_DB5) & 1) << 1) |
+	  (((gpio_out >> PIN_DB6) & 1) << 2) | (((gpio_out >> PIN_DB7) & 1) << 3);
+}
+
+static void model_e_rise(void)
+{
+     if (now < model.busy_until)
+	  fail("instruction while busy [ns]", now, model.busy_until);
+     if (model.has_e_risen && now - model.e_rise < E_CYCLE_TIME)
+	  fail("E cycle time [ns]", now - model.e_rise, E_CYCLE_TIME);
+     model.e_rise = now;
+     model.has_e_risen = true;
+}
+
+static void model_e_fall(void)
+{
+     bool rs = (gpio_out >> PIN_RS) & 1;
+     uint8_t nibble = data_nibble();
+
+     if (now - model.e_rise < E_PULSE_WIDTH)
+	  fail("E pulse width [ns]", now - model.e_rise, E_PULSE_WIDTH);
+
+     if (!model.is_4bit) {
+	  // 8-bit mode after power-on; DB0..3 are not connected (low).
+	  model.init_strobes++;
+	  model_execute(rs, nibble << 4);
+     } else if (!model.has_high_nibble) {
+	  model.high_nibble = nibble;
+	  model.has_high_nibble = true;
+     } else {
+	  model.has_high_nibble = false;
+	  model_execute(rs, (model.high_nibble << 4) | nibble);
+     }
+}
+
+/**
+ * One write of the OUTSET or OUTCLR register: the pins of the mask are set
+ * to the level at the same time.
+ */
+static void gpio_write(uint32_t mask, bool level)
+{
+     uint32_t old_out = gpio_out;
+     uint32_t e = 1ul << PIN_E;
+
+     now += GPIO_WRITE_TIME;
+     gpio_writes++;
+     if (level)
+	  gpio_out |= mask;
+     else
+	  gpio_out &= ~mask;
+
+     uint32_t changed = (old_out ^ gpio_out) & ~e;
+     if ((old_out & e) && changed != 0)
+	  fail("RS or data changed while E is high, pins", changed, 0);
+     if (!(old_out & e) && (gpio_out & e) && (changed & (1ul << PIN_RS)))
+	  fail("RS changed with rising edge of E", 0, 0);
+
+     if ((gpio_out & e) && !(old_out & e))
+	  model_e_rise();
+     else if (!(gpio_out & e) && (old_out & e))
+	  model_e_fall();
+}
+
+void nrf_gpio_cfg_output(uint32_t pin_number)
+{
+     now += GPIO_WRITE_TIME;
+}
+
+void nrf_gpio_pin_set(uint32_t pin_number)
+{
+     gpio_write(1ul << pin_number, true);
+}
+
+void nrf_gpio_pin_clear(uint32_t pin_number)
+{
+     gpio_write(1ul << pin_number, false);
+}
+
+void nrf_gpio_pins_set(uint32_t pin_mask)
+{
+     gpio_write(pin_mask, true);
+}
+
+void nrf_gpio_pins_clear(uint32_t pin_mask)
+{
+     gpio_write(pin_mask, false);
+}
+
+void nrf_delay_us(uint32_t us)
+{
+     now += 1000ull*us;
+}
+
+void nrf_delay_ms(uint32_t ms)
+{
+     now += 1000000ull*ms;
+}
+
+static void check_text(const char *what, const char *text1,
+		       const char *text2)
+{
+     const char *text[2] = {text1, text2};
+     for (unsigned int line = 0; line < 2; line++) {
+	  unsigned int length = text[line] != NULL ? strlen(text[line]) : 0;
+	  for (unsigned int i = 0; i < COLUMNS; i++) {
+	       char expected = i < length ? text[line][i] : ' ';
+	       if (model.ddram[line*LINE_OFFSET + i] != expected) {
+		    printf("FAIL %s: line %u \"%.16s\"\n", what, line,
+			   (const char *) &model.ddram[line*LINE_OFFSET]);
+		    exit(1);
+	       }
+	  }
+     }
+}
+
+// Screens of Key20 (key20.c) during a key exchange and an unlock.
+static const char *const screens[][2] = {
+     {"Booting", NULL},
+     {"Ready", NULL},
+     {"Waiting for", "client key"},
+     {"Calculating", "secret"},
+     {"Key checksum", "3F2A9C0B7D1E5A64"},
+     {"Storing key", NULL},
+     {"Ready", NULL},
+     {"Authentication", NULL},
+     {"Opening door", NULL},
+     {"Ready", NULL}
+};
+
+#define SCREENS (sizeof(screens)/sizeof(screens[0]))
+
+static void test_init(void)
+{
+     model_power_on();
+     hd44780_init(&lcd);
+     hd44780_display_on_off(&lcd, true, false, false);
+     if (!model.is_4bit || !model.is_display_on)
+	  fail("initialization", model.is_4bit, model.is_display_on);
+     check_text("initialization", NULL, NULL);
+}
+
+/**
+ * Blocking update as done by display_text() of Key20 before: clear the
+ * display, then print the lines.
+ */
+static void update_blocking(const char *text1, const char *text2)
+{
+     hd44780_clear_display(&lcd);
+     if (text1 != NULL)
+	  hd44780_print_line(&lcd, text1, strlen(text1), 0);
+     if (text2 != NULL)
+	  hd44780_print_line(&lcd, text2, strlen(text2), 1);
+}
+
+/**
+ * Asynchronous update, stepped every STEP_INTERVAL.
+ *
+ * @return number of instructions sent.
+ */
+static unsigned int update_async(struct hd44780_async *async,
+				 const char *text1, const char *text2,
+				 unsigned long long *bus_time)
+{
+     unsigned int steps = 0;
+
+     hd44780_async_print_line(async, text1, text1 != NULL ? strlen(text1) :
+			      0, 0);
+     hd44780_async_print_line(async, text2, text2 != NULL ? strlen(text2) :
+			      0, 1);
+     *bus_time = 0;
+     while (1) {
+	  unsigned long long start = now;
+	  bool is_sent = hd44780_async_step(async);
+	  *bus_time += now - start;
+	  if (!is_sent)
+	       break;
+	  steps++;
+	  now = start + STEP_INTERVAL;
+     }
+
+     return steps;
+}
+
+static void test_screens(void)
+{
+     unsigned long long blocking_time[SCREENS];
+     unsigned long blocking_instructions[SCREENS];
+     unsigned long blocking_writes[SCREENS];
+     unsigned long long total_blocking = 0;
+     unsigned long long total_async = 0;
+
+     test_init();
+     for (unsigned int i = 0; i < SCREENS; i++) {
+	  unsigned long long start = now;
+	  instructions = 0;
+	  gpio_writes = 0;
+	  update_blocking(screens[i][0], screens[i][1]);
+	  blocking_time[i] = now - start;
+	  blocking_instructions[i] = instructions;
+	  blocking_writes[i] = gpio_writes;
+	  total_blocking += blocking_time[i];
+	  check_text("blocking update", screens[i][0], screens[i][1]);
+     }
+
+     printf("  %-18s %-16s %18s %18s %9s\n", "screen", "",
+	    "blocking [us]", "async [us]", "done [ms]");
+     test_init();
+     struct hd44780_async async;
+     hd44780_async_init(&async, &lcd);
+     for (unsigned int i = 0; i < SCREENS; i++) {
+	  unsigned long long start = now;
+	  unsigned long long bus_time;
+	  instructions = 0;
+	  gpio_writes = 0;
+	  unsigned int steps = update_async(&async, screens[i][0],
+					    screens[i][1], &bus_time);
+	  if (steps != instructions)
+	       fail("instructions per step", steps, instructions);
+	  total_async += bus_time;
+	  check_text("async update", screens[i][0], screens[i][1]);
+	  printf("  %-18s %-16s %8.1f (%2lu instr) %8.1f (%2lu instr) %9.2f\n",
+		 screens[i][0], screens[i][1] != NULL ? screens[i][1] : "",
+		 blocking_time[i]/1e3, blocking_instructions[i],
+		 bus_time/1e3, instructions, (now - start)/1e6);
+	  if (bus_time >= blocking_time[i])
+	       fail("async bus time not below blocking [ns]", bus_time,
+		    blocking_time[i]);
+	  // Asynchronously, the cells of the previous text are overwritten
+	  // with spaces instead of clearing the display: more instructions
+	  // and register writes, but no wait of 1.52 ms.
+	  if (i == SCREENS - 1)
+	       printf("  register writes of the last screen: blocking %lu "
+		      "(%lu instr), async %lu (%lu instr)\n",
+		      blocking_writes[i], blocking_instructions[i],
+		      gpio_writes, instructions);
+     }
+     printf("  bus time of all screens: blocking %.1f us, async %.1f us\n",
+	    total_blocking/1e3, total_async/1e3);
+}
+
+static void test_concurrent_change(void)
+{
+     struct hd44780_async async;
+     unsigned long long bus_time;
+
+     test_init();
+     hd44780_async_init(&async, &lcd);
+     update_async(&async, "Ready", NULL, &bus_time);
+
+     // A few instructions of the next screen have been sent when the
+     // screen changes again.
+     hd44780_async_print_line(&async, "Authentication", 14, 0);
+     for (unsigned int i = 0; i < 5; i++) {
+	  if (!hd44780_async_step(&async))
+	       fail("async update finished early", i, 0);
+	  now += STEP_INTERVAL;
+     }
+     update_async(&async, "Opening door", "Key 7", &bus_time);
+     check_text("changed during update", "Opening door", "Key 7");
+
+     // Nothing to do if the text does not change.
+     instructions = 0;
+     update_async(&async, "Opening door", "Key 7", &bus_time);
+     if (instructions != 0)
+	  fail("instructions without change", instructions, 0);
+}
+
+static void test_full_screen(void)
+{
+     static const char *const text[2][2] = {
+	  {"0123456789ABCDEF", "FEDCBA9876543210"},
+	  {"abcdefghijklmnop", "ponmlkjihgfedcba"}
+     };
+     struct hd44780_async async;
+     unsigned long long bus_time;
+
+     test_init();
+     gpio_writes = 0;
+     instructions = 0;
+     hd44780_print_line(&lcd, text[0][0], COLUMNS, 0);
+     hd44780_print_line(&lcd, text[0][1], COLUMNS, 1);
+     check_text("full screen", text[0][0], text[0][1]);
+     printf("  full screen (blocking): %lu register writes, "
+	    "%lu instructions\n", gpio_writes, instructions);
+     unsigned long blocking_writes = gpio_writes;
+
+     hd44780_async_init(&async, &lcd);
+     async.addr = 0xff;
+     memcpy(async.ddram[0], text[0][0], COLUMNS);
+     memcpy(async.ddram[1], text[0][1], COLUMNS);
+     gpio_writes = 0;
+     instructions = 0;
+     update_async(&async, text[1][0], text[1][1], &bus_time);
+     check_text("full screen", text[1][0], text[1][1]);
+     printf("  full screen (async): %lu register writes, "
+	    "%lu instructions, bus time %.1f us\n", gpio_writes,
+	    instructions, bus_time/1e3);
+     // RS is only written when it changes, as by hd44780_print_line().
+     if (gpio_writes > blocking_writes)
+	  fail("async register writes above blocking", gpio_writes,
+	       blocking_writes);
+}
+
+/**
+ * Sends a nibble as the driver did before precomputing the masks of the
+ * pins: each data pin is written separately, then E is pulsed (1 us high,
+ * 1 us low).
+ */
+static void per_pin_send_nibble(uint8_t bits)
+{
+     static const unsigned int pins[4] = {PIN_DB4, PIN_DB5, PIN_DB6, PIN_DB7};
+
+     for (unsigned int i = 0; i < 4; i++) {
+	  if (bits & (1 << i))
+	       nrf_gpio_pin_set(pins[i]);
+	  else
+	       nrf_gpio_pin_clear(pins[i]);
+     }
+     nrf_gpio_pin_set(PIN_E);
+     nrf_delay_us(1);
+     nrf_gpio_pin_clear(PIN_E);
+     nrf_delay_us(1);
+}
+
+static void per_pin_send_byte(uint8_t data)
+{
+     per_pin_send_nibble(data >> 4);
+     per_pin_send_nibble(data & 0x0f);
+     nrf_delay_us(50);
+}
+
+/**
+ * hd44780_print_line() with the per-pin driver.
+ */
+static void per_pin_print_line(const char *text, unsigned int line)
+{
+     nrf_gpio_pin_clear(PIN_RS);
+     per_pin_send_byte(0x80 | (line == 0 ? 0 : LINE_OFFSET));
+     nrf_gpio_pin_set(PIN_RS);
+     for (unsigned int i = 0; i < strlen(text); i++)
+	  per_pin_send_byte(text[i]);
+}
+
+static void test_nibble_writes(void)
+{
+     static const char *const text[2] = {"0123456789ABCDEF",
+					 "FEDCBA9876543210"};
+     unsigned long per_pin_writes, per_pin_nibbles;
+
+     test_init();
+     gpio_writes = 0;
+     instructions = 0;
+     per_pin_print_line(text[0], 0);
+     per_pin_print_line(text[1], 1);
+     check_text("per-pin driver", text[0], text[1]);
+     per_pin_writes = gpio_writes;
+     per_pin_nibbles = 2*instructions;
+
+     test_init();
+     gpio_writes = 0;
+     instructions = 0;
+     hd44780_print_line(&lcd, text[0], COLUMNS, 0);
+     hd44780_print_line(&lcd, text[1], COLUMNS, 1);
+     check_text("mask driver", text[0], text[1]);
+     printf("  register writes per nibble (including RS): "
+	    "per pin %.2f, masks %.2f\n",
+	    (double) per_pin_writes/per_pin_nibbles,
+	    (double) gpio_writes/(2*instructions));
+     if (gpio_writes*per_pin_nibbles >= per_pin_writes*2*instructions)
+	  fail("mask driver not fewer register writes per nibble",
+	       gpio_writes, per_pin_writes);
+}
+
+static void test_masks(void)
+{
+     const struct hd44780 fixed = {
+	  HD44780_PINS(PIN_RS, PIN_E, PIN_DB4, PIN_DB5, PIN_DB6, PIN_DB7),
+	  .rows = 2,
+	  .columns = COLUMNS
+     };
+
+     test_init();
+     if (fixed.mask_rs != lcd.mask_rs || fixed.mask_e != lcd.mask_e ||
+	 fixed.mask_data != lcd.mask_data ||
+	 memcmp(fixed.nibbles, lcd.nibbles, sizeof(lcd.nibbles)) != 0)
+	  fail("masks differ from HD44780_PINS()", lcd.mask_data,
+	       fixed.mask_data);
+}
+
+int main(void)
+{
+     test_init();
+     test_masks();
+     test_screens();
+     test_concurrent_change();
+     test_full_screen();
+     test_nibble_writes();
+
+     return 0;
+}
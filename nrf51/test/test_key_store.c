@@ -0,0 +1,589 @@
+/**
+ * This file is part of Key20.
+ *
+ * Copyright 2016 Frank Duerr
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host test of the key store (key_store.c) against a flash simulator.
+//
+// The simulated flash behaves like the nRF51 flash: erasing sets all bits
+// of a page, programming can only clear bits, and every word may only be
+// programmed once after erasing. Operations complete asynchronously (when
+// the test says so), and may be cut off by a simulated power loss after
+// any number of words. The simulator counts page erases and programmed
+// words and calculates the time the CPU is blocked by flash operations.
+//
+// 1. Empty store, commit, appends to the log until it is full, rewrites,
+//    remount, delete, busy store.
+// 2. Random writes and deletes of thousands of slots compared against a
+//    model, with regular remounts, with a log of one record per page and
+//    with more pages for longer logs; cost compared to updating a record
+//    with pstorage_update().
+// 3. Static wear levelling with few "hot" slots.
+// 4. Power loss after every possible number of programmed words of 
+//    commits, with rewrites only (full pages) and with appends.
+// 5. Worn flash (word not programmed correctly) when appending and when
+//    rewriting.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "key_store.h"
+
+// Flash timing of the nRF51 (max. values) [us].
+#define FLASH_WORD_WRITE_TIME 46
+#define FLASH_PAGE_ERASE_TIME 22300
+
+#define PAGE_SIZE 1024
+#define MAX_PAGES 81
+
+#define MAX_SLOTS 1200
+#define DATA_SIZE 32
+
+#define RANDOM_COMMITS 20000
+#define REMOUNT_INTERVAL 97
+#define HOT_COMMITS 20000
+
+enum flash_op { FLASH_NONE, FLASH_ERASE, FLASH_WRITE };
+
+static uint32_t flash[MAX_PAGES*PAGE_SIZE/4];
+// Bits that cannot be programmed (worn flash).
+static uint32_t flash_stuck[MAX_PAGES*PAGE_SIZE/4];
+
+static struct {
+     enum flash_op op;
+     unsigned int page;
+     unsigned int offset;
+     const uint32_t *data;
+     unsigned int size;
+} pending;
+
+static unsigned long erases[MAX_PAGES];
+static unsigned long words_programmed;
+static unsigned long long busy_time;
+
+static int flash_erase(unsigned int page)
+{
+     if (pending.op != FLASH_NONE)
+	  return -1;
+     pending.op = FLASH_ERASE;
+     pending.page = page;
+     return 0;
+}
+
+static int flash_write(unsigned int page, unsigned int offset,
+		       const uint32_t *data, unsigned int size)
+{
+     if (pending.op != FLASH_NONE || size%4 != 0 || offset%4 != 0 ||
+	 offset + size > PAGE_SIZE)
+	  return -1;
+     pending.op = FLASH_WRITE;
+     pending.page = page;
+     pending.offset = offset;
+     pending.data = data;
+     pending.size = size;
+     return 0;
+}
+
+static void fail(const char *what, unsigned long a, unsigned long b)
+{
+     printf("FAIL %s (%lu, %lu)\n", what, a, b);
+     exit(1);
+}
+
+/**
+ * Execute the pending operation. A write is cut off after max_words
+ * words; an erase is not executed at all if max_words is 0.
+ */
+static void flash_execute(unsigned int max_words)
+{
+     unsigned int i;
+
+     if (pending.op == FLASH_ERASE) {
+	  if (max_words > 0) {
+	       memset(&flash[pending.page*PAGE_SIZE/4], 0xff, PAGE_SIZE);
+	       erases[pending.page]++;
+	       busy_time += FLASH_PAGE_ERASE_TIME;
+	  }
+     } else if (pending.op == FLASH_WRITE) {
+	  for (i = 0; i < pending.size/4 && i < max_words; i++) {
+	       unsigned int w = (pending.page*PAGE_SIZE + pending.offset)/4 + i;
+	       if (flash[w] != 0xffffffff)
+		    fail("word programmed twice", pending.page,
+			 pending.offset + 4*i);
+	       flash[w] &= pending.data[i] | flash_stuck[w];
+	       words_programmed++;
+	       busy_time += FLASH_WORD_WRITE_TIME;
+	  }
+     }
+     pending.op = FLASH_NONE;
+}
+
+static struct key_store store;
+static uint8_t map[MAX_PAGES];
+static uint32_t buffer[KEY_STORE_BUFFER_WORDS(DATA_SIZE)];
+static unsigned int slots;
+static unsigned int pages;
+
+// Expected contents: data of each slot, or model_valid[i] == 0.
+static uint8_t model[MAX_SLOTS][DATA_SIZE];
+static uint8_t model_valid[MAX_SLOTS];
+
+static void mount()
+{
+     struct key_store_flash fl = {
+	  .erase = flash_erase,
+	  .write = flash_write,
+	  .base = (const uint8_t *) flash,
+	  .page_size = PAGE_SIZE,
+	  .page_count = pages
+     };
+
+     pending.op = FLASH_NONE;
+     if (key_store_init(&store, &fl, 0x4b325332, slots, DATA_SIZE,
+			map, buffer) != 0)
+	  fail("init", slots, pages);
+}
+
+static void format_flash(unsigned int slot_count, unsigned int page_count)
+{
+     slots = slot_count;
+     pages = page_count;
+     memset(flash, 0xff, sizeof(flash));
+     memset(flash_stuck, 0, sizeof(flash_stuck));
+     memset(erases, 0, sizeof(erases));
+     memset(model_valid, 0, sizeof(model_valid));
+     words_programmed = 0;
+     busy_time = 0;
+     mount();
+}
+
+static void check_model(const char *what, unsigned long n)
+{
+     for (unsigned int i = 0; i < slots; i++) {
+	  const uint8_t *data = key_store_read(&store, i);
+	  if (model_valid[i] != (data != NULL))
+	       fail(what, n, i);
+	  if (data != NULL && memcmp(data, model[i], DATA_SIZE) != 0)
+	       fail(what, n, i);
+     }
+}
+
+/**
+ * Complete all flash operations of a commit.
+ *
+ * @return number of flash operations.
+ */
+static unsigned int complete_commit()
+{
+     unsigned int ops = 0;
+     int r;
+
+     do {
+	  if (pending.op == FLASH_NONE)
+	       fail("no flash operation pending", ops, 0);
+	  flash_execute(PAGE_SIZE);
+	  ops++;
+	  r = key_store_flash_done(&store);
+	  if (r < 0)
+	       fail("commit failed", ops, 0);
+     } while (r == 0);
+     if (pending.op != FLASH_NONE || key_store_is_busy(&store))
+	  fail("commit completed with flash operation pending", ops, 0);
+
+     return ops;
+}
+
+static void commit()
+{
+     if (key_store_commit(&store) != 0)
+	  fail("commit", 0, 0);
+     complete_commit();
+}
+
+static void write_slot(unsigned int slot, const uint8_t *data)
+{
+     if (key_store_write(&store, slot, data) != 0)
+	  fail("write", slot, 0);
+     if (data != NULL)
+	  memcpy(model[slot], data, DATA_SIZE);
+     model_valid[slot] = (data != NULL);
+}
+
+static void fill(uint8_t *data, unsigned long n)
+{
+     for (unsigned int i = 0; i < DATA_SIZE; i++)
+	  data[i] = n*31 + i;
+}
+
+static uint32_t rnd_state = 0x2545f491;
+
+static uint32_t rnd()
+{
+     rnd_state ^= rnd_state << 13;
+     rnd_state ^= rnd_state >> 17;
+     rnd_state ^= rnd_state << 5;
+     return rnd_state;
+}
+
+static void test_basic()
+{
+     uint8_t data[DATA_SIZE];
+
+     format_flash(4, 2);
+     check_model("empty store", 0);
+     if (key_store_commit(&store) != 1)
+	  fail("empty commit", 0, 0);
+
+     // First commit: the spare page is still erased, so the bitmap and
+     // the slots are written with one chunk, followed by the header.
+     fill(data, 1);
+     write_slot(1, data);
+     fill(data, 2);
+     write_slot(2, data);
+     // Written twice before the commit.
+     fill(data, 3);
+     write_slot(1, data);
+     if (key_store_commit(&store) != 0)
+	  fail("commit", 0, 0);
+     if (key_store_write(&store, 0, data) != -1 ||
+	 key_store_commit(&store) != -1)
+	  fail("busy store accepted write or commit", 0, 0);
+     if (complete_commit() != 2)
+	  fail("first commit", 0, 0);
+     check_model("first commit", 0);
+
+     // Appended to the log: data and tag of slot 0, tag of the deleted 
+     // slot 2.
+     fill(data, 4);
+     write_slot(0, data);
+     write_slot(2, NULL);
+     if (key_store_commit(&store) != 0 || complete_commit() != 3)
+	  fail("append", 0, 0);
+     check_model("append", 0);
+     mount();
+     check_model("append remount", 0);
+
+     // The log is filled by writing the same slot.
+     for (unsigned int r = 2; r < store.log_records; r++) {
+	  fill(data, 100 + r);
+	  write_slot(3, data);
+	  if (key_store_commit(&store) != 0 || complete_commit() != 2)
+	       fail("append", r, 0);
+     }
+     check_model("full log", 0);
+
+     // Rewrite into the other (still erased) page: two chunks (bitmap and
+     // four slots), header.
+     fill(data, 5);
+     write_slot(1, data);
+     if (key_store_commit(&store) != 0 || complete_commit() != 3)
+	  fail("rewrite", 0, 0);
+     check_model("rewrite", 0);
+
+     // Rewrite into the first page after filling the log again: erase, 
+     // chunks, header.
+     for (unsigned int r = 0; r <= store.log_records; r++) {
+	  fill(data, 200 + r);
+	  write_slot(r%4, r%5 == 4 ? NULL : data);
+	  commit();
+     }
+     if (erases[0] != 1 || erases[1] != 0)
+	  fail("rewrite after erase", erases[0], erases[1]);
+     check_model("rewrite after erase", 0);
+
+     mount();
+     check_model("remount", 0);
+     if (key_store_write(&store, 4, data) != -1)
+	  fail("invalid slot", 4, 0);
+
+     // Too many staged slots.
+     format_flash(KEY_STORE_MAX_STAGED + 1, 2);
+     for (unsigned int i = 0; i < KEY_STORE_MAX_STAGED; i++)
+	  write_slot(i, data);
+     if (key_store_write(&store, KEY_STORE_MAX_STAGED, data) != -1)
+	  fail("too many staged slots", 0, 0);
+     commit();
+     check_model("staged slots", 0);
+
+     // Not enough pages for the slots.
+     slots = PAGE_SIZE/DATA_SIZE;
+     pages = 2;
+     struct key_store_flash fl = {
+	  .erase = flash_erase,
+	  .write = flash_write,
+	  .base = (const uint8_t *) flash,
+	  .page_size = PAGE_SIZE,
+	  .page_count = pages
+     };
+     if (key_store_init(&store, &fl, 0, slots, DATA_SIZE, map, buffer) != -1)
+	  fail("capacity", slots, pages);
+}
+
+static void test_random(unsigned int page_count)
+{
+     uint8_t data[DATA_SIZE];
+     unsigned long n;
+
+     format_flash(MAX_SLOTS, page_count);
+
+     for (n = 0; n < RANDOM_COMMITS; n++) {
+	  // Mostly single writes (key exchanges), sometimes several slots
+	  // and deletes.
+	  unsigned int writes = 1 + ((n%7 == 0) ? n%KEY_STORE_MAX_STAGED : 0);
+	  for (unsigned int i = 0; i < writes; i++) {
+	       uint32_t r = rnd();
+	       fill(data, n + i);
+	       write_slot(r%slots, (r >> 16)%13 == 0 ? NULL : data);
+	  }
+	  commit();
+	  if (n%REMOUNT_INTERVAL == 0) {
+	       check_model("random", n);
+	       mount();
+	       check_model("random remount", n);
+	  }
+     }
+     check_model("random", n);
+
+     unsigned long max = 0, sum = 0;
+     for (unsigned int i = 0; i < pages; i++) {
+	  sum += erases[i];
+	  if (erases[i] > max)
+	       max = erases[i];
+     }
+
+     // pstorage_update() of one record: erase swap page, copy page to swap
+     // page, erase page, copy back.
+     double update_time = 2*FLASH_PAGE_ERASE_TIME +
+	  2*(PAGE_SIZE/4)*FLASH_WORD_WRITE_TIME;
+     printf("  %u slots in %u pages (%u log records/page), %u commits: "
+	    "%.2f erases/commit, max. %lu erases/page, %.3f ms/commit "
+	    "(pstorage_update: %.3f ms)\n",
+	    slots, pages, store.log_records, RANDOM_COMMITS, 
+	    (double) sum/RANDOM_COMMITS, max, 
+	    busy_time/1000.0/RANDOM_COMMITS, update_time/1000.0);
+}
+
+static void test_wear_levelling()
+{
+     uint8_t data[DATA_SIZE];
+
+     // All pages hold data, but only two slots of the first page are 
+     // written over and over again.
+     format_flash(8*31, 9);
+     for (unsigned int i = 0; i < slots; i++) {
+	  fill(data, i);
+	  write_slot(i, data);
+	  if (i%KEY_STORE_MAX_STAGED == KEY_STORE_MAX_STAGED - 1)
+	       commit();
+     }
+     for (unsigned long n = 0; n < HOT_COMMITS; n++) {
+	  fill(data, n);
+	  write_slot(n%2, data);
+	  commit();
+	  if (n%REMOUNT_INTERVAL == 0)
+	       mount();
+     }
+     check_model("wear levelling", 0);
+
+     unsigned long min = erases[0], max = erases[0];
+     for (unsigned int i = 1; i < pages; i++) {
+	  if (erases[i] < min)
+	       min = erases[i];
+	  if (erases[i] > max)
+	       max = erases[i];
+     }
+     if (max - min > KEY_STORE_WEAR_THRESHOLD + 2)
+	  fail("wear levelling", min, max);
+     printf("  %u hot commits: %lu..%lu erases/page\n", HOT_COMMITS, min, 
+	    max);
+}
+
+/**
+ * Commit the staged slots, cutting off power after the given number of
+ * programmed words (counting an erase as one word). Remount afterwards.
+ *
+ * @return 1 if the cut happened before the commit completed.
+ */
+static int commit_with_power_loss(unsigned int cut)
+{
+     unsigned int words = 0;
+
+     if (key_store_commit(&store) != 0)
+	  fail("commit", cut, 0);
+     while (1) {
+	  unsigned int op_words = (pending.op == FLASH_ERASE) ? 1 :
+	       pending.size/4;
+	  if (words + op_words > cut) {
+	       flash_execute(cut - words);
+	       mount();
+	       return 1;
+	  }
+	  flash_execute(op_words);
+	  words += op_words;
+	  int r = key_store_flash_done(&store);
+	  if (r < 0)
+	       fail("commit failed", cut, 0);
+	  if (r == 1)
+	       return 0;
+     }
+}
+
+/**
+ * Power loss in commits to three pages (two logical pages of s slots).
+ *
+ * @return number of runs.
+ */
+static unsigned long test_power_loss(unsigned int s, unsigned int victims)
+{
+     uint8_t data[DATA_SIZE];
+     uint8_t old[MAX_SLOTS][DATA_SIZE];
+     uint8_t old_valid[MAX_SLOTS];
+     unsigned long runs = 0;
+
+     // Commit number victim loses power after every possible number of
+     // words. Commits write one or two logical pages, into erased or used 
+     // spare pages, or append to their logs.
+     for (unsigned int victim = 0; victim < victims; victim++) {
+	  for (unsigned int cut = 0; ; cut++) {
+	       int cut_happened = 0;
+	       unsigned int n;
+
+	       format_flash(2*s, 3);
+	       for (n = 0; n <= victim; n++) {
+		    memcpy(old, model, sizeof(model));
+		    memcpy(old_valid, model_valid, sizeof(model_valid));
+		    fill(data, n);
+		    write_slot((n*7)%slots, data);
+		    fill(data, n + 1000);
+		    write_slot((n*7 + s*(n%2))%slots, n%3 == 2 ? NULL : data);
+		    if (n < victim)
+			 commit();
+		    else
+			 cut_happened = commit_with_power_loss(cut);
+	       }
+	       runs++;
+	       if (!cut_happened) {
+		    check_model("power loss: no cut", cut);
+		    break;
+	       }
+
+	       // Every logical page has either its old or its new contents.
+	       for (unsigned int page = 0; page < 2; page++) {
+		    unsigned int olds = 0, news = 0;
+		    for (unsigned int i = page*s; i < page*s + s; i++) {
+			 const uint8_t *p = key_store_read(&store, i);
+			 olds += (old_valid[i] == (p != NULL)) &&
+			      (p == NULL || memcmp(p, old[i], DATA_SIZE) == 0);
+			 news += (model_valid[i] == (p != NULL)) &&
+			      (p == NULL || memcmp(p, model[i], DATA_SIZE) == 0);
+		    }
+		    if (olds != s && news != s)
+			 fail("power loss: page damaged", victim, cut);
+	       }
+
+	       // The store recovers with the next commit.
+	       for (unsigned int i = 0; i < slots; i++) {
+		    const uint8_t *p = key_store_read(&store, i);
+		    model_valid[i] = (p != NULL);
+		    if (p != NULL)
+			 memcpy(model[i], p, DATA_SIZE);
+	       }
+	       fill(data, n + 2000);
+	       write_slot(n%slots, data);
+	       write_slot(s + n%s, data);
+	       commit();
+	       check_model("power loss: recovery", cut);
+	       mount();
+	       check_model("power loss: recovery remount", cut);
+	  }
+     }
+     return runs;
+}
+
+/**
+ * Complete a commit that fails because of worn flash.
+ */
+static void fail_commit(const char *what)
+{
+     if (key_store_commit(&store) != 0)
+	  fail(what, 0, 0);
+     int r;
+     do {
+	  flash_execute(PAGE_SIZE);
+	  r = key_store_flash_done(&store);
+     } while (r == 0);
+     if (r != -1 || key_store_is_busy(&store))
+	  fail(what, r, 0);
+}
+
+static void test_worn_flash()
+{
+     uint8_t data[DATA_SIZE];
+
+     format_flash(4, 2);
+     fill(data, 1);
+     write_slot(0, data);
+     commit();
+
+     // The first data word of the first log record cannot be programmed:
+     // the commit fails, and the record is not valid. The retry appends 
+     // the slot to the next record.
+     flash_stuck[(map[0]*PAGE_SIZE + store.log_offset + 4)/4] = 0xffffffff;
+     fill(data, 2);
+     if (key_store_write(&store, 1, data) != 0)
+	  fail("worn flash: write", 0, 0);
+     fail_commit("worn flash: append did not fail");
+     check_model("worn flash: append", 0);
+     mount();
+     check_model("worn flash: append remount", 0);
+     write_slot(1, data);
+     commit();
+     check_model("worn flash: append retried", 0);
+
+     // Full pages without log. The first data word of slot 1 in the spare 
+     // page cannot be programmed: the commit fails, and the old page stays
+     // in place.
+     format_flash(2*31, 3);
+     fill(data, 1);
+     write_slot(0, data);
+     commit();
+     unsigned int spare = (map[0] + 1)%pages;
+     flash_stuck[(spare*PAGE_SIZE + store.slots_offset + DATA_SIZE)/4] = 
+	  0xffffffff;
+     fill(data, 2);
+     if (key_store_write(&store, 1, data) != 0)
+	  fail("worn flash: write", 0, 0);
+     fail_commit("worn flash: rewrite did not fail");
+     check_model("worn flash: rewrite", 0);
+     mount();
+     check_model("worn flash: rewrite remount", 0);
+}
+
+int main(void)
+{
+     test_basic();
+     // 40 logical pages of 30 slots and 1 log record; 80 logical pages of
+     // 15 slots and 14 log records.
+     test_random(41);
+     test_random(81);
+     test_wear_levelling();
+     unsigned long runs = test_power_loss(31, 6);
+     runs += test_power_loss(20, 14);
+     printf("  power loss tested in %lu runs\n", runs);
+     test_worn_flash();
+
+     return 0;
+}